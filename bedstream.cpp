@@ -0,0 +1,580 @@
+/**
+ * Streaming projection of BED files.
+ */
+#include "bedstream.h"
+
+#include "ipp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct BedRecord {
+    std::string name;
+    std::string chromName;
+    uint32_t loc;
+    // The center of the region.
+    std::optional<Ipp::ChromId> chrom;
+    // Not set if there is no alignment for the chromosome.
+};
+
+class BedReader {
+    // Reads the records of a BED file one by one.
+public:
+    explicit BedReader(std::string const& fileName)
+        : fileName_(fileName)
+        , file_(fileName)
+        , lineNumber_(0)
+    {
+        if (!file_.is_open()) {
+            throw std::runtime_error(
+                format("could not open the file: %s", fileName.c_str()));
+        }
+    }
+
+    bool read(Ipp const& ipp, BedRecord* record) {
+        // Reads the next record. Returns false at the end of the file.
+        std::string line;
+        while (std::getline(file_, line)) {
+            ++lineNumber_;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                continue;
+            }
+
+            // chrom, start, end, name, ...
+            std::string cols[4];
+            std::size_t pos(0);
+            for (unsigned i(0); i < 4; ++i) {
+                if (pos > line.size()) {
+                    throw std::runtime_error(
+                        format("%s:%zu: expected at least 4 columns",
+                               fileName_.c_str(), lineNumber_));
+                }
+                std::size_t const end(std::min(line.find('\t', pos),
+                                               line.size()));
+                cols[i] = line.substr(pos, end - pos);
+                pos = end + 1;
+            }
+
+            uint64_t start;
+            uint64_t end;
+            try {
+                start = std::stoull(cols[1]);
+                end = std::stoull(cols[2]);
+            } catch (std::exception const&) {
+                throw std::runtime_error(
+                    format("%s:%zu: invalid start or end",
+                           fileName_.c_str(), lineNumber_));
+            }
+
+            record->name = cols[3];
+            record->chromName = cols[0];
+            record->loc = (start + end) / 2;
+            record->chrom = ipp.chromIdFromName(cols[0]);
+            return true;
+        }
+        if (file_.bad()) {
+            throw std::runtime_error(
+                format("could not read the file: %s", fileName_.c_str()));
+        }
+        return false;
+    }
+
+private:
+    std::string const fileName_;
+    std::ifstream file_;
+    std::size_t lineNumber_;
+};
+
+double
+trimScore(double score) {
+    // Trims the score to the third decimal (floor) such that 0.9999 becomes
+    // 0.999 instead of 1.000 (as project.py does).
+    return std::floor(score*1000)/1000;
+}
+
+class ProjWriter {
+    // Writes the results in the format of the .proj table of project.py.
+public:
+    ProjWriter(Ipp const& ipp,
+               std::string const& projFileName,
+               std::string const& unmappedFileName,
+               BedStreamOptions const& options)
+        : ipp_(ipp)
+        , projFile_(projFileName)
+        , unmappedFile_(unmappedFileName)
+        , scoreDC_(options.scoreDC)
+        , scoreIC_(options.scoreIC)
+    {
+        if (!projFile_.is_open()) {
+            throw std::runtime_error(
+                format("could not open the file: %s", projFileName.c_str()));
+        }
+        if (!unmappedFile_.is_open()) {
+            throw std::runtime_error(
+                format("could not open the file: %s", unmappedFileName.c_str()));
+        }
+        projFile_ << "id\tcoords_ref\tcoords_direct\tcoords_multi"
+                  << "\tscore_direct\tscore_multi\tsequence_conservation"
+                  << "\tfunctional_conservation\tbridging_species\n";
+    }
+
+    bool write(BedRecord const& record,
+               Ipp::CoordProjection const& coordProjection) {
+        // Writes the result of the given record. Returns false if the record
+        // could not be projected.
+        Ipp::ShortestPath const& path(coordProjection.multiShortestPath);
+        if (path.empty()) {
+            unmappedFile_ << record.name << '\n';
+            return false;
+        }
+
+        projFile_ << record.name
+                  << '\t' << record.chromName << ':' << record.loc
+                  << '\t';
+        if (coordProjection.direct) {
+            writeCoords(coordProjection.direct->nextCoords);
+        }
+        projFile_ << '\t';
+        writeCoords(path.back().coords);
+        double const scoreDirect(
+            trimScore(coordProjection.direct ? coordProjection.direct->score
+                                             : 0));
+        double const scoreMulti(trimScore(path.back().score));
+        projFile_ << '\t';
+        writeScore(scoreDirect);
+        projFile_ << '\t';
+        writeScore(scoreMulti);
+        // The sequence conservation like project.py classifies it. The
+        // functional conservation stays empty (there are no target regions).
+        projFile_ << '\t'
+                  << (scoreDirect >= scoreDC_ ? "DC"
+                      : scoreMulti >= scoreIC_ ? "IC"
+                      : "NC")
+                  << "\t\t";
+        for (std::size_t i(1); i + 1 < path.size(); ++i) {
+            if (i > 1) {
+                projFile_ << ',';
+            }
+            projFile_ << path[i].species;
+        }
+        projFile_ << '\n';
+        return true;
+    }
+
+    void flush() {
+        projFile_.flush();
+        unmappedFile_.flush();
+        if (!projFile_.good() || !unmappedFile_.good()) {
+            throw std::runtime_error("could not write the results");
+        }
+    }
+
+private:
+    void writeCoords(Ipp::Coords const& coords) {
+        projFile_ << ipp_.chromName(coords.chrom) << ':' << coords.loc;
+    }
+
+    void writeScore(double score) {
+        // The score must be trimmed (see trimScore()).
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.3f", score);
+        projFile_ << buf;
+    }
+
+    Ipp const& ipp_;
+    std::ofstream projFile_;
+    std::ofstream unmappedFile_;
+    double const scoreDC_;
+    double const scoreIC_;
+};
+
+class BinaryProjWriter {
+    // Writes the results in the binary format of projectBedFileBinary().
+public:
+    BinaryProjWriter(Ipp const& ipp,
+                     std::string const& refSpecies,
+                     std::string const& qrySpecies,
+                     std::string const& resultsFileName,
+                     BedStreamOptions const& options)
+        : fileName_(resultsFileName)
+        , file_(resultsFileName, std::ios::binary)
+        , pos_(0)
+        , scoreDC_(options.scoreDC)
+        , scoreIC_(options.scoreIC)
+        , includeAnchors_(options.includeAnchors)
+        , numMaskWords_((ipp.speciesNames().size() + 63) / 64)
+    {
+        if (!file_.is_open()) {
+            throw std::runtime_error(
+                format("could not open the file: %s", resultsFileName.c_str()));
+        }
+
+        std::vector<std::string> const& speciesNames(ipp.speciesNames());
+        std::vector<std::string> const& chromNames(ipp.chromNames());
+        for (std::size_t i(0); i < speciesNames.size(); ++i) {
+            speciesIds_.emplace(speciesNames[i], i);
+        }
+
+        writeBytes("IPPRES", 6);
+        writeValue(uint16_t(0xAFFE));
+        writeValue(uint8_t(1));
+        writeValue(uint8_t(includeAnchors_ ? 1 : 0));
+        writeValue(uint16_t(numMaskWords_));
+        writePadding();
+        writeValue(scoreDC_);
+        writeValue(scoreIC_);
+        writeValue(uint16_t(speciesId(refSpecies)));
+        writeValue(uint16_t(speciesId(qrySpecies)));
+        writeValue(uint16_t(speciesNames.size()));
+        for (std::string const& name : speciesNames) {
+            writeBytes(name.c_str(), name.size() + 1);
+        }
+        writeValue(uint32_t(chromNames.size()));
+        for (std::string const& name : chromNames) {
+            writeBytes(name.c_str(), name.size() + 1);
+        }
+        writePadding();
+    }
+
+    bool write(BedRecord const& record,
+               Ipp::CoordProjection const& coordProjection) {
+        // Adds the result of the given record to the current batch. Returns
+        // false if the record could not be projected.
+        nameEnds_.push_back(names_.size() + record.name.size());
+        names_ += record.name;
+        refChrom_.push_back(record.chrom ? int32_t(*record.chrom) : -1);
+        refLoc_.push_back(record.loc);
+
+        Ipp::ShortestPath const& path(coordProjection.multiShortestPath);
+        std::optional<Ipp::GenomicProjectionResult> const& direct(
+            coordProjection.direct);
+        if (direct) {
+            directChrom_.push_back(direct->nextCoords.chrom);
+            directLoc_.push_back(direct->nextCoords.loc);
+            directScore_.push_back(direct->score);
+        } else {
+            directChrom_.push_back(-1);
+            directLoc_.push_back(0);
+            directScore_.push_back(0);
+        }
+        if (!path.empty()) {
+            multiChrom_.push_back(path.back().coords.chrom);
+            multiLoc_.push_back(path.back().coords.loc);
+            multiScore_.push_back(path.back().score);
+        } else {
+            multiChrom_.push_back(-1);
+            multiLoc_.push_back(0);
+            multiScore_.push_back(0);
+        }
+
+        std::size_t const maskBegin(bridgingSpecies_.size());
+        bridgingSpecies_.resize(maskBegin + numMaskWords_, 0);
+        for (std::size_t i(1); i + 1 < path.size(); ++i) {
+            std::size_t const id(speciesId(path[i].species));
+            bridgingSpecies_[maskBegin + id/64] |= uint64_t(1) << (id%64);
+        }
+
+        sequenceConservation_.push_back(
+            path.empty() ? 0
+            : trimScore(directScore_.back()) >= scoreDC_ ? 1
+            : trimScore(multiScore_.back()) >= scoreIC_ ? 2
+            : 3);
+
+        if (includeAnchors_) {
+            // In the order of the anchor columns of project.py.
+            Ipp::Anchors const* const directAnchors(
+                direct ? &direct->anchors : nullptr);
+            Ipp::Anchors const* const firstAnchors(
+                path.size() > 1 ? &path[1].anchors : nullptr);
+            Ipp::Anchors const* const lastAnchors(
+                !path.empty() ? &path.back().anchors : nullptr);
+            appendAnchors(directAnchors, false);
+            appendAnchors(firstAnchors, false);
+            appendAnchors(directAnchors, true);
+            appendAnchors(lastAnchors, true);
+        }
+        return !path.empty();
+    }
+
+    void flush() {
+        // Writes the current batch (if any).
+        if (!refLoc_.empty()) {
+            writeValue(uint64_t(refLoc_.size()));
+            writeValue(uint64_t(names_.size()));
+            writeColumn(nameEnds_);
+            writeColumn(names_);
+            writeColumn(refChrom_);
+            writeColumn(refLoc_);
+            writeColumn(directChrom_);
+            writeColumn(directLoc_);
+            writeColumn(directScore_);
+            writeColumn(multiChrom_);
+            writeColumn(multiLoc_);
+            writeColumn(multiScore_);
+            writeColumn(bridgingSpecies_);
+            writeColumn(sequenceConservation_);
+            if (includeAnchors_) {
+                writeColumn(anchors_);
+            }
+            clearBatch();
+        }
+        file_.flush();
+        if (!file_.good()) {
+            throw std::runtime_error(
+                format("could not write the file: %s", fileName_.c_str()));
+        }
+    }
+
+    void finish() {
+        // Writes the current batch and the end of the file.
+        flush();
+        writeValue(uint64_t(0));
+        file_.close();
+        if (!file_.good()) {
+            throw std::runtime_error(
+                format("could not write the file: %s", fileName_.c_str()));
+        }
+    }
+
+private:
+    std::size_t speciesId(std::string const& speciesName) const {
+        auto const it(speciesIds_.find(speciesName));
+        if (it == speciesIds_.end()) {
+            throw std::runtime_error(
+                format("unknown species: %s", speciesName.c_str()));
+        }
+        return it->second;
+    }
+
+    void appendAnchors(Ipp::Anchors const* anchors, bool qry) {
+        // Appends the ref (or qry) start and end of the up- and downstream
+        // anchors (zeros if there are none).
+        if (!anchors) {
+            anchors_.insert(anchors_.end(), 4, 0);
+            return;
+        }
+        for (Ipp::PwalnEntry const* anchor
+                 : {&anchors->upstream, &anchors->downstream}) {
+            if (!qry) {
+                anchors_.push_back(anchor->refStart());
+                anchors_.push_back(anchor->refEnd());
+            } else {
+                anchors_.push_back(anchor->qryStart());
+                anchors_.push_back(anchor->qryEnd());
+            }
+        }
+    }
+
+    void writeBytes(void const* data, std::size_t size) {
+        file_.write(static_cast<char const*>(data), size);
+        pos_ += size;
+    }
+
+    template<typename T>
+    void writeValue(T const& value) {
+        writeBytes(&value, sizeof(value));
+    }
+
+    template<typename Column>
+    void writeColumn(Column const& column) {
+        writeBytes(column.data(), column.size() * sizeof(column[0]));
+        writePadding();
+    }
+
+    void writePadding() {
+        // Pads the file to the next 8 byte boundary.
+        char const zeros[8] = {};
+        writeBytes(zeros, (8 - pos_%8) % 8);
+    }
+
+    void clearBatch() {
+        nameEnds_.clear();
+        names_.clear();
+        refChrom_.clear();
+        refLoc_.clear();
+        directChrom_.clear();
+        directLoc_.clear();
+        directScore_.clear();
+        multiChrom_.clear();
+        multiLoc_.clear();
+        multiScore_.clear();
+        bridgingSpecies_.clear();
+        sequenceConservation_.clear();
+        anchors_.clear();
+    }
+
+    std::string const fileName_;
+    std::ofstream file_;
+    std::size_t pos_;
+    // The number of bytes written (for the padding).
+    double const scoreDC_;
+    double const scoreIC_;
+    bool const includeAnchors_;
+    std::size_t const numMaskWords_;
+    std::unordered_map<std::string, std::size_t> speciesIds_;
+
+    // The columns of the current batch.
+    std::vector<uint32_t> nameEnds_;
+    std::string names_;
+    std::vector<int32_t> refChrom_;
+    std::vector<uint32_t> refLoc_;
+    std::vector<int32_t> directChrom_;
+    std::vector<uint32_t> directLoc_;
+    std::vector<double> directScore_;
+    std::vector<int32_t> multiChrom_;
+    std::vector<uint32_t> multiLoc_;
+    std::vector<double> multiScore_;
+    std::vector<uint64_t> bridgingSpecies_;
+    std::vector<uint8_t> sequenceConservation_;
+    std::vector<uint32_t> anchors_;
+};
+
+template<typename Writer>
+BedStreamStats projectBedStream(Ipp& ipp,
+                                std::string const& refSpecies,
+                                std::string const& qrySpecies,
+                                std::string const& bedFileName,
+                                BedStreamOptions const& options,
+                                Writer* writer) {
+    // Reads a chunk of records, projects their distinct coords and writes the
+    // results through a reorder buffer: The results arrive in any order but
+    // are written in the order of the records as soon as all the preceding
+    // records of the chunk are written. The writer is flushed after each
+    // chunk.
+    BedReader reader(bedFileName);
+    BedStreamStats stats;
+
+    std::size_t const chunkSize(std::max<std::size_t>(options.chunkSize, 1));
+    Ipp::ProjectionParams const params(options.params
+                                       ? *options.params
+                                       : ipp.defaultProjectionParams());
+    std::vector<BedRecord> records(chunkSize);
+    std::vector<std::optional<Ipp::CoordProjection>> results(chunkSize);
+    std::map<Ipp::Coords, std::vector<std::size_t>> recordsByCoords;
+    std::vector<Ipp::Coords> refCoords;
+
+    bool eof(false);
+    while (!eof && !ipp.isCancelled()) {
+        // Read the next chunk.
+        std::size_t numRecords(0);
+        recordsByCoords.clear();
+        while (numRecords < chunkSize) {
+            BedRecord& record(records[numRecords]);
+            if (!reader.read(ipp, &record)) {
+                eof = true;
+                break;
+            }
+            results[numRecords].reset();
+            if (!record.chrom) {
+                // No alignment for this chromosome.
+                results[numRecords].emplace();
+            } else {
+                recordsByCoords[Ipp::Coords(*record.chrom, record.loc)]
+                    .push_back(numRecords);
+            }
+            ++numRecords;
+        }
+
+        refCoords.clear();
+        for (auto const& [coords, indices] : recordsByCoords) {
+            refCoords.push_back(coords);
+        }
+
+        // Project the chunk and write the results in order.
+        std::size_t nextRecord(0);
+        auto const writeReady = [&]() {
+            for (; nextRecord < numRecords && results[nextRecord];
+                 ++nextRecord) {
+                if (!writer->write(records[nextRecord], *results[nextRecord])) {
+                    ++stats.numUnmapped;
+                }
+                results[nextRecord].reset();
+                ++stats.numRecords;
+            }
+        };
+        auto const onJobDone = [&](Ipp::Coords const& refCoord,
+                                   Ipp::CoordProjection const& coordProjection) {
+            for (std::size_t const i : recordsByCoords.at(refCoord)) {
+                results[i] = coordProjection;
+            }
+            writeReady();
+        };
+        writeReady();
+        if (ipp.isCancelled()) {
+            break;
+        }
+        if (options.sorted) {
+            ipp.projectCoordsSorted(refSpecies,
+                                    qrySpecies,
+                                    refCoords,
+                                    options.nThreads,
+                                    params,
+                                    onJobDone);
+        } else {
+            ipp.projectCoords(refSpecies,
+                              qrySpecies,
+                              refCoords,
+                              options.nThreads,
+                              params,
+                              onJobDone);
+        }
+        if (nextRecord < numRecords) {
+            // Cancelled.
+            break;
+        }
+        writer->flush();
+    }
+
+    return stats;
+}
+
+} // namespace
+
+BedStreamStats
+projectBedFile(Ipp& ipp,
+               std::string const& refSpecies,
+               std::string const& qrySpecies,
+               std::string const& bedFileName,
+               std::string const& projFileName,
+               std::string const& unmappedFileName,
+               BedStreamOptions const& options) {
+    ProjWriter writer(ipp, projFileName, unmappedFileName, options);
+    BedStreamStats const stats(projectBedStream(
+        ipp, refSpecies, qrySpecies, bedFileName, options, &writer));
+    writer.flush();
+    return stats;
+}
+
+BedStreamStats
+projectBedFileBinary(Ipp& ipp,
+                     std::string const& refSpecies,
+                     std::string const& qrySpecies,
+                     std::string const& bedFileName,
+                     std::string const& resultsFileName,
+                     BedStreamOptions const& options) {
+    BinaryProjWriter writer(
+        ipp, refSpecies, qrySpecies, resultsFileName, options);
+    BedStreamStats const stats(projectBedStream(
+        ipp, refSpecies, qrySpecies, bedFileName, options, &writer));
+    if (ipp.isCancelled()) {
+        // Leave out the end of the file such that readers see that it is
+        // incomplete.
+        writer.flush();
+    } else {
+        writer.finish();
+    }
+    return stats;
+}
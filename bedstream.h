@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+
+#include "ipp.h"
+
+struct BedStreamOptions {
+    unsigned nThreads;
+    // Number of worker threads for the projection.
+    std::size_t chunkSize;
+    // Number of BED records that are read and projected at a time. This
+    // bounds the memory usage (and the size of the reorder buffer).
+    bool sorted;
+    // Project each chunk with Ipp::projectCoordsSorted().
+    std::optional<Ipp::ProjectionParams> params;
+    // The params of the projection (default: the defaults of the Ipp).
+    double scoreDC;
+    double scoreIC;
+    // The thresholds of the DC/IC/NC classification (see
+    // projectBedFileBinary()).
+    bool includeAnchors;
+    // Write the anchors to the binary results.
+
+    BedStreamOptions()
+        : nThreads(1)
+        , chunkSize(100000)
+        , sorted(false)
+        , scoreDC(0.98)
+        , scoreIC(0.84)
+        , includeAnchors(false)
+    {}
+};
+
+struct BedStreamStats {
+    std::size_t numRecords;
+    std::size_t numUnmapped;
+
+    BedStreamStats()
+        : numRecords(0)
+        , numUnmapped(0)
+    {}
+};
+
+BedStreamStats projectBedFile(Ipp& ipp,
+                              std::string const& refSpecies,
+                              std::string const& qrySpecies,
+                              std::string const& bedFileName,
+                              std::string const& projFileName,
+                              std::string const& unmappedFileName,
+                              BedStreamOptions const& options);
+// Projects the center of each region in the given BED file from refSpecies
+// to qrySpecies and writes the results to projFileName (tab-separated, one
+// line per projected region in the order of the BED file, with the columns
+// of the .proj table of project.py) and the names of the unmapped regions to
+// unmappedFileName. The sequence_conservation is classified with
+// options.scoreDC and options.scoreIC; the functional_conservation is empty
+// (as in project.py without target regions).
+// The BED file is read in chunks of options.chunkSize records. The results
+// of a chunk are written in order as soon as they are available, so the
+// memory usage does not depend on the size of the BED file.
+// Stops early (after the current chunk) if ipp.cancel() is called.
+
+BedStreamStats projectBedFileBinary(Ipp& ipp,
+                                    std::string const& refSpecies,
+                                    std::string const& qrySpecies,
+                                    std::string const& bedFileName,
+                                    std::string const& resultsFileName,
+                                    BedStreamOptions const& options);
+// Like projectBedFile() but writes the results of all the regions (mapped or
+// not) to one binary, columnar file that can be loaded without parsing
+// (e.g. with numpy.frombuffer(), see ipp_results.py). The regions are
+// classified by sequence conservation like project.py does: DC if the
+// direct score is >= options.scoreDC, otherwise IC if the multi score is
+// >= options.scoreIC, otherwise NC (on the scores trimmed to the third
+// decimal).
+//
+// Format (version 1), in the byte order of the producer:
+//   magic                      [6 bytes, "IPPRES"]
+//   endianness_magic           [uint16, 0xAFFE]
+//   version                    [uint8]
+//   flags                      [uint8, bit 0: with anchors]
+//   num_mask_words             [uint16, per bridging species mask]
+//   padding                    [4 bytes]
+//   score_DC                   [float64]
+//   score_IC                   [float64]
+//   ref_species                [uint16]
+//   qry_species                [uint16]
+//   num_species                [uint16]
+//   {
+//     species_name             [null-terminated string]
+//   } num_species times
+//   num_chroms                 [uint32]
+//   {
+//     chrom_name               [null-terminated string]
+//   } num_chroms times
+//   padding                    [up to the next 8 byte boundary]
+//   {
+//     num_records              [uint64]
+//     names_size               [uint64]
+//     name_ends                [uint32 x num_records, end offsets in names]
+//     names                    [names_size bytes]
+//     ref_chrom                [int32 x num_records]
+//     ref_loc                  [uint32 x num_records]
+//     direct_chrom             [int32 x num_records]
+//     direct_loc               [uint32 x num_records]
+//     direct_score             [float64 x num_records]
+//     multi_chrom              [int32 x num_records]
+//     multi_loc                [uint32 x num_records]
+//     multi_score              [float64 x num_records]
+//     bridging_species         [uint64 x num_mask_words x num_records]
+//     sequence_conservation    [uint8 x num_records]
+//     anchors                  [uint32 x 16 x num_records, if flags & 1]
+//   } once per chunk of the BED file, each column padded to the next 8 byte
+//     boundary
+//   num_records                [uint64, 0: end of the file]
+// The chroms are ids into the chrom names (-1: none, i.e. the ref chrom has
+// no alignments, there is no direct projection or the region is unmapped).
+// The scores are untrimmed (0 if there is no projection). Bit i of a
+// bridging species mask is set if species i is on the path (the order of
+// the path is not kept). sequence_conservation: 0 unmapped, 1 DC, 2 IC,
+// 3 NC. The anchors are those of the anchor columns of the .proj table of
+// project.py --include_anchors, in that order (0 where there are none).
+// If cancelled, the end of the file is not written.
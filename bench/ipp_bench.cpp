@@ -0,0 +1,599 @@
+/**
+ * Microbenchmarks of the Ipp class and a generator of synthetic pwaln files.
+ *
+ * Usage:
+ *     ipp_bench generate OUT_PWALN [--species N] [--chroms N]
+ *                        [--chrom_length L] [--density D] [--seed S]
+ *     ipp_bench run PWALN [--ref SPECIES] [--qry SPECIES] [--bed BED_FILE]
+ *                   [--num_points N] [--max_threads N] [--repeat N] [--seed S]
+ *
+ * "generate" writes a v4 pwaln file with the pairwise alignments between all
+ * pairs of N species (named sp0, sp1, ...) with N chromosomes each. The
+ * alignments form long collinear chains (with some inversions, duplications
+ * and outliers) with on average D alignments per Mb.
+ *
+ * "run" measures loadPwalns() with the different load options, getAnchors()
+ * (the anchor selection including the collinearity filter) and
+ * projectCoords() with 1 up to max_threads threads (and reports the Dijkstra
+ * and anchor search stats of the projections). The points are the
+ * centers of the regions of the BED file or random locations on the ref
+ * chromosomes. Each measurement is the best of `repeat` runs.
+ *
+ * Build with `python setup.py build_bench` (writes build/ipp_bench).
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "ipp.h"
+#include "pwalnformat.h"
+
+namespace {
+
+class Args {
+    // The "--key value" options of the command line.
+public:
+    Args(int argc, char** argv, int first) {
+        for (int i(first); i < argc; i += 2) {
+            if (std::strncmp(argv[i], "--", 2) || i + 1 >= argc) {
+                throw std::runtime_error(
+                    format("invalid argument: %s", argv[i]));
+            }
+            values_[argv[i] + 2] = argv[i + 1];
+        }
+    }
+
+    std::string get(std::string const& key, std::string const& def) const {
+        auto const it(values_.find(key));
+        return it != values_.end() ? it->second : def;
+    }
+
+    unsigned long getInt(std::string const& key, unsigned long def) const {
+        auto const it(values_.find(key));
+        return it != values_.end() ? std::stoul(it->second) : def;
+    }
+
+private:
+    std::map<std::string, std::string> values_;
+};
+
+double
+seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename Fn>
+double
+bestOf(unsigned repeat, Fn const& fn) {
+    // Returns the shortest of `repeat` runs of fn() in seconds.
+    double best(std::numeric_limits<double>::max());
+    for (unsigned i(0); i < std::max(repeat, 1u); ++i) {
+        auto const start(std::chrono::steady_clock::now());
+        fn();
+        best = std::min(best, seconds(start));
+    }
+    return best;
+}
+
+struct GeneratorOptions {
+    unsigned numSpecies;
+    unsigned numChroms;
+    uint32_t chromLength;
+    double density;
+    // Alignments per Mb.
+    unsigned seed;
+
+    GeneratorOptions()
+        : numSpecies(5)
+        , numChroms(3)
+        , chromLength(10000000)
+        , density(250)
+        , seed(1)
+    {}
+};
+
+class PwalnWriter {
+    // Writes the v4 format (see Ipp::loadPwalnsV4()).
+public:
+    explicit PwalnWriter(std::string const& fileName)
+        : file_(fileName, std::ios::out|std::ios::binary)
+    {
+        if (!file_.is_open()) {
+            throw std::runtime_error("could not open the file");
+        }
+    }
+
+    template<typename T>
+    void writeInt(T value) {
+        file_.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    void writeString(char const* s) {
+        file_.write(s, std::strlen(s) + 1);
+    }
+
+    void writeEntry(Ipp::PwalnEntry const& entry) {
+        writeInt<uint32_t>(entry.refStart());
+        writeInt<uint32_t>(entry.qryStart());
+        writeInt<uint32_t>(entry.qryChrom());
+        writeInt<uint16_t>(entry.lengthAndStrand());
+    }
+
+    void close() {
+        file_.close();
+        if (!file_) {
+            throw std::runtime_error("could not write the file");
+        }
+    }
+
+private:
+    std::ofstream file_;
+};
+
+std::vector<Ipp::PwalnEntry>
+generateBlock(GeneratorOptions const& options,
+              std::vector<Ipp::ChromId> const& qryChroms,
+              std::mt19937_64& rng) {
+    // Returns the sorted entries of one (sp1, sp2, ref chrom) block: A chain
+    // of collinear alignments that occasionally jumps to another place or
+    // strand of the qry genome, plus some duplications and outliers.
+    auto const uniform = [&](uint64_t lo, uint64_t hi) {
+        return std::uniform_int_distribution<uint64_t>(lo, hi)(rng);
+    };
+    auto const chance = [&](double p) {
+        return std::uniform_real_distribution<double>()(rng) < p;
+    };
+    uint32_t const maxLength(300);
+    uint32_t const margin(100000);
+    uint64_t const meanGap(std::max(1e6 / options.density - maxLength / 2, 1.0));
+
+    std::vector<Ipp::PwalnEntry> entries;
+    auto const add = [&](uint32_t refStart,
+                         uint32_t qryStart,
+                         Ipp::ChromId qryChrom,
+                         uint32_t length,
+                         bool reversed) {
+        entries.emplace_back(refStart,
+                             qryStart,
+                             qryChrom,
+                             length | (reversed ? 1u<<15 : 0u));
+    };
+
+    Ipp::ChromId qryChrom(qryChroms[uniform(0, qryChroms.size() - 1)]);
+    bool reversed(chance(0.3));
+    uint64_t qryLoc(uniform(margin, options.chromLength - margin));
+    uint64_t refLoc(uniform(0, meanGap));
+    while (refLoc + maxLength < options.chromLength) {
+        uint32_t const length(uniform(5, maxLength));
+        if (chance(0.02)) {
+            // An outlier somewhere else.
+            add(refLoc,
+                uniform(margin, options.chromLength - margin),
+                qryChroms[uniform(0, qryChroms.size() - 1)],
+                uniform(5, maxLength),
+                chance(0.5));
+        }
+        if (chance(0.05)) {
+            // An overlapping duplication.
+            add(refLoc + uniform(0, length),
+                uniform(margin, options.chromLength - margin),
+                qryChrom,
+                uniform(5, 100),
+                false);
+        }
+        if (qryLoc < length || qryLoc + length >= options.chromLength || chance(0.01)) {
+            // Jump to another place (and maybe strand) of the qry genome.
+            qryChrom = qryChroms[uniform(0, qryChroms.size() - 1)];
+            reversed = chance(0.5);
+            qryLoc = uniform(margin, options.chromLength - margin);
+        }
+        add(refLoc, qryLoc, qryChrom, length, reversed);
+        uint64_t const qryGap(length + uniform(0, meanGap));
+        if (!reversed) {
+            qryLoc += qryGap;
+        } else {
+            // 0 makes the next alignment jump.
+            qryLoc = qryLoc > qryGap ? qryLoc - qryGap : 0;
+        }
+        refLoc += length + uniform(0, 2*meanGap);
+    }
+
+    std::sort(entries.begin(),
+              entries.end(),
+              [](Ipp::PwalnEntry const& lhs, Ipp::PwalnEntry const& rhs) {
+                  return std::make_tuple(lhs.refStart(),
+                                         lhs.qryChrom(),
+                                         lhs.qryStart(),
+                                         lhs.lengthAndStrand())
+                      < std::make_tuple(rhs.refStart(),
+                                        rhs.qryChrom(),
+                                        rhs.qryStart(),
+                                        rhs.lengthAndStrand());
+              });
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+    return entries;
+}
+
+void
+generatePwalns(std::string const& fileName, GeneratorOptions const& options) {
+    // Writes a synthetic v4 pwaln file (see GeneratorOptions).
+    if (options.numSpecies < 2 || options.numSpecies > 255
+        || !options.numChroms || options.chromLength < 1000000
+        || options.density <= 0) {
+        throw std::runtime_error("invalid generator options");
+    }
+    std::mt19937_64 rng(options.seed);
+
+    std::vector<std::string> chroms;
+    std::vector<std::vector<Ipp::ChromId>> speciesChroms(options.numSpecies);
+    for (unsigned sp(0); sp < options.numSpecies; ++sp) {
+        for (unsigned c(0); c < options.numChroms; ++c) {
+            speciesChroms[sp].push_back(chroms.size());
+            chroms.push_back(format("sp%u_chr%u", sp, c).c_str());
+        }
+    }
+
+    PwalnWriter writer(fileName);
+    writer.writeInt<uint8_t>(pwalnFormatV4);
+    writer.writeInt<uint16_t>(pwalnEndiannessMagic);
+    writer.writeInt<uint8_t>(options.numSpecies);
+    std::size_t numEntries(0);
+    for (unsigned sp1(0); sp1 < options.numSpecies; ++sp1) {
+        writer.writeString(format("sp%u", sp1).c_str());
+        writer.writeInt<uint64_t>(
+            static_cast<uint64_t>(options.numChroms)*options.chromLength);
+        writer.writeInt<uint8_t>(options.numSpecies - 1);
+        for (unsigned sp2(0); sp2 < options.numSpecies; ++sp2) {
+            if (sp1 == sp2) {
+                continue;
+            }
+            writer.writeString(format("sp%u", sp2).c_str());
+            writer.writeInt<uint32_t>(options.numChroms);
+            for (Ipp::ChromId refChrom : speciesChroms[sp1]) {
+                std::vector<Ipp::PwalnEntry> const entries(
+                    generateBlock(options, speciesChroms[sp2], rng));
+                writer.writeInt<uint32_t>(refChrom);
+                writer.writeInt<uint32_t>(entries.size());
+                for (Ipp::PwalnEntry const& entry : entries) {
+                    writer.writeEntry(entry);
+                }
+                numEntries += entries.size();
+            }
+        }
+    }
+    writer.writeInt<uint32_t>(chroms.size());
+    for (std::string const& chrom : chroms) {
+        writer.writeString(chrom.c_str());
+    }
+    writer.close();
+
+    std::printf("wrote %zu alignments of %u species to %s\n",
+                numEntries,
+                options.numSpecies,
+                fileName.c_str());
+}
+
+std::vector<Ipp::Coords>
+readBedCenters(Ipp const& ipp, std::string const& fileName) {
+    // Returns the centers of the regions of the BED file (like project.py).
+    // Regions on unknown chromosomes are skipped.
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        throw std::runtime_error("could not open the bed file");
+    }
+    std::vector<Ipp::Coords> coords;
+    std::string chrom;
+    uint64_t start;
+    uint64_t end;
+    std::string rest;
+    while (file >> chrom >> start >> end) {
+        std::getline(file, rest);
+        std::optional<Ipp::ChromId> const chromId(ipp.chromIdFromName(chrom));
+        if (chromId) {
+            coords.emplace_back(*chromId, (start + end) / 2);
+        }
+    }
+    return coords;
+}
+
+} // namespace
+
+struct IppBench {
+    // The benchmarks that need access to the internals of Ipp.
+
+    static Ipp::Pwaln const& pwaln(Ipp const& ipp,
+                                   std::string const& refSpecies,
+                                   std::string const& qrySpecies) {
+        // Returns the pwaln between the given species.
+        Ipp::SpeciesId const ref(ipp.requireSpeciesId(refSpecies));
+        Ipp::SpeciesId const qry(ipp.requireSpeciesId(qrySpecies));
+        for (auto const& [sp2, pwaln] : ipp.pwalns_[ref]) {
+            if (sp2 == qry) {
+                return pwaln;
+            }
+        }
+        throw std::runtime_error("no pwaln between the species");
+    }
+
+    static std::vector<Ipp::Coords> randomCoords(Ipp const& ipp,
+                                                 std::string const& refSpecies,
+                                                 std::string const& qrySpecies,
+                                                 std::size_t numPoints,
+                                                 unsigned seed) {
+        // Returns random locations within the aligned range of each ref chrom
+        // of the pwaln.
+        std::vector<std::pair<Ipp::ChromId, uint32_t>> chroms;
+        for (auto const& [refChrom, block] :
+                 pwaln(ipp, refSpecies, qrySpecies)) {
+            ipp.ensureLoaded(block);
+            uint32_t const end(block.visitEntries([](auto const& entries) {
+                return entries.refStart(entries.size() - 1);
+            }));
+            chroms.emplace_back(refChrom, end);
+        }
+        std::sort(chroms.begin(), chroms.end());
+        if (chroms.empty()) {
+            throw std::runtime_error("empty pwaln");
+        }
+
+        std::mt19937_64 rng(seed);
+        std::vector<Ipp::Coords> coords;
+        for (std::size_t i(0); i < numPoints; ++i) {
+            auto const& [chrom, end] = chroms[rng() % chroms.size()];
+            coords.emplace_back(chrom, rng() % end);
+        }
+        return coords;
+    }
+
+    static double getAnchors(Ipp const& ipp,
+                             std::string const& refSpecies,
+                             std::string const& qrySpecies,
+                             std::vector<Ipp::Coords> const& coords,
+                             Ipp::ProjectionParams const& params,
+                             unsigned repeat) {
+        // Returns the time of one getAnchors() call in ns (without the
+        // memoization of the anchor searches).
+        Ipp::Pwaln const& p(pwaln(ipp, refSpecies, qrySpecies));
+        std::size_t numAnchors(0);
+        std::vector<Ipp::Anchors> anchors;
+        double const t(bestOf(repeat, [&]() {
+            for (Ipp::Coords const& c : coords) {
+                numAnchors += ipp.getAnchors(p, c, params, nullptr, nullptr,
+                                             Ipp::noUpperBoundHint,
+                                             &anchors).size();
+            }
+        }));
+        // Keep the calls from being optimized away.
+        if (numAnchors == std::numeric_limits<std::size_t>::max()) {
+            std::printf("\n");
+        }
+        return t * 1e9 / coords.size();
+    }
+};
+
+namespace {
+
+void
+run(std::string const& fileName, Args const& args) {
+    // Runs the benchmarks on the given pwaln file.
+    std::string const ref(args.get("ref", "sp0"));
+    std::string const qry(args.get("qry", "sp1"));
+    unsigned const repeat(args.getInt("repeat", 3));
+    unsigned const maxThreads(
+        args.getInt("max_threads", std::max(std::thread::hardware_concurrency(), 1u)));
+    bool const numa(args.getInt("numa", 0));
+    // Interleave the alignments and pin the projection threads.
+
+    // loadPwalns() with the different options.
+    std::printf("%-36s %10s\n", "loadPwalns", "s");
+    Ipp::LoadOptions const defaultOptions;
+    std::vector<std::pair<char const*, Ipp::LoadOptions>> loadVariants;
+    loadVariants.emplace_back("default", defaultOptions);
+    Ipp::LoadOptions options(defaultOptions);
+    options.lazy = true;
+    loadVariants.emplace_back("lazy", options);
+    options = defaultOptions;
+    options.compact = true;
+    loadVariants.emplace_back("compact", options);
+    options = defaultOptions;
+    options.searchIndex = true;
+    loadVariants.emplace_back("search_index", options);
+    options = defaultOptions;
+    options.deriveReverse = true;
+    loadVariants.emplace_back("derive_reverse", options);
+    options = defaultOptions;
+    options.nThreads = maxThreads;
+    loadVariants.emplace_back("default, max_threads", options);
+    for (auto const& [name, loadOptions] : loadVariants) {
+        double const t(bestOf(repeat, [&]() {
+            Ipp ipp;
+            ipp.loadPwalns(fileName, loadOptions);
+        }));
+        std::printf("  %-34s %10.3f\n", name, t);
+    }
+
+    Ipp ipp;
+    options = defaultOptions;
+    options.nThreads = maxThreads;
+    options.numaInterleave = numa;
+    ipp.loadPwalns(fileName, options);
+    ipp.setThreadPinning(numa);
+
+    std::vector<Ipp::Coords> const coords(
+        args.get("bed", "").empty()
+        ? IppBench::randomCoords(ipp,
+                                 ref,
+                                 qry,
+                                 args.getInt("num_points", 20000),
+                                 args.getInt("seed", 1))
+        : readBedCenters(ipp, args.get("bed", "")));
+    if (coords.empty()) {
+        throw std::runtime_error("no points to project");
+    }
+    std::printf("\n%zu points of %s, projected to %s\n\n",
+                coords.size(),
+                ref.c_str(),
+                qry.c_str());
+
+    // getAnchors() with different topn values (the cost of the collinearity
+    // filter grows with topn).
+    std::printf("%-36s %10s\n", "getAnchors", "ns/call");
+    for (unsigned topn : {10u, 20u, 40u}) {
+        Ipp::ProjectionParams params(ipp.defaultProjectionParams());
+        params.topn = topn;
+        std::printf("  %-34s %10.0f\n",
+                    format("topn=%u", topn).c_str(),
+                    IppBench::getAnchors(ipp, ref, qry, coords, params, repeat));
+    }
+
+    // projectCoords() with increasing numbers of threads. The first run
+    // collects the stats of the searches.
+    Ipp::ProjectionParams const params(ipp.defaultProjectionParams());
+    std::size_t numHops(0);
+    std::size_t numMapped(0);
+    ipp.resetStats();
+    ipp.setStatsEnabled(true);
+    ipp.projectCoords(ref,
+                      qry,
+                      coords,
+                      1,
+                      params,
+                      [&](Ipp::Coords const&,
+                          Ipp::CoordProjection const& coordProjection) {
+                          if (!coordProjection.multiShortestPath.empty()) {
+                              numHops +=
+                                  coordProjection.multiShortestPath.size() - 1;
+                              ++numMapped;
+                          }
+                      });
+    double const meanHops(numMapped ? 1.0*numHops / numMapped : 0);
+    std::printf("\nprojectCoords: %zu of %zu points mapped, %.2f hops per "
+                "path\n",
+                numMapped,
+                coords.size(),
+                meanHops);
+    ipp.setStatsEnabled(false);
+    Ipp::Stats const stats(ipp.stats());
+    uint64_t numGetAnchorsCalls(0);
+    for (auto const& [pwaln, calls] : stats.getAnchorsCalls) {
+        numGetAnchorsCalls += calls;
+    }
+    std::printf("%-26s %10s %10s %10s %10s\n",
+                "per point", "mean", "p50", "p99", "max");
+    auto const printHistogram = [&](char const* name,
+                                    Ipp::Histogram const& histogram) {
+        std::printf("  %-24s %10.1f %10llu %10llu %10llu\n",
+                    name,
+                    histogram.count() ? 1.0*histogram.sum / histogram.count() : 0,
+                    (unsigned long long)histogram.quantile(0.5),
+                    (unsigned long long)histogram.quantile(0.99),
+                    (unsigned long long)histogram.max);
+    };
+    printHistogram("search nodes", stats.searchNodes);
+    printHistogram("projectCoord ns", stats.projectCoordNs);
+    std::printf("  %-24s %10.1f\n",
+                "orange pops",
+                1.0*stats.orangePops / coords.size());
+    std::printf("  %-24s %10.1f\n",
+                "getAnchors calls",
+                1.0*numGetAnchorsCalls / coords.size());
+    std::printf("%-26s\n", "per anchor search");
+    printHistogram("upstream walk length", stats.upstreamWalkLengths);
+    printHistogram("LIS input size", stats.lisInputSizes);
+    std::printf("\n%-12s %12s %14s %10s\n",
+                "threads", "ns/point", "ns/point/hop", "speedup");
+    double singleThreaded(0);
+    for (unsigned nThreads(1); ; nThreads = std::min(2*nThreads, maxThreads)) {
+        double const t(bestOf(repeat, [&]() {
+            ipp.projectCoords(ref,
+                              qry,
+                              coords,
+                              nThreads,
+                              params,
+                              [](Ipp::Coords const&,
+                                 Ipp::CoordProjection const&) {});
+        }));
+        if (nThreads == 1) {
+            singleThreaded = t;
+        }
+        double const nsPerPoint(t * 1e9 / coords.size());
+        std::printf("%-12u %12.0f %14.0f %10.2f\n",
+                    nThreads,
+                    nsPerPoint,
+                    meanHops > 0 ? nsPerPoint / meanHops : 0,
+                    singleThreaded / t);
+        if (nThreads == maxThreads) {
+            break;
+        }
+    }
+
+    // projectCoords() on one thread with increasing numbers of interleaved
+    // searches.
+    std::printf("\n%-12s %12s %10s\n", "interleave", "ns/point", "speedup");
+    double notInterleaved(0);
+    for (unsigned numSearches : {1u, 2u, 4u, 8u, 16u, 32u}) {
+        ipp.setSearchInterleave(numSearches);
+        double const t(bestOf(repeat, [&]() {
+            ipp.projectCoords(ref,
+                              qry,
+                              coords,
+                              1,
+                              params,
+                              [](Ipp::Coords const&,
+                                 Ipp::CoordProjection const&) {});
+        }));
+        if (numSearches == 1) {
+            notInterleaved = t;
+        }
+        std::printf("%-12u %12.0f %10.2f\n",
+                    numSearches,
+                    t * 1e9 / coords.size(),
+                    notInterleaved / t);
+    }
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+    try {
+        if (argc >= 3 && !std::strcmp(argv[1], "generate")) {
+            Args const args(argc, argv, 3);
+            GeneratorOptions options;
+            options.numSpecies = args.getInt("species", options.numSpecies);
+            options.numChroms = args.getInt("chroms", options.numChroms);
+            options.chromLength = args.getInt("chrom_length", options.chromLength);
+            options.density = std::stod(args.get("density",
+                                                 std::to_string(options.density)));
+            options.seed = args.getInt("seed", options.seed);
+            generatePwalns(argv[2], options);
+        } else if (argc >= 3 && !std::strcmp(argv[1], "run")) {
+            run(argv[2], Args(argc, argv, 3));
+        } else {
+            std::fprintf(stderr,
+                         "usage: %s generate OUT_PWALN [--species N] [--chroms N] "
+                         "[--chrom_length L] [--density D] [--seed S]\n"
+                         "       %s run PWALN [--ref SPECIES] [--qry SPECIES] "
+                         "[--bed BED_FILE] [--num_points N] [--max_threads N] "
+                         "[--repeat N] [--seed S] [--numa 0|1]\n",
+                         argv[0],
+                         argv[0]);
+            return 2;
+        }
+    } catch (std::exception const& e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,909 @@
+/**
+ * Native version of collect_pwalns.py: Collects the chain files of all pairs
+ * of the given species into one pwaln file.
+ *
+ * Usage:
+ *     collect_pwalns [-f 4|5|6] [-t N] [--max_entries N] [--tmp_dir DIR]
+ *                    [--one_direction]
+ *                    CHAIN_DIR ASSEMBLY_DIR SPECIES_LIST OUTFILE
+ *
+ * The arguments are those of collect_pwalns.py: The alignment blocks are read
+ * from CHAIN_DIR/<sp1>.<sp2>.all.pre.chain for all the pairs of the
+ * comma-separated SPECIES_LIST and the genome sizes from
+ * ASSEMBLY_DIR/<sp>.sizes. OUTFILE is written in format version 4, 5 or 6
+ * (-f, default: 5). Version 6 is only written by this converter: Each block
+ * is compressed independently (see PwalnBlockEncoder), which makes the file
+ * about half as large as a v4 file.
+ *
+ * The species pairs are processed by N threads (-t, default: the number of
+ * cores), one pair per thread. Each thread parses its chain file line by
+ * line and sorts the alignment blocks in runs of at most --max_entries
+ * (default: 2^24) blocks. The runs are spilled to temporary files in
+ * --tmp_dir (default: the directory of OUTFILE) and merged, so a thread
+ * holds at most max_entries blocks (20 bytes each) in memory. The output is
+ * the same as that of collect_pwalns.py, except that blocks which only differ
+ * in their length may come in a different order.
+ *
+ * With --one_direction, only the pairs (sp1, sp2) where sp1 comes before sp2
+ * in SPECIES_LIST are written, which halves the size of the file. IPP
+ * derives the other direction from them when the file is loaded (which is
+ * not exactly the same as the alignments of the chain file of the other
+ * direction).
+ *
+ * Build with `python setup.py build_collect_pwalns` (writes
+ * build/collect_pwalns).
+ */
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ipp.h"
+#include "pwalnformat.h"
+
+namespace {
+
+using ChromId = Ipp::ChromId;
+
+template<typename T>
+void
+writeInt(std::ostream& os, T val) {
+    os.write(reinterpret_cast<char const*>(&val), sizeof(T));
+}
+
+void
+writeString(std::ostream& os, std::string const& s) {
+    os.write(s.c_str(), s.size() + 1);
+}
+
+std::vector<std::string>
+split(std::string const& s, char delim) {
+    std::vector<std::string> parts;
+    std::size_t start(0);
+    while (true) {
+        std::size_t const end(s.find(delim, start));
+        parts.push_back(s.substr(start, end - start));
+        if (end == std::string::npos) {
+            return parts;
+        }
+        start = end + 1;
+    }
+}
+
+std::vector<char*>
+splitFields(std::string* line) {
+    // Splits the line at runs of whitespace (in place).
+    std::vector<char*> fields;
+    char* state;
+    for (char* field(strtok_r(line->data(), " \t\r\n", &state));
+         field;
+         field = strtok_r(nullptr, " \t\r\n", &state)) {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+uint64_t
+readGenomeSize(std::string const& sizesFileName) {
+    // Sums up the chromosome sizes (second column) of a .sizes file.
+    std::ifstream file(sizesFileName);
+    if (!file.is_open()) {
+        throw std::runtime_error(
+            format("could not open %s", sizesFileName.c_str()).c_str());
+    }
+    uint64_t genomeSize(0);
+    std::string chrom;
+    uint64_t size;
+    while (file >> chrom >> size) {
+        genomeSize += size;
+    }
+    return genomeSize;
+}
+
+struct ChainEntry {
+    // An alignment block of a chain file with the global chrom ids.
+    ChromId refChrom;
+    uint32_t refStart;
+    ChromId qryChrom;
+    uint32_t qryStart;
+    uint16_t lengthAndStrand;
+
+    ChainEntry()
+        : refChrom(0)
+        , refStart(0)
+        , qryChrom(0)
+        , qryStart(0)
+        , lengthAndStrand(0)
+    {}
+    ChainEntry(ChromId refChrom,
+               uint32_t refStart,
+               ChromId qryChrom,
+               uint32_t qryStart,
+               uint16_t lengthAndStrand)
+        : refChrom(refChrom)
+        , refStart(refStart)
+        , qryChrom(qryChrom)
+        , qryStart(qryStart)
+        , lengthAndStrand(lengthAndStrand)
+    {}
+
+    bool operator<(ChainEntry const& other) const {
+        // The order of collect_pwalns.py (and Ipp::Pwalns).
+        return std::tie(refChrom, refStart, qryChrom, qryStart, lengthAndStrand)
+            < std::tie(other.refChrom,
+                       other.refStart,
+                       other.qryChrom,
+                       other.qryStart,
+                       other.lengthAndStrand);
+    }
+    bool operator==(ChainEntry const& other) const {
+        return !(*this < other) && !(other < *this);
+    }
+};
+
+class ChainReader {
+    // Reads the header and alignment block lines of a chain file:
+    //     chain score tName tSize tStrand tStart tEnd qName qSize qStrand
+    //         qStart qEnd id
+    //     size dt dq
+    //     ...
+    //     size
+    // Comments and empty lines are skipped.
+public:
+    explicit ChainReader(std::string const& fileName)
+        : fileName_(fileName)
+        , file_(fileName)
+        , lineNo_(0)
+    {
+        if (!file_.is_open()) {
+            throw std::runtime_error(
+                format("could not open %s", fileName.c_str()).c_str());
+        }
+    }
+
+    bool next(std::vector<char*>* fields, bool* isHeader) {
+        // Returns the fields of the next header or alignment block line.
+        while (std::getline(file_, line_)) {
+            ++lineNo_;
+            if (line_.empty() || line_[0] == '#') {
+                continue;
+            }
+            *isHeader = !line_.compare(0, 5, "chain");
+            *fields = splitFields(&line_);
+            if (fields->empty()) {
+                continue;
+            }
+            if (*isHeader ? fields->size() < 12
+                          : fields->size() != 1 && fields->size() != 3) {
+                error("invalid line");
+            }
+            return true;
+        }
+        return false;
+    }
+
+    uint32_t toUInt32(char const* field) const {
+        char* end;
+        unsigned long long const value(std::strtoull(field, &end, 10));
+        if (*end || end == field || value > UINT32_MAX) {
+            error(format("invalid number: %s", field).c_str());
+        }
+        return value;
+    }
+
+    [[noreturn]] void error(char const* message) const {
+        throw std::runtime_error(
+            format("%s:%zu: %s", fileName_.c_str(), lineNo_, message).c_str());
+    }
+
+private:
+    std::string const fileName_;
+    std::ifstream file_;
+    std::string line_;
+    std::size_t lineNo_;
+};
+
+std::vector<std::string>
+scanChroms(std::string const& chainFileName) {
+    // Returns the chroms of the chain headers in the order of their first
+    // occurrence (ref before qry).
+    std::vector<std::string> chroms;
+    std::unordered_set<std::string> seen;
+    ChainReader reader(chainFileName);
+    std::vector<char*> fields;
+    bool isHeader;
+    while (reader.next(&fields, &isHeader)) {
+        if (isHeader) {
+            for (char const* chrom : {fields[2], fields[7]}) {
+                if (seen.insert(chrom).second) {
+                    chroms.push_back(chrom);
+                }
+            }
+        }
+    }
+    return chroms;
+}
+
+template<typename Fn>
+void
+parseChain(std::string const& chainFileName,
+           std::unordered_map<std::string, ChromId> const& chromIds,
+           Fn const& onEntry) {
+    // Calls onEntry(ChainEntry) for each alignment block. The coords on the
+    // reverse qry strand are converted to forward strand coords (the chain
+    // file counts them from the end of the chrom); qryStart is inclusive.
+    ChainReader reader(chainFileName);
+    std::vector<char*> fields;
+    bool isHeader;
+    bool inChain(false);
+    ChromId refChrom(0);
+    ChromId qryChrom(0);
+    bool qryReversed(false);
+    uint32_t qryChromSize(0);
+    uint64_t refStart(0);
+    uint64_t qryStart(0);
+    while (reader.next(&fields, &isHeader)) {
+        if (isHeader) {
+            refChrom = chromIds.at(fields[2]);
+            qryChrom = chromIds.at(fields[7]);
+            qryReversed = !std::strcmp(fields[9], "-");
+            qryChromSize = reader.toUInt32(fields[8]);
+            refStart = reader.toUInt32(fields[5]);
+            qryStart = reader.toUInt32(fields[10]);
+            inChain = true;
+            continue;
+        }
+
+        if (!inChain) {
+            reader.error("alignment block outside of a chain");
+        }
+        uint32_t const blockWidth(reader.toUInt32(fields[0]));
+        if (blockWidth >= (1u << 15)) {
+            reader.error("the MSB must not be set by the length");
+        }
+        if (refStart > UINT32_MAX
+            || qryStart > UINT32_MAX
+            || (qryReversed && qryStart >= qryChromSize)) {
+            reader.error("alignment block out of range");
+        }
+        onEntry(ChainEntry(refChrom,
+                           refStart,
+                           qryChrom,
+                           !qryReversed ? qryStart
+                                        : qryChromSize - qryStart - 1,
+                           blockWidth | (qryReversed ? (1u << 15) : 0)));
+
+        if (fields.size() == 3) {
+            // Move the ref and qry start by the sum of the alignment block
+            // and the respective gap size.
+            refStart += blockWidth + reader.toUInt32(fields[1]);
+            qryStart += blockWidth + reader.toUInt32(fields[2]);
+        } else {
+            // The last block of the chain.
+            inChain = false;
+        }
+    }
+}
+
+class TempFile {
+    // A file that is removed upon destruction.
+public:
+    explicit TempFile(std::string const& fileName)
+        : fileName_(fileName)
+    {}
+    TempFile(TempFile const&) = delete;
+    TempFile& operator=(TempFile const&) = delete;
+
+    ~TempFile() {
+        std::remove(fileName_.c_str());
+    }
+
+    std::string const& fileName() const {
+        return fileName_;
+    }
+
+private:
+    std::string const fileName_;
+};
+
+class ExternalSorter {
+    // Sorts the pushed entries in runs of up to maxEntries. Full runs are
+    // written to temporary files; finish() merges them.
+public:
+    ExternalSorter(std::size_t maxEntries, std::string const& tmpFilePrefix)
+        : maxEntries_(std::max<std::size_t>(maxEntries, 1))
+        , tmpFilePrefix_(tmpFilePrefix)
+    {}
+
+    void push(ChainEntry const& entry) {
+        entries_.push_back(entry);
+        if (entries_.size() == maxEntries_) {
+            spill();
+        }
+    }
+
+    template<typename Fn>
+    void finish(Fn const& onEntry) {
+        // Calls onEntry() for the distinct entries in sorted order.
+        std::sort(entries_.begin(), entries_.end());
+        if (runs_.empty()) {
+            // Everything fit into memory.
+            for (std::size_t i(0); i < entries_.size(); ++i) {
+                if (!i || !(entries_[i] == entries_[i - 1])) {
+                    onEntry(entries_[i]);
+                }
+            }
+            return;
+        }
+        spill();
+        std::vector<ChainEntry>().swap(entries_);
+        merge(onEntry);
+    }
+
+private:
+    class RunReader {
+        // Buffered reading of the entries of a run.
+    public:
+        RunReader(std::string const& fileName, std::size_t bufSize)
+            : file_(fileName, std::ios::in|std::ios::binary)
+            , buf_(bufSize)
+            , pos_(0)
+            , end_(0)
+        {
+            if (!file_.is_open()) {
+                throw std::runtime_error(
+                    format("could not open %s", fileName.c_str()).c_str());
+            }
+        }
+
+        bool next(ChainEntry* entry) {
+            if (pos_ == end_) {
+                file_.read(reinterpret_cast<char*>(buf_.data()),
+                           buf_.size()*sizeof(ChainEntry));
+                end_ = file_.gcount() / sizeof(ChainEntry);
+                pos_ = 0;
+                if (!end_) {
+                    return false;
+                }
+            }
+            *entry = buf_[pos_++];
+            return true;
+        }
+
+    private:
+        std::ifstream file_;
+        std::vector<ChainEntry> buf_;
+        std::size_t pos_;
+        std::size_t end_;
+    };
+
+    void spill() {
+        // Writes the sorted entries to a new run.
+        std::sort(entries_.begin(), entries_.end());
+        runs_.push_back(std::make_unique<TempFile>(
+            format("%s.run%zu", tmpFilePrefix_.c_str(), runs_.size()).c_str()));
+        std::ofstream file(runs_.back()->fileName(),
+                           std::ios::out|std::ios::binary|std::ios::trunc);
+        file.write(reinterpret_cast<char const*>(entries_.data()),
+                   entries_.size()*sizeof(ChainEntry));
+        if (!file.good()) {
+            throw std::runtime_error(
+                format("could not write %s",
+                       runs_.back()->fileName().c_str()).c_str());
+        }
+        entries_.clear();
+    }
+
+    template<typename Fn>
+    void merge(Fn const& onEntry) {
+        // k-way merge of the runs with a min-heap of the next entry of each.
+        std::size_t const bufSize(
+            std::max<std::size_t>(maxEntries_ / runs_.size(), 1024));
+        std::vector<std::unique_ptr<RunReader>> readers;
+        using HeapEntry = std::pair<ChainEntry, std::size_t>;
+        auto const greater = [](HeapEntry const& lhs, HeapEntry const& rhs) {
+            return rhs.first < lhs.first;
+        };
+        std::priority_queue<HeapEntry,
+                            std::vector<HeapEntry>,
+                            decltype(greater)> heap(greater);
+        for (auto const& run : runs_) {
+            readers.push_back(
+                std::make_unique<RunReader>(run->fileName(), bufSize));
+            ChainEntry entry;
+            if (readers.back()->next(&entry)) {
+                heap.emplace(entry, readers.size() - 1);
+            }
+        }
+
+        bool first(true);
+        ChainEntry last;
+        while (!heap.empty()) {
+            auto const [entry, run] = heap.top();
+            heap.pop();
+            if (first || !(entry == last)) {
+                onEntry(entry);
+                first = false;
+                last = entry;
+            }
+            ChainEntry nextEntry;
+            if (readers[run]->next(&nextEntry)) {
+                heap.emplace(nextEntry, run);
+            }
+        }
+    }
+
+    std::size_t const maxEntries_;
+    std::string const tmpFilePrefix_;
+    std::vector<ChainEntry> entries_;
+    std::vector<std::unique_ptr<TempFile>> runs_;
+};
+
+struct Block {
+    // The entries of one ref chrom of a species pair.
+    ChromId refChrom;
+    uint32_t numEntries;
+    uint16_t maxAnchorLength;
+    uint64_t numBytes;
+    // The size of the encoded entries.
+
+    Block(ChromId refChrom)
+        : refChrom(refChrom)
+        , numEntries(0)
+        , maxAnchorLength(0)
+        , numBytes(0)
+    {}
+};
+
+struct PairResult {
+    // The sorted entries of a species pair in the encoding of the output
+    // format (in a temporary file).
+    std::unique_ptr<TempFile> entriesFile;
+    std::vector<Block> blocks;
+    std::exception_ptr exception;
+    bool done;
+
+    PairResult()
+        : done(false)
+    {}
+};
+
+struct Options {
+    uint8_t formatVersion;
+    unsigned nThreads;
+    std::size_t maxEntries;
+    std::string tmpDir;
+    bool oneDirection;
+    // Only write the pairs (sp1, sp2) where sp1 comes before sp2 in the
+    // species list (Ipp derives the other direction).
+
+    Options()
+        : formatVersion(pwalnFormatV5)
+        , nThreads(std::max(std::thread::hardware_concurrency(), 1u))
+        , maxEntries(std::size_t(1) << 24)
+        , oneDirection(false)
+    {}
+};
+
+void
+collectPair(std::string const& chainFileName,
+            std::unordered_map<std::string, ChromId> const& chromIds,
+            Options const& options,
+            std::string const& tmpFilePrefix,
+            PairResult* result) {
+    // Sorts the entries of one chain file and writes them to the
+    // entriesFile of the result.
+    ExternalSorter sorter(options.maxEntries, tmpFilePrefix);
+    parseChain(chainFileName, chromIds, [&](ChainEntry const& entry) {
+        sorter.push(entry);
+    });
+
+    result->entriesFile = std::make_unique<TempFile>(tmpFilePrefix + ".entries");
+    std::ofstream file(result->entriesFile->fileName(),
+                       std::ios::out|std::ios::binary|std::ios::trunc);
+    std::vector<Block>& blocks(result->blocks);
+    std::unique_ptr<PwalnBlockEncoder> encoder;
+    std::string compressed;
+    // The compressed entries (v6) that are not written yet.
+    sorter.finish([&](ChainEntry const& entry) {
+        if (blocks.empty() || blocks.back().refChrom != entry.refChrom) {
+            blocks.emplace_back(entry.refChrom);
+            encoder = std::make_unique<PwalnBlockEncoder>();
+        }
+        Block& block(blocks.back());
+        Ipp::PwalnEntry const pwalnEntry(entry.refStart,
+                                         entry.qryStart,
+                                         entry.qryChrom,
+                                         entry.lengthAndStrand);
+        ++block.numEntries;
+        block.maxAnchorLength = std::max(block.maxAnchorLength,
+                                         pwalnEntry.length());
+        if (options.formatVersion == pwalnFormatV6) {
+            std::size_t const size(compressed.size());
+            encoder->add(pwalnEntry, &compressed);
+            block.numBytes += compressed.size() - size;
+            if (compressed.size() >= (1 << 20)) {
+                file.write(compressed.data(), compressed.size());
+                compressed.clear();
+            }
+        } else if (options.formatVersion == pwalnFormatV4) {
+            block.numBytes += sizeof(PackedPwalnEntry);
+            PackedPwalnEntry const packed(pwalnEntry);
+            file.write(reinterpret_cast<char const*>(&packed), sizeof(packed));
+        } else {
+            block.numBytes += sizeof(Ipp::PwalnEntry);
+            // Write the padding bytes as zeros.
+            char buf[sizeof(Ipp::PwalnEntry)] = {};
+            PackedPwalnEntry const packed(pwalnEntry);
+            std::memcpy(buf, &packed, sizeof(packed));
+            file.write(buf, sizeof(buf));
+        }
+    });
+    file.write(compressed.data(), compressed.size());
+    if (!file.good()) {
+        throw std::runtime_error(
+            format("could not write %s",
+                   result->entriesFile->fileName().c_str()).c_str());
+    }
+}
+
+void
+copyBytes(std::istream& in, std::ostream& out, uint64_t numBytes) {
+    std::vector<char> buf(1 << 20);
+    while (numBytes) {
+        std::size_t const n(std::min<uint64_t>(numBytes, buf.size()));
+        in.read(buf.data(), n);
+        if (!in.good()) {
+            throw std::runtime_error("Unexpected EOF");
+        }
+        out.write(buf.data(), n);
+        numBytes -= n;
+    }
+}
+
+struct IndexEntry {
+    // A block of the v5 or v6 index.
+    ChromId refChrom;
+    uint32_t numEntries;
+    uint16_t maxAnchorLength;
+    uint64_t entriesOffset;
+    uint64_t numBytes;
+
+    IndexEntry(Block const& block, uint64_t entriesOffset)
+        : refChrom(block.refChrom)
+        , numEntries(block.numEntries)
+        , maxAnchorLength(block.maxAnchorLength)
+        , entriesOffset(entriesOffset)
+        , numBytes(block.numBytes)
+    {}
+};
+
+void
+collectPwalns(std::string const& chainDir,
+              std::string const& assemblyDir,
+              std::vector<std::string> const& species,
+              std::string const& outFileName,
+              Options const& options) {
+    // Writes the pwaln file (see collect_pwalns.py for the format).
+    if (species.size() > Ipp::maxNumSpecies - 1) {
+        throw std::runtime_error("too many species");
+    }
+    std::vector<std::pair<std::size_t, std::size_t>> pairs;
+    for (std::size_t i(0); i < species.size(); ++i) {
+        for (std::size_t j(0); j < species.size(); ++j) {
+            if (i != j && (!options.oneDirection || i < j)) {
+                pairs.emplace_back(i, j);
+            }
+        }
+    }
+    std::vector<std::size_t> numSp2(species.size());
+    for (auto const& [sp1, sp2] : pairs) {
+        ++numSp2[sp1];
+    }
+    auto const chainFileName = [&](std::size_t pair) -> std::string {
+        return format("%s/%s.%s.all.pre.chain",
+                      chainDir.c_str(),
+                      species[pairs[pair].first].c_str(),
+                      species[pairs[pair].second].c_str()).c_str();
+    };
+    std::vector<uint64_t> genomeSizes;
+    for (std::string const& sp : species) {
+        genomeSizes.push_back(
+            readGenomeSize(format("%s/%s.sizes",
+                                  assemblyDir.c_str(),
+                                  sp.c_str()).c_str()));
+    }
+
+    // Set once the output has failed (by the writer or a failed pair): No
+    // further pairs are started then.
+    std::atomic<bool> abort(false);
+
+    auto const forEachPair = [&](auto const& fn) {
+        // Calls fn(pair) for each pair with nThreads threads and forwards
+        // the first exception. Stops handing out pairs once abort is set
+        // (a pair that was handed out is always finished, so that the writer
+        // gets to the failed pair).
+        std::atomic<std::size_t> nextPair(0);
+        std::mutex mutex;
+        std::exception_ptr exception;
+        std::vector<std::thread> threads;
+        for (unsigned t(0); t < std::min<std::size_t>(options.nThreads,
+                                                      pairs.size()); ++t) {
+            threads.emplace_back([&]() {
+                while (!abort) {
+                    std::size_t const p(nextPair++);
+                    if (p >= pairs.size()) {
+                        break;
+                    }
+                    try {
+                        fn(p);
+                    } catch (...) {
+                        std::lock_guard const lockGuard(mutex);
+                        if (!exception) {
+                            exception = std::current_exception();
+                        }
+                        nextPair = pairs.size();
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    };
+
+    // Intern the chroms in the order of collect_pwalns.py: by pair and, within
+    // a pair, by their first occurrence. Only the headers are read for that.
+    std::vector<std::vector<std::string>> pairChroms(pairs.size());
+    forEachPair([&](std::size_t p) {
+        pairChroms[p] = scanChroms(chainFileName(p));
+    });
+    std::vector<std::string> chroms;
+    std::unordered_map<std::string, ChromId> chromIds;
+    for (auto const& names : pairChroms) {
+        for (std::string const& name : names) {
+            if (chromIds.emplace(name, chroms.size()).second) {
+                chroms.push_back(name);
+            }
+        }
+    }
+    std::vector<std::vector<std::string>>().swap(pairChroms);
+
+    // Sort the pairs on the worker threads while this thread writes the
+    // finished ones in order.
+    std::string const tmpDir(
+        !options.tmpDir.empty() ? options.tmpDir
+        : outFileName.find('/') != std::string::npos
+        ? outFileName.substr(0, outFileName.rfind('/'))
+        : ".");
+    std::string const tmpFilePrefix(
+        format("%s/%s.tmp%d",
+               tmpDir.c_str(),
+               outFileName.substr(outFileName.rfind('/') + 1).c_str(),
+               getpid()).c_str());
+    std::vector<PairResult> results(pairs.size());
+    std::mutex resultsMutex;
+    std::condition_variable resultDone;
+    std::thread sorterThread([&]() {
+        try {
+            forEachPair([&](std::size_t p) {
+                PairResult result;
+                try {
+                    collectPair(chainFileName(p),
+                                chromIds,
+                                options,
+                                format("%s.%zu", tmpFilePrefix.c_str(), p).c_str(),
+                                &result);
+                } catch (...) {
+                    // The writer rethrows it once it gets to this pair.
+                    result.exception = std::current_exception();
+                    abort = true;
+                }
+                std::lock_guard const lockGuard(resultsMutex);
+                result.done = true;
+                results[p] = std::move(result);
+                resultDone.notify_all();
+            });
+        } catch (...) {
+            // Only the results carry exceptions.
+        }
+    });
+
+    std::exception_ptr exception;
+    try {
+        std::ofstream out(outFileName,
+                          std::ios::out|std::ios::binary|std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error(
+                format("could not open %s", outFileName.c_str()).c_str());
+        }
+        bool const v5(options.formatVersion != pwalnFormatV4);
+        // v6 has the layout of v5 (except for the blocks).
+        bool const v6(options.formatVersion == pwalnFormatV6);
+        writeInt<uint8_t>(out, options.formatVersion);
+        writeInt<uint16_t>(out, pwalnEndiannessMagic);
+        if (v5) {
+            // Padding and a placeholder for the index offset.
+            std::fill_n(std::ostreambuf_iterator<char>(out), 5, '\0');
+            writeInt<uint64_t>(out, 0);
+        } else {
+            writeInt<uint8_t>(out, species.size());
+        }
+
+        auto const writeSp1 = [&](std::size_t sp1) {
+            writeString(out, species[sp1]);
+            writeInt<uint64_t>(out, genomeSizes[sp1]);
+            writeInt<uint8_t>(out, numSp2[sp1]);
+        };
+        // The next species whose sp1 header is to be written (the pairs are
+        // sorted by sp1, some species might have none).
+        std::size_t nextSp1(0);
+
+        std::vector<std::vector<IndexEntry>> index(pairs.size());
+        for (std::size_t p(0); p < pairs.size(); ++p) {
+            PairResult result;
+            {
+                std::unique_lock lock(resultsMutex);
+                resultDone.wait(lock, [&]() { return results[p].done; });
+                result = std::move(results[p]);
+            }
+            if (result.exception) {
+                std::rethrow_exception(result.exception);
+            }
+
+            auto const [sp1, sp2] = pairs[p];
+            if (!v5) {
+                while (nextSp1 <= sp1) {
+                    writeSp1(nextSp1++);
+                }
+                writeString(out, species[sp2]);
+                writeInt<uint32_t>(out, result.blocks.size());
+            }
+
+            std::ifstream entries(result.entriesFile->fileName(),
+                                  std::ios::in|std::ios::binary);
+            for (Block const& block : result.blocks) {
+                if (v5) {
+                    uint64_t const pos(out.tellp());
+                    if (!v6) {
+                        std::fill_n(std::ostreambuf_iterator<char>(out),
+                                    -pos % pwalnV5BlockAlignment,
+                                    '\0');
+                    }
+                    index[p].emplace_back(block, out.tellp());
+                } else {
+                    writeInt<uint32_t>(out, block.refChrom);
+                    writeInt<uint32_t>(out, block.numEntries);
+                }
+                copyBytes(entries, out, block.numBytes);
+            }
+            std::printf("%s -> %s: %zu blocks\n",
+                        species[sp1].c_str(),
+                        species[sp2].c_str(),
+                        result.blocks.size());
+        }
+
+        uint64_t const indexOffset(out.tellp());
+        if (v5) {
+            writeInt<uint8_t>(out, species.size());
+            nextSp1 = 0;
+            for (std::size_t p(0); p < pairs.size(); ++p) {
+                auto const [sp1, sp2] = pairs[p];
+                while (nextSp1 <= sp1) {
+                    writeSp1(nextSp1++);
+                }
+                writeString(out, species[sp2]);
+                writeInt<uint32_t>(out, index[p].size());
+                for (IndexEntry const& entry : index[p]) {
+                    writeInt<uint32_t>(out, entry.refChrom);
+                    writeInt<uint32_t>(out, entry.numEntries);
+                    writeInt<uint16_t>(out, entry.maxAnchorLength);
+                    writeInt<uint64_t>(out, entry.entriesOffset);
+                    if (v6) {
+                        writeInt<uint64_t>(out, entry.numBytes);
+                    }
+                }
+            }
+        }
+        while (nextSp1 < species.size()) {
+            writeSp1(nextSp1++);
+        }
+
+        writeInt<uint32_t>(out, chroms.size());
+        for (std::string const& chrom : chroms) {
+            writeString(out, chrom);
+        }
+
+        if (v5) {
+            out.seekp(pwalnV5HeaderSize - sizeof(uint64_t));
+            writeInt<uint64_t>(out, indexOffset);
+        }
+        if (!out.good()) {
+            throw std::runtime_error(
+                format("could not write %s", outFileName.c_str()).c_str());
+        }
+    } catch (...) {
+        exception = std::current_exception();
+        abort = true;
+    }
+
+    // Let the workers finish their current pairs (their temporary files are
+    // removed with the results).
+    sorterThread.join();
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+    Options options;
+    std::vector<std::string> args;
+    try {
+        for (int i(1); i < argc; ++i) {
+            std::string const arg(argv[i]);
+            bool const hasValue(i + 1 < argc);
+            if (arg == "-f" && hasValue) {
+                options.formatVersion = std::stoul(argv[++i]);
+            } else if (arg == "-t" && hasValue) {
+                options.nThreads = std::max(std::stoul(argv[++i]), 1ul);
+            } else if (arg == "--max_entries" && hasValue) {
+                options.maxEntries = std::stoull(argv[++i]);
+            } else if (arg == "--tmp_dir" && hasValue) {
+                options.tmpDir = argv[++i];
+            } else if (arg == "--one_direction") {
+                options.oneDirection = true;
+            } else if (arg.size() > 1 && arg[0] == '-') {
+                throw std::invalid_argument(arg);
+            } else {
+                args.push_back(arg);
+            }
+        }
+    } catch (std::logic_error const& e) {
+        args.clear();
+    }
+    if (args.size() != 4
+        || (options.formatVersion != pwalnFormatV4
+            && options.formatVersion != pwalnFormatV5
+            && options.formatVersion != pwalnFormatV6)) {
+        std::fprintf(stderr,
+                     "usage: %s [-f 4|5|6] [-t N] [--max_entries N] "
+                     "[--tmp_dir DIR] [--one_direction] CHAIN_DIR "
+                     "ASSEMBLY_DIR SPECIES_LIST OUTFILE\n",
+                     argv[0]);
+        return 2;
+    }
+
+    try {
+        std::printf("Collecting alignment blocks from all species pairs\n");
+        std::printf("Writing output to %s\n", args[3].c_str());
+        collectPwalns(args[0], args[1], split(args[2], ','), args[3], options);
+    } catch (std::exception const& e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        std::remove(args[3].c_str());
+        return 1;
+    }
+    return 0;
+}
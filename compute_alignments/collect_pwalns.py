@@ -12,8 +12,8 @@ import numpy as np
 
 # Whenever you change the output format in an incompatible way, be sure to
 # increase the FORMAT_VERSION.
-FORMAT_VERSION = 4
-# Format:
+FORMAT_VERSION = 5
+# Format (version 4):
 #   version                   [uint8]
 #   endianness_magic          [uint16]
 #   num_sp1                   [uint8]
@@ -40,6 +40,67 @@ FORMAT_VERSION = 4
 #   {
 #     chrom_name              [null-terminated string]
 #   } num_chromosomes times
+#
+# Format (version 5):
+# The pwaln entries are stored aligned and with the in-memory layout of the
+# c++ ipp module, followed by an index. That way the file can be memory-mapped
+# and used in place.
+#   version                   [uint8]
+#   endianness_magic          [uint16]
+#   padding                   [5 bytes]
+#   index_offset              [uint64]
+#   {
+#     padding                 [0-15 bytes, up to the next 16 byte boundary]
+#     {
+#       ref_start             [uint32]
+#       qry_start             [uint32]
+#       qry_chrom             [uint32]
+#       length_and_strand     [uint16]
+#       padding               [uint16]
+#     } num_pwaln_entries times
+#   } once per (sp1, sp2, ref_chrom) block
+#   index (at index_offset):
+#   num_sp1                   [uint8]
+#   {
+#     sp1_name                [null-terminated string]
+#     sp1_genome_size         [uint64]
+#     num_sp2                 [uint8]
+#     {
+#       sp2_name              [null-terminated string]
+#       num_ref_chrom_entries [uint32]
+#       {
+#         ref_chrom           [uint32]
+#         num_pwaln_entries   [uint32]
+#         max_anchor_length   [uint16]
+#         entries_offset      [uint64]
+#       } num_ref_chrom_entries times
+#     } num_sp2 times
+#   } num_sp1 times
+#   num_chomosomes            [uint32]
+#   {
+#     chrom_name              [null-terminated string]
+#   } num_chromosomes times
+#
+# Format (version 6, only written by the native collect_pwalns.cpp):
+# Like version 5, but the pwaln entries of each block are compressed
+# independently (delta-encoded varints, see PwalnBlockEncoder in
+# pwalnformat.h) without padding, and each index entry has the size of the
+# compressed entries after the entries_offset:
+#       {
+#         ref_chrom           [uint32]
+#         num_pwaln_entries   [uint32]
+#         max_anchor_length   [uint16]
+#         entries_offset      [uint64]
+#         entries_size        [uint64]
+#       } num_ref_chrom_entries times
+
+# The in-memory layout of a pwaln entry in format version 5.
+PWALN_ENTRY_V5_DTYPE = np.dtype([('ref_start', '=u4'),
+                                 ('qry_start', '=u4'),
+                                 ('qry_chrom', '=u4'),
+                                 ('length_and_strand', '=u2'),
+                                 ('padding', '=u2')])
+assert PWALN_ENTRY_V5_DTYPE.itemsize == 16
 
 def create_ptr_to_chromosome(chrom_name):
   # Checks whether the given chromosome is already in `chroms`. If so, then
@@ -130,6 +191,25 @@ def read_alignment_blocks_from_chain(chain_file):
 
   return df
 
+def write_pwaln_entries_v5(out, df):
+  # Writes the alignment blocks of one species pair in the v5 layout, i.e. one
+  # 16-byte aligned block of entries per ref chromosome.
+  # Returns the index entries [(ref_chrom, num_pwaln_entries,
+  # max_anchor_length, entries_offset)] of the written blocks.
+  ref_chrom_entries = []
+  for ref_chrom, df_chrom in df.groupby('ref_chrom', sort=False):
+    # pad up to the next 16 byte boundary
+    out.write(b'\x00' * (-out.tell() % 16))
+
+    entries = np.zeros(df_chrom.shape[0], dtype=PWALN_ENTRY_V5_DTYPE)
+    for col in ('ref_start', 'qry_start', 'qry_chrom', 'length_and_strand'):
+      entries[col] = df_chrom[col].values
+    max_anchor_length = int((entries['length_and_strand'] & ~(1<<15)).max())
+
+    ref_chrom_entries.append((ref_chrom, len(entries), max_anchor_length, out.tell()))
+    out.write(entries.tobytes())
+  return ref_chrom_entries
+
 def main():
   # parse arguments
   parser = argparse.ArgumentParser()
@@ -138,6 +218,7 @@ def main():
   parser.add_argument('species_list')
   parser.add_argument('outfile')
   parser.add_argument('-l', '--leave_progressbar', action='store_true', help='do not remove completed progressbar')
+  parser.add_argument('-f', '--format_version', type=int, choices=[4, 5], default=FORMAT_VERSION, help='version of the output format')
   args = parser.parse_args()
   species_list = args.species_list.split(',')
   
@@ -168,34 +249,51 @@ def main():
 
     # Write the version of the output format that is used. That enables the
     # consumer to verify that it does not read any outdated pwalns file.
-    write_int(FORMAT_VERSION, 1)
+    write_int(args.format_version, 1)
 
     # Write a magic number to ensure that the endianness of the system that
     # produced the pwalns file is the same as the endianness of the system that
     # consumes it.
     write_int(0xAFFE, 2)
 
-    write_int(n_species, 1)
-    for sp1 in species_list:
-      write_str(sp1)
+    if args.format_version == 5:
+      # Padding and a placeholder for the index offset which is only known once
+      # all the pwaln entries are written.
+      out.write(b'\x00' * 5)
+      write_int(0, 8)
+    else:
+      write_int(n_species, 1)
 
+    # The index of the v5 format: [(sp1, genome_size, [(sp2, [(ref_chrom,
+    # num_pwaln_entries, max_anchor_length, entries_offset)])])]
+    index = []
+    for sp1 in species_list:
       # read and write genome size
       with open(os.path.join(args.assembly_dir, sp1 + '.sizes'), 'r') as f:
         genome_size_sp1 = sum([int(line.strip().split()[1]) for line in f.readlines()])
-      write_int(genome_size_sp1, 8)
-      
-      write_int(n_species-1, 1)
+      if args.format_version == 5:
+        index.append((sp1, genome_size_sp1, []))
+      else:
+        write_str(sp1)
+        write_int(genome_size_sp1, 8)
+        write_int(n_species-1, 1)
+
       for sp2 in species_list:
         if sp1 == sp2:
           continue
 
-        # write sp2 name
-        write_str(sp2)
-
         # read chain file and save alignment blocks in df
         chain_file = get_chain_path(sp1,sp2)
         df = read_alignment_blocks_from_chain(chain_file)
 
+        if args.format_version == 5:
+          index[-1][2].append((sp2, write_pwaln_entries_v5(out, df)))
+          pbar.update()
+          continue
+
+        # write sp2 name
+        write_str(sp2)
+
         # write number of ref chrom entries
         ref_chrom_counts = df.ref_chrom.value_counts(sort=False)
         write_int(len(ref_chrom_counts), 4)
@@ -219,12 +317,33 @@ def main():
         pbar2.close()
           
         pbar.update()
+
+    if args.format_version == 5:
+      # write the index and patch its offset into the header
+      index_offset = out.tell()
+      write_int(n_species, 1)
+      for sp1, genome_size_sp1, sp2_entries in index:
+        write_str(sp1)
+        write_int(genome_size_sp1, 8)
+        write_int(len(sp2_entries), 1)
+        for sp2, ref_chrom_entries in sp2_entries:
+          write_str(sp2)
+          write_int(len(ref_chrom_entries), 4)
+          for ref_chrom, num_pwaln_entries, max_anchor_length, entries_offset in ref_chrom_entries:
+            write_int(ref_chrom, 4)
+            write_int(num_pwaln_entries, 4)
+            write_int(max_anchor_length, 2)
+            write_int(entries_offset, 8)
     
     # write chromosomes
     write_int(len(chroms), 4)
     for chrom in chroms:
       write_str(chrom)
 
+    if args.format_version == 5:
+      out.seek(8)
+      write_int(index_offset, 8)
+
   pbar.close()
   return
 
@@ -2,25 +2,47 @@
  * C++ implementation of the ipp module.
  */
 #include "ipp.h"
+#include "pwalnformat.h"
 
 // Always execute assert()s!
 #undef NDEBUG
 
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <mutex>
-#include <queue>
+#include <stdexcept>
 #include <thread>
 #include <tuple>
-#include <unordered_set>
+
+#include <dirent.h>
+#include <fcntl.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace {
 
 template<typename T>
 T
-readInt(std::ifstream& file) {
+readInt(std::istream& file) {
     T val;
     file.read(reinterpret_cast<char*>(&val), sizeof(val));
     if (!file.good()) {
@@ -30,7 +52,7 @@ readInt(std::ifstream& file) {
 }
 
 std::string
-readString(std::ifstream& file) {
+readString(std::istream& file) {
     std::string s;
     std::getline(file, s, '\0');
     if (!file.good()) {
@@ -39,11 +61,601 @@ readString(std::ifstream& file) {
     return s;
 }
 
+template<typename T>
+void
+writeInt(std::ostream& file, T val) {
+    file.write(reinterpret_cast<char const*>(&val), sizeof(val));
+}
+
+template<typename T>
+void
+readArray(std::istream& file, std::vector<T>* v) {
+    // Reads v->size() values.
+    file.read(reinterpret_cast<char*>(v->data()), v->size()*sizeof(T));
+    if (!file.good()) {
+        throw std::runtime_error("Unexpected EOF");
+    }
+}
+
+template<typename T>
+void
+writeArray(std::ostream& file, std::vector<T> const& v) {
+    file.write(reinterpret_cast<char const*>(v.data()), v.size()*sizeof(T));
+}
+
+struct stat
+fileStat(std::string const& fileName) {
+    struct stat st;
+    if (::stat(fileName.c_str(), &st) != 0) {
+        throw std::runtime_error(
+            format("could not stat the file: %s", fileName.c_str()));
+    }
+    return st;
+}
+
+uint64_t
+fileSize(std::string const& fileName) {
+    return fileStat(fileName).st_size;
+}
+
+int64_t
+fileModificationTimeNs(std::string const& fileName) {
+    struct stat const st(fileStat(fileName));
+    return static_cast<int64_t>(st.st_mtim.tv_sec)*1000000000
+        + st.st_mtim.tv_nsec;
+}
+
+uint64_t
+elapsedNs(std::chrono::steady_clock::time_point startTime) {
+    // Returns the time since startTime in ns.
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - startTime).count();
+}
+
+uint8_t const anchorTablesFormatVersion(4);
+
+Ipp::ProjectionParams const anchorTablesParams;
+// The AnchorTables are built with the default topn and minn and only used
+// by projections with the same values.
+
+class NumaTopology {
+    // The NUMA nodes of the machine (from /sys/devices/system/node) and the
+    // CPUs of each that this process may run on.
+public:
+    static std::size_t const maxNumNodes = 1024;
+    using NodeMask = std::array<unsigned long, maxNumNodes / 64>;
+
+    static NumaTopology const& get() {
+        static NumaTopology const topology;
+        return topology;
+    }
+
+    std::size_t numNodes() const {
+        return numNodes_;
+    }
+    NodeMask const& nodeMask() const {
+        return nodeMask_;
+    }
+
+    int workerCpu(unsigned workerId) const {
+        // Returns the CPU of the given worker (or -1 if unknown): Round-robin
+        // over the nodes, in order within each node.
+        return workerCpus_.empty()
+            ? -1
+            : workerCpus_[workerId % workerCpus_.size()];
+    }
+
+private:
+    NumaTopology()
+        : numNodes_(0)
+        , nodeMask_()
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return;
+        }
+
+        std::vector<std::vector<int>> nodeCpus;
+        if (DIR* const dir = ::opendir("/sys/devices/system/node")) {
+            while (dirent const* const entry = ::readdir(dir)) {
+                unsigned node;
+                char c;
+                if (std::sscanf(entry->d_name, "node%u%c", &node, &c) != 1
+                    || node >= maxNumNodes) {
+                    continue;
+                }
+                std::vector<int> cpus;
+                std::ifstream file(format("/sys/devices/system/node/%s/cpulist",
+                                          entry->d_name).c_str());
+                std::string range;
+                // E.g. "0-15,32-47".
+                while (std::getline(file, range, ',')) {
+                    int first;
+                    int last;
+                    int const n(std::sscanf(range.c_str(), "%d-%d", &first, &last));
+                    for (int cpu(first); n >= 1 && cpu <= (n == 2 ? last : first);
+                         ++cpu) {
+                        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                            cpus.push_back(cpu);
+                        }
+                    }
+                }
+                nodeMask_[node / 64] |= 1ul << (node % 64);
+                ++numNodes_;
+                if (!cpus.empty()) {
+                    nodeCpus.push_back(std::move(cpus));
+                }
+            }
+            ::closedir(dir);
+        }
+
+        for (std::size_t i(0); ; ++i) {
+            bool done(true);
+            for (auto const& cpus : nodeCpus) {
+                if (i < cpus.size()) {
+                    workerCpus_.push_back(cpus[i]);
+                    done = false;
+                }
+            }
+            if (done) {
+                break;
+            }
+        }
+    }
+
+    std::size_t numNodes_;
+    NodeMask nodeMask_;
+    std::vector<int> workerCpus_;
+};
+
+void
+pinThisThread(int cpu) {
+    // Restricts the calling thread to the given CPU (if known).
+    if (cpu < 0) {
+        return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    // Best effort: Without pinning the worker still runs.
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+class ScopedNumaInterleave {
+    // Makes the calling thread allocate its pages interleaved over all the
+    // NUMA nodes until the end of the scope, then restores its previous
+    // memory policy. Does nothing unless enabled and there are several nodes.
+public:
+    explicit ScopedNumaInterleave(bool enabled)
+        : active_(false)
+        , prevMode_(0)
+        , prevMask_()
+    {
+        NumaTopology const& topology(NumaTopology::get());
+        if (!enabled || topology.numNodes() < 2) {
+            return;
+        }
+        // maxnode is the number of bits + 1 (see set_mempolicy(2)).
+        if (::syscall(SYS_get_mempolicy,
+                      &prevMode_,
+                      prevMask_.data(),
+                      maxNode,
+                      nullptr,
+                      0) != 0) {
+            return;
+        }
+        active_ = ::syscall(SYS_set_mempolicy,
+                            mpolInterleave,
+                            topology.nodeMask().data(),
+                            maxNode) == 0;
+    }
+
+    ~ScopedNumaInterleave() {
+        if (active_) {
+            ::syscall(SYS_set_mempolicy, prevMode_, prevMask_.data(), maxNode);
+        }
+    }
+
+    ScopedNumaInterleave(ScopedNumaInterleave const&) = delete;
+    ScopedNumaInterleave& operator=(ScopedNumaInterleave const&) = delete;
+
+private:
+    static int const mpolInterleave = 3;
+    // MPOL_INTERLEAVE of <numaif.h> (libnuma is not required).
+    static unsigned long const maxNode = NumaTopology::maxNumNodes + 1;
+
+    bool active_;
+    int prevMode_;
+    NumaTopology::NodeMask prevMask_;
+};
+
+class MemReader {
+    // Reads integers and null-terminated strings from a memory buffer (e.g.
+    // a memory-mapped file).
+public:
+    MemReader(char const* begin, char const* end)
+        : pos_(begin)
+        , end_(end)
+    {}
+
+    template<typename T>
+    T readInt() {
+        T val;
+        if (static_cast<std::size_t>(end_ - pos_) < sizeof(val)) {
+            throw std::runtime_error("Unexpected EOF");
+        }
+        std::memcpy(&val, pos_, sizeof(val));
+        pos_ += sizeof(val);
+        return val;
+    }
+
+    std::string readString() {
+        auto const nul(static_cast<char const*>(
+                std::memchr(pos_, '\0', end_ - pos_)));
+        if (!nul) {
+            throw std::runtime_error("Unexpected EOF");
+        }
+        std::string s(pos_, nul);
+        pos_ = nul + 1;
+        return s;
+    }
+
+    void skip(std::size_t n) {
+        if (static_cast<std::size_t>(end_ - pos_) < n) {
+            throw std::runtime_error("Unexpected EOF");
+        }
+        pos_ += n;
+    }
+
+    bool atEnd() const {
+        return pos_ == end_;
+    }
+
+private:
+    char const* pos_;
+    char const* const end_;
+};
+
+void
+checkEndiannessMagic(uint16_t endiannessMagic) {
+    if (endiannessMagic != pwalnEndiannessMagic) {
+        throw std::runtime_error(
+            "the endianness of the system that produced the pwalns file "
+            "differs from the enndianess of this system");
+    }
+}
+
 } // namespace
 
+class Ipp::MappedFile {
+    // Read-only memory mapping of a whole file. The mapping is shared, i.e.
+    // several processes that map the same file share one page-cache copy.
+public:
+    explicit MappedFile(std::string const& fileName)
+        : data_(MAP_FAILED)
+        , size_(0)
+    {
+        int const fd(::open(fileName.c_str(), O_RDONLY));
+        if (fd < 0) {
+            throw std::runtime_error("could not open the file");
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0) {
+            size_ = st.st_size;
+            data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+
+        if (data_ == MAP_FAILED) {
+            throw std::runtime_error("could not map the file");
+        }
+    }
+
+    ~MappedFile() {
+        ::munmap(data_, size_);
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    char const* data() const {
+        return static_cast<char const*>(data_);
+    }
+    std::size_t size() const {
+        return size_;
+    }
+
+private:
+    void* data_;
+    std::size_t size_;
+};
+
+class Ipp::ProjectionCache {
+    // Bounded concurrent cache of the results of projectGenomicLocation()
+    // keyed on the pwaln and the ref coords. Split into shards with one lock
+    // each to keep the contention between the workers low. Each shard
+    // evicts its oldest entries when full.
+public:
+    explicit ProjectionCache(std::size_t maxNumEntries)
+        : maxShardSize_(std::max<std::size_t>(maxNumEntries / numShards, 1))
+        , hits_(0)
+        , misses_(0)
+    {}
+
+    ProjectionCache(ProjectionCache const&) = delete;
+    ProjectionCache& operator=(ProjectionCache const&) = delete;
+
+    void useParams(ProjectionParams const& params) {
+        // Drops the entries if they were computed with other params. Must
+        // not be called while the cache is in use.
+        if (!hasParams(params)) {
+            clear();
+            params_ = params;
+        }
+    }
+
+    bool hasParams(ProjectionParams const& params) const {
+        // Returns whether the entries are computed with the given params.
+        return params.topn == params_.topn
+            && params.minn == params_.minn
+            && params.halfLifeDistance == params_.halfLifeDistance
+            && params.genomeSizeBasis == params_.genomeSizeBasis;
+    }
+
+    bool lookup(Pwaln const* pwaln,
+                Coords const& refCoords,
+                std::vector<GenomicProjectionResult>* projs) {
+        // Copies the cached results to projs. Returns false if there are
+        // none.
+        Key const key(pwaln, refCoords);
+        Shard& shard(shardOf(key));
+        {
+            std::lock_guard const lockGuard(shard.mutex);
+            auto const it(shard.entries.find(key));
+            if (it != shard.entries.end()) {
+                projs->assign(it->second.begin(), it->second.end());
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void insert(Pwaln const* pwaln,
+                Coords const& refCoords,
+                std::vector<GenomicProjectionResult> const& projs) {
+        Key const key(pwaln, refCoords);
+        Shard& shard(shardOf(key));
+        std::lock_guard const lockGuard(shard.mutex);
+        if (!shard.entries.emplace(key, projs).second) {
+            // Another worker was faster.
+            return;
+        }
+        shard.insertionOrder.push_back(key);
+        if (shard.insertionOrder.size() > maxShardSize_) {
+            shard.entries.erase(shard.insertionOrder.front());
+            shard.insertionOrder.pop_front();
+        }
+    }
+
+    void clear() {
+        // Drops all the entries (but keeps the hit and miss counts).
+        for (Shard& shard : shards_) {
+            std::lock_guard const lockGuard(shard.mutex);
+            shard.entries.clear();
+            shard.insertionOrder.clear();
+        }
+    }
+
+    ProjectionCacheStats stats() const {
+        ProjectionCacheStats stats;
+        stats.hits = hits_.load(std::memory_order_relaxed);
+        stats.misses = misses_.load(std::memory_order_relaxed);
+        for (Shard const& shard : shards_) {
+            std::lock_guard const lockGuard(shard.mutex);
+            stats.numEntries += shard.entries.size();
+        }
+        return stats;
+    }
+
+private:
+    using Key = std::pair<Pwaln const*, Coords>;
+
+    struct KeyHash {
+        std::size_t operator()(Key const& key) const {
+            std::size_t h(std::hash<Pwaln const*>()(key.first));
+            h = h*0x9e3779b97f4a7c15ull + key.second.chrom;
+            h = h*0x9e3779b97f4a7c15ull + key.second.loc;
+            return h ^ (h >> 32);
+        }
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<Key,
+                           std::vector<GenomicProjectionResult>,
+                           KeyHash> entries;
+        std::deque<Key> insertionOrder;
+        // The keys of entries, oldest first.
+    };
+
+    Shard& shardOf(Key const& key) {
+        // The low bits are used by the hash table of the shard.
+        return shards_[(KeyHash()(key) >> 48) % numShards];
+    }
+
+    static constexpr std::size_t numShards = 64;
+    std::size_t const maxShardSize_;
+    ProjectionParams params_;
+    // The params of the cached projections (the search limits don't matter).
+    std::array<Shard, numShards> shards_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+};
+
+Ipp::Ipp()
+    : pwalnsFormatVersion_(0)
+    , pinThreads_(false)
+    , searchInterleave_(8)
+    , statsEnabled_(false)
+    , cancel_(false)
+    , numRunningProjections_(0)
+{}
+
+Ipp::~Ipp() {}
+
 void
-Ipp::loadPwalns(std::string const& fileName) {
+Ipp::loadPwalns(std::string const& fileName, LoadOptions const& options) {
     // Reads the chromosomes and pwalns from the given file.
+    // The first byte of the file is the format version which decides how the
+    // rest of the file is read.
+    auto const startTime(std::chrono::steady_clock::now());
+    uint8_t formatVersion;
+    {
+        std::ifstream file(fileName, std::ios::in|std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("could not open the file");
+        }
+        formatVersion = readInt<uint8_t>(file);
+    }
+
+    clearPwalns();
+    pwalnsFileName_ = fileName;
+    pwalnsFormatVersion_ = formatVersion;
+    loadOptions_ = options;
+
+    try {
+        if (formatVersion == pwalnFormatV4) {
+            loadPwalnsV4(fileName);
+        } else if (formatVersion == pwalnFormatV5
+                   || formatVersion == pwalnFormatV6) {
+            loadPwalnsV5(fileName);
+        } else {
+            throw std::runtime_error(
+                format("invalid version: %u (expected: 4, 5 or 6)",
+                       formatVersion));
+        }
+
+        std::vector<std::pair<Pwaln const*, Pwaln*>> const derivedPwalns(
+            prepareDerivedPwalns());
+        if (!options.lazy) {
+            loadBlocks(options.nThreads);
+        } else if (!derivedPwalns.empty()) {
+            // Only the forward blocks of the derived pwalns are needed.
+            std::vector<Pwaln const*> forwardPwalns;
+            for (auto const& [forward, reverse] : derivedPwalns) {
+                forwardPwalns.push_back(forward);
+            }
+            loadBlocks(forwardPwalns, options.nThreads);
+        }
+        std::vector<std::pair<Pwaln const*, Pwaln*> const*> derivedPwalnPtrs;
+        for (auto const& derivedPwaln : derivedPwalns) {
+            derivedPwalnPtrs.push_back(&derivedPwaln);
+        }
+        forEachBlock(derivedPwalnPtrs,
+                     options.nThreads,
+                     [this](auto const& derivedPwaln, std::ifstream&) {
+                         derivePwaln(*derivedPwaln.first, derivedPwaln.second);
+                     });
+
+        if (options.anchorTables) {
+            std::string const anchorTablesFile(anchorTablesFileName(fileName));
+            if (!loadAnchorTables(anchorTablesFile)) {
+                buildAnchorTables(options.nThreads);
+                try {
+                    saveAnchorTables(anchorTablesFile);
+                } catch (std::runtime_error const&) {
+                    // E.g. the directory is not writable. The tables are
+                    // still used for this run.
+                }
+            }
+        }
+    } catch (...) {
+        // Don't leave a partially loaded state behind (which might also refer
+        // to a memory mapping that does not exist anymore).
+        clearPwalns();
+        throw;
+    }
+
+    if (statsEnabled_) {
+        std::lock_guard const lockGuard(statsMutex_);
+        stats_.loadPwalnsNs.add(elapsedNs(startTime));
+    }
+}
+
+void
+Ipp::clearPwalns() {
+    // Clears the species, chromosomes and pwalns.
+    chroms_.clear();
+    chromIds_.clear();
+    species_.clear();
+    speciesIds_.clear();
+    genomeSizes_.clear();
+    pwalns_.clear();
+    mappedFile_.reset();
+    clearProjectionCache();
+}
+
+void
+Ipp::clearProjectionCache() {
+    // Drops the cached projections (if the cache is enabled).
+    if (projectionCache_) {
+        projectionCache_->clear();
+    }
+}
+
+Ipp::SpeciesId
+Ipp::internSpecies(std::string const& speciesName) {
+    // Returns the id of the given species and assigns a new one if necessary.
+    auto const it(speciesIds_.find(speciesName));
+    if (it != speciesIds_.end()) {
+        return it->second;
+    }
+
+    if (species_.size() >= maxNumSpecies) {
+        throw std::runtime_error(
+            format("too many species (max: %zu)", maxNumSpecies));
+    }
+    SpeciesId const speciesId(species_.size());
+    species_.push_back(speciesName);
+    speciesIds_.emplace(speciesName, speciesId);
+    genomeSizes_.push_back(0);
+    pwalns_.emplace_back();
+    return speciesId;
+}
+
+Ipp::Pwaln&
+Ipp::insertPwaln(std::string const& sp1, std::string const& sp2) {
+    // Returns the pwaln from sp1 to sp2; creates it if necessary.
+    SpeciesId const sp1Id(internSpecies(sp1));
+    SpeciesId const sp2Id(internSpecies(sp2));
+    auto& pwalnsSp1(pwalns_[sp1Id]);
+    for (auto& [qrySpecies, pwaln] : pwalnsSp1) {
+        if (qrySpecies == sp2Id) {
+            return pwaln;
+        }
+    }
+    return pwalnsSp1.emplace_back(sp2Id, Pwaln()).second;
+}
+
+void
+Ipp::indexChroms() {
+    // Fills chromIds_ from chroms_. If a name occurs multiple times, then its
+    // first id is used.
+    chromIds_.reserve(chroms_.size());
+    for (std::size_t i(0); i < chroms_.size(); ++i) {
+        chromIds_.emplace(chroms_[i], i);
+    }
+}
+
+void
+Ipp::loadPwalnsV4(std::string const& fileName) {
+    // Reads the chromosomes and the index of the pwalns from the given file.
+    // Only the offsets of the (sp1, sp2, ref_chrom) blocks are recorded, the
+    // pwaln entries are read by loadBlock().
     // The data in the file is expected to be in the following format:
     //
     // version                   [uint8]
@@ -73,94 +685,42 @@ Ipp::loadPwalns(std::string const& fileName) {
     //   chrom_name              [null-terminated string]
     // } num_chromosomes times
 
-    uint8_t expectedFormatVersion(4);
-
-    chroms_.clear();
-    genomeSizes_.clear();
-    pwalns_.clear();
-
     std::ifstream file(fileName, std::ios::in|std::ios::binary);
     if (!file.is_open()) {
         throw std::runtime_error("could not open the file");
     }
 
-    // Read and check the format version.
-    auto const formatVersion(readInt<uint8_t>(file));
-    if (formatVersion != expectedFormatVersion) {
-        throw std::runtime_error(format("invalid version: %u (expected: %u)",
-                                        formatVersion, expectedFormatVersion));
-    }
+    // Skip the format version (checked by loadPwalns()).
+    readInt<uint8_t>(file);
 
     // Read and check the endianness magic number.
-    auto const endiannessMagic(readInt<uint16_t>(file));
-    if (endiannessMagic != 0xAFFE) {
-        throw std::runtime_error(
-            "the endianness of the system that produced the pwalns file "
-            "differs from the enndianess of this system");
-    }
+    checkEndiannessMagic(readInt<uint16_t>(file));
 
-    // Read the pwalns.
-    maxAnchorLength_ = 0;
+    // Create the map entries and record the offsets of the blocks but skip the
+    // pwaln entries themselves.
     auto const numSp1(readInt<uint8_t>(file));
     for (unsigned i(0); i < numSp1; ++i) {
         // Create new entry in the map if it is not yet there.
         std::string const sp1(readString(file));
 
-        genomeSizes_[sp1] = readInt<uint64_t>(file);
-        auto& pwalnsSp1(pwalns_[sp1]);
+        genomeSizes_[internSpecies(sp1)] = readInt<uint64_t>(file);
 
         auto const numSp2(readInt<uint8_t>(file));
         for (unsigned j(0); j < numSp2; ++j) {
             std::string const sp2(readString(file));
-            auto& pwaln(pwalnsSp1[sp2]);
+            Pwaln& pwaln(insertPwaln(sp1, sp2));
 
             auto const numRefChromEntries(readInt<uint32_t>(file));
             for (unsigned k(0); k < numRefChromEntries; ++k) {
                 auto const refChrom(readInt<uint32_t>(file));
                 auto const numPwalnEntries(readInt<uint32_t>(file));
 
-                // Bulk-read the pwaln entries into a temporary buffer.
-                class BufAnchor {
-                public:
-                   explicit BufAnchor(std::size_t size)
-                       : size(size)
-                       , buf(std::malloc(size))
-                   {}
-                   ~BufAnchor() {
-                       std::free(buf);
-                   }
-
-                   std::size_t const size;
-                   void* const buf;
-                };
-
-                #pragma pack(1)
-                class PackedPwalnEntry : public PwalnEntry {
-                    // Packed PwalnEntry that does not have the extra padding
-                    // bytes at the end which are used for alignment.
-                };
-                static_assert(sizeof(PackedPwalnEntry) == 14);
-                #pragma pack()
-
-                BufAnchor bufAnchor(numPwalnEntries*sizeof(PackedPwalnEntry));
-                auto const buf(
-                    reinterpret_cast<PackedPwalnEntry*>(bufAnchor.buf));
+                PwalnBlock& block(pwaln[refChrom]);
+                block.fileOffset = file.tellg();
+                block.numPwalnEntries = numPwalnEntries;
 
-                file.read(reinterpret_cast<char*>(buf), bufAnchor.size);
-                if (!file.good()) {
-                    throw std::runtime_error("Unexpected EOF");
-                }
-
-                // Copy the packed representation to the properly aligned
-                // vector.
-                static_assert(sizeof(PwalnEntry) == 16);
-                std::vector<PwalnEntry>& pwalnEntries(pwaln[refChrom]);
-                pwalnEntries.reserve(numPwalnEntries);
-                for (unsigned l(0); l < numPwalnEntries; ++l) {
-                    maxAnchorLength_ = std::max(maxAnchorLength_,
-                                                buf[l].length());
-                    pwalnEntries.emplace_back(buf[l]);
-                }
+                file.seekg(numPwalnEntries*sizeof(PackedPwalnEntry),
+                           std::ios::cur);
             }
         }
     }
@@ -171,6 +731,7 @@ Ipp::loadPwalns(std::string const& fileName) {
     for (unsigned i(0); i < numChromosomes; ++i) {
         chroms_.push_back(readString(file));
     }
+    indexChroms();
 
     if (file.peek() != std::ifstream::traits_type::eof()) {
         throw std::runtime_error("Remaining data at EOF");
@@ -178,111 +739,211 @@ Ipp::loadPwalns(std::string const& fileName) {
     }
 }
 
-uint64_t
-Ipp::getGenomeSize(std::string const& speciesName) {
-  // Returns the genome size for a given species name
-  return genomeSizes_[speciesName];
-}
-
 void
-Ipp::setHalfLifeDistance(unsigned halfLifeDistance) {
-    // Sets the half-life distance;
-    halfLifeDistance_ = halfLifeDistance;
-}
+Ipp::loadPwalnsV5(std::string const& fileName) {
+    // Memory-maps the given file and reads the chromosomes and the index of
+    // the pwalns. The pwaln entries are not copied but used in place.
+    // The data in the file is expected to be in the following format:
+    //
+    // version                   [uint8]
+    // endianness_magic          [uint16]
+    // padding                   [5 bytes]
+    // index_offset              [uint64]
+    // {
+    //   padding                 [0-15 bytes, up to the next 16 byte boundary]
+    //   {
+    //     ref_start             [uint32]
+    //     qry_start             [uint32]
+    //     qry_chrom             [uint32]
+    //     length_and_strand     [uint16]
+    //     padding               [uint16]
+    //   } num_pwaln_entries times
+    // } once per (sp1, sp2, ref_chrom) block
+    // index (at index_offset):
+    // num_sp1                   [uint8]
+    // {
+    //   sp1_name                [null-terminated string]
+    //   sp1_genome_size         [uint64]
+    //   num_sp2                 [uint8]
+    //   {
+    //     sp2_name              [null-terminated string]
+    //     num_ref_chrom_entries [uint32]
+    //     {
+    //       ref_chrom           [uint32]
+    //       num_pwaln_entries   [uint32]
+    //       max_anchor_length   [uint16]
+    //       entries_offset      [uint64]
+    //     } num_ref_chrom_entries times
+    //   } num_sp2 times
+    // } num_sp1 times
+    // num_chomosomes            [uint32]
+    // {
+    //   chrom_name              [null-terminated string]
+    // } num_chromosomes times
+    //
+    // The pwaln entries have the in-memory layout of PwalnEntry.
+    //
+    // Version 6 differs in the blocks: They are not padded but compressed
+    // with PwalnBlockEncoder, and their index entries have the size of the
+    // compressed data (uint64) after the entries_offset.
 
-std::optional<Ipp::ChromId>
-Ipp::chromIdFromName(std::string const& chromName) const {
-    // Looks up the given chromosome name in chroms_ and returns its id.
-    auto const it(std::find(chroms_.begin(), chroms_.end(), chromName));
-    if (it == chroms_.end()) {
-        return {};
+    auto mappedFile(std::make_unique<MappedFile>(fileName));
+    char const* const data(mappedFile->data());
+    std::size_t const size(mappedFile->size());
+
+    // Read the header.
+    MemReader header(data, data + size);
+    bool const compressed(header.readInt<uint8_t>() == pwalnFormatV6);
+    checkEndiannessMagic(header.readInt<uint16_t>());
+    header.skip(5);
+    auto const indexOffset(header.readInt<uint64_t>());
+    if (indexOffset < pwalnV5HeaderSize || indexOffset > size) {
+        throw std::runtime_error("invalid index offset");
     }
-    return {std::distance(chroms_.begin(), it)};
-}
 
-std::string const&
-Ipp::chromName(ChromId chromId) const {
-    // Returns the name of the chromosome with the given id.
-    return chroms_.at(chromId);
-}
+    // Read the index of the pwalns.
+    MemReader index(data + indexOffset, data + size);
+    auto const numSp1(index.readInt<uint8_t>());
+    for (unsigned i(0); i < numSp1; ++i) {
+        std::string const sp1(index.readString());
 
-double
-Ipp::projectionScore(uint32_t loc,
-                     uint32_t upBound,
-                     uint32_t downBound,
-                     uint64_t genomeSize,
-                     uint64_t genomeSizeBasis) const {
-    // Anchors must be the locations of the up- and downstream anchors, not the
-    // data frame with ref and qry coordinates.
-    // The scaling factor determines how fast the function falls when moving
-    // away from an anchor.
-    // Ideally, we define a half-life X_half, i.e. at a distance of X_half, the
-    // model is at 0.5. With a scaling factor of 50 kb, X_half is at 20 kb (with
-    // 100 kb at 10 kb).
-    // score = 0.5^{minDist * genomeSizeBasis / (genomeSize * halfLifeDistance_)}
+        genomeSizes_[internSpecies(sp1)] = index.readInt<uint64_t>();
 
-    uint32_t const minDist(std::min(loc - upBound, downBound - loc));
-    double const exp(((1.0d*minDist) / halfLifeDistance_)
-                     * ((1.0d*genomeSizeBasis) / genomeSize));
-    double const score(std::pow(0.5d, exp));
-    assert(0 <= score && score <= 1);
-    return score;
+        auto const numSp2(index.readInt<uint8_t>());
+        for (unsigned j(0); j < numSp2; ++j) {
+            std::string const sp2(index.readString());
+            Pwaln& pwaln(insertPwaln(sp1, sp2));
+
+            auto const numRefChromEntries(index.readInt<uint32_t>());
+            for (unsigned k(0); k < numRefChromEntries; ++k) {
+                auto const refChrom(index.readInt<uint32_t>());
+                auto const numPwalnEntries(index.readInt<uint32_t>());
+                auto const maxAnchorLength(index.readInt<uint16_t>());
+                auto const entriesOffset(index.readInt<uint64_t>());
+                if (compressed) {
+                    auto const compressedSize(index.readInt<uint64_t>());
+                    if (entriesOffset < pwalnV5HeaderSize
+                        || entriesOffset > indexOffset
+                        || indexOffset - entriesOffset < compressedSize) {
+                        throw std::runtime_error(
+                            format("invalid offset of the pwaln entries: %s %s %u",
+                                   sp1.c_str(), sp2.c_str(), refChrom));
+                    }
+
+                    // Decompressed by loadBlock().
+                    PwalnBlock& block(pwaln[refChrom]);
+                    block.maxAnchorLength = maxAnchorLength;
+                    block.fileOffset = entriesOffset;
+                    block.numPwalnEntries = numPwalnEntries;
+                    block.compressedSize = compressedSize;
+                    continue;
+                }
+                if (entriesOffset % pwalnV5BlockAlignment
+                    || entriesOffset < pwalnV5HeaderSize
+                    || entriesOffset > indexOffset
+                    || (indexOffset - entriesOffset) / sizeof(PwalnEntry)
+                        < numPwalnEntries) {
+                    throw std::runtime_error(
+                        format("invalid offset of the pwaln entries: %s %s %u",
+                               sp1.c_str(), sp2.c_str(), refChrom));
+                }
+
+                auto const begin(
+                    reinterpret_cast<PwalnEntry const*>(data + entriesOffset));
+                PwalnBlock& block(pwaln[refChrom]);
+                block.entries = PwalnEntries(begin, begin + numPwalnEntries);
+                block.maxAnchorLength = maxAnchorLength;
+                block.numPwalnEntries = numPwalnEntries;
+                // The block only needs to be processed by loadBlock() if it
+                // is converted, indexed or its pages are interleaved.
+                block.loaded = !loadOptions_.compact
+                    && !loadOptions_.searchIndex
+                    && !loadOptions_.numaInterleave;
+            }
+        }
+    }
+
+    // Read the chromosomes.
+    auto const numChromosomes(index.readInt<uint32_t>());
+    chroms_.reserve(numChromosomes);
+    for (unsigned i(0); i < numChromosomes; ++i) {
+        chroms_.push_back(index.readString());
+    }
+    indexChroms();
+
+    if (!index.atEnd()) {
+        throw std::runtime_error("Remaining data at EOF");
+        // There is more data to read when we don't expect it.
+    }
+
+    mappedFile_ = std::move(mappedFile);
 }
 
 void
-Ipp::projectCoords(
-    std::string const& refSpecies,
-    std::string const& qrySpecies,
-    std::vector<Coords> const& refCoords,
-    unsigned const nThreads,
-    OnProjectCoordsJobDoneCallback const& onJobDoneCallback) {
-    // Calls projectCoord() on the given list of refCoords.
-    // If nThreads > 1 then that many worker threads are started.
-    // For each completed job the onJobDoneCallback() is called with the result.
-    // The call to onJobDoneCallback() can come from any thread but no
-    // concurrent calls will be made.
+Ipp::loadBlocks(unsigned nThreads) {
+    // Loads all the blocks that are not loaded yet.
+    std::vector<Pwaln const*> pwalns;
+    for (auto const& pwalnsSp1 : pwalns_) {
+        for (auto const& [sp2, pwaln] : pwalnsSp1) {
+            pwalns.push_back(&pwaln);
+        }
+    }
+    loadBlocks(pwalns, nThreads);
+}
+
+void
+Ipp::loadBlocks(std::vector<Pwaln const*> const& pwalns, unsigned nThreads) {
+    // Loads the blocks of the given pwalns that are not loaded yet with
+    // nThreads worker threads. Starts with the largest blocks so that the
+    // work is evenly distributed over the threads.
+    std::vector<PwalnBlock const*> blocks;
+    for (Pwaln const* pwaln : pwalns) {
+        for (auto const& [refChrom, block] : *pwaln) {
+            if (!block.loaded) {
+                blocks.push_back(&block);
+            }
+        }
+    }
+    std::sort(blocks.begin(), blocks.end(),
+              [](PwalnBlock const* lhs, PwalnBlock const* rhs) {
+                  return lhs->numPwalnEntries > rhs->numPwalnEntries;
+              });
 
+    forEachBlock(blocks,
+                 nThreads,
+                 [this](PwalnBlock const& block, std::ifstream& file) {
+                     loadBlock(block, file);
+                 });
+}
+
+template<typename Item, typename Fn>
+void
+Ipp::forEachBlock(std::vector<Item const*> const& blocks,
+                  unsigned nThreads,
+                  Fn const& fn) const {
+    // Calls fn(block, file) for each of the given blocks with nThreads
+    // worker threads which take the next block from the list once they are
+    // done.
     std::mutex mutex;
-    std::vector<Coords> jobs(refCoords.rbegin(), refCoords.rend());
+    std::atomic<std::size_t> nextBlock(0);
     std::exception_ptr workerException;
 
-    cancel_ = false;
-
     auto const worker = [&]() {
-        while (true) {
-            // Get the next job.
-            Coords refCoord;
-            {
-                std::lock_guard const lockGuard(mutex);
-                if (jobs.empty()) {
-                    // All jobs done.
-                    return;
-                } else if (workerException) {
-                    // An exception occured on a different thread. Abort.
-                    return;
-                } else if (cancel_) {
-                    return;
-                }
-
-                refCoord = jobs.back();
-                jobs.pop_back();
+        try {
+            // The blocks, tables etc. are allocated by the workers.
+            ScopedNumaInterleave const numaInterleave(
+                loadOptions_.numaInterleave);
+            std::ifstream file;
+            for (std::size_t i(nextBlock++); i < blocks.size(); i = nextBlock++) {
+                fn(*blocks[i], file);
             }
-
-            try {
-                // Execute the next job (while not holding the mutex!).
-                Ipp::CoordProjection const coordProjection(
-                    projectCoord(refSpecies, qrySpecies, refCoord));
-
-                // Call the callback (while holding the mutex).
-                {
-                    std::lock_guard const lockGuard(mutex);
-                    onJobDoneCallback(refCoord, coordProjection);
-                }
-            } catch (...) {
-                std::lock_guard const lockGuard(mutex);
+        } catch (...) {
+            std::lock_guard const lockGuard(mutex);
+            if (!workerException) {
                 workerException = std::current_exception();
-                return;
             }
+            // Make the other workers stop.
+            nextBlock = blocks.size();
         }
     };
 
@@ -309,402 +970,2885 @@ Ipp::projectCoords(
 }
 
 void
-Ipp::cancel() {
-    // Cancel ongoing project_coords() call.
-    cancel_ = true;
+Ipp::loadBlock(PwalnBlock const& block, std::ifstream& file) const {
+    // Makes the entries of the given block available: Reads them from the v4
+    // file (opening it if necessary) or decompresses them from the v6 file
+    // and/or converts them to the compact representation. Does nothing if the
+    // block is already loaded.
+    // Thread-safe.
+    std::lock_guard const lockGuard(block.mutex);
+    if (block.loaded) {
+        // Another thread was faster.
+        return;
+    }
+    auto const startTime(std::chrono::steady_clock::now());
+    ScopedNumaInterleave const numaInterleave(loadOptions_.numaInterleave);
+
+    if (pwalnsFormatVersion_ == pwalnFormatV6) {
+        // Decompress the entries from the memory mapping.
+        char const* const begin(mappedFile_->data() + block.fileOffset);
+        PwalnBlockDecoder decoder(begin, begin + block.compressedSize);
+        block.storage.reserve(block.numPwalnEntries);
+        for (uint32_t i(0); i < block.numPwalnEntries; ++i) {
+            block.storage.push_back(decoder.next());
+        }
+        if (!decoder.atEnd()) {
+            throw std::runtime_error("invalid compressed pwaln entries");
+        }
+        block.entries = PwalnEntries(
+            block.storage.data(),
+            block.storage.data() + block.storage.size());
+    } else if (!mappedFile_) {
+        // Bulk-read the pwaln entries into a temporary buffer.
+        if (!file.is_open()) {
+            file.open(pwalnsFileName_, std::ios::in|std::ios::binary);
+            if (!file.is_open()) {
+                throw std::runtime_error("could not open the file");
+            }
+        }
+        std::vector<PackedPwalnEntry> buf(block.numPwalnEntries);
+        file.seekg(block.fileOffset);
+        file.read(reinterpret_cast<char*>(buf.data()),
+                  buf.size()*sizeof(PackedPwalnEntry));
+        if (!file.good()) {
+            throw std::runtime_error("Unexpected EOF");
+        }
+
+        // Copy the packed representation to the properly aligned vector.
+        static_assert(sizeof(PwalnEntry) == 16);
+        block.storage.reserve(buf.size());
+        for (PackedPwalnEntry const& entry : buf) {
+            block.maxAnchorLength = std::max(block.maxAnchorLength,
+                                             entry.length());
+            block.storage.emplace_back(entry);
+        }
+        block.entries = PwalnEntries(
+            block.storage.data(),
+            block.storage.data() + block.storage.size());
+    } else if (loadOptions_.numaInterleave) {
+        // Fault in the pages of the mapped entries under the interleave
+        // policy (instead of on the node of the first projection thread that
+        // touches them).
+        static long const pageSize(::sysconf(_SC_PAGESIZE));
+        char const* const begin(
+            reinterpret_cast<char const*>(block.entries.begin()));
+        char const* const end(
+            reinterpret_cast<char const*>(block.entries.end()));
+        for (char const* p(begin); p < end; p += pageSize) {
+            *static_cast<char const volatile*>(p);
+        }
+    }
+
+    indexBlock(block);
+    block.loaded.store(true, std::memory_order_release);
+
+    if (statsEnabled_) {
+        std::lock_guard const lockGuard(statsMutex_);
+        stats_.loadBlockNs.add(elapsedNs(startTime));
+    }
 }
 
-namespace {
+void
+Ipp::indexBlock(PwalnBlock const& block) const {
+    // Builds the search index and/or the compact representation of the
+    // entries of the given block (according to the load options).
+    if (loadOptions_.searchIndex) {
+        std::vector<uint32_t> refStarts;
+        block.visitEntries([&](auto const& entries) {
+            refStarts.reserve(entries.size());
+            for (std::size_t i(0); i < entries.size(); ++i) {
+                refStarts.push_back(entries.refStart(i));
+            }
+        });
+        block.refStartIndex = std::make_unique<RefStartIndex>(refStarts);
+    }
 
-struct ShortestPathMapKey {
-    std::string species;
-    Ipp::Coords coords;
+    if (loadOptions_.compact && !block.reverse) {
+        block.compact = CompactPwalnEntries::create(block.entries);
+        if (block.compact) {
+            // Release the (owned) entries.
+            std::vector<PwalnEntry>().swap(block.storage);
+            block.entries = PwalnEntries();
+        }
+    }
+}
 
-    ShortestPathMapKey() {}
-    ShortestPathMapKey(std::string const& species, Ipp::Coords const& coords)
-        : species(species)
-        , coords(coords)
-    {}
+std::vector<std::pair<Ipp::Pwaln const*, Ipp::Pwaln*>>
+Ipp::prepareDerivedPwalns() {
+    // Returns the (forward, reverse) pwalns where reverse is derived from
+    // forward: All the species pairs that are only in the file in one
+    // direction and, with the deriveReverse option, also those in both
+    // directions (the direction whose ref species comes first is kept).
+    auto const findPwaln = [this](SpeciesId sp1, SpeciesId sp2) {
+        auto& pwalnsSp1(pwalns_[sp1]);
+        auto const it(std::find_if(pwalnsSp1.begin(),
+                                   pwalnsSp1.end(),
+                                   [&](auto const& p) { return p.first == sp2; }));
+        return it != pwalnsSp1.end() ? &it->second : nullptr;
+    };
 
-    bool operator==(ShortestPathMapKey const& other) const {
-        return species == other.species && coords == other.coords;
+    std::vector<std::pair<SpeciesId, SpeciesId>> pairs;
+    for (SpeciesId sp1(0); sp1 < pwalns_.size(); ++sp1) {
+        for (auto const& [sp2, pwaln] : pwalns_[sp1]) {
+            if (sp1 != sp2
+                && (!findPwaln(sp2, sp1)
+                    || (loadOptions_.deriveReverse && sp1 < sp2))) {
+                pairs.emplace_back(sp1, sp2);
+            }
+        }
     }
-};
 
-struct ShortestPathMapEntry {
-    double score;
-    Ipp::Anchors anchors;
-    ShortestPathMapKey const* prevKey;
-    ShortestPathMapEntry const* prevEntry;
+    // Create (or empty) all the reverse pwalns before taking pointers.
+    for (auto const& [sp1, sp2] : pairs) {
+        insertPwaln(species_[sp2], species_[sp1]).clear();
+    }
+    std::vector<std::pair<Pwaln const*, Pwaln*>> derivedPwalns;
+    for (auto const& [sp1, sp2] : pairs) {
+        derivedPwalns.emplace_back(findPwaln(sp1, sp2), findPwaln(sp2, sp1));
+    }
+    return derivedPwalns;
+}
 
-    ShortestPathMapEntry()
-        : score(0) , prevKey(nullptr), prevEntry(nullptr)
-    {}
-    ShortestPathMapEntry(double score, 
-                         Ipp::Anchors const& anchors,
-                         ShortestPathMapKey const* prevKey,
-                         ShortestPathMapEntry const* prevEntry)
-        : score(score)
-        , anchors(anchors)
-        , prevKey(prevKey)
-        , prevEntry(prevEntry)
-    {}
-};
+void
+Ipp::derivePwaln(Pwaln const& forward, Pwaln* reverse) const {
+    // Moves each entry of forward to the block of its qry chromosome, with
+    // ref and qry swapped, and sorts the blocks by [refStart, qryChrom,
+    // qryStart]. The blocks only keep the permutation of the forward entries
+    // (ReversePwalnEntries) unless these are converted to the compact
+    // representation or there are too many forward blocks. Then the entries
+    // are copied (and converted by indexBlock()).
+    struct ReverseEntry {
+        PwalnEntry entry;
+        uint16_t sourceIdx;
+        uint32_t entryIdx;
 
-struct OrangeEntry {
-    double score;
-    int pathLength;
-    ShortestPathMapKey const* spKey;
+        ReverseEntry(PwalnEntry const& entry,
+                     uint16_t sourceIdx,
+                     uint32_t entryIdx)
+            : entry(entry)
+            , sourceIdx(sourceIdx)
+            , entryIdx(entryIdx)
+        {}
+    };
 
-    OrangeEntry(double score,
-                int pathLength,
-                ShortestPathMapKey const* spKey)
-        : score(score)
-        , pathLength(pathLength)
-        , spKey(spKey)
-    {}
+    bool const permutation(
+        !loadOptions_.compact
+        && forward.size() <= ReversePwalnEntries::maxNumSources);
+    auto sources(std::make_shared<ReversePwalnEntries::Sources>());
+    std::unordered_map<ChromId, std::vector<ReverseEntry>> reverseEntries;
+    for (auto const& [refChrom, block] : forward) {
+        uint16_t const sourceIdx(sources->size());
+        if (permutation) {
+            sources->emplace_back(refChrom, block.entries);
+        }
+        block.visitEntries([&](auto const& entries) {
+            for (std::size_t i(0); i < entries.size(); ++i) {
+                PwalnEntry const entry(entries[i]);
+                reverseEntries[entry.qryChrom()].emplace_back(
+                    entry.reversed(refChrom), sourceIdx, i);
+            }
+        });
+    }
 
-    bool operator<(OrangeEntry const& other) const {
-        // Use negative path length as shorter paths are better than longer
-        // ones.
-        return std::forward_as_tuple(score, -pathLength)
-            < std::forward_as_tuple(other.score, -other.pathLength);
+    for (auto& [refChrom, entries] : reverseEntries) {
+        std::sort(entries.begin(),
+                  entries.end(),
+                  [](ReverseEntry const& lhs, ReverseEntry const& rhs) {
+                      PwalnEntry const& l(lhs.entry);
+                      PwalnEntry const& r(rhs.entry);
+                      return std::make_tuple(l.refStart(),
+                                             l.qryChrom(),
+                                             l.qryStart(),
+                                             l.lengthAndStrand())
+                          < std::make_tuple(r.refStart(),
+                                            r.qryChrom(),
+                                            r.qryStart(),
+                                            r.lengthAndStrand());
+                  });
+
+        PwalnBlock& block((*reverse)[refChrom]);
+        block.numPwalnEntries = entries.size();
+        for (ReverseEntry const& e : entries) {
+            block.maxAnchorLength = std::max(block.maxAnchorLength,
+                                             e.entry.length());
+        }
+        if (permutation) {
+            std::vector<uint16_t> sourceIdxs;
+            std::vector<uint32_t> entryIdxs;
+            sourceIdxs.reserve(entries.size());
+            entryIdxs.reserve(entries.size());
+            for (ReverseEntry const& e : entries) {
+                sourceIdxs.push_back(e.sourceIdx);
+                entryIdxs.push_back(e.entryIdx);
+            }
+            block.reverse = std::make_unique<ReversePwalnEntries>(
+                sources, std::move(sourceIdxs), std::move(entryIdxs));
+        } else {
+            block.storage.reserve(entries.size());
+            for (ReverseEntry const& e : entries) {
+                block.storage.push_back(e.entry);
+            }
+            block.entries = PwalnEntries(
+                block.storage.data(),
+                block.storage.data() + block.storage.size());
+        }
+        std::vector<ReverseEntry>().swap(entries);
+
+        indexBlock(block);
+        block.loaded.store(true, std::memory_order_release);
     }
-};
+}
 
-} // namespace
+void
+Ipp::ensureLoaded(PwalnBlock const& block) const {
+    // Loads the given block if that did not happen yet (lazy mode).
+    if (!block.loaded.load(std::memory_order_acquire)) {
+        std::ifstream file;
+        loadBlock(block, file);
+    }
+}
+
+std::size_t
+Ipp::PwalnEntries::upperBound(uint32_t refLoc) const {
+    // Returns the index of the first entry with refStart > refLoc.
+    return std::upper_bound(begin_,
+                            end_,
+                            refLoc,
+                            [](uint32_t loc, PwalnEntry const& e) {
+                                return loc < e.refStart();
+                            })
+        - begin_;
+}
 
-template<>
-struct std::hash<Ipp::Coords> {
-    std::size_t operator()(Ipp::Coords const& coords) const noexcept {
-        return std::hash<decltype(coords.chrom)>{}(coords.chrom)
-            ^ (std::hash<decltype(coords.loc)>{}(coords.loc) << 1);
+std::size_t
+Ipp::ReversePwalnEntries::upperBound(uint32_t refLoc) const {
+    // Returns the index of the first entry with refStart > refLoc.
+    std::size_t lo(0);
+    std::size_t hi(size());
+    while (lo < hi) {
+        std::size_t const mid(lo + (hi - lo) / 2);
+        if (refStart(mid) <= refLoc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
-};
-template<>
-struct std::hash<ShortestPathMapKey> {
-    std::size_t operator()(ShortestPathMapKey const& spk) const noexcept {
-        return std::hash<decltype(spk.species)>{}(spk.species)
-            ^ (std::hash<decltype(spk.coords)>{}(spk.coords) << 1);
+    return lo;
+}
+
+std::size_t
+Ipp::ReversePwalnEntries::memoryUsage() const {
+    // Returns the number of bytes used by the permutation.
+    return sourceIdxs_.capacity()*sizeof(uint16_t)
+        + entryIdxs_.capacity()*sizeof(uint32_t);
+}
+
+std::unique_ptr<Ipp::CompactPwalnEntries>
+Ipp::CompactPwalnEntries::create(PwalnEntries const& entries) {
+    // Returns the compact representation of the given entries or nullptr if
+    // they cannot be represented (too many qry chromosomes).
+    unsigned const maxGroupShift(6);
+
+    // Use the largest group size for which the refStarts of all entries of a
+    // group are within 2^16 of the first refStart of the group. A group size
+    // of 1 always works.
+    unsigned groupShift(maxGroupShift);
+    for (; groupShift > 0; --groupShift) {
+        std::size_t const groupSize(std::size_t(1) << groupShift);
+        bool fits(true);
+        for (std::size_t i(0); fits && i < entries.size(); i += groupSize) {
+            std::size_t const last(std::min(i + groupSize, entries.size()) - 1);
+            fits = entries[last].refStart() - entries[i].refStart()
+                <= std::numeric_limits<uint16_t>::max();
+        }
+        if (fits) {
+            break;
+        }
     }
-};
 
-Ipp::CoordProjection
-Ipp::projectCoord(std::string const& refSpecies,
-                  std::string const& qrySpecies,
-                  Coords const& refCoords) const {
-    bool const debug(false);
-    if (debug) {
-        std::cout.precision(16);
-        std::cout << std::endl;
-        std::cout << refSpecies << " " << qrySpecies << " "
-                  << refCoords.chrom << ":" << refCoords.loc << std::endl;
-    }
-
-	// Define basis genome size as the mouse genome mm39
-	// That way, scores from projections from different reference genomes
-	// will be comparable to each other because they are relative to the
-	// basis genome.
-	uint64_t const genomeSizeBasis(2728222451);
-	// uint64_t const genomeSizeRef(genomeSizes_.at(refSpecies));
-
-    CoordProjection coordProjection;
-    std::unordered_map<ShortestPathMapKey, ShortestPathMapEntry> shortestPath;
-
-    ShortestPathMapKey const* const refSpKey(
-        &shortestPath.try_emplace(ShortestPathMapKey(refSpecies, refCoords),
-                                  1.0, Ipp::Anchors(), nullptr, nullptr)
-        .first->first);
-
-    std::priority_queue<OrangeEntry> orange; // greatest first.
-    orange.emplace(1.0, 0, refSpKey);
-
-    ShortestPathMapKey const* bestQrySpKey(nullptr);
-    while (!orange.empty()) {
-        OrangeEntry const current(orange.top());
-        orange.pop();
-
-        auto const it(shortestPath.find(*current.spKey));
-        if (it != shortestPath.end() && it->second.score > current.score) {
-            continue;
-            // The current <species,coord> was already reached by a faster path,
-            // ignore this path and go to the next species.
+    std::unique_ptr<CompactPwalnEntries> compact(new CompactPwalnEntries());
+    compact->refStartGroupShift_ = groupShift;
+    compact->refStartBases_.reserve(
+        (entries.size() >> groupShift) + 1);
+    compact->refStartDeltas_.reserve(entries.size());
+    compact->qryStarts_.reserve(entries.size());
+    compact->qryChromIndices_.reserve(entries.size());
+    compact->lengthsAndStrands_.reserve(entries.size());
+
+    std::unordered_map<ChromId, uint16_t> qryChromIndices;
+    for (std::size_t i(0); i < entries.size(); ++i) {
+        PwalnEntry const& e(entries[i]);
+        if (!(i & ((std::size_t(1) << groupShift) - 1))) {
+            compact->refStartBases_.push_back(e.refStart());
         }
+        compact->refStartDeltas_.push_back(
+            e.refStart() - compact->refStartBases_.back());
+        compact->qryStarts_.push_back(e.qryStart());
+        compact->lengthsAndStrands_.push_back(e.lengthAndStrand());
 
-        std::string const& currentSpecies(current.spKey->species);
-        Coords const& currentCoords(current.spKey->coords);
-        if (debug) {
-            std::cout << "- " << currentSpecies << " " << current.score << " "
-                      << currentCoords.chrom << ":" << currentCoords.loc
-                      << std::endl;
+        auto const [it, inserted] = qryChromIndices.try_emplace(
+            e.qryChrom(), compact->qryChroms_.size());
+        if (inserted) {
+            if (compact->qryChroms_.size()
+                > std::numeric_limits<uint16_t>::max()) {
+                return nullptr;
+            }
+            compact->qryChroms_.push_back(e.qryChrom());
         }
-        
-        if (currentSpecies == qrySpecies) {
-            bestQrySpKey = current.spKey;
+        compact->qryChromIndices_.push_back(it->second);
+    }
+    return compact;
+}
+
+std::size_t
+Ipp::CompactPwalnEntries::upperBound(uint32_t refLoc) const {
+    // Returns the index of the first entry with refStart > refLoc.
+    // First find the group that contains the last entry with
+    // refStart <= refLoc, then search for the entry in its deltas.
+    auto const groupIt(std::upper_bound(refStartBases_.begin(),
+                                        refStartBases_.end(),
+                                        refLoc));
+    if (groupIt == refStartBases_.begin()) {
+        // All entries have refStart > refLoc.
+        return 0;
+    }
+    std::size_t const group(std::distance(refStartBases_.begin(), groupIt) - 1);
+    std::size_t const groupBegin(group << refStartGroupShift_);
+    std::size_t const groupEnd(
+        std::min(groupBegin + (std::size_t(1) << refStartGroupShift_),
+                 refStartDeltas_.size()));
+    uint32_t const delta(refLoc - refStartBases_[group]);
+    return std::upper_bound(refStartDeltas_.begin() + groupBegin,
+                            refStartDeltas_.begin() + groupEnd,
+                            delta,
+                            [](uint32_t d, uint16_t e) {
+                                return d < e;
+                            })
+        - refStartDeltas_.begin();
+}
+
+std::size_t
+Ipp::CompactPwalnEntries::memoryUsage() const {
+    // Returns the number of bytes used by the arrays.
+    return refStartBases_.capacity()*sizeof(uint32_t)
+        + refStartDeltas_.capacity()*sizeof(uint16_t)
+        + qryStarts_.capacity()*sizeof(uint32_t)
+        + qryChromIndices_.capacity()*sizeof(uint16_t)
+        + lengthsAndStrands_.capacity()*sizeof(uint16_t)
+        + qryChroms_.capacity()*sizeof(ChromId);
+}
+
+Ipp::RefStartIndex::RefStartIndex(std::vector<uint32_t> const& refStarts)
+    : size_(refStarts.size())
+{
+    // Builds the levels bottom-up: The leaves are the refStarts (padded to a
+    // multiple of nodeSize with keys that are never <= a searched refLoc) and
+    // each level above holds the first key of each node of the level below.
+    // A refLoc of UINT32_MAX is handled in upperBound().
+    uint32_t const padKey(std::numeric_limits<uint32_t>::max());
+
+    std::vector<std::vector<uint32_t>> levels;
+    levels.emplace_back(refStarts);
+    do {
+        std::vector<uint32_t>& level(levels.back());
+        level.resize(std::max<std::size_t>(
+                         (level.size() + nodeSize - 1) / nodeSize * nodeSize,
+                         nodeSize),
+                     padKey);
+        if (level.size() <= nodeSize) {
+            // This is the root.
             break;
-            // qry species reached, stop.
         }
 
-        // Collect all the species that are traversed on the current path and
-        // avoid visiting them again.
-        std::unordered_set<std::string> speciesOnPath;
-        ShortestPathMapKey const* currentSpKey(current.spKey);
-        ShortestPathMapEntry const* currentSpEntry(&it->second);
-        while (currentSpKey) {
-            speciesOnPath.insert(currentSpKey->species);
-            currentSpKey = currentSpEntry->prevKey;
-            currentSpEntry = currentSpEntry->prevEntry;
+        std::vector<uint32_t> parent;
+        parent.reserve(level.size() / nodeSize);
+        for (std::size_t i(0); i < level.size(); i += nodeSize) {
+            parent.push_back(level[i]);
         }
+        levels.emplace_back(std::move(parent));
+    } while (true);
 
-        for (auto const& nxt : pwalns_.at(currentSpecies)) {
-            std::string const& nxtSpecies(nxt.first);
+    // Store the levels from the root down to the leaves.
+    for (auto it(levels.rbegin()); it != levels.rend(); ++it) {
+        levelOffsets_.push_back(keys_.size());
+        keys_.insert(keys_.end(), it->begin(), it->end());
+    }
+}
 
-            // Don't visit a species twice on the same path.
-            if (speciesOnPath.find(nxtSpecies) != speciesOnPath.end()) {
-                continue;
-            }
+namespace {
 
-            if (debug) {
-                std::cout << "--> " << nxtSpecies << std::endl;
-            }
+inline unsigned
+countLessEqual(uint32_t const* keys, uint32_t refLoc) {
+    // Returns the number of the 16 given keys that are <= refLoc.
+    static_assert(Ipp::RefStartIndex::nodeSize == 16);
+#if defined(__AVX2__)
+    // Unsigned a <= b is equivalent to min(a, b) == a.
+    __m256i const loc(_mm256_set1_epi32(refLoc));
+    __m256i const k0(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(keys)));
+    __m256i const k1(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(keys + 8)));
+    unsigned const m0(_mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(_mm256_min_epu32(k0, loc), k0))));
+    unsigned const m1(_mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(_mm256_min_epu32(k1, loc), k1))));
+    return __builtin_popcount(m0 | (m1 << 8));
+#elif defined(__SSE2__)
+    // SSE2 only has signed comparisons: flip the sign bits to compare
+    // unsigned values.
+    __m128i const signBit(_mm_set1_epi32(0x80000000));
+    __m128i const loc(_mm_xor_si128(_mm_set1_epi32(refLoc), signBit));
+    unsigned greater(0);
+    for (unsigned i(0); i < 16; i += 4) {
+        __m128i const k(_mm_xor_si128(
+            _mm_loadu_si128(reinterpret_cast<__m128i const*>(keys + i)),
+            signBit));
+        greater |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, loc)))
+            << i;
+    }
+    return 16 - __builtin_popcount(greater);
+#else
+    unsigned count(0);
+    for (unsigned i(0); i < 16; ++i) {
+        count += keys[i] <= refLoc;
+    }
+    return count;
+#endif
+}
 
-            std::vector<GenomicProjectionResult> const projs(
-                projectGenomicLocation(currentSpecies,
-                                       nxtSpecies,
-                                       currentCoords,
-                                       genomeSizeBasis));
-            if (projs.empty()) {
-                continue;
-                // No path was found.
-            }
-
-            if(currentSpecies == refSpecies && nxtSpecies == qrySpecies) {
-                // Direct projection.
-                coordProjection.direct = projs[0];
-            }
-
-            for (GenomicProjectionResult const& proj : projs) {
-                double const nxtScore(current.score * proj.score);
-                const auto [it2, success] = shortestPath.try_emplace(
-                    {nxtSpecies, proj.nextCoords},
-                    nxtScore, proj.anchors, current.spKey, &it->second);
-                if (success || it2->second.score < nxtScore) {
-                    if (!success) {
-                        // There was already an entry in shortestPath but it had
-                        // a worse score -> replace.
-                        it2->second.score = nxtScore;
-                        it2->second.anchors = proj.anchors;
-                        it2->second.prevKey = current.spKey;
-                        it2->second.prevEntry = &it->second;
-                    }
+} // namespace
 
-                    // Only increase the path length if we don't reach the query
-                    // species as the next hop. This ensures that for the same
-                    // score we prefer the path that reaches the qry species
-                    // first.
-                    int const nxtPathLength(nxtSpecies != qrySpecies
-                                            ? current.pathLength + 1
-                                            : current.pathLength);
-                    orange.emplace(nxtScore, nxtPathLength, &it2->first);
-                }
+std::size_t
+Ipp::RefStartIndex::upperBound(uint32_t refLoc) const {
+    // Returns the index of the first refStart > refLoc.
+    if (refLoc == std::numeric_limits<uint32_t>::max()) {
+        // Would also count the padding keys.
+        return size_;
+    }
+
+    // Descend from the root: In an inner node, the number of keys <= refLoc
+    // determines the child to continue with (the last one whose first key is
+    // <= refLoc). If there is none, then all keys of the subtree are > refLoc.
+    std::size_t node(0);
+    for (std::size_t l(0); l < levelOffsets_.size(); ++l) {
+        unsigned const count(
+            countLessEqual(keys_.data() + levelOffsets_[l] + node*nodeSize,
+                           refLoc));
+        if (l + 1 == levelOffsets_.size()) {
+            // Leaf level.
+            return std::min(node*nodeSize + count, size_);
+        }
+        if (!count) {
+            // All refStarts of this subtree are > refLoc, i.e. it's the first
+            // refStart of the subtree.
+            for (++l; l < levelOffsets_.size(); ++l) {
+                node *= nodeSize;
             }
+            return std::min(node*nodeSize, size_);
         }
+        node = node*nodeSize + count - 1;
     }
+    return 0;
+}
 
-    if (bestQrySpKey) {
-        // Backtrace the shortest path from the reference to the given target
-        // species (in reversed order).
-        ShortestPathMapKey const* currentSpKey(bestQrySpKey);
-        ShortestPathMapEntry const* currentSpEntry(
-            &shortestPath.at(*currentSpKey));
-        while (currentSpKey) {
-            coordProjection.multiShortestPath.emplace_back(
-                currentSpKey->species,
-                currentSpKey->coords,
-                currentSpEntry->score,
-                currentSpEntry->anchors);
-            currentSpKey = currentSpEntry->prevKey;
-            currentSpEntry = currentSpEntry->prevEntry;
-        }
+std::size_t
+Ipp::RefStartIndex::memoryUsage() const {
+    // Returns the number of bytes used by the index.
+    return keys_.capacity()*sizeof(uint32_t)
+        + levelOffsets_.capacity()*sizeof(std::size_t);
+}
+
+uint64_t
+Ipp::getGenomeSize(std::string const& speciesName) {
+  // Returns the genome size for a given species name
+  std::optional<SpeciesId> const speciesId(speciesIdFromName(speciesName));
+  return speciesId ? genomeSizes_[*speciesId] : 0;
+}
+
+void
+Ipp::setHalfLifeDistance(unsigned halfLifeDistance) {
+    // Sets the half-life distance;
+    defaultParams_.halfLifeDistance = halfLifeDistance;
+}
+
+void
+Ipp::setProjectionCacheSize(std::size_t maxNumEntries) {
+    // Enables (or disables for 0) the projection cache. Any cached
+    // projections are dropped.
+    projectionCache_.reset(maxNumEntries
+                           ? new ProjectionCache(maxNumEntries)
+                           : nullptr);
+}
+
+Ipp::ProjectionCacheStats
+Ipp::projectionCacheStats() const {
+    return projectionCache_
+        ? projectionCache_->stats()
+        : ProjectionCacheStats();
+}
+
+void
+Ipp::Histogram::add(uint64_t value) {
+    // The bucket is the number of significant bits of the value.
+    ++counts[value ? 64 - __builtin_clzll(value) : 0];
+    sum += value;
+    max = std::max(max, value);
+}
 
-        // Reverse the shortest path list to have it in the right order.
-        std::reverse(coordProjection.multiShortestPath.begin(),
-                     coordProjection.multiShortestPath.end());
+void
+Ipp::Histogram::merge(Histogram const& other) {
+    for (std::size_t i(0); i < counts.size(); ++i) {
+        counts[i] += other.counts[i];
     }
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
 
-    return coordProjection;
+uint64_t
+Ipp::Histogram::count() const {
+    uint64_t count(0);
+    for (uint64_t const c : counts) {
+        count += c;
+    }
+    return count;
 }
 
-namespace {
+uint64_t
+Ipp::Histogram::quantile(double q) const {
+    // Walks up the buckets until they hold the q-quantile.
+    uint64_t const rank(std::ceil(q*count()));
+    uint64_t numValues(0);
+    for (std::size_t i(0); i < counts.size(); ++i) {
+        numValues += counts[i];
+        if (numValues && numValues >= rank) {
+            uint64_t const bucketEnd(i < 64 ? (uint64_t(1) << i) - 1
+                                            : std::numeric_limits<uint64_t>::max());
+            return std::min(bucketEnd, max);
+        }
+    }
+    return 0;
+}
 
-template<typename T>
 void
-updateChromCount(std::unordered_map<Ipp::ChromId, unsigned>& chromCount,
-                 T const& v) {
-    for (Ipp::PwalnEntry const* entry : v) {
-        ++chromCount[entry->qryChrom()];
+Ipp::Stats::merge(Stats const& other) {
+    for (auto const& [pwaln, calls] : other.getAnchorsCalls) {
+        getAnchorsCalls[pwaln] += calls;
     }
+    upstreamWalkLengths.merge(other.upstreamWalkLengths);
+    lisInputSizes.merge(other.lisInputSizes);
+    orangePushes += other.orangePushes;
+    orangePops += other.orangePops;
+    searchNodes.merge(other.searchNodes);
+    projectCoordNs.merge(other.projectCoordNs);
+    loadBlockNs.merge(other.loadBlockNs);
+    loadPwalnsNs.merge(other.loadPwalnsNs);
+}
+
+void
+Ipp::setStatsEnabled(bool enabled) {
+    statsEnabled_ = enabled;
+}
+
+void
+Ipp::setThreadPinning(bool enabled) {
+    pinThreads_ = enabled;
+}
+
+void
+Ipp::setSearchInterleave(unsigned numSearches) {
+    searchInterleave_ = std::max(numSearches, 1u);
+}
+
+Ipp::Stats
+Ipp::stats() const {
+    std::lock_guard const lockGuard(statsMutex_);
+    return stats_;
+}
+
+void
+Ipp::resetStats() {
+    std::lock_guard const lockGuard(statsMutex_);
+    stats_ = Stats();
+}
+
+void
+Ipp::setSearchLimits(SearchLimits const& searchLimits) {
+    // Sets the limits of the multi-species search.
+    defaultParams_.searchLimits = searchLimits;
 }
 
-template<typename T, typename... Args>
 void
-updateChromCount(std::unordered_map<Ipp::ChromId, unsigned>& chromCount,
-                 T const& v,
-                 Args const&... args) {
-    updateChromCount(chromCount, v);
-    updateChromCount(chromCount, args...);
+Ipp::setDefaultProjectionParams(ProjectionParams const& params) {
+    defaultParams_ = params;
+}
+
+Ipp::ProjectionParams const&
+Ipp::defaultProjectionParams() const {
+    return defaultParams_;
+}
+
+std::optional<Ipp::ChromId>
+Ipp::chromIdFromName(std::string const& chromName) const {
+    // Looks up the given chromosome name in chroms_ and returns its id.
+    auto const it(chromIds_.find(chromName));
+    if (it == chromIds_.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+std::string const&
+Ipp::chromName(ChromId chromId) const {
+    // Returns the name of the chromosome with the given id.
+    return chroms_.at(chromId);
+}
+
+std::vector<std::string> const&
+Ipp::chromNames() const {
+    // Returns the names of all the chromosomes, indexed by their ids.
+    return chroms_;
+}
+
+std::optional<Ipp::SpeciesId>
+Ipp::speciesIdFromName(std::string const& speciesName) const {
+    // Returns the id of the given species.
+    auto const it(speciesIds_.find(speciesName));
+    if (it == speciesIds_.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+Ipp::SpeciesId
+Ipp::requireSpeciesId(std::string const& speciesName) const {
+    // Like speciesIdFromName() but throws if the species is unknown.
+    std::optional<SpeciesId> const speciesId(speciesIdFromName(speciesName));
+    if (!speciesId) {
+        throw std::runtime_error(
+            format("unknown species: %s", speciesName.c_str()));
+    }
+    return *speciesId;
+}
+
+std::string const&
+Ipp::speciesName(SpeciesId speciesId) const {
+    // Returns the name of the species with the given id.
+    return species_.at(speciesId);
 }
 
-template<typename... Args>
-Ipp::ChromId
-computeMajorChrom(Args const&... args) {
-    std::unordered_map<Ipp::ChromId, unsigned> chromCount;
-    updateChromCount(chromCount, args...);
+std::vector<std::string> const&
+Ipp::speciesNames() const {
+    // Returns the names of all the species, indexed by their ids.
+    return species_;
+}
+
+double
+Ipp::projectionScore(uint32_t loc,
+                     uint32_t upBound,
+                     uint32_t downBound,
+                     ScoreScale const& scoreScale) {
+    // Anchors must be the locations of the up- and downstream anchors, not the
+    // data frame with ref and qry coordinates.
+    // The scaling factor determines how fast the function falls when moving
+    // away from an anchor.
+    // Ideally, we define a half-life X_half, i.e. at a distance of X_half, the
+    // model is at 0.5. With a scaling factor of 50 kb, X_half is at 20 kb (with
+    // 100 kb at 10 kb).
+    // score = 0.5^{minDist * genomeSizeBasis / (genomeSize * halfLifeDistance)}
+    // The exponent is computed in this order (rather than with one
+    // precomputed factor) so that the scores stay bit-identical; the shortest
+    // path search breaks ties between equal scores by their order.
+
+    uint32_t const minDist(std::min(loc - upBound, downBound - loc));
+    double const exp(((1.0d*minDist) / scoreScale.halfLifeDistance)
+                     * scoreScale.genomeSizeFactor);
+    double const score(std::pow(0.5d, exp));
+    assert(0 <= score && score <= 1);
+    return score;
+}
+
+void
+Ipp::projectionScores(uint32_t const* minDists,
+                      std::size_t n,
+                      ScoreScale const& scoreScale,
+                      double* scores) {
+    // Like projectionScore() for n distances to the closest anchor at once.
+    double const halfLifeDistance(scoreScale.halfLifeDistance);
+    double const genomeSizeFactor(scoreScale.genomeSizeFactor);
+    for (std::size_t i(0); i < n; ++i) {
+        scores[i] = std::pow(
+            0.5d, ((1.0d*minDists[i]) / halfLifeDistance) * genomeSizeFactor);
+    }
+}
+
+std::vector<Ipp::ScoreScale>
+Ipp::scoreScales(ProjectionParams const& params) const {
+    // Returns the score scale of each species (see projectionScore()).
+    std::vector<ScoreScale> ret;
+    ret.reserve(genomeSizes_.size());
+    for (uint64_t const genomeSize : genomeSizes_) {
+        ret.emplace_back((1.0d*params.genomeSizeBasis) / genomeSize,
+                         params.halfLifeDistance);
+    }
+    return ret;
+}
+
+struct Ipp::AnchorsMemo {
+    std::map<std::pair<Pwaln const*, ChromId>, AnchorsSearch> searches;
+};
+
+struct Ipp::SearchStats {
+    Stats stats;
+    // Everything but the getAnchorsCalls, which are counted below.
+    std::size_t numSpecies;
+    std::vector<uint64_t> getAnchorsCalls;
+    // Indexed by refSpecies*numSpecies + qrySpecies.
+    std::size_t currentPwaln;
+    // The getAnchorsCalls index of the pwaln that is currently searched.
+
+    explicit SearchStats(std::size_t numSpecies)
+        : numSpecies(numSpecies)
+        , getAnchorsCalls(numSpecies*numSpecies)
+        , currentPwaln(0)
+    {}
+};
+
+void
+Ipp::mergeStats(SearchStats const& searchStats) {
+    // Converts the species ids of the getAnchorsCalls to names.
+    Stats stats(searchStats.stats);
+    for (std::size_t i(0); i < searchStats.getAnchorsCalls.size(); ++i) {
+        if (searchStats.getAnchorsCalls[i]) {
+            stats.getAnchorsCalls[{species_[i / searchStats.numSpecies],
+                                   species_[i % searchStats.numSpecies]}]
+                = searchStats.getAnchorsCalls[i];
+        }
+    }
+
+    std::lock_guard const lockGuard(statsMutex_);
+    stats_.merge(stats);
+}
+
+namespace {
+
+using SpeciesSet = std::bitset<Ipp::maxNumSpecies>;
+
+uint32_t const noNode(std::numeric_limits<uint32_t>::max());
+
+struct ShortestPathNode {
+    // A <species, coords> reached by the search together with the best path
+    // to it found so far.
+    Ipp::SpeciesId species;
+    Ipp::Coords coords;
+    double score;
+    Ipp::Anchors anchors;
+    uint32_t prevNode;
+    // The index of the previous node on the path (noNode for the ref).
+    unsigned numHops;
+    // The number of hops from the ref to this node.
+    SpeciesSet speciesOnPath;
+    // The species on the path up to and including this node.
+
+    ShortestPathNode(Ipp::SpeciesId species,
+                     Ipp::Coords const& coords,
+                     double score,
+                     Ipp::Anchors const& anchors,
+                     uint32_t prevNode,
+                     unsigned numHops,
+                     SpeciesSet const& speciesOnPath)
+        : species(species)
+        , coords(coords)
+        , score(score)
+        , anchors(anchors)
+        , prevNode(prevNode)
+        , numHops(numHops)
+        , speciesOnPath(speciesOnPath)
+    {}
+};
+
+class ShortestPathTable {
+    // Open-addressing hash table (linear probing) from <species, coords> to
+    // the index of its ShortestPathNode.
+    // The slots are tagged with a generation so that clear() does not need
+    // to touch them and the memory is kept from one search to the next.
+public:
+    ShortestPathTable()
+        : slots_(initialCapacity)
+        , generation_(1)
+        , size_(0)
+    {}
+
+    void clear() {
+        size_ = 0;
+        if (++generation_ == 0) {
+            // The generation wrapped around; really clear the slots.
+            std::fill(slots_.begin(), slots_.end(), Slot());
+            generation_ = 1;
+        }
+    }
+
+    uint32_t* findOrInsert(Ipp::SpeciesId species,
+                           Ipp::Coords const& coords,
+                           bool* inserted) {
+        // Returns the node index of the given key. If the key was not in the
+        // table yet, then it is inserted and the caller needs to set the
+        // returned node index. The pointer is valid until the next insert.
+        if (2*(size_ + 1) > slots_.size()) {
+            grow();
+        }
+
+        Slot* const slot(probe(species, coords));
+        *inserted = slot->generation != generation_;
+        if (*inserted) {
+            slot->generation = generation_;
+            slot->species = species;
+            slot->coords = coords;
+            ++size_;
+        }
+        return &slot->node;
+    }
+
+private:
+    static std::size_t const initialCapacity = 256;
+
+    struct Slot {
+        uint32_t generation;
+        uint32_t node;
+        Ipp::Coords coords;
+        Ipp::SpeciesId species;
+
+        Slot()
+            : generation(0)
+            , node(noNode)
+            , species(0)
+        {}
+    };
+
+    Slot* probe(Ipp::SpeciesId species, Ipp::Coords const& coords) {
+        // Returns the slot of the given key or the empty slot where it
+        // belongs.
+        std::size_t const mask(slots_.size() - 1);
+        for (std::size_t i(hash(species, coords) & mask);; i = (i + 1) & mask) {
+            Slot& slot(slots_[i]);
+            if (slot.generation != generation_
+                || (slot.species == species && slot.coords == coords)) {
+                return &slot;
+            }
+        }
+    }
+
+    void grow() {
+        // Doubles the number of slots and re-inserts the current entries.
+        std::vector<Slot> oldSlots(2*slots_.size());
+        oldSlots.swap(slots_);
+        for (Slot const& oldSlot : oldSlots) {
+            if (oldSlot.generation == generation_) {
+                *probe(oldSlot.species, oldSlot.coords) = oldSlot;
+            }
+        }
+    }
+
+    static std::size_t hash(Ipp::SpeciesId species, Ipp::Coords const& coords) {
+        uint64_t h((uint64_t(coords.chrom) << 32 | coords.loc)
+                   * 0x9e3779b97f4a7c15ull);
+        h ^= (h >> 29) ^ (species * 0xc2b2ae3d27d4eb4full);
+        return h ^ (h >> 32);
+    }
+
+    std::vector<Slot> slots_;
+    // The number of slots is a power of 2.
+    uint32_t generation_;
+    std::size_t size_;
+};
+
+struct OrangeEntry {
+    double score;
+    int pathLength;
+    uint32_t node;
+
+    OrangeEntry(double score,
+                int pathLength,
+                uint32_t node)
+        : score(score)
+        , pathLength(pathLength)
+        , node(node)
+    {}
+
+    bool operator<(OrangeEntry const& other) const {
+        // Use negative path length as shorter paths are better than longer
+        // ones.
+        return std::forward_as_tuple(score, -pathLength)
+            < std::forward_as_tuple(other.score, -other.pathLength);
+    }
+};
+
+} // namespace
+
+struct Ipp::ProjectCoordScratch {
+    std::vector<ShortestPathNode> nodes;
+    ShortestPathTable nodeIndex;
+    std::vector<OrangeEntry> orange;
+    // Binary max-heap (std::push_heap() and std::pop_heap()).
+    std::vector<GenomicProjectionResult> projs;
+    std::vector<Anchors> anchors;
+    // The anchors of the current hop (unless they come from the AnchorsMemo).
+    std::vector<uint32_t> qryNodes;
+    std::vector<double> bestQryScores;
+    // The node that settled each qry species and the best score of each qry
+    // species so far (for multiple qry species).
+    std::vector<ScoreScale> scoreScales;
+    // The scoreScales() of the params of the current projectCoords() call.
+    std::vector<std::vector<GenomicProjectionResult>> firstHops;
+    std::vector<uint32_t> gapCoords;
+    std::vector<uint32_t> minDists;
+    std::vector<double> scores;
+    // The first hops of a chunk of sorted coords and the temporaries of
+    // their batched scoring (see projectFirstHops()).
+    std::vector<GenomicProjectionResult> const* coordFirstHops;
+    // Null or the firstHops of the coords of the current search, indexed by
+    // the pwaln of the ref species.
+    SearchStats* stats;
+    // Null unless the stats are enabled.
+
+    ProjectCoordScratch()
+        : coordFirstHops(nullptr)
+        , stats(nullptr)
+    {}
+};
+
+class Ipp::CoordSearch {
+    // Searches the shortest paths from a ref coord to each of its (distinct)
+    // qry species (Dijkstra on the <species, coords> nodes, greatest score
+    // first).
+    // The search is a state machine so that it can be suspended: If
+    // interleaving is enabled, then it stops in front of each anchor search
+    // in a large block and runs the binary search for the closest downstream
+    // anchor one probe per resume() call, prefetching the next probe. A
+    // worker that resumes several searches in turn thus has several probes
+    // in flight at any time instead of waiting for one cache miss after the
+    // other.
+public:
+    CoordSearch(Ipp const& ipp,
+                ProjectionParams const& params,
+                ProjectCoordScratch& scratch,
+                AnchorsMemo* anchorsMemo,
+                bool interleave)
+        : ipp_(ipp)
+        , params_(params)
+        , scratch_(scratch)
+        , anchorsMemo_(anchorsMemo)
+        , interleave_(interleave)
+        , refSpecies_(0)
+        , qrySpecies_(nullptr)
+        , numQrySpecies_(0)
+        , coordProjections_(nullptr)
+        , numUnsettled_(0)
+        , cutoffScore_(0)
+        , done_(true)
+        , expanding_(false)
+        , current_(0, 0, noNode)
+        , currentSpecies_(0)
+        , nxtNumHops_(0)
+        , nextPwaln_(0)
+        , suspended_(false)
+        , boundBlock_(nullptr)
+        , boundLoc_(0)
+        , boundLo_(0)
+        , boundHi_(0)
+        , boundNeighbourhood_(false)
+    {}
+
+    void start(SpeciesId refSpecies,
+               SpeciesId const* qrySpecies,
+               std::size_t numQrySpecies,
+               Coords const& refCoords,
+               CoordProjection* coordProjections) {
+        // Starts the search for refCoords. The results are written to
+        // coordProjections[i] once resume() returns false.
+        refSpecies_ = refSpecies;
+        qrySpecies_ = qrySpecies;
+        numQrySpecies_ = numQrySpecies;
+        coordProjections_ = coordProjections;
+        expanding_ = false;
+        suspended_ = false;
+        if (debug) {
+            std::cout.precision(16);
+            std::cout << std::endl;
+            std::cout << ipp_.species_[refSpecies];
+            for (std::size_t i(0); i < numQrySpecies; ++i) {
+                std::cout << " " << ipp_.species_[qrySpecies[i]];
+            }
+            std::cout << " " << refCoords.chrom << ":" << refCoords.loc
+                      << std::endl;
+        }
+
+        for (std::size_t i(0); i < numQrySpecies; ++i) {
+            coordProjections[i] = CoordProjection();
+        }
+        done_ = !numQrySpecies;
+        if (done_) {
+            return;
+        }
+
+        qrySpeciesSet_.reset();
+        for (std::size_t i(0); i < numQrySpecies; ++i) {
+            qrySpeciesSet_.set(qrySpecies[i]);
+        }
+
+        // The nodes are referred to by their index in the nodes vector.
+        std::vector<ShortestPathNode>& nodes(scratch_.nodes);
+        std::vector<OrangeEntry>& orange(scratch_.orange); // greatest first.
+        nodes.clear();
+        scratch_.nodeIndex.clear();
+        orange.clear();
+
+        bool inserted;
+        *scratch_.nodeIndex.findOrInsert(refSpecies, refCoords, &inserted)
+            = nodes.size();
+        nodes.emplace_back(refSpecies,
+                           refCoords,
+                           1.0,
+                           Ipp::Anchors(),
+                           noNode,
+                           0,
+                           SpeciesSet().set(refSpecies));
+        orange.emplace_back(1.0, 0, 0);
+        if (scratch_.stats) {
+            ++scratch_.stats->stats.orangePushes;
+        }
+
+        scratch_.qryNodes.assign(numQrySpecies, noNode);
+        scratch_.bestQryScores.assign(numQrySpecies, 0);
+        numUnsettled_ = numQrySpecies;
+        cutoffScore_ = 0;
+    }
+
+    bool resume() {
+        // Continues the search. Returns true if it is suspended (and needs
+        // to be resumed again) or false once the results are written.
+        if (done_) {
+            return false;
+        }
+        if (suspended_) {
+            if (stepUpperBound()) {
+                return true;
+            }
+            suspended_ = false;
+            hop(boundLo_);
+        }
+
+        while (true) {
+            if (expanding_) {
+                // Follow the pwalns of the current node.
+                auto const& pwalns(ipp_.pwalns_[currentSpecies_]);
+                while (nextPwaln_ < pwalns.size()) {
+                    auto const& [nxtSpecies, pwaln] = pwalns[nextPwaln_];
+                    if (speciesOnPath_[nxtSpecies]) {
+                        // Don't visit a species twice on the same path.
+                        ++nextPwaln_;
+                        continue;
+                    }
+                    if (interleave_ && startUpperBound(pwaln)) {
+                        suspended_ = true;
+                        return true;
+                    }
+                    hop(noUpperBoundHint);
+                }
+                expanding_ = false;
+            }
+            if (!popNode()) {
+                finish();
+                return false;
+            }
+        }
+    }
+
+private:
+    static constexpr bool debug = false;
+    static constexpr std::size_t minInterleavedBlockSize = 4096;
+    // Smaller blocks tend to be in the cache anyway.
+
+    std::size_t qryIndex(SpeciesId species) const {
+        // The index of the given qry species in qrySpecies.
+        return std::find(qrySpecies_, qrySpecies_ + numQrySpecies_, species)
+            - qrySpecies_;
+    }
+
+    void updateCutoffScore() {
+        // The lowest best score of the qry species that are not settled yet
+        // (for the early cutoff). Paths with a lower score cannot improve any
+        // result.
+        cutoffScore_ = std::numeric_limits<double>::max();
+        for (std::size_t i(0); i < numQrySpecies_; ++i) {
+            if (scratch_.qryNodes[i] == noNode) {
+                cutoffScore_ = std::min(cutoffScore_, scratch_.bestQryScores[i]);
+            }
+        }
+    }
+
+    bool popNode() {
+        // Takes the next node from the priority queue, which is then
+        // expanded. Returns false if the search is complete.
+        std::vector<ShortestPathNode>& nodes(scratch_.nodes);
+        std::vector<OrangeEntry>& orange(scratch_.orange);
+        SearchStats* const stats(scratch_.stats);
+        while (!orange.empty()) {
+            std::pop_heap(orange.begin(), orange.end());
+            current_ = orange.back();
+            orange.pop_back();
+            if (stats) {
+                ++stats->stats.orangePops;
+            }
+
+            if (nodes[current_.node].score > current_.score) {
+                continue;
+                // The current <species,coord> was already reached by a faster
+                // path, ignore this path and go to the next species.
+            }
+
+            // Copy what is needed since nodes might grow below.
+            currentSpecies_ = nodes[current_.node].species;
+            currentCoords_ = nodes[current_.node].coords;
+            if (debug) {
+                std::cout << "- " << ipp_.species_[currentSpecies_] << " "
+                          << current_.score << " "
+                          << currentCoords_.chrom << ":" << currentCoords_.loc
+                          << std::endl;
+            }
+
+            if (qrySpeciesSet_[currentSpecies_]) {
+                std::size_t const i(qryIndex(currentSpecies_));
+                if (scratch_.qryNodes[i] == noNode) {
+                    // The first node of a qry species is its shortest path.
+                    scratch_.qryNodes[i] = current_.node;
+                    if (!--numUnsettled_) {
+                        return false;
+                        // All qry species reached, stop.
+                    }
+                    updateCutoffScore();
+                }
+                // Otherwise continue as an intermediate species of the paths
+                // to the other qry species.
+            }
+
+            nxtNumHops_ = nodes[current_.node].numHops + 1;
+            SearchLimits const& searchLimits(params_.searchLimits);
+            if (searchLimits.maxPathLength
+                && nxtNumHops_ > searchLimits.maxPathLength) {
+                continue;
+                // Don't extend the path beyond maxPathLength hops.
+            }
+
+            // Avoid visiting the species that are traversed on the current
+            // path again.
+            speciesOnPath_ = nodes[current_.node].speciesOnPath;
+            scoreScale_ = scratch_.scoreScales[currentSpecies_];
+            nextPwaln_ = 0;
+            expanding_ = true;
+            return true;
+        }
+        return false;
+    }
+
+    bool startUpperBound(Pwaln const& pwaln) {
+        // Prepares the binary search for the closest downstream anchor of
+        // the current coords in the given pwaln and prefetches its first
+        // probe. Returns false if the anchor search does not need it (or
+        // gains nothing from it), then it runs right away.
+        if (anchorsMemo_) {
+            return false;
+        }
+        auto const pwalnBlockIt(pwaln.find(currentCoords_.chrom));
+        if (pwalnBlockIt == pwaln.end()) {
+            return false;
+        }
+        PwalnBlock const& block(pwalnBlockIt->second);
+        if (!block.loaded.load(std::memory_order_acquire)
+            || block.refStartIndex
+            || (block.anchorTable
+                && params_.topn == anchorTablesParams.topn
+                && params_.minn == anchorTablesParams.minn)) {
+            // Loaded in lazy mode, searched in the index or precomputed.
+            return false;
+        }
+
+        boundBlock_ = &block;
+        boundLoc_ = currentCoords_.loc;
+        boundLo_ = 0;
+        boundNeighbourhood_ = false;
+        return block.visitEntries([&](auto const& entries) {
+            boundHi_ = entries.size();
+            if (boundHi_ < minInterleavedBlockSize) {
+                return false;
+            }
+            entries.prefetch(boundLo_ + (boundHi_ - boundLo_) / 2);
+            return true;
+        });
+    }
+
+    bool stepUpperBound() {
+        // One step of the binary search (the same as upperBound()). Returns
+        // whether it needs more steps, after the prefetch of the next probe.
+        return boundBlock_->visitEntries([&](auto const& entries) {
+            std::size_t const mid(boundLo_ + (boundHi_ - boundLo_) / 2);
+            if (entries.refStart(mid) <= boundLoc_) {
+                boundLo_ = mid + 1;
+            } else {
+                boundHi_ = mid;
+            }
+            if (boundLo_ < boundHi_) {
+                entries.prefetch(boundLo_ + (boundHi_ - boundLo_) / 2);
+                return true;
+            }
+            if (!boundNeighbourhood_) {
+                // Before the anchor search itself, prefetch the topn entries
+                // on both sides that it walks over (one cache line of
+                // entries at a time).
+                boundNeighbourhood_ = true;
+                std::size_t const first(boundLo_ - std::min<std::size_t>(
+                    boundLo_, params_.topn));
+                std::size_t const last(std::min(boundLo_ + params_.topn,
+                                                entries.size()));
+                for (std::size_t i(first); i < last; i += 4) {
+                    entries.prefetch(i);
+                }
+                return true;
+            }
+            return false;
+        });
+    }
+
+    void hop(std::size_t upperBoundHint) {
+        // Projects the current coords with the pwaln nextPwaln_ and updates
+        // the nodes that are reached with it. Moves on to the next pwaln.
+        auto const& [nxtSpecies, pwaln] = ipp_.pwalns_[currentSpecies_][nextPwaln_];
+        ++nextPwaln_;
+        std::vector<ShortestPathNode>& nodes(scratch_.nodes);
+        std::vector<GenomicProjectionResult>& projs(scratch_.projs);
+        SearchStats* const stats(scratch_.stats);
+
+        if (debug) {
+            std::cout << "--> " << ipp_.species_[nxtSpecies] << std::endl;
+        }
+
+        std::vector<GenomicProjectionResult> const* hopProjs(&projs);
+        if (!current_.node && scratch_.coordFirstHops) {
+            // The hop from the ref coords was projected with those of the
+            // whole chunk.
+            hopProjs = &scratch_.coordFirstHops[nextPwaln_ - 1];
+        } else {
+            if (stats) {
+                stats->currentPwaln
+                    = currentSpecies_*stats->numSpecies + nxtSpecies;
+            }
+            ipp_.projectGenomicLocation(pwaln,
+                                        scoreScale_,
+                                        currentCoords_,
+                                        params_,
+                                        anchorsMemo_,
+                                        stats,
+                                        upperBoundHint,
+                                        &scratch_.anchors,
+                                        &projs);
+        }
+        if (hopProjs->empty()) {
+            return;
+            // No path was found.
+        }
+
+        bool const nxtIsQry(qrySpeciesSet_[nxtSpecies]);
+        if (currentSpecies_ == refSpecies_ && nxtIsQry) {
+            // Direct projection.
+            coordProjections_[qryIndex(nxtSpecies)].direct = (*hopProjs)[0];
+        }
+
+        SearchLimits const& searchLimits(params_.searchLimits);
+        for (GenomicProjectionResult const& proj : *hopProjs) {
+            double const nxtScore(current_.score * proj.score);
+            if (nxtScore < searchLimits.minScore
+                || (searchLimits.earlyCutoff && nxtScore < cutoffScore_)) {
+                continue;
+                // Pruned. Since the projection scores are <= 1, the score of
+                // a path never grows with more hops.
+            }
+
+            bool inserted;
+            uint32_t* const nxtNode(
+                scratch_.nodeIndex.findOrInsert(nxtSpecies,
+                                                proj.nextCoords,
+                                                &inserted));
+            if (inserted) {
+                *nxtNode = nodes.size();
+                nodes.emplace_back(nxtSpecies,
+                                   proj.nextCoords,
+                                   nxtScore,
+                                   proj.anchors,
+                                   current_.node,
+                                   nxtNumHops_,
+                                   SpeciesSet(speciesOnPath_).set(nxtSpecies));
+            } else if (nodes[*nxtNode].score < nxtScore) {
+                // There was already a node but it had a worse score
+                // -> replace.
+                ShortestPathNode& node(nodes[*nxtNode]);
+                node.score = nxtScore;
+                node.anchors = proj.anchors;
+                node.prevNode = current_.node;
+                node.numHops = nxtNumHops_;
+                node.speciesOnPath = SpeciesSet(speciesOnPath_).set(nxtSpecies);
+            } else {
+                continue;
+            }
+
+            if (nxtIsQry) {
+                std::size_t const i(qryIndex(nxtSpecies));
+                if (scratch_.qryNodes[i] == noNode
+                    && scratch_.bestQryScores[i] < nxtScore) {
+                    scratch_.bestQryScores[i] = nxtScore;
+                    updateCutoffScore();
+                }
+            }
+
+            // Only increase the path length if we don't reach a query species
+            // as the next hop. This ensures that for the same score we prefer
+            // the path that reaches the qry species first.
+            int const nxtPathLength(!nxtIsQry
+                                    ? current_.pathLength + 1
+                                    : current_.pathLength);
+            scratch_.orange.emplace_back(nxtScore, nxtPathLength, *nxtNode);
+            std::push_heap(scratch_.orange.begin(), scratch_.orange.end());
+            if (stats) {
+                ++stats->stats.orangePushes;
+            }
+        }
+    }
+
+    void finish() {
+        // Writes the shortest paths to the coordProjections.
+        done_ = true;
+        std::vector<ShortestPathNode> const& nodes(scratch_.nodes);
+        if (scratch_.stats) {
+            scratch_.stats->stats.searchNodes.add(nodes.size());
+        }
+
+        for (std::size_t q(0); q < numQrySpecies_; ++q) {
+            if (scratch_.qryNodes[q] == noNode) {
+                continue;
+            }
+
+            // Backtrace the shortest path from the reference to the given
+            // target species (in reversed order).
+            ShortestPath& shortestPath(coordProjections_[q].multiShortestPath);
+            for (uint32_t i(scratch_.qryNodes[q]); i != noNode;
+                 i = nodes[i].prevNode) {
+                ShortestPathNode const& node(nodes[i]);
+                shortestPath.emplace_back(ipp_.species_[node.species],
+                                          node.coords,
+                                          node.score,
+                                          node.anchors);
+            }
+
+            // Reverse the shortest path list to have it in the right order.
+            std::reverse(shortestPath.begin(), shortestPath.end());
+        }
+    }
+
+    Ipp const& ipp_;
+    ProjectionParams const& params_;
+    ProjectCoordScratch& scratch_;
+    AnchorsMemo* const anchorsMemo_;
+    bool const interleave_;
+
+    SpeciesId refSpecies_;
+    SpeciesId const* qrySpecies_;
+    std::size_t numQrySpecies_;
+    CoordProjection* coordProjections_;
+    SpeciesSet qrySpeciesSet_;
+    std::size_t numUnsettled_;
+    double cutoffScore_;
+    bool done_;
+
+    bool expanding_;
+    // The node of current_ is expanded, i.e. its pwalns from nextPwaln_ on
+    // are still to be followed.
+    OrangeEntry current_;
+    SpeciesId currentSpecies_;
+    Coords currentCoords_;
+    unsigned nxtNumHops_;
+    SpeciesSet speciesOnPath_;
+    ScoreScale scoreScale_;
+    std::size_t nextPwaln_;
+
+    bool suspended_;
+    // The binary search for the upper bound of boundLoc_ in boundBlock_ is
+    // in progress; the upper bound is in [boundLo_, boundHi_].
+    PwalnBlock const* boundBlock_;
+    uint32_t boundLoc_;
+    std::size_t boundLo_;
+    std::size_t boundHi_;
+    bool boundNeighbourhood_;
+    // The entries around the upper bound were prefetched.
+};
+
+namespace {
+
+class JobRange {
+    // The range of job indices [begin, end) that is owned by one worker. The
+    // owner takes chunks from the front, the other workers steal from the
+    // back.
+public:
+    JobRange()
+        : begin_(0)
+        , end_(0)
+    {}
+
+    void assign(std::size_t begin, std::size_t end) {
+        std::lock_guard const lockGuard(mutex_);
+        begin_ = begin;
+        end_ = end;
+    }
+
+    bool take(std::size_t maxChunkSize, std::size_t* begin, std::size_t* end) {
+        // Takes up to maxChunkSize jobs from the front.
+        std::lock_guard const lockGuard(mutex_);
+        if (begin_ == end_) {
+            return false;
+        }
+        *begin = begin_;
+        *end = begin_ + std::min(maxChunkSize, end_ - begin_);
+        begin_ = *end;
+        return true;
+    }
+
+    bool steal(std::size_t* begin, std::size_t* end) {
+        // Takes the back half of the remaining jobs.
+        std::lock_guard const lockGuard(mutex_);
+        if (begin_ == end_) {
+            return false;
+        }
+        *begin = end_ - (end_ - begin_ + 1) / 2;
+        *end = end_;
+        end_ = *begin;
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    std::size_t begin_;
+    std::size_t end_;
+};
+
+template<typename Projection>
+using ResultBatch = std::vector<std::pair<Ipp::Coords, Projection>>;
+
+template<typename Projection>
+class ResultQueue {
+    // Bounded queue that passes the result batches from the workers to the
+    // thread that calls the callback.
+public:
+    ResultQueue(std::size_t capacity, unsigned numProducers)
+        : capacity_(capacity)
+        , numProducers_(numProducers)
+        , closed_(false)
+    {}
+
+    bool push(ResultBatch<Projection>&& batch) {
+        // Waits while the queue is full. Returns false if the queue was
+        // closed (and the batch was dropped).
+        std::unique_lock lock(mutex_);
+        notFull_.wait(lock, [&]() {
+            return closed_ || batches_.size() < capacity_;
+        });
+        if (closed_) {
+            return false;
+        }
+        batches_.push_back(std::move(batch));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    bool pop(ResultBatch<Projection>* batch) {
+        // Waits until a batch is available. Returns false once the queue was
+        // closed or all producers are done and the queue is empty.
+        std::unique_lock lock(mutex_);
+        notEmpty_.wait(lock, [&]() {
+            return closed_ || !batches_.empty() || !numProducers_;
+        });
+        if (closed_ || batches_.empty()) {
+            return false;
+        }
+        *batch = std::move(batches_.front());
+        batches_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    void producerDone() {
+        std::lock_guard const lockGuard(mutex_);
+        --numProducers_;
+        notEmpty_.notify_all();
+    }
+
+    void close() {
+        // Drops the queued batches and wakes up all waiting threads.
+        std::lock_guard const lockGuard(mutex_);
+        closed_ = true;
+        batches_.clear();
+        notFull_.notify_all();
+        notEmpty_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
+    std::deque<ResultBatch<Projection>> batches_;
+    std::size_t const capacity_;
+    unsigned numProducers_;
+    bool closed_;
+};
+
+Ipp::CoordProjection*
+coordProjectionSlots(Ipp::CoordProjection* projection, std::size_t) {
+    // Returns where the projections to the qry species of one job go.
+    return projection;
+}
+
+Ipp::CoordProjection*
+coordProjectionSlots(std::vector<Ipp::CoordProjection>* projections,
+                     std::size_t numQrySpecies) {
+    projections->resize(numQrySpecies);
+    return projections->data();
+}
+
+std::vector<Ipp::Coords>
+sortedCoords(std::vector<Ipp::Coords> const& coords) {
+    // Returns a sorted copy of the given coords.
+    std::vector<Ipp::Coords> ret(coords);
+    std::sort(ret.begin(), ret.end(),
+              [](Ipp::Coords const& lhs, Ipp::Coords const& rhs) {
+                  return std::tie(lhs.chrom, lhs.loc)
+                      < std::tie(rhs.chrom, rhs.loc);
+              });
+    return ret;
+}
+
+} // namespace
+
+void
+Ipp::projectCoords(
+    std::string const& refSpecies,
+    std::string const& qrySpecies,
+    std::vector<Coords> const& refCoords,
+    unsigned const nThreads,
+    ProjectionParams const& params,
+    OnProjectCoordsJobDoneCallback const& onJobDoneCallback) {
+    // Projects each of the given refCoords.
+    // If nThreads > 1 then that many worker threads are started.
+    // For each completed job the onJobDoneCallback() is called with the result
+    // from the calling thread.
+    SpeciesId const refSpeciesId(requireSpeciesId(refSpecies));
+    SpeciesId const qrySpeciesId(requireSpeciesId(qrySpecies));
+    cancel_ = false;
+    projectCoordsImpl<CoordProjection>(
+        refCoords,
+        nThreads,
+        params,
+        false,
+        refSpeciesId,
+        {qrySpeciesId},
+        cancel_,
+        onJobDoneCallback);
+}
+
+void
+Ipp::projectCoords(
+    std::string const& refSpecies,
+    std::string const& qrySpecies,
+    std::vector<Coords> const& refCoords,
+    unsigned const nThreads,
+    bool const sorted,
+    ProjectionParams const& params,
+    std::atomic<bool> const& cancelFlag,
+    OnProjectCoordsJobDoneCallback const& onJobDoneCallback) {
+    // Projects the refCoords like projectCoords() or projectCoordsSorted()
+    // but is cancelled through the given flag.
+    SpeciesId const refSpeciesId(requireSpeciesId(refSpecies));
+    SpeciesId const qrySpeciesId(requireSpeciesId(qrySpecies));
+    projectCoordsImpl<CoordProjection>(
+        sorted ? sortedCoords(refCoords) : refCoords,
+        nThreads,
+        params,
+        sorted,
+        refSpeciesId,
+        {qrySpeciesId},
+        cancelFlag,
+        onJobDoneCallback);
+}
+
+void
+Ipp::projectCoordsSorted(
+    std::string const& refSpecies,
+    std::string const& qrySpecies,
+    std::vector<Coords> const& refCoords,
+    unsigned const nThreads,
+    ProjectionParams const& params,
+    OnProjectCoordsJobDoneCallback const& onJobDoneCallback) {
+    // Projects the refCoords in sorted order.
+    // Each worker takes a run of neighbouring coords at a time and reuses the
+    // anchor searches between them. The results are delivered as for
+    // projectCoords().
+    SpeciesId const refSpeciesId(requireSpeciesId(refSpecies));
+    SpeciesId const qrySpeciesId(requireSpeciesId(qrySpecies));
+    cancel_ = false;
+    projectCoordsImpl<CoordProjection>(
+        sortedCoords(refCoords),
+        nThreads,
+        params,
+        true,
+        refSpeciesId,
+        {qrySpeciesId},
+        cancel_,
+        onJobDoneCallback);
+}
+
+void
+Ipp::projectCoordsMulti(
+    std::string const& refSpecies,
+    std::vector<std::string> const& qrySpecies,
+    std::vector<Coords> const& refCoords,
+    unsigned const nThreads,
+    bool const sorted,
+    ProjectionParams const& params,
+    OnProjectCoordsMultiJobDoneCallback const& onJobDoneCallback) {
+    // Projects the given list of refCoords to all the qrySpecies (in sorted
+    // order and with reuse of the anchor searches if sorted is set). The
+    // results are delivered as for projectCoords().
+    SpeciesId const refSpeciesId(requireSpeciesId(refSpecies));
+    std::vector<SpeciesId> qrySpeciesIds;
+    SpeciesSet seen;
+    for (std::string const& name : qrySpecies) {
+        SpeciesId const speciesId(requireSpeciesId(name));
+        if (seen[speciesId]) {
+            throw std::runtime_error(
+                format("duplicate qry species: %s", name.c_str()));
+        }
+        seen.set(speciesId);
+        qrySpeciesIds.push_back(speciesId);
+    }
+
+    cancel_ = false;
+    projectCoordsImpl<std::vector<CoordProjection>>(
+        sorted ? sortedCoords(refCoords) : refCoords,
+        nThreads,
+        params,
+        sorted,
+        refSpeciesId,
+        qrySpeciesIds,
+        cancel_,
+        onJobDoneCallback);
+}
+
+template<typename Projection>
+void
+Ipp::projectCoordsImpl(
+    std::vector<Coords> const& jobs,
+    unsigned nThreads,
+    ProjectionParams const& params,
+    bool const memoizeAnchors,
+    SpeciesId refSpecies,
+    std::vector<SpeciesId> const& qrySpecies,
+    std::atomic<bool> const& cancelFlag,
+    std::function<void(Coords const&, Projection const&)> const&
+        onJobDoneCallback) {
+    // Projects the jobs with a CoordSearch each.
+    // Each worker owns an equal share of the jobs and takes chunks of
+    // consecutive jobs from it. Workers that run out of jobs steal half of
+    // the remaining jobs of another worker. The results of a chunk are
+    // passed to the calling thread which calls the onJobDoneCallback(). That
+    // way the workers never wait for the callback (unless the result queue
+    // is full).
+    // If memoizeAnchors is set, then each worker reuses its anchor searches
+    // from one job to the next and projects the first hops of a chunk in one
+    // go (see projectFirstHops()). Otherwise each worker interleaves the
+    // searches of up to searchInterleave_ jobs of its chunk.
+    nThreads = std::max(nThreads, 1u);
+
+    if (params.topn == 0 || params.halfLifeDistance == 0) {
+        throw std::runtime_error("topn and halfLifeDistance must be > 0");
+    }
+
+    // Switch the projection cache to the params unless other projections
+    // are running (then this one bypasses the cache if the params differ).
+    // Pinned workers take the lowest worker CPUs that no other running
+    // projection is pinned to, so that concurrent projections don't pile
+    // onto the same cores.
+    bool const pinThreads(pinThreads_ && nThreads > 1);
+    unsigned firstWorkerCpu(0);
+    {
+        std::lock_guard const lockGuard(runningProjectionsMutex_);
+        if (projectionCache_ && numRunningProjections_ == 0) {
+            projectionCache_->useParams(params);
+        }
+        ++numRunningProjections_;
+        if (pinThreads) {
+            for (auto const& [first, num] : pinnedWorkerCpus_) {
+                if (firstWorkerCpu + nThreads <= first) {
+                    break;
+                }
+                firstWorkerCpu = std::max(firstWorkerCpu, first + num);
+            }
+            pinnedWorkerCpus_.emplace(firstWorkerCpu, nThreads);
+        }
+    }
+    class RunningProjection {
+        // Unregisters the projection (and its worker CPUs) when it ends.
+    public:
+        RunningProjection(Ipp& ipp, std::optional<unsigned> firstWorkerCpu)
+            : ipp_(ipp)
+            , firstWorkerCpu_(firstWorkerCpu)
+        {}
+        ~RunningProjection() {
+            std::lock_guard const lockGuard(ipp_.runningProjectionsMutex_);
+            --ipp_.numRunningProjections_;
+            if (firstWorkerCpu_) {
+                ipp_.pinnedWorkerCpus_.erase(*firstWorkerCpu_);
+            }
+        }
+
+    private:
+        Ipp& ipp_;
+        std::optional<unsigned> const firstWorkerCpu_;
+    };
+    RunningProjection const runningProjection(
+        *this,
+        pinThreads ? std::optional<unsigned>(firstWorkerCpu) : std::nullopt);
+
+    // Use chunks small enough that the load is balanced between the threads
+    // but large enough to keep the synchronization overhead low (and for
+    // memoizeAnchors to be effective).
+    std::size_t const maxChunkSize(256);
+    std::size_t const numChunksPerThread(16);
+    std::size_t const numChunks(nThreads*numChunksPerThread);
+    std::size_t const chunkSize(
+        std::clamp<std::size_t>((jobs.size() + numChunks - 1) / numChunks,
+                                1,
+                                maxChunkSize));
+
+    std::vector<JobRange> jobRanges(nThreads);
+    for (unsigned i(0); i < nThreads; ++i) {
+        jobRanges[i].assign(jobs.size()*i / nThreads,
+                            jobs.size()*(i+1) / nThreads);
+    }
+
+    ResultQueue<Projection> resultQueue(2*nThreads, nThreads);
+    std::mutex exceptionMutex;
+    std::exception_ptr workerException;
+    std::atomic<bool> abort(false);
+
+    auto const nextChunk = [&](unsigned workerId,
+                               std::size_t* begin,
+                               std::size_t* end) {
+        // Gets the next chunk of jobs for the given worker.
+        if (jobRanges[workerId].take(chunkSize, begin, end)) {
+            return true;
+        }
+        for (unsigned i(1); i < nThreads; ++i) {
+            JobRange& victim(jobRanges[(workerId + i) % nThreads]);
+            if (victim.steal(begin, end)) {
+                jobRanges[workerId].assign(*begin, *end);
+                return jobRanges[workerId].take(chunkSize, begin, end);
+            }
+        }
+        // All jobs are taken.
+        return false;
+    };
+
+    std::vector<ScoreScale> const scoreScales(this->scoreScales(params));
+    std::size_t const numSlots(memoizeAnchors
+                               ? 1
+                               : std::max(searchInterleave_, 1u));
+    std::size_t const noJob(std::numeric_limits<std::size_t>::max());
+
+    auto const worker = [&](unsigned workerId) {
+        try {
+            SearchStats searchStats(species_.size());
+            AnchorsMemo anchorsMemo;
+            AnchorsMemo* const anchorsMemoPtr(memoizeAnchors ? &anchorsMemo
+                                                             : nullptr);
+            // One search (and its scratch) per slot.
+            std::vector<ProjectCoordScratch> scratches(numSlots);
+            std::vector<CoordSearch> searches;
+            searches.reserve(numSlots);
+            for (ProjectCoordScratch& scratch : scratches) {
+                scratch.scoreScales = scoreScales;
+                if (statsEnabled_) {
+                    scratch.stats = &searchStats;
+                }
+                searches.emplace_back(*this,
+                                      params,
+                                      scratch,
+                                      anchorsMemoPtr,
+                                      numSlots > 1);
+            }
+            std::vector<std::size_t> slotJobs(numSlots, noJob);
+            std::vector<uint64_t> slotNs(numSlots, 0);
+            // The job of each slot and the time spent on its search.
+
+            std::size_t begin;
+            std::size_t end;
+            while (!cancelFlag && !abort
+                   && nextChunk(workerId, &begin, &end)) {
+                std::vector<Projection> projections(end - begin);
+                std::vector<bool> jobsDone(end - begin, false);
+                std::size_t nextJob(begin);
+                std::size_t numDelivered(0);
+                if (memoizeAnchors) {
+                    projectFirstHops(refSpecies,
+                                     &jobs[begin],
+                                     end - begin,
+                                     params,
+                                     anchorsMemoPtr,
+                                     &scratches[0]);
+                }
+
+                auto const resume = [&](std::size_t slot) {
+                    // Resumes the search of the slot. Returns false once it
+                    // is done.
+                    if (!statsEnabled_) {
+                        return searches[slot].resume();
+                    }
+                    auto const startTime(std::chrono::steady_clock::now());
+                    bool const suspended(searches[slot].resume());
+                    slotNs[slot] += elapsedNs(startTime);
+                    return suspended;
+                };
+                auto const jobDone = [&](std::size_t slot) {
+                    std::size_t const i(slotJobs[slot]);
+                    slotJobs[slot] = noJob;
+                    jobsDone[i - begin] = true;
+                    if (statsEnabled_) {
+                        searchStats.stats.projectCoordNs.add(slotNs[slot]);
+                    }
+                    if (nThreads == 1) {
+                        // The worker runs on the calling thread: Deliver the
+                        // results in order as soon as possible.
+                        for (; numDelivered < jobsDone.size()
+                             && jobsDone[numDelivered]; ++numDelivered) {
+                            onJobDoneCallback(jobs[begin + numDelivered],
+                                              projections[numDelivered]);
+                        }
+                    }
+                };
+                auto const startJob = [&](std::size_t slot) {
+                    // Starts the next job of the chunk in the slot (if any).
+                    while (nextJob < end && !cancelFlag && !abort) {
+                        std::size_t const i(nextJob++);
+                        slotJobs[slot] = i;
+                        slotNs[slot] = 0;
+                        if (memoizeAnchors) {
+                            scratches[slot].coordFirstHops
+                                = scratches[slot].firstHops.data()
+                                + (i - begin)*pwalns_[refSpecies].size();
+                        }
+                        searches[slot].start(
+                            refSpecies,
+                            qrySpecies.data(),
+                            qrySpecies.size(),
+                            jobs[i],
+                            coordProjectionSlots(&projections[i - begin],
+                                                 qrySpecies.size()));
+                        if (resume(slot)) {
+                            return;
+                        }
+                        jobDone(slot);
+                    }
+                };
+
+                // Resume the searches in turn until all are done.
+                for (std::size_t slot(0); slot < numSlots; ++slot) {
+                    startJob(slot);
+                }
+                for (bool active(true); active;) {
+                    active = false;
+                    for (std::size_t slot(0); slot < numSlots; ++slot) {
+                        if (slotJobs[slot] == noJob) {
+                            continue;
+                        }
+                        if (!resume(slot)) {
+                            jobDone(slot);
+                            startJob(slot);
+                        }
+                        active = active || slotJobs[slot] != noJob;
+                    }
+                }
+
+                if (nThreads > 1) {
+                    // The jobs from nextJob on were not started (cancelled).
+                    ResultBatch<Projection> batch;
+                    batch.reserve(nextJob - begin);
+                    for (std::size_t i(begin); i < nextJob; ++i) {
+                        batch.emplace_back(jobs[i],
+                                           std::move(projections[i - begin]));
+                    }
+                    if (!resultQueue.push(std::move(batch))) {
+                        // Aborted.
+                        break;
+                    }
+                }
+            }
+            if (statsEnabled_) {
+                mergeStats(searchStats);
+            }
+        } catch (...) {
+            if (nThreads == 1) {
+                // The exception comes from this thread anyway.
+                throw;
+            }
+
+            std::lock_guard const lockGuard(exceptionMutex);
+            if (!workerException) {
+                workerException = std::current_exception();
+            }
+            abort = true;
+            resultQueue.close();
+        }
+        resultQueue.producerDone();
+    };
+
+    if (nThreads == 1) {
+        // Just execute the worker in this thread.
+        worker(0);
+        return;
+    }
+
+    // Create the threads.
+    std::vector<std::thread> threads;
+    for (unsigned i(0); i < nThreads; ++i) {
+        threads.emplace_back([&worker, i, pinThreads, firstWorkerCpu]() {
+            if (pinThreads) {
+                pinThisThread(
+                    NumaTopology::get().workerCpu(firstWorkerCpu + i));
+            }
+            worker(i);
+        });
+    }
+
+    // Deliver the results.
+    std::exception_ptr callbackException;
+    try {
+        ResultBatch<Projection> batch;
+        while (resultQueue.pop(&batch)) {
+            for (auto const& [refCoord, coordProjection] : batch) {
+                onJobDoneCallback(refCoord, coordProjection);
+            }
+        }
+    } catch (...) {
+        // Stop the workers.
+        callbackException = std::current_exception();
+        abort = true;
+        resultQueue.close();
+    }
+
+    // Wait for the threads to complete.
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Forward any exception that occured in a worker or the callback.
+    if (workerException) {
+        std::rethrow_exception(workerException);
+    }
+    if (callbackException) {
+        std::rethrow_exception(callbackException);
+    }
+}
+
+void
+Ipp::cancel() {
+    // Cancel ongoing project_coords() call.
+    cancel_ = true;
+}
+
+bool
+Ipp::isCancelled() const {
+    // Returns whether cancel() was called since the start of the last
+    // project_coords() call.
+    return cancel_;
+}
+
+void
+Ipp::projectGenomicLocation(Pwaln const& pwaln,
+                            ScoreScale const& scoreScale,
+                            Coords const& refCoords,
+                            ProjectionParams const& params,
+                            AnchorsMemo* anchorsMemo,
+                            SearchStats* stats,
+                            std::size_t upperBoundHint,
+                            std::vector<Anchors>* anchorsBuffer,
+                            std::vector<GenomicProjectionResult>* projs) const {
+    std::vector<GenomicProjectionResult>& ret(*projs);
+    ret.clear();
+
+    if (projectionCache_ && projectionCache_->hasParams(params)) {
+        if (projectionCache_->lookup(&pwaln, refCoords, projs)) {
+            return;
+        }
+        projectGenomicLocationUncached(pwaln,
+                                       scoreScale,
+                                       refCoords,
+                                       params,
+                                       anchorsMemo,
+                                       stats,
+                                       upperBoundHint,
+                                       anchorsBuffer,
+                                       projs);
+        projectionCache_->insert(&pwaln, refCoords, *projs);
+    } else {
+        projectGenomicLocationUncached(pwaln,
+                                       scoreScale,
+                                       refCoords,
+                                       params,
+                                       anchorsMemo,
+                                       stats,
+                                       upperBoundHint,
+                                       anchorsBuffer,
+                                       projs);
+    }
+}
+
+void
+Ipp::projectGenomicLocationUncached(
+    Pwaln const& pwaln,
+    ScoreScale const& scoreScale,
+    Coords const& refCoords,
+    ProjectionParams const& params,
+    AnchorsMemo* anchorsMemo,
+    SearchStats* stats,
+    std::size_t upperBoundHint,
+    std::vector<Anchors>* anchorsBuffer,
+    std::vector<GenomicProjectionResult>* projs) const {
+    std::vector<GenomicProjectionResult>& ret(*projs);
+    ret.clear();
+
+    // Get the anchors; this either returns an empty list in case no anchors
+    // were found, a list with only one entry for the closest up- and downstream
+    // anchors, or a list of possibly many direct alignments.
+    std::vector<Anchors> const& anchorsList(
+        getAnchors(pwaln, refCoords, params, anchorsMemo, stats,
+                   upperBoundHint, anchorsBuffer));
+    if (anchorsList.empty()) {
+        // If no or only one anchor is found because of border region, return 0
+        // score and empty coordinate string.
+        return;
+    }
+
+    uint32_t const refLoc(refCoords.loc);
+
+    if (anchorsList[0].upstream == anchorsList[0].downstream) {
+        // refLoc lies on an aligment (or multiple).
+        ret.reserve(anchorsList.size());
+        for (Anchors const& anchors : anchorsList) {
+            ret.emplace_back(1.0d,
+                             Coords(anchors.upstream.qryChrom(),
+                                    interpolateQryLoc(anchors, refLoc)),
+                             anchors);
+        }
+    } else {
+        assert(anchorsList.size()==1
+               &&"Only one anchors pair expected if no direct alignment");
+        Anchors const& anchors(anchorsList[0]);
+
+        // ONLY USE DISTANCE TO CLOSE ANCHOR AT REF SPECIES, because at the qry
+        // species it should be roughly the same as it is a projection of the
+        // reference.
+        double const score(projectionScore(refLoc,
+                                           anchors.upstream.refEnd(),
+                                           anchors.downstream.refStart(),
+                                           scoreScale));
+        ret.emplace_back(score,
+                         Coords(anchors.upstream.qryChrom(),
+                                interpolateQryLoc(anchors, refLoc)),
+                         anchors);
+    }
+}
+
+void
+Ipp::projectFirstHops(SpeciesId refSpecies,
+                      Coords const* refCoords,
+                      std::size_t numCoords,
+                      ProjectionParams const& params,
+                      AnchorsMemo* anchorsMemo,
+                      ProjectCoordScratch* scratch) const {
+    // Like projectGenomicLocationUncached() for each of the refCoords and
+    // pwalns of the ref species, but the projections into gaps are collected
+    // and scored with one projectionScores() call per pwaln.
+    auto const& pwalns(pwalns_[refSpecies]);
+    std::size_t const numPwalns(pwalns.size());
+    ScoreScale const scoreScale(scratch->scoreScales[refSpecies]);
+    SearchStats* const stats(scratch->stats);
+    std::vector<std::vector<GenomicProjectionResult>>& firstHops(
+        scratch->firstHops);
+    firstHops.resize(numCoords*numPwalns);
+
+    for (std::size_t p(0); p < numPwalns; ++p) {
+        auto const& [qrySpecies, pwaln] = pwalns[p];
+        if (stats) {
+            stats->currentPwaln = refSpecies*stats->numSpecies + qrySpecies;
+        }
+        scratch->gapCoords.clear();
+        scratch->minDists.clear();
+        for (std::size_t i(0); i < numCoords; ++i) {
+            std::vector<GenomicProjectionResult>& projs(
+                firstHops[i*numPwalns + p]);
+            projs.clear();
+            std::vector<Anchors> const& anchorsList(
+                getAnchors(pwaln, refCoords[i], params, anchorsMemo, stats,
+                           noUpperBoundHint, &scratch->anchors));
+            if (anchorsList.empty()) {
+                continue;
+            }
+
+            uint32_t const refLoc(refCoords[i].loc);
+            if (anchorsList[0].upstream == anchorsList[0].downstream) {
+                // refLoc lies on an aligment (or multiple).
+                for (Anchors const& anchors : anchorsList) {
+                    projs.emplace_back(1.0d,
+                                       Coords(anchors.upstream.qryChrom(),
+                                              interpolateQryLoc(anchors, refLoc)),
+                                       anchors);
+                }
+            } else {
+                // Scored below.
+                Anchors const& anchors(anchorsList[0]);
+                scratch->gapCoords.push_back(i);
+                scratch->minDists.push_back(
+                    std::min(refLoc - anchors.upstream.refEnd(),
+                             anchors.downstream.refStart() - refLoc));
+                projs.emplace_back(0.0d,
+                                   Coords(anchors.upstream.qryChrom(),
+                                          interpolateQryLoc(anchors, refLoc)),
+                                   anchors);
+            }
+        }
+
+        scratch->scores.resize(scratch->minDists.size());
+        projectionScores(scratch->minDists.data(),
+                         scratch->minDists.size(),
+                         scoreScale,
+                         scratch->scores.data());
+        for (std::size_t k(0); k < scratch->gapCoords.size(); ++k) {
+            firstHops[scratch->gapCoords[k]*numPwalns + p][0].score
+                = scratch->scores[k];
+        }
+    }
+}
+
+uint32_t
+Ipp::interpolateQryLoc(Anchors const& anchors, uint32_t refLoc) {
+    // Computes the qryLoc by linear interpolation: Consider where refLoc lies
+    // between the ref coords of the up- and downstream anchors and project
+    // that to the qry coords of the anchors.
+    // Note: The qry coords might be reversed (up.start > up.end). Either both
+    //       anchors are reversed or both are not.
+    //       The ref coords are never reversed.
+    bool const isQryReversed(anchors.upstream.isQryReversed());
+    if (anchors.upstream == anchors.downstream) {
+        // refLoc lies on the aligment.
+        //  [  up.ref  ]
+        //  [ down.ref ]
+        //          x
+        uint32_t const refUpBound(anchors.upstream.refStart());
+        uint32_t const qryUpBound(anchors.upstream.qryStart());
+
+        assert(refUpBound <= refLoc && refLoc <= anchors.upstream.refEnd());
+
+        // Both endpoints are inclusive and the ref region is guaranteed to be
+        // the same size than the qry region.
+        return !isQryReversed ? qryUpBound + (refLoc - refUpBound)
+                              : qryUpBound - (refLoc - refUpBound);
+    }
+
+    // [ up.ref ]  x    [ down.ref ]
+    assert(isQryReversed == anchors.downstream.isQryReversed());
+    uint32_t const refUpBound(anchors.upstream.refEnd());
+    uint32_t const refDownBound(anchors.downstream.refStart());
+    uint32_t const qryUpBound(anchors.upstream.qryEnd());
+    uint32_t const qryDownBound(anchors.downstream.qryStart());
+
+    // Both endpoints are exclusive.
+    assert(refUpBound < refLoc && refLoc < refDownBound);
+
+    // +0.5 to bring the projection into the middle of the projected qry
+    // region of potentially different size:
+    //     up.refEnd = 10, down.refStart = 20
+    //     up.qryEnd = 110, down.qryStart = 150
+    //     refLoc = 11
+    //     qryLoc = 110 + ((11 - 10 + 0.5) / (20-10)) * (150-110)
+    //            = 110 + 1.5/10 * 40 = 116
+    //     (vs. 114 w/o the +0.5).
+    double const relativeRefLoc(
+        1.0d*(refLoc - refUpBound + 0.5) / (refDownBound - refUpBound));
+    uint32_t const qryLoc(
+        !isQryReversed
+        ? qryUpBound + relativeRefLoc*(qryDownBound - qryUpBound)
+        : qryUpBound - relativeRefLoc*(qryUpBound - qryDownBound));
+
+    // <= and >= below in case the qry range is of size <= 1 (then the
+    // projection is onto the lower boundary).
+    assert((!isQryReversed && qryUpBound <= qryLoc && qryLoc < qryDownBound)
+           ||(isQryReversed && qryUpBound > qryLoc && qryLoc >= qryDownBound));
+    return qryLoc;
+}
+
+namespace {
+
+template<typename Entries>
+uint32_t
+entryIndex(Entries const& entries, Ipp::PwalnEntry const& entry) {
+    // Returns the index of the given entry, which must be one of the entries.
+    std::size_t i(entry.refStart() ? entries.upperBound(entry.refStart() - 1)
+                                   : 0);
+    while (!(entries[i] == entry)) {
+        ++i;
+        assert(i < entries.size());
+    }
+    return i;
+}
+
+template<typename Entries>
+void
+tableAnchors(Entries const& entries,
+             std::pair<Ipp::AnchorTable::AnchorIdxs const*,
+                       Ipp::AnchorTable::AnchorIdxs const*> const& anchorIdxs,
+             std::vector<Ipp::Anchors>* anchors) {
+    // Replaces the contents of anchors with the anchors of the given range of
+    // an AnchorTable.
+    anchors->clear();
+    for (auto it(anchorIdxs.first); it != anchorIdxs.second; ++it) {
+        anchors->emplace_back(entries[it->first], entries[it->second]);
+    }
+}
+
+} // namespace
+
+std::vector<Ipp::Anchors> const&
+Ipp::getAnchors(Pwaln const& pwaln,
+                Coords const& refCoords,
+                ProjectionParams const& params,
+                AnchorsMemo* anchorsMemo,
+                SearchStats* stats,
+                std::size_t upperBoundHint,
+                std::vector<Anchors>* anchorsBuffer) const {
+    // Looks up the pwaln entries of refCoords.chrom and selects the anchors
+    // for refCoords.loc from them.
+    // If an anchorsMemo is given, then the last search in the same block is
+    // reused if possible (and its anchors are returned and updated in
+    // place). Otherwise the search starts from the upperBoundHint if there
+    // is one.
+    if (stats) {
+        ++stats->getAnchorsCalls[stats->currentPwaln];
+    }
+    auto const pwalnBlockIt(pwaln.find(refCoords.chrom));
+    if (pwalnBlockIt == pwaln.end()) {
+        // No pwaln entry for this refCoords.chrom.
+        anchorsBuffer->clear();
+        return *anchorsBuffer;
+    }
+
+    AnchorsSearch* search(nullptr);
+    std::vector<Anchors>* anchors(anchorsBuffer);
+    if (anchorsMemo) {
+        search = &anchorsMemo->searches[{&pwaln, refCoords.chrom}];
+        if (search->valid && search->validity.contains(refCoords.loc)) {
+            // The last search yields the same anchors.
+            return search->anchors;
+        }
+        anchors = &search->anchors;
+    }
+    AnchorsSearch hintedSearch;
+    if (!search && upperBoundHint != noUpperBoundHint) {
+        // The gallop from the exact result only touches its two entries.
+        hintedSearch.valid = true;
+        hintedSearch.closestDownstreamAnchorIdx = upperBoundHint;
+        search = &hintedSearch;
+    }
+
+    PwalnBlock const& block(pwalnBlockIt->second);
+    ensureLoaded(block);
+    if (block.anchorTable
+        && params.topn == anchorTablesParams.topn
+        && params.minn == anchorTablesParams.minn) {
+        // The anchors are precomputed.
+        auto const anchorIdxs(block.anchorTable->find(refCoords.loc));
+        block.visitEntries([&](auto const& entries) {
+            tableAnchors(entries, anchorIdxs, anchorsBuffer);
+        });
+        return *anchorsBuffer;
+    }
+
+    block.visitEntries([&](auto const& entries) {
+        selectAnchors(entries,
+                      block.refStartIndex.get(),
+                      block.maxAnchorLength,
+                      params.topn,
+                      params.minn,
+                      refCoords.loc,
+                      search,
+                      stats ? &stats->stats : nullptr,
+                      anchors);
+    });
+    return *anchors;
+}
+
+template<typename Entries>
+void
+Ipp::intervalAnchors(Entries const& pwalnEntries,
+                     PwalnBlock const& block,
+                     ProjectionParams const& params,
+                     uint32_t refLoc,
+                     AnchorsSearch* search,
+                     uint32_t* intervalEnd,
+                     std::vector<Anchors>* anchors) const {
+    // Gets the anchors of refLoc from the anchor table of the block if
+    // possible and from a search otherwise. Sets intervalEnd to the last
+    // refLoc with the same anchors.
+    if (block.anchorTable
+        && params.topn == anchorTablesParams.topn
+        && params.minn == anchorTablesParams.minn) {
+        tableAnchors(pwalnEntries,
+                     block.anchorTable->find(refLoc, intervalEnd),
+                     anchors);
+        return;
+    }
+
+    selectAnchors(pwalnEntries,
+                  block.refStartIndex.get(),
+                  block.maxAnchorLength,
+                  params.topn,
+                  params.minn,
+                  refLoc,
+                  search,
+                  nullptr,
+                  anchors);
+    *intervalEnd = search->validity.end;
+}
+
+std::vector<Ipp::ProjectedSegment>
+Ipp::projectInterval(std::string const& refSpecies,
+                     std::string const& qrySpecies,
+                     ChromId refChrom,
+                     LocInterval const& refInterval,
+                     ProjectionParams const& params) {
+    SpeciesId const refSpeciesId(requireSpeciesId(refSpecies));
+    SpeciesId const qrySpeciesId(requireSpeciesId(qrySpecies));
+    cancel_ = false;
+    return projectIntervalImpl(refSpeciesId,
+                               qrySpeciesId,
+                               refChrom,
+                               refInterval,
+                               params,
+                               cancel_);
+}
+
+std::vector<Ipp::ProjectedSegment>
+Ipp::projectIntervalImpl(SpeciesId refSpeciesId,
+                         SpeciesId qrySpeciesId,
+                         ChromId refChrom,
+                         LocInterval const& refInterval,
+                         ProjectionParams const& params,
+                         std::atomic<bool> const& cancelFlag) const {
+    // Walks over refInterval from one interval of refLocs with the same
+    // anchors to the next one (see buildAnchorTable()) and emits a segment
+    // for each that is mappable.
+    if (params.topn == 0 || params.halfLifeDistance == 0) {
+        throw std::runtime_error("topn and halfLifeDistance must be > 0");
+    }
+    if (refInterval.start > refInterval.end) {
+        throw std::invalid_argument("refInterval.start must be <= refInterval.end");
+    }
+
+    std::vector<ProjectedSegment> segments;
+    auto const pwalnIt(
+        std::find_if(pwalns_[refSpeciesId].begin(),
+                     pwalns_[refSpeciesId].end(),
+                     [&](auto const& p) { return p.first == qrySpeciesId; }));
+    if (pwalnIt == pwalns_[refSpeciesId].end()) {
+        // No direct pwaln between the species.
+        return segments;
+    }
+    auto const blockIt(pwalnIt->second.find(refChrom));
+    if (blockIt == pwalnIt->second.end()) {
+        // No pwaln entry for this refChrom.
+        return segments;
+    }
+    PwalnBlock const& block(blockIt->second);
+    ensureLoaded(block);
+    ScoreScale const scoreScale(scoreScales(params)[refSpeciesId]);
+
+    AnchorsSearch search;
+    std::vector<Anchors> anchorsList;
+    uint32_t refLoc(refInterval.start);
+    while (true) {
+        uint32_t intervalEnd;
+        block.visitEntries([&](auto const& entries) {
+            intervalAnchors(entries,
+                            block,
+                            params,
+                            refLoc,
+                            &search,
+                            &intervalEnd,
+                            &anchorsList);
+        });
+        uint32_t const end(std::min(intervalEnd, refInterval.end));
+
+        if (!anchorsList.empty()) {
+            // The direct projection uses the first anchors.
+            Anchors const& anchors(anchorsList[0]);
+            if (!segments.empty()
+                && segments.back().ref.end + 1 == refLoc
+                && segments.back().anchors.upstream == anchors.upstream
+                && segments.back().anchors.downstream == anchors.downstream) {
+                // Continues the previous segment (the search intervals are
+                // not always maximal).
+                refLoc = segments.back().ref.start;
+                segments.pop_back();
+            }
+            double minScore(1);
+            double maxScore(1);
+            if (!(anchors.upstream == anchors.downstream)) {
+                // The score falls with the distance to the closer anchor,
+                // i.e. it is lowest in the middle of the gap.
+                uint32_t const upBound(anchors.upstream.refEnd());
+                uint32_t const downBound(anchors.downstream.refStart());
+                uint32_t const middle(upBound + (downBound - upBound) / 2);
+                minScore = projectionScore(std::clamp(middle, refLoc, end),
+                                           upBound,
+                                           downBound,
+                                           scoreScale);
+                maxScore = std::max(
+                    projectionScore(refLoc, upBound, downBound, scoreScale),
+                    projectionScore(end, upBound, downBound, scoreScale));
+            }
+            segments.emplace_back(LocInterval(refLoc, end),
+                                  anchors.upstream.qryChrom(),
+                                  interpolateQryLoc(anchors, refLoc),
+                                  interpolateQryLoc(anchors, end),
+                                  minScore,
+                                  maxScore,
+                                  anchors);
+        }
+
+        if (end == refInterval.end || cancelFlag) {
+            break;
+        }
+        refLoc = end + 1;
+    }
+    return segments;
+}
+
+std::vector<Ipp::TileProjection>
+Ipp::projectTiles(std::string const& refSpecies,
+                  std::string const& qrySpecies,
+                  ChromId refChrom,
+                  LocInterval const& refInterval,
+                  uint32_t step,
+                  ProjectionParams const& params) {
+    // Projects the tiles of each segment of projectInterval() by
+    // interpolation from the anchors of the segment. The scores of the tiles
+    // of a gap are computed in one batch.
+    if (!step) {
+        throw std::runtime_error("step must be > 0");
+    }
+    SpeciesId const refSpeciesId(requireSpeciesId(refSpecies));
+    SpeciesId const qrySpeciesId(requireSpeciesId(qrySpecies));
+    cancel_ = false;
+    std::vector<ProjectedSegment> const segments(
+        projectIntervalImpl(refSpeciesId,
+                            qrySpeciesId,
+                            refChrom,
+                            refInterval,
+                            params,
+                            cancel_));
+    ScoreScale const scoreScale(scoreScales(params)[refSpeciesId]);
+
+    std::vector<TileProjection> tiles;
+    std::vector<uint32_t> minDists;
+    std::vector<double> scores;
+    for (ProjectedSegment const& segment : segments) {
+        if (cancel_) {
+            break;
+        }
+        // The first tile within the segment.
+        uint64_t const offset(segment.ref.start - refInterval.start);
+        uint64_t const firstLoc(refInterval.start
+                                + (offset + step - 1) / step * step);
+        std::size_t const firstTile(tiles.size());
+        for (uint64_t loc(firstLoc); loc <= segment.ref.end; loc += step) {
+            tiles.emplace_back(
+                loc,
+                GenomicProjectionResult(
+                    1.0d,
+                    Coords(segment.qryChrom,
+                           interpolateQryLoc(segment.anchors, loc)),
+                    segment.anchors));
+        }
+
+        Anchors const& anchors(segment.anchors);
+        if (anchors.upstream == anchors.downstream
+            || firstTile == tiles.size()) {
+            // On an alignment (score 1) or no tile in the segment.
+            continue;
+        }
+        uint32_t const upBound(anchors.upstream.refEnd());
+        uint32_t const downBound(anchors.downstream.refStart());
+        minDists.clear();
+        for (std::size_t i(firstTile); i < tiles.size(); ++i) {
+            uint32_t const loc(tiles[i].first);
+            minDists.push_back(std::min(loc - upBound, downBound - loc));
+        }
+        scores.resize(minDists.size());
+        projectionScores(minDists.data(),
+                         minDists.size(),
+                         scoreScale,
+                         scores.data());
+        for (std::size_t i(firstTile); i < tiles.size(); ++i) {
+            tiles[i].second.score = scores[i - firstTile];
+        }
+    }
+    return tiles;
+}
+
+namespace {
+
+template<typename Entries>
+std::size_t
+gallopUpperBound(Entries const& entries, std::size_t hint, uint32_t refLoc) {
+    // Returns the index of the first entry with refStart > refLoc like
+    // upperBound() but searches from the given hint outwards with
+    // exponentially increasing steps. That is faster than a binary search
+    // over all the entries if the result is close to the hint.
+    std::size_t const n(entries.size());
+    hint = std::min(hint, n);
+
+    // Find [lo, hi] that contains the result.
+    std::size_t lo;
+    std::size_t hi;
+    std::size_t step(1);
+    if (hint < n && entries.refStart(hint) <= refLoc) {
+        // Gallop downstream.
+        lo = hint + 1;
+        hi = lo;
+        while (hi < n && entries.refStart(hi) <= refLoc) {
+            lo = hi + 1;
+            hi = lo + step;
+            step *= 2;
+        }
+        hi = std::min(hi, n);
+    } else {
+        // Gallop upstream.
+        hi = hint;
+        lo = hint;
+        while (lo > 0 && entries.refStart(lo - 1) > refLoc) {
+            hi = lo - 1;
+            lo = hi > step ? hi - step : 0;
+            step *= 2;
+        }
+    }
+
+    // Binary search in [lo, hi].
+    while (lo < hi) {
+        std::size_t const mid(lo + (hi - lo) / 2);
+        if (entries.refStart(mid) <= refLoc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+template<typename T, std::size_t N>
+class SmallVector {
+    // A vector of trivially copyable values that keeps up to N of them
+    // inline and only allocates if it grows beyond that. Used for the
+    // temporaries of selectAnchors() which are small in almost all cases.
+public:
+    SmallVector()
+        : data_(inline_)
+        , size_(0)
+        , capacity_(N)
+    {}
+
+    SmallVector(SmallVector const&) = delete;
+    SmallVector& operator=(SmallVector const&) = delete;
+
+    T* begin() {
+        return data_;
+    }
+    T* end() {
+        return data_ + size_;
+    }
+    T const* begin() const {
+        return data_;
+    }
+    T const* end() const {
+        return data_ + size_;
+    }
+    std::size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return !size_;
+    }
+    T& operator[](std::size_t i) {
+        return data_[i];
+    }
+    T const& operator[](std::size_t i) const {
+        return data_[i];
+    }
+    T& back() {
+        return data_[size_ - 1];
+    }
+    T const& back() const {
+        return data_[size_ - 1];
+    }
+
+    void push_back(T const& val) {
+        if (size_ == capacity_) {
+            reserve(2*capacity_);
+        }
+        data_[size_++] = val;
+    }
+    void pop_back() {
+        --size_;
+    }
+    void resize(std::size_t size) {
+        // The new values are unspecified.
+        reserve(size);
+        size_ = size;
+    }
+
+private:
+    void reserve(std::size_t capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+        std::unique_ptr<T[]> heap(new T[capacity]);
+        std::copy(begin(), end(), heap.get());
+        heap_ = std::move(heap);
+        data_ = heap_.get();
+        capacity_ = capacity;
+    }
+
+    T inline_[N];
+    std::unique_ptr<T[]> heap_;
+    T* data_;
+    std::size_t size_;
+    std::size_t capacity_;
+};
+
+template<std::size_t N>
+class MajorChromVote {
+    // Counts the qry chromosomes of (a few dozen) entries. The entries come
+    // in runs of the same chromosome, so a linear search over the distinct
+    // chromosomes is cheaper than a hash map.
+public:
+    template<typename Entries>
+    void add(Entries const& entries) {
+        for (Ipp::PwalnEntry const& e : entries) {
+            add(e.qryChrom());
+        }
+    }
+
+    void add(Ipp::ChromId chrom) {
+        for (auto& [c, count] : counts_) {
+            if (c == chrom) {
+                ++count;
+                return;
+            }
+        }
+        counts_.push_back({chrom, 1});
+    }
 
-    unsigned maxCount(0);
-    Ipp::ChromId maxChrom(0);
-    for (auto const& [chrom, count] : chromCount) {
-        if (count > maxCount) {
-            maxChrom = chrom;
-            maxCount = count;
+    Ipp::ChromId majority() const {
+        // Returns the most frequent chromosome. Of several equally frequent
+        // ones, the one that was added first wins.
+        unsigned maxCount(0);
+        Ipp::ChromId maxChrom(0);
+        for (auto const& [chrom, count] : counts_) {
+            if (count > maxCount) {
+                maxChrom = chrom;
+                maxCount = count;
+            }
         }
+        return maxChrom;
     }
-    return maxChrom;
-}
 
-template<typename T>
+private:
+    SmallVector<std::pair<Ipp::ChromId, unsigned>, N> counts_;
+};
+
+template<typename T, typename Anchors>
 unsigned
-insertIfMajorQryChromosome(
-    T& anchors,
-    Ipp::ChromId majorChrom,
-    std::vector<Ipp::PwalnEntry const*>* closestAnchors) {
+insertIfMajorQryChromosome(Anchors const& anchors,
+                           Ipp::ChromId majorChrom,
+                           T* closestAnchors) {
     unsigned numInserted(0);
-    for (Ipp::PwalnEntry const* e : anchors) {
-        if (e->qryChrom() == majorChrom) {
-            closestAnchors->push_back(e);
+    for (Ipp::PwalnEntry const& e : anchors) {
+        if (e.qryChrom() == majorChrom) {
+            closestAnchors->push_back(&e);
             ++numInserted;
         }
     }
     return numInserted;
 }
 
-} // namespace
+struct IncreasingQry {
+    // The entries on the forward qry strand in increasing qry order.
+    static bool filter(Ipp::PwalnEntry const* e) {
+        return !e->isQryReversed();
+    }
+    static int qryStart(Ipp::PwalnEntry const* e) {
+        return e->qryStart();
+    }
+    static int qryEnd(Ipp::PwalnEntry const* e) {
+        return e->qryEnd();
+    }
+};
 
-std::vector<Ipp::GenomicProjectionResult>
-Ipp::projectGenomicLocation(std::string const& refSpecies,
-                            std::string const& qrySpecies,
-                            Coords const& refCoords,
-                            uint64_t genomeSizeBasis) const {
-    auto const it1(pwalns_.find(refSpecies));
-    if (it1 == pwalns_.end()) {
-        // There is no pairwise alignment for the ref species.
-        return {};
+struct DecreasingQry {
+    // The entries on the reverse qry strand in decreasing qry order.
+    static bool filter(Ipp::PwalnEntry const* e) {
+        return e->isQryReversed();
     }
-    auto const it2(it1->second.find(qrySpecies));
-    if (it2 == it1->second.end()) {
-        // There is no pairwise alignment for the qry species.
-        return {};
+    static int qryStart(Ipp::PwalnEntry const* e) {
+        return -1 * (int)e->qryStart();
+    }
+    static int qryEnd(Ipp::PwalnEntry const* e) {
+        return -1 * (int)e->qryEnd();
     }
+};
 
-    // Get the anchors; this either returns an empty list in case no anchors
-    // were found, a list with only one entry for the closest up- and downstream
-    // anchors, or a list of possibly many direct alignments.
-    auto const anchorsList(
-        getAnchors(it2->second, refSpecies, refCoords, qrySpecies));
-    if (anchorsList.empty()) {
-        // If no or only one anchor is found because of border region, return 0
-        // score and empty coordinate string.
-        return {};
+template<typename Order, typename Seq>
+void
+longestSubsequence(Seq const& seq, Seq* res) {
+    // Finds the longest strictly increasing subsequence (in regards to the
+    // qryStart and qryEnd of Order) and puts it in res. Only elements for
+    // which Order::filter(seq[i]) returns true are considered.
+    // O(n log k) algorithm.
+    res->resize(0);
+    if (!seq.size()) {
+        return;
     }
 
-    uint32_t const refLoc(refCoords.loc);
+    // m[i] contains the index to the smallest value in seq[] that is the end of
+    // a subsequence of length i+1.
+    SmallVector<unsigned, 64> m;
 
-    // Compute the qryLoc by linear interpolation: Consider where refLoc lies
-    // between the ref coords of the up- and downstream anchors and project that
-    // to the qry coords of the anchors.
-    // Note: The qry coords might be reversed (up.start > up.end). Either both
-    //       anchors are reversed or both are not.
-    //       The ref coords are never reversed.
-    std::vector<GenomicProjectionResult> ret;
-    if (anchorsList[0].upstream == anchorsList[0].downstream) {
-        // refLoc lies on an aligment (or multiple).
-        //  [  up.ref  ]
-        //  [ down.ref ]
-        //          x
-        ret.reserve(anchorsList.size());
-        for (Anchors const& anchors : anchorsList) {
-            uint32_t const refUpBound(anchors.upstream.refStart());
-            uint32_t const refDownBound(anchors.upstream.refEnd());
-            uint32_t const qryUpBound(anchors.upstream.qryStart());
+    // prev[i] contains the index of the element in seq that is the one before
+    // seq[i] in the longest subsequence for seq[i].
+    SmallVector<unsigned, 64> prev;
+    prev.resize(seq.size());
 
-            assert(refUpBound <= refLoc && refLoc <= refDownBound);
+    for (unsigned i(0); i < seq.size(); ++i) {
+        // If the next element seq[i] is greater than the last element of the
+        // current longest subsequence seq[m.back()], just push it to the end of
+        // `m` and continue.
+        if (!Order::filter(seq[i])) {
+            continue;
+        }
 
-            // Both endpoints are inclusive and the ref region is guaranteed to be
-            // the same size than the qry region.
-            uint32_t const qryLoc(!anchors.upstream.isQryReversed()
-                                  ? qryUpBound + (refLoc - refUpBound)
-                                  : qryUpBound - (refLoc - refUpBound));
+        if (!m.size()) {
+            // This is the first element that matches the filter. Just add it to
+            // m.
+            m.push_back(i);
+            continue;
+        }
 
-            ret.emplace_back(1.0d,
-                             Coords(anchors.upstream.qryChrom(), qryLoc),
-                             anchors);
+        if (Order::qryEnd(seq[m.back()]) < Order::qryStart(seq[i])) {
+            prev[i] = m.back();
+            m.push_back(i);
+            continue;
+        }
+
+        // Binary search to find the smallest element referenced by m which is
+        // just bigger than seq[i].
+        // Note : Binary search is performed on m (and not seq).
+        // Size of m is always <=i and hence contributes O(log i) to the
+        // complexity.
+        unsigned u(0);
+        unsigned v(m.size()-1);
+        while(u < v) {
+            unsigned const mid((u + v) / 2);
+            if (Order::qryEnd(seq[m[mid]]) < Order::qryStart(seq[i])) {
+                u = mid+1;
+            } else {
+                v = mid;
+            }
         }
-    } else {
-        // [ up.ref ]  x    [ down.ref ]
-        assert(anchorsList.size()==1
-               &&"Only one anchors pair expected if no direct alignment");
-        Anchors const& anchors(anchorsList[0]);
-        assert(anchors.upstream.isQryReversed()
-               == anchors.downstream.isQryReversed());
-        uint32_t const refUpBound(anchors.upstream.refEnd());
-        uint32_t const refDownBound(anchors.downstream.refStart()); 
-        uint32_t const qryUpBound(anchors.upstream.qryEnd());
-        uint32_t const qryDownBound(anchors.downstream.qryStart());
 
-        // Both endpoints are exclusive.
-        assert(refUpBound < refLoc && refLoc < refDownBound);
+        // Update m if the new value is smaller than the previously referenced
+        // one.
+        if (Order::qryEnd(seq[i]) < Order::qryEnd(seq[m[u]])) {
+            if (u > 0) {
+                prev[i] = m[u-1];
+            }
+            m[u] = i;
+        }
+    }
 
-        // ONLY USE DISTANCE TO CLOSE ANCHOR AT REF SPECIES, because at the qry
-        // species it should be roughly the same as it is a projection of the
-        // reference.
-        double const score(projectionScore(refLoc,
-                                           refUpBound,
-                                           refDownBound,
-                                           genomeSizes_.at(refSpecies),
-                                           genomeSizeBasis));
-
-        // +0.5 to bring the projection into the middle of the projected qry
-        // region of potentially different size:
-        //     up.refEnd = 10, down.refStart = 20
-        //     up.qryEnd = 110, down.qryStart = 150
-        //     refLoc = 11
-        //     qryLoc = 110 + ((11 - 10 + 0.5) / (20-10)) * (150-110)
-        //            = 110 + 1.5/10 * 40 = 116
-        //     (vs. 114 w/o the +0.5).
-        double const relativeRefLoc(
-            1.0d*(refLoc - refUpBound + 0.5) / (refDownBound - refUpBound));
-        bool const isQryReversed(anchors.upstream.isQryReversed());
-        uint32_t const qryLoc(
-            !isQryReversed
-            ? qryUpBound + relativeRefLoc*(qryDownBound - qryUpBound)
-            : qryUpBound - relativeRefLoc*(qryUpBound - qryDownBound));
-
-        // <= and >= below in case the qry range is of size <= 1 (then the
-        // projection is onto the lower boundary).
-        assert((!isQryReversed && qryUpBound <= qryLoc && qryLoc < qryDownBound)
-               ||(isQryReversed && qryUpBound > qryLoc && qryLoc >= qryDownBound));
-        ret.emplace_back(score,
-                         Coords(anchors.upstream.qryChrom(), qryLoc),
-                         anchors);
+    if (m.empty()) {
+        return;
+    }
+
+    // Backtrace the longest subsequence into res.
+    res->resize(m.size());
+    unsigned v(m.back());
+    for (unsigned u(m.size()); u; --u) {
+        (*res)[u-1] = seq[v];
+        v = prev[v];
     }
-    return ret;
 }
 
-std::vector<Ipp::Anchors>
-Ipp::getAnchors(Pwaln const& pwaln,
-                std::string const& refSpecies,
-                Coords const& refCoords,
-                std::string const& qrySpecies) const {
+} // namespace
+
+template<typename Entries>
+void
+Ipp::selectAnchors(Entries const& pwalnEntries,
+                   RefStartIndex const* refStartIndex,
+                   uint16_t maxAnchorLength,
+                   unsigned topn,
+                   unsigned minn,
+                   uint32_t refLoc,
+                   AnchorsSearch* search,
+                   Stats* stats,
+                   std::vector<Anchors>* anchors) {
+    // Use the kernel with the smallest stack buffers that fit topn (the
+    // buffers of the largest one grow on the heap if necessary).
+    if (topn <= 10) {
+        selectAnchorsImpl<10>(pwalnEntries, refStartIndex,
+                              maxAnchorLength, topn, minn, refLoc,
+                              search, stats, anchors);
+    } else if (topn <= 20) {
+        selectAnchorsImpl<20>(pwalnEntries, refStartIndex,
+                              maxAnchorLength, topn, minn, refLoc,
+                              search, stats, anchors);
+    } else {
+        selectAnchorsImpl<40>(pwalnEntries, refStartIndex,
+                              maxAnchorLength, topn, minn, refLoc,
+                              search, stats, anchors);
+    }
+}
+
+template<unsigned MaxTopN, typename Entries>
+void
+Ipp::selectAnchorsImpl(Entries const& pwalnEntries,
+                       RefStartIndex const* refStartIndex,
+                       uint16_t maxAnchorLength,
+                       unsigned topn,
+                       unsigned minn,
+                       uint32_t refLoc,
+                       AnchorsSearch* search,
+                       Stats* stats,
+                       std::vector<Anchors>* anchors) {
     // First define anchors upstream, downstream and ovAln, then do major-chrom
     // and collinearity test, then either return overlapping anchor or closest
     // anchors.
@@ -718,40 +3862,50 @@ Ipp::getAnchors(Pwaln const& pwaln,
     // produced many locally collinear pwalns that were still non-collinear
     // outliers in the global view of the GRB).
     // Note: using ungapped chain blocks might require n to be even larger.
-    unsigned const minn(5);
-    unsigned const topn(20);
-
-    uint32_t const refLoc(refCoords.loc);
-
-    auto const pwalnEntriesIt(pwaln.find(refCoords.chrom));
-    if (pwalnEntriesIt == pwaln.end()) {
-        // No pwaln entry for this refCoords.chrom.
-        return {};
-    }
-    std::vector<PwalnEntry> const& pwalnEntries(pwalnEntriesIt->second);
+    // (See ProjectionParams for topn and minn.)
 
     // Find the topn entries by largest(smallest) refEnd(refStart) in the
     // upstream(downstream) anchors.
+    // The selected entries are copied (the compact representation has no
+    // PwalnEntry objects to point to). All the temporaries below live on
+    // the stack unless there are unusually many overlapping alignments, and
+    // the result goes to the caller's anchors (which keep their capacity).
+    std::vector<Anchors>& ret(*anchors);
+    ret.clear();
 
     // Binary search for the closest upstream anchor (the first with
-    // refStart > refLoc).
-    auto const closestDownstreamAnchorIt(std::upper_bound(
-            pwalnEntries.begin(),
-            pwalnEntries.end(),
-            refLoc,
-            [](uint32_t loc, PwalnEntry const& e) {
-                return loc < e.refStart();
-            }));
+    // refStart > refLoc). Start from the previous search if there is one.
+    std::size_t const closestDownstreamAnchorIdx(
+        search && search->valid
+        ? gallopUpperBound(pwalnEntries,
+                           search->closestDownstreamAnchorIdx,
+                           refLoc)
+        : refStartIndex
+        ? refStartIndex->upperBound(refLoc)
+        : pwalnEntries.upperBound(refLoc));
+
+    // Track the range of refLocs for which this search yields the same
+    // result: They need to have the same closestDownstreamAnchorIdx and the
+    // visited upstream entries must be classified the same (upstream anchor
+    // or ovAln).
+    LocInterval validity(
+        closestDownstreamAnchorIdx > 0
+        ? pwalnEntries.refStart(closestDownstreamAnchorIdx - 1)
+        : 0,
+        closestDownstreamAnchorIdx < pwalnEntries.size()
+        ? pwalnEntries.refStart(closestDownstreamAnchorIdx) - 1
+        : std::numeric_limits<uint32_t>::max());
 
     // Find the downstream anchors.
-    std::vector<PwalnEntry const*> anchorsDownstream;
-    anchorsDownstream.reserve(topn);
-    for (auto it(closestDownstreamAnchorIt); it != pwalnEntries.end(); ++it) {
+    SmallVector<PwalnEntry, MaxTopN> anchorsDownstream;
+    for (std::size_t i(closestDownstreamAnchorIdx);
+         i < pwalnEntries.size();
+         ++i) {
         // downstream anchor
         //    x     [ anchor ]
-        PwalnEntry const& pwalnEntry(*it);
+        PwalnEntry const pwalnEntry(pwalnEntries[i]);
         assert(refLoc < pwalnEntry.refStart());
-        anchorsDownstream.push_back(&pwalnEntry);
+        anchorsDownstream.push_back(pwalnEntry);
         if(anchorsDownstream.size() == topn) {
             // We found the topn closest anchors with refStart > refLoc.
             // Since the pwalnEntries are sorted by refStart, all the
@@ -762,37 +3916,35 @@ Ipp::getAnchors(Pwaln const& pwaln,
     }
 
     // Find the ovAln and upstream anchors. Walk backwards on the pwalnEntries
-    // starting from closestDownstreamAnchorIt and walk until
-    // e.refStart+maxAnchorLength_ < furthestUpstreamAnchor.refEnd.
+    // starting from closestDownstreamAnchorIdx and walk until
+    // e.refStart+maxAnchorLength < furthestUpstreamAnchor.refEnd.
     // For this, keep a priority queue of the furthest upstream anchor.
-    auto const compGreaterRefEnd = [](PwalnEntry const* lhs,
-                                      PwalnEntry const* rhs) {
-        return std::forward_as_tuple(lhs->refEnd(),
-                                     lhs->refStart(),
-                                     lhs->qryStart(),
-                                     lhs->qryChrom())
-            > std::forward_as_tuple(rhs->refEnd(),
-                                    rhs->refStart(),
-                                    rhs->qryStart(),
-                                    rhs->qryChrom());
+    auto const compGreaterRefEnd = [](PwalnEntry const& lhs,
+                                      PwalnEntry const& rhs) {
+        return std::forward_as_tuple(lhs.refEnd(),
+                                     lhs.refStart(),
+                                     lhs.qryStart(),
+                                     lhs.qryChrom())
+            > std::forward_as_tuple(rhs.refEnd(),
+                                    rhs.refStart(),
+                                    rhs.qryStart(),
+                                    rhs.qryChrom());
     };
-    std::vector<PwalnEntry const*> anchorsUpstreamPqContainer;
-    anchorsUpstreamPqContainer.reserve(topn+1);
-    std::priority_queue<PwalnEntry const*,
-                        decltype(anchorsUpstreamPqContainer),
-                        decltype(compGreaterRefEnd)> anchorsUpstreamPq(
-            compGreaterRefEnd,
-            std::move(anchorsUpstreamPqContainer));
-    std::vector<PwalnEntry const*> ovAln;
-    for (auto it(closestDownstreamAnchorIt); it-- != pwalnEntries.begin();) {
+    // A heap with the furthest upstream anchor at the front.
+    SmallVector<PwalnEntry, MaxTopN+1> anchorsUpstreamPq;
+    SmallVector<PwalnEntry, MaxTopN> ovAln;
+    std::size_t walkLength(0);
+    for (std::size_t i(closestDownstreamAnchorIdx); i-- > 0;) {
         // Walk upstream on the chromosome.
-        PwalnEntry const& pwalnEntry(*it);
+        ++walkLength;
+        PwalnEntry const pwalnEntry(pwalnEntries[i]);
         if (pwalnEntry.refEnd() < refLoc) { // refEnd is inclusive
             // upstream anchor
             // [ anchor ]    x
+            validity.start = std::max(validity.start, pwalnEntry.refEnd() + 1);
             if (anchorsUpstreamPq.size() == topn) {
-                if (pwalnEntry.refStart() + maxAnchorLength_
-                    < anchorsUpstreamPq.top()->refEnd()) {
+                if (pwalnEntry.refStart() + maxAnchorLength
+                    < anchorsUpstreamPq[0].refEnd()) {
                     // This anchor is so far away from the currently furthest
                     // upstream anchor that there is no further pwalnEntry2
                     // (with pwalnEntry2.refStart < pwalnEntry.refStart) that
@@ -800,17 +3952,23 @@ Ipp::getAnchors(Pwaln const& pwaln,
                     break;
                 }
 
-                if (pwalnEntry.refEnd() < anchorsUpstreamPq.top()->refEnd()) {
+                if (pwalnEntry.refEnd() < anchorsUpstreamPq[0].refEnd()) {
                     // Prevent adding an entry that would immediately be removed
                     // again.
                     continue;
                 }
             }
 
-            anchorsUpstreamPq.push(&pwalnEntry);
+            anchorsUpstreamPq.push_back(pwalnEntry);
+            std::push_heap(anchorsUpstreamPq.begin(),
+                           anchorsUpstreamPq.end(),
+                           compGreaterRefEnd);
             if (anchorsUpstreamPq.size() > topn) {
                 // Remove surplus anchors that are too far away.
-                anchorsUpstreamPq.pop();
+                std::pop_heap(anchorsUpstreamPq.begin(),
+                              anchorsUpstreamPq.end(),
+                              compGreaterRefEnd);
+                anchorsUpstreamPq.pop_back();
             }
         } else {
             // refLoc lies on an alignment block.
@@ -818,26 +3976,43 @@ Ipp::getAnchors(Pwaln const& pwaln,
             //      x
             assert(pwalnEntry.refStart() <= refLoc
                    && refLoc <= pwalnEntry.refEnd());
-            ovAln.push_back(&pwalnEntry);
+            validity.end = std::min(validity.end, pwalnEntry.refEnd());
+            ovAln.push_back(pwalnEntry);
         }
     }
     assert(anchorsUpstreamPq.size() <= topn);
+    assert(validity.contains(refLoc));
+    if (stats) {
+        stats->upstreamWalkLengths.add(walkLength);
+    }
 
-    // Convert the anchorsUpstream priority queue into a vector.
-    std::vector<PwalnEntry const*> anchorsUpstream;
-    anchorsUpstream.reserve(anchorsUpstreamPq.size());
+    if (search) {
+        // Nothing below depends on refLoc other than through the anchors
+        // found so far.
+        search->valid = true;
+        search->closestDownstreamAnchorIdx = closestDownstreamAnchorIdx;
+        search->validity = validity;
+    }
+
+    // Convert the anchorsUpstream heap into a list (furthest first).
+    SmallVector<PwalnEntry, MaxTopN> anchorsUpstream;
     while (!anchorsUpstreamPq.empty()) {
-        anchorsUpstream.push_back(anchorsUpstreamPq.top());
-        anchorsUpstreamPq.pop();
+        std::pop_heap(anchorsUpstreamPq.begin(),
+                      anchorsUpstreamPq.end(),
+                      compGreaterRefEnd);
+        anchorsUpstream.push_back(anchorsUpstreamPq.back());
+        anchorsUpstreamPq.pop_back();
     }
 
     // MAJOR CHROMOSOME: Retain anchors that point to the majority chromosome in
     // top n of both up- and downstream anchors.
-    ChromId const majorChrom(
-        computeMajorChrom(ovAln, anchorsUpstream, anchorsDownstream));
-    std::vector<PwalnEntry const*> closestAnchors;
-    closestAnchors.reserve(
-        anchorsUpstream.size() + ovAln.size() + anchorsDownstream.size());
+    MajorChromVote<3*MaxTopN> majorChromVote;
+    majorChromVote.add(ovAln);
+    majorChromVote.add(anchorsUpstream);
+    majorChromVote.add(anchorsDownstream);
+    ChromId const majorChrom(majorChromVote.majority());
+    using AnchorPtrs = SmallVector<PwalnEntry const*, 3*MaxTopN>;
+    AnchorPtrs closestAnchors;
     unsigned const numUpstream(insertIfMajorQryChromosome(anchorsUpstream,
                                                           majorChrom,
                                                           &closestAnchors));
@@ -849,7 +4024,7 @@ Ipp::getAnchors(Pwaln const& pwaln,
         // Require minimum of 1 anchor on each side. Later, the minimum total
         // number of collinear anchors will be set to `minn` (but one side is
         // allowed to have as little as 1 anchor).
-        return {};
+        return;
     }
 
     // Sort the closestAnchors entries by increasing refStart. That is necessary
@@ -871,13 +4046,17 @@ Ipp::getAnchors(Pwaln const& pwaln,
     // sorted subsequence of the top n of both up- and downstream anchors.
     // Compute longest collinear anchor subsequence (while considering both
     // normal and reversed direction).
-    closestAnchors = longestSubsequence(closestAnchors);
+    AnchorPtrs collinearAnchors;
+    if (stats) {
+        stats->lisInputSizes.add(closestAnchors.size());
+    }
+    longestCollinearSubsequence(closestAnchors, &collinearAnchors);
 
     // Set minimum number of collinear anchors to `minn` (for species pairs with
     // very large evol. distances setting a lower boundary for the number of
     // collinear anchors will help reduce false positives).
-    if (closestAnchors.size() < minn) {
-        return {};
+    if (collinearAnchors.size() < minn) {
+        return;
     }
   
     // Check if the original ovAln is still present (or ever was) in the
@@ -885,8 +4064,8 @@ Ipp::getAnchors(Pwaln const& pwaln,
     // if not, it was an outlier alignment and was filtered out
     PwalnEntry const* closestUpstreamAnchor(nullptr);
     PwalnEntry const* closestDownstreamAnchor(nullptr);
-    std::vector<PwalnEntry const*> ovAlnAnchors;
-    for (PwalnEntry const* anchor : closestAnchors) {
+    AnchorPtrs ovAlnAnchors;
+    for (PwalnEntry const* anchor : collinearAnchors) {
         if (anchor->refEnd() < refLoc) {
             if (!closestUpstreamAnchor
                 || closestUpstreamAnchor->refEnd() < anchor->refEnd()) {
@@ -905,10 +4084,8 @@ Ipp::getAnchors(Pwaln const& pwaln,
         }
     }
 
-    std::vector<Anchors> ret;
     if (!ovAlnAnchors.empty()) {
         // We found direct mapping(s).
-        ret.reserve(ovAlnAnchors.size());
         for (PwalnEntry const* ovAlnAnchor : ovAlnAnchors) {
             ret.emplace_back(*ovAlnAnchor, *ovAlnAnchor);
         }
@@ -917,138 +4094,350 @@ Ipp::getAnchors(Pwaln const& pwaln,
             // Not both up- and downstream anchors were found (e.g. at synteny
             // break points where one side does not have any anchors to the
             // majority chromosome)
-            return {};
+            return;
         }
 
         ret.emplace_back(*closestUpstreamAnchor, *closestDownstreamAnchor);
     }
-    return ret;
 }
 
-namespace {
+template<typename AnchorPtrs>
+void
+Ipp::longestCollinearSubsequence(AnchorPtrs const& seq, AnchorPtrs* res) {
+    // Searches the longest strictly increasing (forward strand) and
+    // decreasing (reverse strand) subsequences and keeps the longer one.
+    AnchorPtrs dec;
+    longestSubsequence<IncreasingQry>(seq, res);
+    longestSubsequence<DecreasingQry>(seq, &dec);
 
-std::vector<Ipp::PwalnEntry const*>
-longestSubsequence(std::vector<Ipp::PwalnEntry const*> const& seq,
-                   std::function<bool(Ipp::PwalnEntry const*)> const& filter,
-                   std::function<int(Ipp::PwalnEntry const*)> const& qryStart,
-                   std::function<int(Ipp::PwalnEntry const*)> const& qryEnd) {
-    // Finds the longest strictly increasing subsequence (in regards to the
-    // given greater-than function). Only elements for which filter(seq[i])
-    // returns true are considered.
-    // O(n log k) algorithm.
+    // Sanity check: The entries in the inc/dec list should be strictly
+    // increasing/decreasing.
+    uint32_t loc(0);
+    for (PwalnEntry const* e : *res) {
+        assert((!loc && !e->qryStart()) || loc < e->qryStart());
+        assert(e->qryStart() <= e->qryEnd());
+        loc = e->qryEnd();
+    }
+    loc = std::numeric_limits<uint32_t>::max();
+    for (PwalnEntry const* e : dec) {
+        assert(loc > e->qryEnd());
+        assert(e->qryStart() >= e->qryEnd());
+        loc = e->qryStart();
+    }
 
-    // m[i] contains the index to the smallest value in seq[] that is the end of
-    // a subsequence of length i+1.
-    std::vector<unsigned> m;
-    m.reserve(seq.size());
+    if (res->size() < dec.size()) {
+        res->resize(dec.size());
+        std::copy(dec.begin(), dec.end(), res->begin());
+    }
+}
 
-    if (!seq.size()) {
-        return {};
+void
+Ipp::AnchorTable::append(uint32_t start,
+                         std::vector<AnchorIdxs> const& anchorIdxs) {
+    // Adds the interval that starts at `start`; merges it with the previous
+    // one if it has the same anchors.
+    assert(starts_.empty() ? start == 0 : starts_.back() < start);
+    if (!starts_.empty()
+        && anchorIdxs.size() == anchorIdxs_.size() - offsets_[offsets_.size() - 2]
+        && std::equal(anchorIdxs.begin(),
+                      anchorIdxs.end(),
+                      anchorIdxs_.begin() + offsets_[offsets_.size() - 2])) {
+        return;
     }
 
-    // prev[i] contains the index of the element in seq that is the one before
-    // seq[i] in the longest subsequence for seq[i].
-    std::vector<unsigned> prev(seq.size());
+    if (offsets_.empty()) {
+        offsets_.push_back(0);
+    }
+    starts_.push_back(start);
+    anchorIdxs_.insert(anchorIdxs_.end(), anchorIdxs.begin(), anchorIdxs.end());
+    offsets_.push_back(anchorIdxs_.size());
+}
 
-    for (unsigned i(0); i < seq.size(); ++i) {
-        // If the next element seq[i] is greater than the last element of the
-        // current longest subsequence seq[m.back()], just push it to the end of
-        // `m` and continue.
-        if (!filter(seq[i])) {
-            continue;
+std::pair<Ipp::AnchorTable::AnchorIdxs const*,
+          Ipp::AnchorTable::AnchorIdxs const*>
+Ipp::AnchorTable::find(uint32_t refLoc, uint32_t* intervalEnd) const {
+    // Returns the range of the anchor pairs of the interval of refLoc.
+    // The first interval starts at 0, i.e. there always is one.
+    std::size_t const i(
+        std::upper_bound(starts_.begin(), starts_.end(), refLoc)
+        - starts_.begin() - 1);
+    if (intervalEnd) {
+        *intervalEnd = i + 1 < starts_.size()
+            ? starts_[i + 1] - 1
+            : std::numeric_limits<uint32_t>::max();
+    }
+    return {anchorIdxs_.data() + offsets_[i],
+            anchorIdxs_.data() + offsets_[i + 1]};
+}
+
+std::size_t
+Ipp::AnchorTable::memoryUsage() const {
+    // Returns the number of bytes used by the table.
+    return starts_.capacity()*sizeof(uint32_t)
+        + offsets_.capacity()*sizeof(uint32_t)
+        + anchorIdxs_.capacity()*sizeof(AnchorIdxs);
+}
+
+void
+Ipp::AnchorTable::write(std::ostream& os) const {
+    // Format:
+    //     uint32 numIntervals
+    //     uint32 numAnchorIdxs
+    //     uint32 starts[numIntervals]
+    //     uint32 offsets[numIntervals + 1]
+    //     {uint32 upstream, uint32 downstream} anchorIdxs[numAnchorIdxs]
+    static_assert(sizeof(AnchorIdxs) == 8);
+    writeInt<uint32_t>(os, starts_.size());
+    writeInt<uint32_t>(os, anchorIdxs_.size());
+    writeArray(os, starts_);
+    writeArray(os, offsets_);
+    writeArray(os, anchorIdxs_);
+}
+
+void
+Ipp::AnchorTable::read(std::istream& is, uint32_t numPwalnEntries) {
+    // Reads a table written by write().
+    starts_.resize(readInt<uint32_t>(is));
+    anchorIdxs_.resize(readInt<uint32_t>(is));
+    offsets_.resize(starts_.size() + 1);
+    readArray(is, &starts_);
+    readArray(is, &offsets_);
+    readArray(is, &anchorIdxs_);
+
+    if (starts_.empty()
+        || starts_[0] != 0
+        || !std::is_sorted(offsets_.begin(), offsets_.end())
+        || offsets_.front() != 0
+        || offsets_.back() != anchorIdxs_.size()
+        || std::any_of(anchorIdxs_.begin(),
+                       anchorIdxs_.end(),
+                       [numPwalnEntries](AnchorIdxs const& idxs) {
+                           return idxs.first >= numPwalnEntries
+                               || idxs.second >= numPwalnEntries;
+                       })) {
+        throw std::runtime_error("invalid anchor table");
+    }
+}
+
+template<typename Entries>
+void
+Ipp::buildAnchorTable(Entries const& pwalnEntries,
+                      uint16_t maxAnchorLength,
+                      AnchorTable* anchorTable) {
+    // Walks over the ref chromosome from one validity interval of the anchor
+    // search to the next one and records the anchors of each.
+    AnchorsSearch search;
+    std::vector<Anchors> anchors;
+    std::vector<AnchorTable::AnchorIdxs> anchorIdxs;
+    uint32_t refLoc(0);
+    while (true) {
+        selectAnchors(pwalnEntries,
+                      nullptr,
+                      maxAnchorLength,
+                      anchorTablesParams.topn,
+                      anchorTablesParams.minn,
+                      refLoc,
+                      &search,
+                      nullptr,
+                      &anchors);
+        anchorIdxs.clear();
+        for (Anchors const& a : anchors) {
+            anchorIdxs.emplace_back(entryIndex(pwalnEntries, a.upstream),
+                                    entryIndex(pwalnEntries, a.downstream));
         }
+        // The validity might start before refLoc, but the previous interval
+        // ends at refLoc - 1.
+        anchorTable->append(refLoc, anchorIdxs);
 
-        if (!m.size()) {
-            // This is the first element that matches the filter. Just add it to
-            // m.
-            m.push_back(i);
-            continue;
+        if (search.validity.end == std::numeric_limits<uint32_t>::max()) {
+            break;
         }
+        refLoc = search.validity.end + 1;
+    }
+}
 
-        if (qryEnd(seq[m.back()]) < qryStart(seq[i])) {
-            prev[i] = m.back();
-            m.push_back(i);
-            continue;
+void
+Ipp::buildAnchorTables(unsigned nThreads) {
+    // Precomputes the AnchorTable of each block (largest blocks first).
+    loadBlocks(nThreads);
+
+    std::vector<PwalnBlock const*> blocks;
+    for (auto const& pwalnsSp1 : pwalns_) {
+        for (auto const& [sp2, pwaln] : pwalnsSp1) {
+            for (auto const& [refChrom, block] : pwaln) {
+                blocks.push_back(&block);
+            }
+        }
+    }
+    std::sort(blocks.begin(), blocks.end(),
+              [](PwalnBlock const* lhs, PwalnBlock const* rhs) {
+                  return lhs->numPwalnEntries > rhs->numPwalnEntries;
+              });
+
+    forEachBlock(blocks,
+                 nThreads,
+                 [](PwalnBlock const& block, std::ifstream&) {
+                     auto anchorTable(std::make_unique<AnchorTable>());
+                     block.visitEntries([&](auto const& entries) {
+                         buildAnchorTable(entries,
+                                          block.maxAnchorLength,
+                                          anchorTable.get());
+                     });
+                     block.anchorTable = std::move(anchorTable);
+                 });
+}
+
+
+void
+Ipp::saveAnchorTables(std::string const& fileName) const {
+    // Format:
+    //     uint8 formatVersion
+    //     uint16 endiannessMagic
+    //     uint64 the size of the pwaln file
+    //     int64 the modification time of the pwaln file (ns since the epoch)
+    //     uint32 topn
+    //     uint32 minn
+    //     uint8 deriveReverse (the blocks of the derived pwalns differ)
+    //     uint32 numTables
+    //     numTables times:
+    //         char[] sp1 (null-terminated)
+    //         char[] sp2 (null-terminated)
+    //         uint32 refChrom
+    //         uint32 numPwalnEntries
+    //         AnchorTable (see AnchorTable::write())
+    // The file is written under a temporary name first so that readers never
+    // see a partially written file.
+    std::string const tmpFileName(fileName + ".tmp");
+    {
+        std::ofstream file(tmpFileName, std::ios::out|std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error(
+                format("could not open the file: %s", tmpFileName.c_str()));
         }
 
-        // Binary search to find the smallest element referenced by m which is
-        // just bigger than seq[i].
-        // Note : Binary search is performed on m (and not seq).
-        // Size of m is always <=i and hence contributes O(log i) to the
-        // complexity.
-        unsigned u(0);
-        unsigned v(m.size()-1);
-        while(u < v) {
-            unsigned const mid((u + v) / 2);
-            if (qryEnd(seq[m[mid]]) < qryStart(seq[i])) {
-                u = mid+1;
-            } else {
-                v = mid;
+        uint32_t numTables(0);
+        for (auto const& pwalnsSp1 : pwalns_) {
+            for (auto const& [sp2, pwaln] : pwalnsSp1) {
+                numTables += pwaln.size();
             }
         }
 
-        // Update m if the new value is smaller than the previously referenced
-        // one.
-        if (qryEnd(seq[i]) < qryEnd(seq[m[u]])) {
-            if (u > 0) {
-                prev[i] = m[u-1];
+        writeInt<uint8_t>(file, anchorTablesFormatVersion);
+        writeInt<uint16_t>(file, pwalnEndiannessMagic);
+        writeInt<uint64_t>(file, fileSize(pwalnsFileName_));
+        writeInt<int64_t>(file, fileModificationTimeNs(pwalnsFileName_));
+        writeInt<uint32_t>(file, anchorTablesParams.topn);
+        writeInt<uint32_t>(file, anchorTablesParams.minn);
+        writeInt<uint8_t>(file, loadOptions_.deriveReverse);
+        writeInt<uint32_t>(file, numTables);
+        for (SpeciesId sp1(0); sp1 < pwalns_.size(); ++sp1) {
+            for (auto const& [sp2, pwaln] : pwalns_[sp1]) {
+                for (auto const& [refChrom, block] : pwaln) {
+                    if (!block.anchorTable) {
+                        throw std::runtime_error("the anchor tables were not built");
+                    }
+                    file << species_[sp1] << '\0' << species_[sp2] << '\0';
+                    writeInt<uint32_t>(file, refChrom);
+                    writeInt<uint32_t>(file, block.numPwalnEntries);
+                    block.anchorTable->write(file);
+                }
             }
-            m[u] = i;
+        }
+
+        if (!file.good()) {
+            throw std::runtime_error(
+                format("could not write the file: %s", tmpFileName.c_str()));
         }
     }
 
-    // Backtrace the longest subsequence into res.
-    std::vector<Ipp::PwalnEntry const*> res(m.size());
-    unsigned v(m.back());
-    for (unsigned u(m.size()); u; --u) {
-        res[u-1] = seq[v];
-        v = prev[v];
+    if (std::rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+        std::remove(tmpFileName.c_str());
+        throw std::runtime_error(
+            format("could not rename the file: %s", tmpFileName.c_str()));
     }
-    return res;
 }
 
-} // namespace
+bool
+Ipp::loadAnchorTables(std::string const& fileName) {
+    // Reads the tables written by saveAnchorTables() and attaches them to
+    // their blocks. Nothing is attached unless there is a matching table for
+    // each block.
+    std::ifstream file(fileName, std::ios::in|std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    try {
+        return readAnchorTables(file);
+    } catch (std::exception const&) {
+        // Truncated or corrupt (e.g. by an interrupted copy): Rebuild them.
+        return false;
+    }
+}
 
-std::vector<Ipp::PwalnEntry const*>
-Ipp::longestSubsequence(std::vector<PwalnEntry const*> const& seq) {
-    std::vector<PwalnEntry const*> const inc(::longestSubsequence(
-            seq,
-            [](PwalnEntry const* e) {
-                return !e->isQryReversed();
-            },
-            [](PwalnEntry const* e) {
-                return e->qryStart();
-            },
-            [](PwalnEntry const* e) {
-                return e->qryEnd();
-            }));
-
-    std::vector<PwalnEntry const*> const dec(::longestSubsequence(
-            seq,
-            [](PwalnEntry const* e) {
-                return e->isQryReversed();
-            },
-            [](PwalnEntry const* e) {
-                return -1 * (int)e->qryStart();
-            },
-            [](PwalnEntry const* e) {
-                return -1 * (int)e->qryEnd();
-            }));
+bool
+Ipp::readAnchorTables(std::istream& file) {
+    // See loadAnchorTables().
+    ScopedNumaInterleave const numaInterleave(loadOptions_.numaInterleave);
 
-    // Sanity check: The entries in the inc/dec list should be strictly
-    // increasing/decreasing.
-    uint32_t loc(0);
-    for (PwalnEntry const* e : inc) {
-        assert((!loc && !e->qryStart()) || loc < e->qryStart());
-        assert(e->qryStart() <= e->qryEnd());
-        loc = e->qryEnd();
+    if (readInt<uint8_t>(file) != anchorTablesFormatVersion
+        || readInt<uint16_t>(file) != pwalnEndiannessMagic
+        || readInt<uint64_t>(file) != fileSize(pwalnsFileName_)
+        || readInt<int64_t>(file) != fileModificationTimeNs(pwalnsFileName_)
+        || readInt<uint32_t>(file) != anchorTablesParams.topn
+        || readInt<uint32_t>(file) != anchorTablesParams.minn
+        || readInt<uint8_t>(file) != loadOptions_.deriveReverse) {
+        // Written by another version, for another (or a since regenerated)
+        // pwaln file or with other params or load options.
+        return false;
     }
-    loc = std::numeric_limits<uint32_t>::max();
-    for (PwalnEntry const* e : dec) {
-        assert(loc > e->qryEnd());
-        assert(e->qryStart() >= e->qryEnd());
-        loc = e->qryStart();
+
+    std::vector<std::pair<PwalnBlock const*, std::unique_ptr<AnchorTable>>>
+        anchorTables;
+    std::size_t numBlocks(0);
+    for (auto const& pwalnsSp1 : pwalns_) {
+        for (auto const& [sp2, pwaln] : pwalnsSp1) {
+            numBlocks += pwaln.size();
+        }
+    }
+    auto const numTables(readInt<uint32_t>(file));
+    if (numTables != numBlocks) {
+        return false;
+    }
+
+    for (uint32_t i(0); i < numTables; ++i) {
+        std::optional<SpeciesId> const sp1(speciesIdFromName(readString(file)));
+        std::optional<SpeciesId> const sp2(speciesIdFromName(readString(file)));
+        auto const refChrom(readInt<uint32_t>(file));
+        auto const numPwalnEntries(readInt<uint32_t>(file));
+        auto anchorTable(std::make_unique<AnchorTable>());
+        anchorTable->read(file, numPwalnEntries);
+
+        if (!sp1 || !sp2) {
+            return false;
+        }
+        PwalnBlock const* block(nullptr);
+        for (auto const& [s, pwaln] : pwalns_[*sp1]) {
+            if (s == *sp2) {
+                auto const it(pwaln.find(refChrom));
+                if (it != pwaln.end()) {
+                    block = &it->second;
+                }
+            }
+        }
+        if (!block || block->numPwalnEntries != numPwalnEntries) {
+            return false;
+        }
+        anchorTables.emplace_back(block, std::move(anchorTable));
     }
 
-    return inc.size() >= dec.size() ? inc : dec;
+    for (auto& [block, anchorTable] : anchorTables) {
+        block->anchorTable = std::move(anchorTable);
+    }
+    return true;
+}
+
+std::string
+Ipp::anchorTablesFileName(std::string const& pwalnsFileName) {
+    // Returns the name of the anchor tables file of the given pwaln file.
+    return pwalnsFileName + ".anchors";
 }
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <functional>
+#include <iosfwd>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <string>
@@ -19,12 +26,22 @@ public:
             , qryChrom_(0)
             , lengthAndStrand_(0)
         {}
+        PwalnEntry(uint32_t refStart,
+                   uint32_t qryStart,
+                   ChromId qryChrom,
+                   uint16_t lengthAndStrand)
+            : refStart_(refStart)
+            , qryStart_(qryStart)
+            , qryChrom_(qryChrom)
+            , lengthAndStrand_(lengthAndStrand)
+        {}
         PwalnEntry(PwalnEntry const& other)
             : refStart_(other.refStart_)
             , qryStart_(other.qryStart_)
             , qryChrom_(other.qryChrom_)
             , lengthAndStrand_(other.lengthAndStrand_)
         {}
+        PwalnEntry& operator=(PwalnEntry const& other) = default;
 
         uint32_t refStart() const {
             return refStart_;
@@ -46,6 +63,9 @@ public:
                 : qryStart_ - length() + 1;
         }
 
+        uint16_t lengthAndStrand() const {
+            return lengthAndStrand_;
+        }
         uint16_t length() const {
             // Remove the MSB bit from lengthAndStrand.
             return lengthAndStrand_ & ~(1<<15);
@@ -55,6 +75,15 @@ public:
             return lengthAndStrand_ & (1<<15);
         }
 
+        PwalnEntry reversed(ChromId refChrom) const {
+            // Returns this entry (of the given ref chromosome) as an entry of
+            // the pwaln in the opposite direction: ref and qry are swapped.
+            // On the reverse strand, the ref start is the former qry end.
+            return !isQryReversed()
+                ? PwalnEntry(qryStart_, refStart_, refChrom, lengthAndStrand_)
+                : PwalnEntry(qryEnd(), refEnd(), refChrom, lengthAndStrand_);
+        }
+
         bool operator==(PwalnEntry const& other) const {
             return refStart_ == other.refStart_
                 && qryStart_ == other.qryStart_
@@ -73,16 +102,371 @@ public:
         // signed integer.
         uint16_t lengthAndStrand_;
     };
-    using Pwaln = std::unordered_map<ChromId, std::vector<PwalnEntry>>;
-    using Pwalns = std::unordered_map<std::string, std::unordered_map<std::string, Pwaln>>;
-    // The map of pairwise alignments: [sp1][sp2][ref_chrom] -> [PwalnEntry]
-    // The entries in the vector are sorted by [refStart, qryChrom, qryStart].
-    // refChrom is the key and also in the entry as PwalnEntry has enough space
-    // to keep it (due to alignment) and that way we can bulk-read the data in
-    // loadPwalns().
+    class PwalnEntries {
+        // A read-only view on the pwaln entries of one ref chromosome.
+        // The entries are either owned by their PwalnBlock (v4 files) or live
+        // directly in the memory mapping of the pwaln file (v5 files).
+    public:
+        using const_iterator = PwalnEntry const*;
+
+        PwalnEntries()
+            : begin_(nullptr)
+            , end_(nullptr)
+        {}
+        PwalnEntries(PwalnEntry const* begin, PwalnEntry const* end)
+            : begin_(begin)
+            , end_(end)
+        {}
+
+        const_iterator begin() const {
+            return begin_;
+        }
+        const_iterator end() const {
+            return end_;
+        }
+        std::size_t size() const {
+            return end_ - begin_;
+        }
+        bool empty() const {
+            return begin_ == end_;
+        }
+        PwalnEntry const& operator[](std::size_t i) const {
+            return begin_[i];
+        }
+        uint32_t refStart(std::size_t i) const {
+            return begin_[i].refStart();
+        }
+        void prefetch(std::size_t i) const {
+            // Starts loading the memory that refStart(i) reads.
+            __builtin_prefetch(begin_ + i);
+        }
+
+        std::size_t upperBound(uint32_t refLoc) const;
+        // Returns the index of the first entry with refStart > refLoc.
+
+    private:
+        PwalnEntry const* begin_;
+        PwalnEntry const* end_;
+    };
+
+    class CompactPwalnEntries {
+        // Structure-of-arrays representation of the pwaln entries of one ref
+        // chromosome that has the same interface as PwalnEntries (but returns
+        // the entries by value).
+        // The refStarts are delta-encoded in groups of 2^refStartGroupShift_
+        // entries: A uint32 base per group plus a uint16 delta per entry. The
+        // qry chromosomes are stored as uint16 indices into a dictionary.
+        // That takes ~10 bytes per entry instead of 16 and the binary search
+        // for a refLoc only touches the (small) array of group bases and the
+        // deltas of one group.
+    public:
+        static std::unique_ptr<CompactPwalnEntries> create(
+            PwalnEntries const& entries);
+        // Returns the compact representation of the given entries or nullptr
+        // if they cannot be represented (too many qry chromosomes).
+
+        std::size_t size() const {
+            return qryStarts_.size();
+        }
+        bool empty() const {
+            return qryStarts_.empty();
+        }
+        PwalnEntry operator[](std::size_t i) const {
+            return PwalnEntry(refStart(i),
+                              qryStarts_[i],
+                              qryChroms_[qryChromIndices_[i]],
+                              lengthsAndStrands_[i]);
+        }
+        uint32_t refStart(std::size_t i) const {
+            return refStartBases_[i >> refStartGroupShift_]
+                + refStartDeltas_[i];
+        }
+        void prefetch(std::size_t i) const {
+            __builtin_prefetch(refStartBases_.data() + (i >> refStartGroupShift_));
+            __builtin_prefetch(refStartDeltas_.data() + i);
+        }
+
+        std::size_t upperBound(uint32_t refLoc) const;
+        // Returns the index of the first entry with refStart > refLoc.
+
+        std::size_t memoryUsage() const;
+        // Returns the number of bytes used by the arrays.
+
+    private:
+        CompactPwalnEntries() {}
+
+        unsigned refStartGroupShift_;
+        std::vector<uint32_t> refStartBases_;
+        std::vector<uint16_t> refStartDeltas_;
+        std::vector<uint32_t> qryStarts_;
+        std::vector<uint16_t> qryChromIndices_;
+        std::vector<uint16_t> lengthsAndStrands_;
+        std::vector<ChromId> qryChroms_;
+    };
+    class ReversePwalnEntries {
+        // The pwaln entries of one ref chromosome of a pwaln that is derived
+        // from the pwaln in the opposite direction (see
+        // LoadOptions::deriveReverse). It has the same interface as
+        // PwalnEntries (but returns the entries by value). Only a permutation
+        // of the entries of the opposite direction is stored: The index of
+        // the source block (uint16) and of the entry in it (uint32). That
+        // takes 6 bytes per entry instead of 16; the entries are reversed
+        // upon access. The source entries must outlive this.
+    public:
+        struct Source {
+            // The entries of one block of the opposite direction.
+            ChromId refChrom;
+            PwalnEntries entries;
+
+            Source(ChromId refChrom, PwalnEntries const& entries)
+                : refChrom(refChrom)
+                , entries(entries)
+            {}
+        };
+        using Sources = std::vector<Source>;
+        static constexpr std::size_t maxNumSources = 1 << 16;
+
+        ReversePwalnEntries(std::shared_ptr<Sources const> sources,
+                            std::vector<uint16_t> sourceIdxs,
+                            std::vector<uint32_t> entryIdxs)
+            : sources_(std::move(sources))
+            , sourceIdxs_(std::move(sourceIdxs))
+            , entryIdxs_(std::move(entryIdxs))
+        {}
+
+        std::size_t size() const {
+            return entryIdxs_.size();
+        }
+        bool empty() const {
+            return entryIdxs_.empty();
+        }
+        PwalnEntry operator[](std::size_t i) const {
+            Source const& source((*sources_)[sourceIdxs_[i]]);
+            return source.entries[entryIdxs_[i]].reversed(source.refChrom);
+        }
+        uint32_t refStart(std::size_t i) const {
+            PwalnEntry const& e((*sources_)[sourceIdxs_[i]].entries[entryIdxs_[i]]);
+            return !e.isQryReversed() ? e.qryStart() : e.qryEnd();
+        }
+        void prefetch(std::size_t i) const {
+            // Only the permutation; the source entry depends on it.
+            __builtin_prefetch(sourceIdxs_.data() + i);
+            __builtin_prefetch(entryIdxs_.data() + i);
+        }
+
+        std::size_t upperBound(uint32_t refLoc) const;
+        // Returns the index of the first entry with refStart > refLoc.
+
+        std::size_t memoryUsage() const;
+        // Returns the number of bytes used by the permutation.
+
+    private:
+        std::shared_ptr<Sources const> sources_;
+        // Shared by all the blocks of the pwaln.
+        std::vector<uint16_t> sourceIdxs_;
+        std::vector<uint32_t> entryIdxs_;
+    };
+    class RefStartIndex {
+        // Cache-friendly search index over the (sorted) refStarts of a block:
+        // An implicit static B+-tree with nodes of 16 keys (one cache line).
+        // The leaves are the refStarts themselves and each inner node holds
+        // the smallest key of each of its 16 children. A lookup touches one
+        // node per level and compares all keys of a node at once (with SIMD
+        // instructions where available).
+    public:
+        explicit RefStartIndex(std::vector<uint32_t> const& refStarts);
+
+        std::size_t upperBound(uint32_t refLoc) const;
+        // Returns the index of the first refStart > refLoc.
 
-    void loadPwalns(std::string const& fileName);
+        std::size_t memoryUsage() const;
+        // Returns the number of bytes used by the index.
+
+        static unsigned const nodeSize = 16;
+
+    private:
+        std::size_t size_;
+        std::vector<uint32_t> keys_;
+        // The nodes of all levels; the root comes first, the leaves last.
+        std::vector<std::size_t> levelOffsets_;
+        // The offset of the first key of each level in keys_, from the root
+        // down to the leaves.
+    };
+
+    class AnchorTable {
+        // The anchors of all the refLocs of a block, precomputed with
+        // selectAnchors(): The ref chromosome is split into intervals of
+        // refLocs that get the same anchors (e.g. the gap between two
+        // alignment blocks) and each interval stores the indices of the
+        // entries of its (upstream, downstream) anchor pairs. An empty list
+        // means that the refLocs of the interval are unmappable.
+    public:
+        using AnchorIdxs = std::pair<uint32_t, uint32_t>;
+        // The indices of the upstream and downstream entries of an anchors
+        // pair.
+
+        AnchorTable() {}
+
+        void append(uint32_t start, std::vector<AnchorIdxs> const& anchorIdxs);
+        // Adds the interval that starts at `start` and ends before the next
+        // one. Merges it with the previous interval if the anchors are the
+        // same. The intervals must be appended in increasing order and the
+        // first one must start at 0.
+
+        std::pair<AnchorIdxs const*, AnchorIdxs const*> find(
+            uint32_t refLoc,
+            uint32_t* intervalEnd = nullptr) const;
+        // Returns the range of the anchor pairs of the interval of refLoc.
+        // Sets intervalEnd (if given) to the last refLoc of the interval.
+
+        std::size_t numIntervals() const {
+            return starts_.size();
+        }
+
+        std::size_t memoryUsage() const;
+        // Returns the number of bytes used by the table.
+
+        void write(std::ostream& os) const;
+        void read(std::istream& is, uint32_t numPwalnEntries);
+        // Serialize the table (see Ipp::saveAnchorTables()). read() checks
+        // that the anchors refer to one of the numPwalnEntries entries.
+
+    private:
+        std::vector<uint32_t> starts_;
+        std::vector<uint32_t> offsets_;
+        // The anchors of interval i are anchorIdxs_[offsets_[i]] up to
+        // anchorIdxs_[offsets_[i+1]] (excluding).
+        std::vector<AnchorIdxs> anchorIdxs_;
+    };
+
+    class PwalnBlock {
+        // The pwaln entries of one (sp1, sp2, ref_chrom) block.
+        // In lazy mode only the location of the entries in the file is known
+        // after loadPwalns() and the entries are read upon first access (see
+        // Ipp::ensureLoaded()). Hence the members describing the entries are
+        // mutable and guarded by `mutex`.
+    public:
+        PwalnBlock()
+            : maxAnchorLength(0)
+            , fileOffset(0)
+            , numPwalnEntries(0)
+            , compressedSize(0)
+            , loaded(false)
+        {}
+
+        mutable PwalnEntries entries;
+        mutable uint16_t maxAnchorLength;
+        // The length of the longest entry.
+        mutable std::vector<PwalnEntry> storage;
+        // The storage of the entries if they were read from a v4 file.
+        mutable std::unique_ptr<CompactPwalnEntries> compact;
+        // The compact representation of the entries (replaces `entries`).
+        mutable std::unique_ptr<ReversePwalnEntries> reverse;
+        // The entries of a derived block with the permutation representation
+        // (replaces `entries`).
+        mutable std::unique_ptr<RefStartIndex> refStartIndex;
+        // The optional search index over the refStarts of the entries.
+        mutable std::unique_ptr<AnchorTable> anchorTable;
+        // The optional precomputed anchors of the block (replaces the anchor
+        // search).
+
+        uint64_t fileOffset;
+        uint32_t numPwalnEntries;
+        // The location of the packed entries in a v4 file or of the
+        // compressed entries in a v6 file.
+        uint64_t compressedSize;
+        // The size of the compressed entries in a v6 file.
+
+        mutable std::atomic<bool> loaded;
+        mutable std::mutex mutex;
+
+        template<typename Fn>
+        decltype(auto) visitEntries(Fn const& fn) const {
+            // Calls fn() with the representation of the entries that is in
+            // use (PwalnEntries, CompactPwalnEntries or ReversePwalnEntries).
+            return compact ? fn(*compact)
+                : reverse ? fn(*reverse)
+                : fn(entries);
+        }
+    };
+    using Pwaln = std::unordered_map<ChromId, PwalnBlock>;
+    using SpeciesId = uint16_t;
+    static constexpr std::size_t maxNumSpecies = 256;
+    // The maximum number of distinct species in a pwaln file.
+    using Pwalns = std::vector<std::vector<std::pair<SpeciesId, Pwaln>>>;
+    // The pairwise alignments: [sp1] -> [(sp2, [ref_chrom] -> [PwalnEntry])]
+    // The species are interned as SpeciesIds (see speciesIdFromName()); the
+    // sp2 of each sp1 are in the order of the file.
+    // The entries are sorted by [refStart, qryChrom, qryStart].
+
+    Ipp();
+    ~Ipp();
+
+    struct LoadOptions {
+        unsigned nThreads;
+        // If > 1 then the blocks are loaded by that many worker threads.
+        bool lazy;
+        // Only read the index of the file and load each block upon its first
+        // use in a projection.
+        bool compact;
+        // Keep the entries in the compact CompactPwalnEntries representation.
+        bool searchIndex;
+        // Build a RefStartIndex for each block.
+        bool anchorTables;
+        // Use precomputed AnchorTables: Read them from the anchor tables
+        // file next to the pwaln file (see anchorTablesFileName()). If there
+        // is none or it does not match the pwaln file, then the tables are
+        // built and saved to that file (if it is writable).
+        bool deriveReverse;
+        // Only use one direction of each species pair of the file (the one
+        // whose ref species comes first) and derive the other direction from
+        // it. The directions that are missing in the file are always derived.
+        // The forward blocks of the derived pwalns are loaded in lazy mode,
+        // too.
+        bool numaInterleave;
+        // Interleave the pages of the entries, indexes and tables over the
+        // memory of all NUMA nodes, so that the workers on all nodes see the
+        // same (average) latency and no node's memory controller serves all
+        // of them. The pages of v5 files are faulted in when the blocks are
+        // loaded (the ones already in the page cache stay where they are).
+        // No effect on machines with a single node.
+
+        LoadOptions()
+            : nThreads(1)
+            , lazy(false)
+            , compact(false)
+            , searchIndex(false)
+            , anchorTables(false)
+            , deriveReverse(false)
+            , numaInterleave(false)
+        {}
+    };
+
+    void loadPwalns(std::string const& fileName,
+                    LoadOptions const& options = LoadOptions());
     // Reads the chromosomes and pwalns from the given file.
+    // Files in format version 4 are copied into memory, files in format
+    // version 5 are memory-mapped and the pwaln entries are used in place
+    // (unless they are converted to the compact representation). Files in
+    // format version 6 are memory-mapped and each block is decompressed
+    // into memory when it is loaded (by the nThreads workers or, in lazy
+    // mode, upon its first use).
+
+    void buildAnchorTables(unsigned nThreads);
+    // Precomputes the AnchorTable of each block with nThreads worker threads
+    // (loads all the blocks).
+
+    void saveAnchorTables(std::string const& fileName) const;
+    // Writes the AnchorTables of all the blocks to the given file.
+
+    bool loadAnchorTables(std::string const& fileName);
+    // Reads the AnchorTables of all the blocks from the given file. Returns
+    // false (and uses no tables) if the file does not exist, is truncated or
+    // corrupt or was built for a different pwaln file (or a version of it
+    // with another size or modification time).
+
+    static std::string anchorTablesFileName(std::string const& pwalnsFileName);
+    // Returns the name of the anchor tables file of the given pwaln file.
 
     uint64_t getGenomeSize(std::string const& speciesName);
     // Returns the genome size for a given species name
@@ -90,12 +474,186 @@ public:
     void setHalfLifeDistance(unsigned halfLifeDistance);
     // Sets the half-life distance.
 
+    struct SearchLimits {
+        // Optional pruning of the multi-species search of the projections.
+        unsigned maxPathLength;
+        // Paths are not extended beyond this many hops (0: no limit).
+        double minScore;
+        // Paths with a lower score are dropped. Coords whose best path to
+        // the qry species scores lower are not projected.
+        bool earlyCutoff;
+        // Drop paths that score lower than the best path to the qry species
+        // found so far. These can never be better, so this does not change
+        // the results.
+
+        SearchLimits()
+            : maxPathLength(0)
+            , minScore(0)
+            , earlyCutoff(false)
+        {}
+    };
+
+    void setSearchLimits(SearchLimits const& searchLimits);
+    // Sets the limits of the multi-species search (default: no limits).
+
+    struct ProjectionParams {
+        // The parameters of a projection. They are given per projectCoords()
+        // call, so one loaded Ipp can serve several configurations.
+        unsigned topn;
+        // The number of closest up- and downstream alignments that are
+        // considered as anchors.
+        unsigned minn;
+        // The minimum number of collinear anchors.
+        unsigned halfLifeDistance;
+        // The distance to the closest anchor (in the basis genome) at which
+        // the score of a projection is 0.5.
+        uint64_t genomeSizeBasis;
+        // The size of the genome that the distances are relative to (default:
+        // mouse mm39). That way, the scores from projections from different
+        // reference genomes are comparable to each other.
+        SearchLimits searchLimits;
+
+        ProjectionParams()
+            : topn(20)
+            , minn(5)
+            , halfLifeDistance(10000)
+            , genomeSizeBasis(2728222451)
+        {}
+    };
+
+    void setDefaultProjectionParams(ProjectionParams const& params);
+    ProjectionParams const& defaultProjectionParams() const;
+    // The params that are used by the callers that don't have their own
+    // (e.g. the Python module). setHalfLifeDistance() and setSearchLimits()
+    // change the respective defaults.
+
+    void setProjectionCacheSize(std::size_t maxNumEntries);
+    // Enables the cache of the projections of <species, coords> along a
+    // pwaln with room for about maxNumEntries projections (0: disabled, the
+    // default). The cache is shared by all the workers and kept from one
+    // projectCoords() call to the next. It is cleared when the pwalns change
+    // or a projectCoords() call uses other ProjectionParams. Projections that
+    // run at the same time as others with other ProjectionParams bypass it.
+
+    struct ProjectionCacheStats {
+        uint64_t hits;
+        uint64_t misses;
+        std::size_t numEntries;
+
+        ProjectionCacheStats()
+            : hits(0)
+            , misses(0)
+            , numEntries(0)
+        {}
+    };
+
+    ProjectionCacheStats projectionCacheStats() const;
+    // Returns the number of cache hits and misses since the cache was
+    // enabled and the number of cached projections.
+
+    struct Histogram {
+        // The distribution of a measured value in power-of-2 buckets:
+        // counts[0] holds the 0s and counts[i] the values in [2^(i-1), 2^i).
+        std::array<uint64_t, 65> counts;
+        uint64_t sum;
+        uint64_t max;
+
+        Histogram()
+            : counts()
+            , sum(0)
+            , max(0)
+        {}
+
+        void add(uint64_t value);
+        void merge(Histogram const& other);
+
+        uint64_t count() const;
+        // The number of values.
+
+        uint64_t quantile(double q) const;
+        // Returns an upper bound of the q-quantile (0 <= q <= 1): the upper
+        // end of its bucket (or the max).
+    };
+
+    struct Stats {
+        // The instrumentation of the projections (see setStatsEnabled()).
+        std::map<std::pair<std::string, std::string>, uint64_t>
+            getAnchorsCalls;
+        // The number of anchor searches per (ref species, qry species) pwaln.
+        // Searches that are answered by the projection cache don't count.
+        Histogram upstreamWalkLengths;
+        // The number of entries that the upstream walk of an anchor search
+        // visits before it stops (see maxAnchorLength).
+        Histogram lisInputSizes;
+        // The number of anchors that the collinearity test gets.
+        uint64_t orangePushes;
+        uint64_t orangePops;
+        // The pushes to and pops from the priority queue of the shortest path
+        // searches.
+        Histogram searchNodes;
+        // The number of <species, coords> nodes reached by a search.
+        Histogram projectCoordNs;
+        // The time of the projection of one coord (to all its qry species).
+        Histogram loadBlockNs;
+        Histogram loadPwalnsNs;
+        // The time of the loading of one block and of a loadPwalns() call.
+
+        Stats()
+            : orangePushes(0)
+            , orangePops(0)
+        {}
+
+        void merge(Stats const& other);
+    };
+
+    void setStatsEnabled(bool enabled);
+    // Enables the collection of the Stats (default: disabled). Each worker
+    // thread counts on its own and adds its counts to the Stats at the end of
+    // the projectCoords() call, so the workers don't contend on them.
+    // Disabled, the instrumentation costs a branch per counter.
+
+    Stats stats() const;
+    // Returns the Stats collected since they were enabled or reset.
+
+    void resetStats();
+    // Clears the Stats.
+
+    void setThreadPinning(bool enabled);
+    // Pins the worker threads of the projections to one CPU each (default:
+    // disabled). The workers are spread round-robin over the NUMA nodes and
+    // fill the CPUs of each node in order (i.e. the physical cores before
+    // their hyperthreads on the usual numbering). Concurrent projections
+    // take the next free CPUs. Combine with LoadOptions::numaInterleave.
+
+    void setSearchInterleave(unsigned numSearches);
+    // Each projection worker keeps the searches of up to numSearches coords
+    // in flight (default: 8; 1 disables the interleaving). While the binary
+    // search for the anchors of one of them waits for its next probe to
+    // arrive from memory (prefetched), the worker advances the others. That
+    // hides the memory latency on large pwalns. The results are the same.
+    // Sorted projections (projectCoordsSorted(), projectCoordsMulti() with
+    // sorted set) reuse the anchor searches of neighbouring coords instead
+    // and are not interleaved.
+
     std::optional<ChromId> chromIdFromName(std::string const& chromName) const;
     // Looks up the given chromosome name in chroms_ and returns its id.
 
     std::string const& chromName(ChromId chromId) const;
     // Returns the name of the chromosome with the given id.
 
+    std::vector<std::string> const& chromNames() const;
+    // Returns the names of all the chromosomes, indexed by their ids.
+
+    std::optional<SpeciesId> speciesIdFromName(
+        std::string const& speciesName) const;
+    // Returns the id of the given species.
+
+    std::string const& speciesName(SpeciesId speciesId) const;
+    // Returns the name of the species with the given id.
+
+    std::vector<std::string> const& speciesNames() const;
+    // Returns the names of all the species, indexed by their ids.
+
     struct Coords {
         ChromId chrom;
         uint32_t loc;
@@ -172,51 +730,470 @@ public:
         std::string const& qrySpecies,
         std::vector<Coords> const& refCoords,
         unsigned const nThreads,
+        ProjectionParams const& params,
         OnProjectCoordsJobDoneCallback const& onJobDoneCallback);
-    // Calls projectCoord() on the given list of refCoords.
-    // If nThreads > 1 then that many worker processes are started.
+    // Projects each of the given refCoords to the qry species.
+    // If nThreads > 1 then that many worker threads are started.
     // For each completed job the onJobDoneCallback() is called with the result.
-    // The call to onJobDoneCallback() can come from any thread but no
-    // concurrent calls will be made.
+    // All calls to onJobDoneCallback() are made from the calling thread. The
+    // order of the calls is unspecified if nThreads > 1.
+    // Exceptions from the workers and the callback are forwarded. cancel()
+    // stops any further jobs from being started.
+
+    void projectCoords(
+        std::string const& refSpecies,
+        std::string const& qrySpecies,
+        std::vector<Coords> const& refCoords,
+        unsigned const nThreads,
+        bool const sorted,
+        ProjectionParams const& params,
+        std::atomic<bool> const& cancelFlag,
+        OnProjectCoordsJobDoneCallback const& onJobDoneCallback);
+    // Like projectCoords() (or projectCoordsSorted() if sorted is set) but
+    // stops starting jobs once cancelFlag is set instead of on cancel().
+    // Several of these calls can run at the same time (from different
+    // threads) on one Ipp, e.g. for different species pairs (see
+    // ProjectCoordsJob in projectjob.h). The Ipp must not be loaded or
+    // configured meanwhile.
+
+    void projectCoordsSorted(
+        std::string const& refSpecies,
+        std::string const& qrySpecies,
+        std::vector<Coords> const& refCoords,
+        unsigned const nThreads,
+        ProjectionParams const& params,
+        OnProjectCoordsJobDoneCallback const& onJobDoneCallback);
+    // Like projectCoords() but for dense inputs: The refCoords are sorted and
+    // each worker projects runs of neighbouring coords. The anchor search of
+    // each hop is remembered and reused as long as the next coords fall into
+    // the range for which it yields the same anchors. The results are the
+    // same as those of projectCoords().
+
+    using OnProjectCoordsMultiJobDoneCallback =
+        std::function<void(Ipp::Coords const&,
+                           std::vector<Ipp::CoordProjection> const&)>;
+
+    void projectCoordsMulti(
+        std::string const& refSpecies,
+        std::vector<std::string> const& qrySpecies,
+        std::vector<Coords> const& refCoords,
+        unsigned const nThreads,
+        bool const sorted,
+        ProjectionParams const& params,
+        OnProjectCoordsMultiJobDoneCallback const& onJobDoneCallback);
+    // Like projectCoords() (or projectCoordsSorted() if sorted is set) but
+    // projects each coord to all the given qry species with a single search:
+    // It continues until the shortest path to every qry species is known. The
+    // onJobDoneCallback() receives one CoordProjection per qry species in the
+    // order of qrySpecies. The results are the same as those of separate
+    // projectCoords() calls, except that paths of equal score may be chosen
+    // differently.
 
     void cancel();
-    // Cancel ongoing project_coords() call.
+    // Cancel ongoing project_coords(), projectInterval() or projectTiles()
+    // call (except those with their own cancelFlag).
 
-private:
-    CoordProjection projectCoord(std::string const& refSpecies,
-                                 std::string const& qrySpecies,
-                                 Coords const& refCoords) const;
+    bool isCancelled() const;
+    // Returns whether cancel() was called since the start of the last
+    // project_coords(), projectInterval() or projectTiles() call.
+
+    struct LocInterval {
+        // A range of locations on a chromosome. Both ends are inclusive.
+        uint32_t start;
+        uint32_t end;
+
+        LocInterval()
+            : start(0)
+            , end(0)
+        {}
+        LocInterval(uint32_t start, uint32_t end) : start(start), end(end) {}
+
+        bool contains(uint32_t loc) const {
+            return start <= loc && loc <= end;
+        }
+    };
 
-    std::vector<GenomicProjectionResult> projectGenomicLocation(
+    struct ProjectedSegment {
+        // A run of consecutive refLocs whose direct projections are
+        // interpolated from the same anchors: Either the refLocs lie on the
+        // same alignment (score 1) or in the same gap between two anchors.
+        LocInterval ref;
+        ChromId qryChrom;
+        uint32_t qryStart;
+        uint32_t qryEnd;
+        // The projections of ref.start and ref.end (qryStart > qryEnd if the
+        // anchors are reversed).
+        double minScore;
+        double maxScore;
+        // The range of the scores of the refLocs.
+        Anchors anchors;
+
+        ProjectedSegment()
+            : qryChrom(0)
+            , qryStart(0)
+            , qryEnd(0)
+            , minScore(0)
+            , maxScore(0)
+        {}
+        ProjectedSegment(LocInterval const& ref,
+                         ChromId qryChrom,
+                         uint32_t qryStart,
+                         uint32_t qryEnd,
+                         double minScore,
+                         double maxScore,
+                         Anchors const& anchors)
+            : ref(ref)
+            , qryChrom(qryChrom)
+            , qryStart(qryStart)
+            , qryEnd(qryEnd)
+            , minScore(minScore)
+            , maxScore(maxScore)
+            , anchors(anchors)
+        {}
+    };
+
+    std::vector<ProjectedSegment> projectInterval(
         std::string const& refSpecies,
         std::string const& qrySpecies,
+        ChromId refChrom,
+        LocInterval const& refInterval,
+        ProjectionParams const& params);
+    // Returns the direct projections of all the refLocs of refInterval as
+    // segments in increasing ref order (liftOver-style). Walks over the
+    // pwaln entries once instead of projecting every refLoc on its own.
+    // Unmappable refLocs are not covered by any segment. For each refLoc the
+    // segment yields the same projection as the direct projection of
+    // projectCoords(). Throws std::invalid_argument if refInterval.start >
+    // refInterval.end. Stops early (with the segments so far) on cancel().
+
+    using TileProjection = std::pair<uint32_t, GenomicProjectionResult>;
+    // The refLoc of a tile and its direct projection.
+
+    std::vector<TileProjection> projectTiles(
+        std::string const& refSpecies,
+        std::string const& qrySpecies,
+        ChromId refChrom,
+        LocInterval const& refInterval,
+        uint32_t step,
+        ProjectionParams const& params);
+    // Returns the direct projections of the refLocs refInterval.start,
+    // refInterval.start + step, ... of refInterval that are mappable. Derived
+    // from the segments of projectInterval(). Stops early (with the tiles so
+    // far) on cancel().
+
+private:
+    struct AnchorsSearch {
+        // The last anchor search in a block. refLocs within `validity` yield
+        // the same anchors; for others, the search starts from
+        // closestDownstreamAnchorIdx (moving finger).
+        bool valid;
+        std::size_t closestDownstreamAnchorIdx;
+        LocInterval validity;
+        std::vector<Anchors> anchors;
+
+        AnchorsSearch()
+            : valid(false)
+            , closestDownstreamAnchorIdx(0)
+        {}
+    };
+
+    static constexpr std::size_t noUpperBoundHint
+        = std::numeric_limits<std::size_t>::max();
+    // See getAnchors().
+
+    struct ScoreScale {
+        // The factors of the exponent of the projection scores in one species
+        // (see projectionScore()).
+        double genomeSizeFactor;
+        // genomeSizeBasis / genomeSize
+        double halfLifeDistance;
+
+        ScoreScale(double genomeSizeFactor = 0, double halfLifeDistance = 1)
+            : genomeSizeFactor(genomeSizeFactor)
+            , halfLifeDistance(halfLifeDistance)
+        {}
+    };
+
+    struct AnchorsMemo;
+    // The AnchorsSearch of each (pwaln, ref chrom) of one worker thread.
+
+    struct ProjectCoordScratch;
+    // The containers used by one CoordSearch. They are reused from one
+    // search to the next to avoid allocations.
+
+    class CoordSearch;
+    // The shortest path search of one coord to its qry species. It can be
+    // suspended in front of each anchor search so that a worker can
+    // interleave the searches of several coords (see setSearchInterleave()).
+
+    struct SearchStats;
+    // The Stats of one worker thread.
+
+    SpeciesId requireSpeciesId(std::string const& speciesName) const;
+    // Like speciesIdFromName() but throws if the species is unknown.
+
+    template<typename Projection>
+    void projectCoordsImpl(
+        std::vector<Coords> const& jobs,
+        unsigned nThreads,
+        ProjectionParams const& params,
+        bool const memoizeAnchors,
+        SpeciesId refSpecies,
+        std::vector<SpeciesId> const& qrySpecies,
+        std::atomic<bool> const& cancelFlag,
+        std::function<void(Coords const&, Projection const&)> const&
+            onJobDoneCallback);
+    // Projects the jobs from refSpecies to the (distinct) qrySpecies and
+    // passes the results to the onJobDoneCallback() (see projectCoords()).
+    // No further jobs are started once cancelFlag is set.
+    // Projection is either a CoordProjection (one qry species) or a vector
+    // with one per qry species.
+
+    std::vector<ProjectedSegment> projectIntervalImpl(
+        SpeciesId refSpecies,
+        SpeciesId qrySpecies,
+        ChromId refChrom,
+        LocInterval const& refInterval,
+        ProjectionParams const& params,
+        std::atomic<bool> const& cancelFlag) const;
+    // See projectInterval(). Stops once cancelFlag is set.
+
+    template<typename Entries>
+    void intervalAnchors(Entries const& pwalnEntries,
+                         PwalnBlock const& block,
+                         ProjectionParams const& params,
+                         uint32_t refLoc,
+                         AnchorsSearch* search,
+                         uint32_t* intervalEnd,
+                         std::vector<Anchors>* anchors) const;
+    // Replaces the contents of anchors with the anchors of refLoc and sets
+    // intervalEnd to the last refLoc with the same anchors. Successive calls
+    // with increasing refLocs and the same search walk over the entries once.
+
+    static uint32_t interpolateQryLoc(Anchors const& anchors, uint32_t refLoc);
+    // Returns the projection of refLoc with the given anchors (see
+    // projectGenomicLocationUncached()).
+
+    void projectGenomicLocation(
+        Pwaln const& pwaln,
+        ScoreScale const& scoreScale,
         Coords const& refCoords,
-        uint64_t genomeSizeRef) const;
+        ProjectionParams const& params,
+        AnchorsMemo* anchorsMemo,
+        SearchStats* stats,
+        std::size_t upperBoundHint,
+        std::vector<Anchors>* anchorsBuffer,
+        std::vector<GenomicProjectionResult>* projs) const;
+    // Projects refCoords with the given pwaln and replaces the contents of
+    // projs with the results. scoreScale is the one of the ref species of the
+    // pwaln (see scoreScales()). anchorsBuffer is passed on to getAnchors().
+    // Uses the projection cache if it is enabled.
 
-    std::vector<Anchors> getAnchors(Pwaln const& pwaln,
-                                    std::string const& refSpecies,
-                                    Coords const& refCoords,
-                                    std::string const& qrySpecies) const;
+    void projectGenomicLocationUncached(
+        Pwaln const& pwaln,
+        ScoreScale const& scoreScale,
+        Coords const& refCoords,
+        ProjectionParams const& params,
+        AnchorsMemo* anchorsMemo,
+        SearchStats* stats,
+        std::size_t upperBoundHint,
+        std::vector<Anchors>* anchorsBuffer,
+        std::vector<GenomicProjectionResult>* projs) const;
 
-    static std::vector<PwalnEntry const*> longestSubsequence(
-        std::vector<PwalnEntry const*> const& seq);
+    void projectFirstHops(SpeciesId refSpecies,
+                          Coords const* refCoords,
+                          std::size_t numCoords,
+                          ProjectionParams const& params,
+                          AnchorsMemo* anchorsMemo,
+                          ProjectCoordScratch* scratch) const;
+    // Projects the sorted refCoords with each pwaln of the ref species (the
+    // first hop of their searches) into scratch->firstHops, indexed by
+    // coord*numPwalns + pwaln. The scores of the projections into gaps are
+    // computed in one projectionScores() batch per pwaln. Bypasses the
+    // projection cache (the anchorsMemo serves these runs of coords).
+
+    std::vector<Anchors> const& getAnchors(
+        Pwaln const& pwaln,
+        Coords const& refCoords,
+        ProjectionParams const& params,
+        AnchorsMemo* anchorsMemo,
+        SearchStats* stats,
+        std::size_t upperBoundHint,
+        std::vector<Anchors>* anchorsBuffer) const;
+    // Returns the anchors of refCoords. They are either the anchors of the
+    // AnchorsMemo (if given) or written to the caller-owned anchorsBuffer, so
+    // that the search does not allocate once the buffers have grown. The
+    // result is valid until the next call with the same memo or buffer.
+    // The stats (if given) count the search. upperBoundHint is the index of
+    // the first entry of the block with refStart > refCoords.loc if the
+    // caller already searched it (see CoordSearch), otherwise
+    // noUpperBoundHint.
+
+    template<typename Entries>
+    static void selectAnchors(
+        Entries const& pwalnEntries,
+        RefStartIndex const* refStartIndex,
+        uint16_t maxAnchorLength,
+        unsigned topn,
+        unsigned minn,
+        uint32_t refLoc,
+        AnchorsSearch* search,
+        Stats* stats,
+        std::vector<Anchors>* anchors);
+    // Selects the anchors for refLoc from the given PwalnEntries or
+    // CompactPwalnEntries and replaces the contents of anchors with them. The
+    // refStartIndex is used for the search of refLoc if given.
+    // If search is given, then a valid search is used as the starting point
+    // and it is updated with the closestDownstreamAnchorIdx and the validity
+    // of this search (but not its anchors).
+    // If stats are given, then the walk length and the LIS input size are
+    // added to them.
+    // Dispatches to selectAnchorsImpl() with buffers that fit topn.
+
+    template<unsigned MaxTopN, typename Entries>
+    static void selectAnchorsImpl(
+        Entries const& pwalnEntries,
+        RefStartIndex const* refStartIndex,
+        uint16_t maxAnchorLength,
+        unsigned topn,
+        unsigned minn,
+        uint32_t refLoc,
+        AnchorsSearch* search,
+        Stats* stats,
+        std::vector<Anchors>* anchors);
+    // The selectAnchors() kernel with stack buffers for up to MaxTopN
+    // anchors on each side (larger topn values spill to the heap).
+
+    template<typename AnchorPtrs>
+    static void longestCollinearSubsequence(AnchorPtrs const& seq,
+                                            AnchorPtrs* res);
     // Searches the longest strictly increasing or decreasing subsequence of seq
     // and puts it in res.
     // O(n log k) algorithm.
 
-    double projectionScore(uint32_t loc,
-                           uint32_t upBound,
-                           uint32_t downBound,
-                           uint64_t genomeSize,
-                           uint64_t genomeSizeRef) const;
+    std::vector<ScoreScale> scoreScales(ProjectionParams const& params) const;
+    // Returns the score scale of each species. The score of a projection at
+    // distance minDist from the closest anchor is
+    //     0.5^(minDist / halfLifeDistance * genomeSizeFactor).
+
+    static double projectionScore(uint32_t loc,
+                                  uint32_t upBound,
+                                  uint32_t downBound,
+                                  ScoreScale const& scoreScale);
+
+    static void projectionScores(uint32_t const* minDists,
+                                 std::size_t n,
+                                 ScoreScale const& scoreScale,
+                                 double* scores);
+    // Like projectionScore() for n distances to the closest anchor at once
+    // (see projectFirstHops()). Free of branches and calls other than pow()
+    // so that the compiler can vectorize it (with a vector math library,
+    // e.g. -O3 -fno-math-errno on glibc).
+
+    void loadPwalnsV4(std::string const& fileName);
+    void loadPwalnsV5(std::string const& fileName);
+    // Read the chromosomes and the index of the pwalns. loadPwalnsV5() also
+    // reads v6 files.
+
+    SpeciesId internSpecies(std::string const& speciesName);
+    // Returns the id of the given species and assigns a new one if necessary.
+
+    Pwaln& insertPwaln(std::string const& sp1, std::string const& sp2);
+    // Returns the pwaln from sp1 to sp2; creates it if necessary.
+
+    void indexChroms();
+    // Fills chromIds_ from chroms_.
+
+    void clearPwalns();
+    // Clears the species, chromosomes and pwalns.
+
+    bool readAnchorTables(std::istream& file);
+    // The part of loadAnchorTables() after the file is opened. Throws if the
+    // file is truncated or corrupt.
+
+    void clearProjectionCache();
+    // Drops the cached projections (if the cache is enabled).
+
+    void loadBlocks(unsigned nThreads);
+    void loadBlocks(std::vector<Pwaln const*> const& pwalns, unsigned nThreads);
+    // Loads all blocks (of the given pwalns) that are not loaded yet.
+
+    template<typename Item, typename Fn>
+    void forEachBlock(std::vector<Item const*> const& blocks,
+                      unsigned nThreads,
+                      Fn const& fn) const;
+    // Calls fn(block, file) for each of the given blocks (or other items,
+    // e.g. pwalns) with nThreads worker threads. Each thread has its own
+    // (initially closed) ifstream for loadBlock(). Exceptions are forwarded.
+
+    std::vector<std::pair<Pwaln const*, Pwaln*>> prepareDerivedPwalns();
+    // Returns the (forward, reverse) pwalns of the species pairs whose
+    // reverse direction is derived (see LoadOptions::deriveReverse). The
+    // reverse pwalns are created or emptied.
+
+    void derivePwaln(Pwaln const& forward, Pwaln* reverse) const;
+    // Fills reverse with the blocks of the opposite direction of forward
+    // (whose blocks must be loaded).
+
+    void indexBlock(PwalnBlock const& block) const;
+    // Builds the search index and/or the compact representation of the
+    // entries of the given block (according to the load options).
+
+    template<typename Entries>
+    static void buildAnchorTable(Entries const& pwalnEntries,
+                                 uint16_t maxAnchorLength,
+                                 AnchorTable* anchorTable);
+
+    void loadBlock(PwalnBlock const& block, std::ifstream& file) const;
+    // Makes the entries of the given block available (reads them from the
+    // given v4 file or decompresses them from the v6 file and/or converts
+    // them to the compact representation) unless that already happened.
+    // Thread-safe.
+
+    void ensureLoaded(PwalnBlock const& block) const;
+    // Loads the given block if that did not happen yet (lazy mode).
+
+    void mergeStats(SearchStats const& searchStats);
+    // Adds the stats of a worker to stats_.
 
 private:
+    class MappedFile;
+    class ProjectionCache;
+
+    friend struct IppBench;
+    // The microbenchmarks of the internals (bench/ipp_bench.cpp).
+
     std::vector<std::string> chroms_;
+    std::unordered_map<std::string, ChromId> chromIds_;
+    // The ids of the chroms_ names.
+    std::vector<std::string> species_;
+    std::unordered_map<std::string, SpeciesId> speciesIds_;
+    // The names of the species indexed by their ids, and vice versa.
     Pwalns pwalns_;
-    std::unordered_map<std::string, uint64_t> genomeSizes_;
-    unsigned halfLifeDistance_;
-    uint16_t maxAnchorLength_;
-    volatile bool cancel_;
+    std::string pwalnsFileName_;
+    uint8_t pwalnsFormatVersion_;
+    LoadOptions loadOptions_;
+    std::unique_ptr<MappedFile> mappedFile_;
+    // The memory mapping of a v5 file.
+    std::vector<uint64_t> genomeSizes_;
+    // Indexed by SpeciesId.
+    ProjectionParams defaultParams_;
+    std::unique_ptr<ProjectionCache> projectionCache_;
+    // Null if the cache is disabled.
+    bool pinThreads_;
+    unsigned searchInterleave_;
+    bool statsEnabled_;
+    mutable std::mutex statsMutex_;
+    mutable Stats stats_;
+    // Guarded by statsMutex_.
+    std::atomic<bool> cancel_;
+    std::mutex runningProjectionsMutex_;
+    std::size_t numRunningProjections_;
+    // Guarded by runningProjectionsMutex_. The params of the projection
+    // cache only change while no projection is running.
+    std::map<unsigned, unsigned> pinnedWorkerCpus_;
+    // Guarded by runningProjectionsMutex_. The worker CPU ranges
+    // (first, num) of the running projections with pinned threads.
 };
 
 template <typename ...Args>
@@ -0,0 +1,144 @@
+#!/usr/bin/env python
+
+# Reader of the binary results files that ipp.Ipp.project_bed_file_binary()
+# (project.py --stream --binary) writes. The format is described at
+# projectBedFileBinary() in bedstream.h; the columns are loaded with
+# np.frombuffer() without any parsing.
+#
+# Usage:
+#     res = read_results('regions.mm39-galGal6.projb')
+#     mapped = res['sequence_conservation'] > 0
+#     direct_chroms = res['chrom_names'][res['direct_chrom'][mapped]]
+
+import numpy as np
+import struct
+import sys
+
+SEQUENCE_CONSERVATION = np.array(['', 'DC', 'IC', 'NC'], dtype=object)
+# The names of the values of the sequence_conservation column (0: unmapped).
+
+ANCHOR_COLS = [
+    'ref_anchor_direct_left_start', 'ref_anchor_direct_left_end', 'ref_anchor_direct_right_start', 'ref_anchor_direct_right_end',
+    'ref_anchor_multi_left_start', 'ref_anchor_multi_left_end', 'ref_anchor_multi_right_start', 'ref_anchor_multi_right_end',
+    'qry_anchor_direct_left_start', 'qry_anchor_direct_left_end', 'qry_anchor_direct_right_start', 'qry_anchor_direct_right_end',
+    'qry_anchor_multi_left_start', 'qry_anchor_multi_left_end', 'qry_anchor_multi_right_start', 'qry_anchor_multi_right_end']
+# The names of the columns of the anchors array (as in the .proj table).
+
+_COLUMNS = [('ref_chrom', 'i4'), ('ref_loc', 'u4'),
+            ('direct_chrom', 'i4'), ('direct_loc', 'u4'), ('direct_score', 'f8'),
+            ('multi_chrom', 'i4'), ('multi_loc', 'u4'), ('multi_score', 'f8')]
+
+def read_results(path):
+    # Returns the results in the given file as a dict:
+    #     ref_species, qry_species   str
+    #     species_names              [str], indexed by species id
+    #     chrom_names                np.array of str, indexed by chrom id
+    #     score_DC, score_IC         float, the classification thresholds
+    #     names                      np.array of str, the region names
+    #     ref_chrom ... multi_score  np.array, one entry per region
+    #     bridging_species           np.array of uint64 [regions, mask words]
+    #     sequence_conservation      np.array of uint8 (see
+    #                                SEQUENCE_CONSERVATION)
+    #     anchors                    np.array of uint32 [regions, 16] (see
+    #                                ANCHOR_COLS; only if written)
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if data[:6] != b'IPPRES':
+        raise ValueError('not an ipp results file: %s' %path)
+    order = '<' if struct.unpack_from('<H', data, 6)[0] == 0xAFFE else '>'
+    if struct.unpack_from(order + 'H', data, 6)[0] != 0xAFFE:
+        raise ValueError('invalid endianness magic: %s' %path)
+    version, flags, num_mask_words = struct.unpack_from(order + 'BBH', data, 8)
+    if version != 1:
+        raise ValueError('unsupported results format version %i: %s' %(version, path))
+    with_anchors = bool(flags & 1)
+    score_DC, score_IC, ref_species, qry_species, num_species = \
+        struct.unpack_from(order + 'ddHHH', data, 16)
+    pos = 38
+
+    def read_strings(count):
+        nonlocal pos
+        strings = []
+        for _ in range(count):
+            end = data.index(b'\0', pos)
+            strings.append(data[pos:end].decode())
+            pos = end + 1
+        return strings
+
+    def align():
+        nonlocal pos
+        pos += -pos % 8
+
+    species_names = read_strings(num_species)
+    num_chroms, = struct.unpack_from(order + 'I', data, pos)
+    pos += 4
+    chrom_names = np.array(read_strings(num_chroms), dtype=object)
+    align()
+
+    def read_column(dtype, count):
+        nonlocal pos
+        dtype = np.dtype(dtype).newbyteorder(order)
+        column = np.frombuffer(data, dtype=dtype, count=count, offset=pos)
+        pos += count * dtype.itemsize
+        align()
+        return column
+
+    batches = {name: [] for name, _ in _COLUMNS}
+    for name in ['names', 'bridging_species', 'sequence_conservation', 'anchors']:
+        batches[name] = []
+    while True:
+        if pos + 8 > len(data):
+            raise ValueError('truncated results file: %s' %path)
+        num_records, = struct.unpack_from(order + 'Q', data, pos)
+        pos += 8
+        if num_records == 0:
+            break
+        names_size, = struct.unpack_from(order + 'Q', data, pos)
+        pos += 8
+        name_ends = read_column('u4', num_records)
+        names = data[pos:pos + names_size]
+        pos += names_size
+        align()
+        name_begins = np.concatenate(([0], name_ends[:-1]))
+        batches['names'].append(np.array([names[b:e].decode() for b, e in zip(name_begins, name_ends)],
+                                         dtype=object))
+        for name, dtype in _COLUMNS:
+            batches[name].append(read_column(dtype, num_records))
+        batches['bridging_species'].append(
+            read_column('u8', num_records * num_mask_words).reshape(num_records, num_mask_words))
+        batches['sequence_conservation'].append(read_column('u1', num_records))
+        if with_anchors:
+            batches['anchors'].append(read_column('u4', num_records * 16).reshape(num_records, 16))
+
+    empty = {'names': np.empty(0, dtype=object),
+             'bridging_species': np.empty((0, num_mask_words), dtype=np.uint64),
+             'sequence_conservation': np.empty(0, dtype=np.uint8),
+             'anchors': np.empty((0, 16), dtype=np.uint32),
+             **{name: np.empty(0, dtype=dtype) for name, dtype in _COLUMNS}}
+    res = {'ref_species': species_names[ref_species],
+           'qry_species': species_names[qry_species],
+           'species_names': species_names,
+           'chrom_names': chrom_names,
+           'score_DC': score_DC,
+           'score_IC': score_IC}
+    for name, columns in batches.items():
+        if name == 'anchors' and not with_anchors:
+            continue
+        res[name] = np.concatenate(columns) if columns else empty[name]
+    return res
+
+def bridging_species_names(res, i):
+    # Returns the names of the bridging species of the i-th region.
+    mask = res['bridging_species'][i]
+    return [name for j, name in enumerate(res['species_names'])
+            if int(mask[j // 64]) >> (j % 64) & 1]
+
+if __name__ == '__main__':
+    # Prints a summary of the given results file.
+    res = read_results(sys.argv[1])
+    classes = res['sequence_conservation']
+    print('%s -> %s: %i regions, %i unmapped, %i DC, %i IC, %i NC'
+          %(res['ref_species'], res['qry_species'], len(classes),
+            np.sum(classes == 0), np.sum(classes == 1), np.sum(classes == 2),
+            np.sum(classes == 3)))
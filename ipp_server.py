@@ -0,0 +1,251 @@
+#!/usr/bin/env python
+
+# Long-lived projection server: Loads the pwaln file once and serves
+# projections over a Unix socket, so that many small projections don't each
+# pay for loadPwalns().
+#
+# Protocol: One JSON object per line in each direction.
+#     request:  {"method": name, "args": [...], "kwargs": {...}}
+#     response: {"result": ...} or {"error": message}
+# numpy arrays are sent as {"__ndarray__": base64 of the raw data, "dtype":
+# ..., "shape": [...]}. The methods are those of ipp.Ipp in SERVED_METHODS.
+#
+# The projections are queued (up to --queue_size, then requests are rejected
+# with a "server busy" error) and run one after another with --n_cores
+# worker threads each; the other methods are answered right away.
+# The projections run on a dispatcher thread, so they don't install the
+# SIGINT/SIGTERM handlers of the ipp module: Ctrl-C stops the server. A
+# projection that is cancelled anyway is answered with an error.
+# With a v5 pwaln file, the alignments are used in place from the memory
+# mapping of the file, so several servers (or other processes) on the same
+# machine share one copy in the page cache.
+#
+# Clients: RemoteIpp below, e.g. project.py --server SOCKET.
+
+import argparse
+import base64
+import json
+import numpy as np
+import os
+import queue
+import socket
+import socketserver
+import sys
+import threading
+
+SERVED_METHODS = {'get_chrom_names', 'get_genome_size',
+                  'get_projection_cache_stats', 'get_stats',
+                  'project_coords_array', 'project_coords_multi'}
+QUEUED_METHODS = {'project_coords_array', 'project_coords_multi'}
+# The methods that run on the worker threads (all others are cheap).
+
+def encode(obj):
+    # Returns obj with the numpy arrays replaced by their JSON encoding.
+    if isinstance(obj, np.ndarray):
+        if obj.dtype == object:
+            return [encode(x) for x in obj]
+        return {'__ndarray__': base64.b64encode(np.ascontiguousarray(obj).tobytes()).decode('ascii'),
+                'dtype': obj.dtype.str,
+                'shape': list(obj.shape)}
+    if isinstance(obj, dict):
+        return {k: encode(v) for k, v in obj.items()}
+    if isinstance(obj, (list, tuple)):
+        return [encode(x) for x in obj]
+    if isinstance(obj, np.generic):
+        return obj.item()
+    return obj
+
+def decode(obj):
+    # Inverse of encode().
+    if isinstance(obj, dict):
+        if '__ndarray__' in obj:
+            return np.frombuffer(base64.b64decode(obj['__ndarray__']),
+                                 dtype=np.dtype(obj['dtype'])).reshape(obj['shape'])
+        return {k: decode(v) for k, v in obj.items()}
+    if isinstance(obj, list):
+        return [decode(x) for x in obj]
+    return obj
+
+def stats_to_json(stats):
+    # get_stats() keys the anchor searches by (ref, qry) tuples, which JSON
+    # does not support.
+    stats = dict(stats)
+    stats['get_anchors_calls'] = [[ref, qry, n] for (ref, qry), n
+                                  in stats['get_anchors_calls'].items()]
+    return stats
+
+def stats_from_json(stats):
+    stats['get_anchors_calls'] = {(ref, qry): n for ref, qry, n
+                                  in stats['get_anchors_calls']}
+    return stats
+
+
+class Job:
+    # A queued projection and its result.
+    def __init__(self, method, args, kwargs):
+        self.method = method
+        self.args = args
+        self.kwargs = kwargs
+        self.response = None
+        self.done = threading.Event()
+
+
+class ProjectionServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    # Serves the requests of each connection on its own thread; the
+    # projections are passed to the worker thread via the bounded job queue.
+    daemon_threads = True
+
+    def __init__(self, socket_path, my_ipp, n_threads, queue_size):
+        self.ipp = my_ipp
+        self.n_threads = n_threads
+        self.jobs = queue.Queue(maxsize=queue_size)
+        super().__init__(socket_path, RequestHandler)
+        threading.Thread(target=self.run_jobs, daemon=True).start()
+
+    def call(self, method, args, kwargs):
+        # Calls the given method of the Ipp and returns the response.
+        try:
+            if method == 'get_stats':
+                return {'result': stats_to_json(self.ipp.get_stats())}
+            if method in QUEUED_METHODS:
+                # The server decides on the number of threads.
+                kwargs['n_threads'] = self.n_threads
+            return {'result': getattr(self.ipp, method)(*args, **kwargs)}
+        except KeyboardInterrupt:
+            # Cancelled: The results would be incomplete.
+            return {'error': 'projection cancelled'}
+        except Exception as e:
+            return {'error': '%s: %s' %(type(e).__name__, e)}
+
+    def run_jobs(self):
+        # Runs the queued projections one after another.
+        while True:
+            job = self.jobs.get()
+            job.response = self.call(job.method, job.args, job.kwargs)
+            job.done.set()
+
+    def handle_request_line(self, line):
+        # Returns the response to the given request.
+        try:
+            request = json.loads(line)
+            method = request['method']
+            args = decode(request.get('args', []))
+            kwargs = decode(request.get('kwargs', {}))
+        except (ValueError, KeyError, TypeError) as e:
+            return {'error': 'invalid request: %s' %e}
+        if method not in SERVED_METHODS:
+            return {'error': 'unknown method: %s' %method}
+        if method not in QUEUED_METHODS:
+            return self.call(method, args, kwargs)
+
+        job = Job(method, args, kwargs)
+        try:
+            self.jobs.put_nowait(job)
+        except queue.Full:
+            return {'error': 'server busy'}
+        job.done.wait()
+        return job.response
+
+
+class RequestHandler(socketserver.StreamRequestHandler):
+    def handle(self):
+        for line in self.rfile:
+            response = self.server.handle_request_line(line)
+            self.wfile.write(json.dumps(encode(response)).encode('utf-8') + b'\n')
+            self.wfile.flush()
+
+
+class RemoteIpp:
+    # Client of a projection server with the same interface as ipp.Ipp for
+    # the SERVED_METHODS.
+    def __init__(self, socket_path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(socket_path)
+        self.file = self.sock.makefile('rwb')
+        self.chrom_names = None
+
+    def close(self):
+        self.file.close()
+        self.sock.close()
+
+    def call(self, method, *args, **kwargs):
+        self.file.write(json.dumps({'method': method,
+                                    'args': encode(args),
+                                    'kwargs': encode(kwargs)}).encode('utf-8') + b'\n')
+        self.file.flush()
+        line = self.file.readline()
+        if not line:
+            raise RuntimeError('connection to the projection server closed')
+        response = json.loads(line)
+        if 'error' in response:
+            raise RuntimeError(response['error'])
+        return decode(response['result'])
+
+    def get_chrom_names(self):
+        # The chrom names don't change, so they are only fetched once.
+        if self.chrom_names is None:
+            self.chrom_names = self.call('get_chrom_names')
+        return self.chrom_names
+
+    def get_genome_size(self, species):
+        return self.call('get_genome_size', species)
+
+    def get_projection_cache_stats(self):
+        return self.call('get_projection_cache_stats')
+
+    def get_stats(self):
+        return stats_from_json(self.call('get_stats'))
+
+    def project_coords_array(self, *args, **kwargs):
+        return self.call('project_coords_array', *args, **kwargs)
+
+    def project_coords_multi(self, *args, **kwargs):
+        return self.call('project_coords_multi', *args, **kwargs)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Serve projections with the alignments of one pwaln file over a Unix socket')
+    parser.add_argument('path_pwaln')
+    parser.add_argument('socket', help='Path of the Unix socket to listen on')
+    parser.add_argument('-n', '--n_cores', type=int, default=1, help='Number of CPUs per projection')
+    parser.add_argument('--queue_size', type=int, default=64, help='Maximum number of waiting projection requests (more are rejected with "server busy")')
+    parser.add_argument('-l', '--lazy', action='store_true', help='Only read the alignments from the pwaln file once they are needed')
+    parser.add_argument('--compact', action='store_true', help='Keep the alignments in a compact representation in memory')
+    parser.add_argument('--search_index', action='store_true', help='Build a search index for the alignments')
+    parser.add_argument('--anchor_tables', action='store_true', help='Use the precomputed anchors of each alignment gap from the <path_pwaln>.anchors file')
+    parser.add_argument('--derive_reverse', action='store_true', help='Only keep one direction of each species pair in memory and derive the other one from it')
+    parser.add_argument('--numa', action='store_true', help='Interleave the alignments over the memory of all NUMA nodes and pin the worker threads to CPUs spread over the nodes (multi-socket machines)')
+    parser.add_argument('--cache_size', type=int, default=0, help='Cache up to this many projections of intermediate coordinates (shared by all requests; 0: no cache)')
+    parser.add_argument('--stats', action='store_true', help='Collect the stats of the projections (see get_stats())')
+    args = parser.parse_args()
+
+    import ipp
+    my_ipp = ipp.Ipp()
+    my_ipp.set_stats_enabled(args.stats)
+    my_ipp.set_thread_pinning(args.numa)
+    my_ipp.load_pwalns(args.path_pwaln,
+                       n_threads=args.n_cores,
+                       lazy=args.lazy,
+                       compact=args.compact,
+                       search_index=args.search_index,
+                       anchor_tables=args.anchor_tables,
+                       derive_reverse=args.derive_reverse,
+                       numa_interleave=args.numa)
+    my_ipp.set_projection_cache_size(args.cache_size)
+
+    if os.path.exists(args.socket):
+        # A stale socket of a previous server.
+        os.unlink(args.socket)
+    with ProjectionServer(args.socket, my_ipp, args.n_cores, args.queue_size) as server:
+        print('Serving %s on %s' %(args.path_pwaln, args.socket), file=sys.stderr)
+        try:
+            server.serve_forever()
+        except KeyboardInterrupt:
+            pass
+        finally:
+            os.unlink(args.socket)
+
+if __name__ == '__main__':
+    main()
+
+# vim: tabstop=4 shiftwidth=4 expandtab
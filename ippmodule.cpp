@@ -4,13 +4,25 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include <algorithm>
 #include <csignal>
 #include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#include "bedstream.h"
 #include "ipp.h"
+#include "projectjob.h"
 
 namespace {
 
@@ -19,14 +31,42 @@ class AbortSignalHandler;
 
 AbortSignalHandler* currentAbortSignalHandler(nullptr);
 
+bool
+isMainThread() {
+    // Returns whether the calling thread is the main thread of the
+    // interpreter, the only one that python delivers signals to. Requires
+    // the GIL.
+    PyObject* const threading(PyImport_ImportModule("threading"));
+    PyObject* const mainThread(
+        threading ? PyObject_CallMethod(threading, "main_thread", nullptr)
+                  : nullptr);
+    PyObject* const currentThread(
+        threading ? PyObject_CallMethod(threading, "current_thread", nullptr)
+                  : nullptr);
+    bool const ret(mainThread && mainThread == currentThread);
+    Py_XDECREF(currentThread);
+    Py_XDECREF(mainThread);
+    Py_XDECREF(threading);
+    PyErr_Clear();
+    return ret;
+}
+
 class AbortSignalHandler {
     // Registers signal handlers for SIGINT and SIGTERM and calls ipp->cancel()
     // upon receiving them.
     // The previous signal handlers are re-installed upon destruction.
+    // Does nothing unless it is created on the main thread: The handlers are
+    // process-wide, so a projection on another thread (e.g. the dispatcher of
+    // ipp_server.py) would otherwise swallow the signals meant for the main
+    // thread.
 public:
     explicit AbortSignalHandler(Ipp* ipp)
         : ipp_(ipp)
+        , installed_(isMainThread())
     {
+        if (!installed_) {
+            return;
+        }
         currentAbortSignalHandler = this;
 
         prevSigIntHandler_ = std::signal(SIGINT, ::signalHandler);
@@ -34,6 +74,9 @@ public:
     }
 
     ~AbortSignalHandler() {
+        if (!installed_) {
+            return;
+        }
         std::signal(SIGTERM, prevSigTermHandler_);
         std::signal(SIGINT, prevSigIntHandler_);
 
@@ -46,6 +89,7 @@ public:
 
 private:
     Ipp* const ipp_;
+    bool const installed_;
 
     typedef void(*SigHandler)(int);
     SigHandler prevSigIntHandler_;
@@ -57,6 +101,350 @@ signalHandler(int signal) {
     currentAbortSignalHandler->signalHandler(signal);
 }
 
+struct PyDecRef {
+    void operator()(PyObject* obj) const {
+        Py_XDECREF(obj);
+    }
+};
+using PyObjectPtr = std::unique_ptr<PyObject, PyDecRef>;
+// Owning reference to a python object.
+
+template<typename T>
+PyObject*
+createPyArray(std::vector<T> const& data, int typeNum, npy_intp numCols = 1) {
+    // Returns a new numpy array with a copy of the given data. The array is
+    // one-dimensional if numCols == 1 and has numCols columns otherwise.
+    npy_intp dims[2] = {static_cast<npy_intp>(data.size()) / numCols, numCols};
+    PyObject* const pyArray(PyArray_SimpleNew(numCols > 1 ? 2 : 1,
+                                              dims,
+                                              typeNum));
+    if (pyArray && !data.empty()) {
+        std::memcpy(PyArray_DATA(reinterpret_cast<PyArrayObject*>(pyArray)),
+                    data.data(),
+                    data.size()*sizeof(T));
+    }
+    return pyArray;
+}
+
+struct ProjectionColumns {
+    // The results of project_coords_array() in columnar form.
+    // The shortest paths of all rows are concatenated; the entries of row i
+    // are [pathOffsets[i], pathOffsets[i+1]). Each anchor consists of four
+    // values: ref_start, ref_end, qry_start, qry_end.
+    std::vector<std::string> speciesNames;
+    std::unordered_map<std::string, int32_t> speciesIds;
+
+    std::vector<int32_t> directChrom;
+    std::vector<uint32_t> directLoc;
+    std::vector<double> directScore;
+    std::vector<uint32_t> directUpAnchor;
+    std::vector<uint32_t> directDownAnchor;
+
+    std::vector<int32_t> multiChrom;
+    std::vector<uint32_t> multiLoc;
+    std::vector<double> multiScore;
+
+    std::vector<int64_t> pathOffsets;
+    std::vector<int32_t> pathSpecies;
+    std::vector<int32_t> pathChrom;
+    std::vector<uint32_t> pathLoc;
+    std::vector<double> pathScore;
+    std::vector<uint32_t> pathUpAnchor;
+    std::vector<uint32_t> pathDownAnchor;
+
+    explicit ProjectionColumns(std::size_t numRows, bool includeAnchors)
+        : includeAnchors_(includeAnchors)
+    {
+        directChrom.reserve(numRows);
+        directLoc.reserve(numRows);
+        directScore.reserve(numRows);
+        multiChrom.reserve(numRows);
+        multiLoc.reserve(numRows);
+        multiScore.reserve(numRows);
+        pathOffsets.reserve(numRows + 1);
+        pathOffsets.push_back(0);
+        if (includeAnchors_) {
+            directUpAnchor.reserve(4*numRows);
+            directDownAnchor.reserve(4*numRows);
+        }
+    }
+
+    void append(Ipp::CoordProjection const* coordProjection) {
+        // Appends a row. coordProjection is nullptr if there is no result.
+        static Ipp::PwalnEntry const noAnchor;
+        bool const hasDirect(coordProjection
+                             && coordProjection->direct.has_value());
+        if (hasDirect) {
+            Ipp::GenomicProjectionResult const& direct(
+                *coordProjection->direct);
+            directChrom.push_back(direct.nextCoords.chrom);
+            directLoc.push_back(direct.nextCoords.loc);
+            directScore.push_back(direct.score);
+        } else {
+            directChrom.push_back(-1);
+            directLoc.push_back(0);
+            directScore.push_back(0);
+        }
+        if (includeAnchors_) {
+            appendAnchor(&directUpAnchor,
+                         hasDirect
+                         ? coordProjection->direct->anchors.upstream
+                         : noAnchor);
+            appendAnchor(&directDownAnchor,
+                         hasDirect
+                         ? coordProjection->direct->anchors.downstream
+                         : noAnchor);
+        }
+
+        if (coordProjection && !coordProjection->multiShortestPath.empty()) {
+            Ipp::ShortestPathEntry const& last(
+                coordProjection->multiShortestPath.back());
+            multiChrom.push_back(last.coords.chrom);
+            multiLoc.push_back(last.coords.loc);
+            multiScore.push_back(last.score);
+
+            for (Ipp::ShortestPathEntry const& spe
+                     : coordProjection->multiShortestPath) {
+                auto const [it, inserted] = speciesIds.try_emplace(
+                    spe.species, speciesNames.size());
+                if (inserted) {
+                    speciesNames.push_back(spe.species);
+                }
+                pathSpecies.push_back(it->second);
+                pathChrom.push_back(spe.coords.chrom);
+                pathLoc.push_back(spe.coords.loc);
+                pathScore.push_back(spe.score);
+                if (includeAnchors_) {
+                    appendAnchor(&pathUpAnchor, spe.anchors.upstream);
+                    appendAnchor(&pathDownAnchor, spe.anchors.downstream);
+                }
+            }
+        } else {
+            multiChrom.push_back(-1);
+            multiLoc.push_back(0);
+            multiScore.push_back(0);
+        }
+        pathOffsets.push_back(pathSpecies.size());
+    }
+
+    PyObject* createPyDict() const {
+        // Returns the columns as a dict of numpy arrays.
+        PyObjectPtr dict(PyDict_New());
+        if (!dict) {
+            return nullptr;
+        }
+        auto const setItem = [&](char const* key, PyObject* value) {
+            PyObjectPtr const valuePtr(value);
+            return valuePtr
+                && PyDict_SetItemString(dict.get(), key, value) == 0;
+        };
+
+        PyObject* const pySpeciesNames(PyList_New(speciesNames.size()));
+        for (std::size_t i(0); pySpeciesNames && i < speciesNames.size(); ++i) {
+            PyList_SET_ITEM(pySpeciesNames,
+                            i,
+                            PyUnicode_FromString(speciesNames[i].c_str()));
+        }
+
+        bool const ok(
+            setItem("species", pySpeciesNames)
+            && setItem("direct_chrom", createPyArray(directChrom, NPY_INT32))
+            && setItem("direct_loc", createPyArray(directLoc, NPY_UINT32))
+            && setItem("direct_score", createPyArray(directScore, NPY_FLOAT64))
+            && setItem("multi_chrom", createPyArray(multiChrom, NPY_INT32))
+            && setItem("multi_loc", createPyArray(multiLoc, NPY_UINT32))
+            && setItem("multi_score", createPyArray(multiScore, NPY_FLOAT64))
+            && setItem("path_offsets", createPyArray(pathOffsets, NPY_INT64))
+            && setItem("path_species", createPyArray(pathSpecies, NPY_INT32))
+            && setItem("path_chrom", createPyArray(pathChrom, NPY_INT32))
+            && setItem("path_loc", createPyArray(pathLoc, NPY_UINT32))
+            && setItem("path_score", createPyArray(pathScore, NPY_FLOAT64))
+            && (!includeAnchors_
+                || (setItem("direct_up_anchor",
+                            createPyArray(directUpAnchor, NPY_UINT32, 4))
+                    && setItem("direct_down_anchor",
+                               createPyArray(directDownAnchor, NPY_UINT32, 4))
+                    && setItem("path_up_anchor",
+                               createPyArray(pathUpAnchor, NPY_UINT32, 4))
+                    && setItem("path_down_anchor",
+                               createPyArray(pathDownAnchor, NPY_UINT32, 4)))));
+        if (!ok) {
+            return nullptr;
+        }
+        return dict.release();
+    }
+
+private:
+    static void appendAnchor(std::vector<uint32_t>* column,
+                             Ipp::PwalnEntry const& anchor) {
+        column->push_back(anchor.refStart());
+        column->push_back(anchor.refEnd());
+        column->push_back(anchor.qryStart());
+        column->push_back(anchor.qryEnd());
+    }
+
+    bool includeAnchors_;
+};
+
+class RefCoordsArrays {
+    // The ref coords given as numpy arrays of chrom ids and locs.
+public:
+    bool parse(PyObject* pyRefChromsArg,
+               PyObject* pyRefLocsArg,
+               std::size_t numChroms) {
+        // Converts the arrays and collects the distinct coords. Rows with an
+        // unknown chrom id have no result. Sets a python exception and
+        // returns false on errors.
+        pyRefChroms_.reset(
+            PyArray_FROM_OTF(pyRefChromsArg, NPY_INT64, NPY_ARRAY_IN_ARRAY));
+        pyRefLocs_.reset(
+            PyArray_FROM_OTF(pyRefLocsArg, NPY_INT64, NPY_ARRAY_IN_ARRAY));
+        if (!pyRefChroms_ || !pyRefLocs_) {
+            return false;
+        }
+        auto const refChromsArray(
+            reinterpret_cast<PyArrayObject*>(pyRefChroms_.get()));
+        auto const refLocsArray(
+            reinterpret_cast<PyArrayObject*>(pyRefLocs_.get()));
+        if (PyArray_NDIM(refChromsArray) != 1
+            || PyArray_NDIM(refLocsArray) != 1
+            || PyArray_DIM(refChromsArray, 0) != PyArray_DIM(refLocsArray, 0)) {
+            PyErr_SetString(PyExc_ValueError,
+                            "ref_chroms and ref_locs must be 1d arrays of the same size");
+            return false;
+        }
+        numRows_ = PyArray_DIM(refChromsArray, 0);
+        numChroms_ = numChroms;
+        refChroms_ = static_cast<int64_t const*>(PyArray_DATA(refChromsArray));
+        refLocs_ = static_cast<int64_t const*>(PyArray_DATA(refLocsArray));
+
+        refCoords_.clear();
+        refCoords_.reserve(numRows_);
+        for (std::size_t i(0); i < numRows_; ++i) {
+            if (refLocs_[i] < 0
+                || refLocs_[i] > std::numeric_limits<uint32_t>::max()) {
+                PyErr_SetString(PyExc_ValueError, "ref_locs out of range");
+                return false;
+            }
+            if (0 <= refChroms_[i]
+                && static_cast<std::size_t>(refChroms_[i]) < numChroms) {
+                refCoords_.emplace_back(refChroms_[i], refLocs_[i]);
+            }
+        }
+        std::sort(refCoords_.begin(), refCoords_.end());
+        refCoords_.erase(std::unique(refCoords_.begin(), refCoords_.end()),
+                         refCoords_.end());
+        return true;
+    }
+
+    std::vector<Ipp::Coords> const& refCoords() const {
+        // The distinct valid coords.
+        return refCoords_;
+    }
+
+    std::size_t numRows() const {
+        return numRows_;
+    }
+
+    std::optional<Ipp::Coords> rowCoords(std::size_t row) const {
+        // Returns the coords of the given row (none if the chrom id is
+        // unknown).
+        if (refChroms_[row] < 0
+            || static_cast<std::size_t>(refChroms_[row]) >= numChroms_) {
+            return std::nullopt;
+        }
+        return Ipp::Coords(refChroms_[row], refLocs_[row]);
+    }
+
+    template<typename Projection>
+    Projection const* find(
+        std::map<Ipp::Coords, Projection> const& results,
+        std::size_t row) const {
+        // Returns the result of the given row (nullptr if there is none).
+        if (refChroms_[row] < 0) {
+            return nullptr;
+        }
+        auto const it(results.find(Ipp::Coords(refChroms_[row],
+                                               refLocs_[row])));
+        return it != results.end() ? &it->second : nullptr;
+    }
+
+private:
+    PyObjectPtr pyRefChroms_;
+    PyObjectPtr pyRefLocs_;
+    std::size_t numRows_ = 0;
+    std::size_t numChroms_ = 0;
+    int64_t const* refChroms_ = nullptr;
+    int64_t const* refLocs_ = nullptr;
+    std::vector<Ipp::Coords> refCoords_;
+};
+
+bool
+parseProjectionParams(PyObject* pyParams, Ipp::ProjectionParams* params) {
+    // Overrides the given params with the values of the given dict with the
+    // keys topn, minn, half_life_distance, genome_size_basis,
+    // max_path_length, min_score and early_cutoff. pyParams may be None.
+    // Sets a python exception and returns false on errors.
+    if (!pyParams || pyParams == Py_None) {
+        return true;
+    }
+    if (!PyDict_Check(pyParams)) {
+        PyErr_SetString(PyExc_TypeError, "params must be a dict");
+        return false;
+    }
+
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos(0);
+    while (PyDict_Next(pyParams, &pos, &key, &value)) {
+        char const* const name(PyUnicode_AsUTF8(key));
+        if (!name) {
+            return false;
+        }
+        auto const asUnsigned = [&](auto* dest) {
+            unsigned long long const v(PyLong_AsUnsignedLongLong(value));
+            if (PyErr_Occurred()) {
+                return false;
+            }
+            using Dest = std::remove_pointer_t<decltype(dest)>;
+            if (v > std::numeric_limits<Dest>::max()) {
+                PyErr_Format(PyExc_OverflowError,
+                             "projection param %s is too large",
+                             name);
+                return false;
+            }
+            *dest = v;
+            return true;
+        };
+        bool ok;
+        if (!std::strcmp(name, "topn")) {
+            ok = asUnsigned(&params->topn);
+        } else if (!std::strcmp(name, "minn")) {
+            ok = asUnsigned(&params->minn);
+        } else if (!std::strcmp(name, "half_life_distance")) {
+            ok = asUnsigned(&params->halfLifeDistance);
+        } else if (!std::strcmp(name, "genome_size_basis")) {
+            ok = asUnsigned(&params->genomeSizeBasis);
+        } else if (!std::strcmp(name, "max_path_length")) {
+            ok = asUnsigned(&params->searchLimits.maxPathLength);
+        } else if (!std::strcmp(name, "min_score")) {
+            params->searchLimits.minScore = PyFloat_AsDouble(value);
+            ok = !PyErr_Occurred();
+        } else if (!std::strcmp(name, "early_cutoff")) {
+            int const v(PyObject_IsTrue(value));
+            params->searchLimits.earlyCutoff = v > 0;
+            ok = v >= 0;
+        } else {
+            PyErr_Format(PyExc_ValueError, "unknown projection param: %s", name);
+            return false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
 } // namespace
 
 extern "C" {
@@ -64,11 +452,17 @@ extern "C" {
 PyTypeObject* PyIppAnchor_Type(nullptr);
 PyTypeObject* PyIppCoords_Type(nullptr);
 PyTypeObject* PyIppShortestPathEntry_Type(nullptr);
+PyTypeObject* PyIppProjectionJob_Type(nullptr);
 
 struct PyIpp {
     PyObject_HEAD
 
     Ipp ipp;
+    std::size_t numRunningCalls;
+    // The calls that use the ipp w/o the GIL, e.g. project_coords_array().
+    std::vector<ProjectCoordsJob const*> jobs;
+    // The jobs of the ipp.ProjectionJobs started on the ipp.
+    // Both guarded by the GIL.
 };
 
 static PyObject*
@@ -77,6 +471,8 @@ ippNew(PyTypeObject* type, PyObject* args, PyObject* kwds) {
     if (self != nullptr) {
         // In-place construct the Ipp instance.
         new (&self->ipp) Ipp();
+        self->numRunningCalls = 0;
+        new (&self->jobs) std::vector<ProjectCoordsJob const*>();
     }
     return (PyObject *) self;
 }
@@ -84,21 +480,87 @@ ippNew(PyTypeObject* type, PyObject* args, PyObject* kwds) {
 static void
 ippDealloc(PyIpp* self) {
     // Destruct the ipp instance.
+    self->jobs.~vector();
     self->ipp.~Ipp();
 
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+class RunningCall {
+    // Registers a call that uses the ipp w/o the GIL for its lifetime (which
+    // must begin and end with the GIL held).
+public:
+    explicit RunningCall(PyIpp* self) : self_(self) {
+        ++self_->numRunningCalls;
+    }
+    ~RunningCall() {
+        --self_->numRunningCalls;
+    }
+
+    RunningCall(RunningCall const&) = delete;
+    RunningCall& operator=(RunningCall const&) = delete;
+
+private:
+    PyIpp* const self_;
+};
+
+static bool
+checkNotProjecting(PyIpp* self) {
+    // Raises a RuntimeError and returns false if projections are running on
+    // the ipp (which must not be loaded or configured meanwhile).
+    bool projecting(self->numRunningCalls > 0);
+    for (ProjectCoordsJob const* job : self->jobs) {
+        projecting = projecting || !job->isDone();
+    }
+    if (projecting) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "the Ipp must not be loaded or configured while "
+                        "projections are running");
+        return false;
+    }
+    return true;
+}
+
 static PyObject*
-ippLoadPwalns(PyIpp* self, PyObject* args) {
+ippLoadPwalns(PyIpp* self, PyObject* args, PyObject* kwds) {
     // Reads the pwalns from the given file.
+    static char const* kwlist[] = {
+        "file_name", "n_threads", "lazy", "compact", "search_index",
+        "anchor_tables", "derive_reverse", "numa_interleave", nullptr};
     char const* fileName;
-    if (!PyArg_ParseTuple(args,"s", &fileName)) {
+    Ipp::LoadOptions options;
+    int lazy(options.lazy);
+    int compact(options.compact);
+    int searchIndex(options.searchIndex);
+    int anchorTables(options.anchorTables);
+    int deriveReverse(options.deriveReverse);
+    int numaInterleave(options.numaInterleave);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "s|Ipppppp",
+                                     const_cast<char**>(kwlist),
+                                     &fileName,
+                                     &options.nThreads,
+                                     &lazy,
+                                     &compact,
+                                     &searchIndex,
+                                     &anchorTables,
+                                     &deriveReverse,
+                                     &numaInterleave)) {
+        return nullptr;
+    }
+    options.lazy = lazy;
+    options.compact = compact;
+    options.searchIndex = searchIndex;
+    options.anchorTables = anchorTables;
+    options.deriveReverse = deriveReverse;
+    options.numaInterleave = numaInterleave;
+    if (!checkNotProjecting(self)) {
         return nullptr;
     }
 
     try {
-        self->ipp.loadPwalns(fileName);
+        self->ipp.loadPwalns(fileName, options);
     } catch (std::exception const& e) {
         PyErr_SetString(PyExc_RuntimeError, e.what());
         return nullptr;
@@ -131,12 +593,211 @@ ippSetHalfLifeDistance(PyIpp* self, PyObject* args) {
     if (!PyArg_ParseTuple(args,"I", &halfLifeDistance)) {
         return nullptr;
     }
+    if (!checkNotProjecting(self)) {
+        return nullptr;
+    }
 
     self->ipp.setHalfLifeDistance(halfLifeDistance);
 
     Py_RETURN_NONE;
 }
 
+static PyObject*
+ippSetSearchLimits(PyIpp* self, PyObject* args, PyObject* kwds) {
+    // Sets the limits of the multi-species search.
+    static char const* kwlist[] = {
+        "max_path_length", "min_score", "early_cutoff", nullptr};
+    Ipp::SearchLimits searchLimits;
+    int earlyCutoff(searchLimits.earlyCutoff);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "|Idp",
+                                     const_cast<char**>(kwlist),
+                                     &searchLimits.maxPathLength,
+                                     &searchLimits.minScore,
+                                     &earlyCutoff)) {
+        return nullptr;
+    }
+    searchLimits.earlyCutoff = earlyCutoff;
+    if (!checkNotProjecting(self)) {
+        return nullptr;
+    }
+
+    self->ipp.setSearchLimits(searchLimits);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+ippSetProjectionCacheSize(PyIpp* self, PyObject* args) {
+    // Enables the projection cache (or disables it for 0).
+    Py_ssize_t maxNumEntries;
+    if (!PyArg_ParseTuple(args, "n", &maxNumEntries)) {
+        return nullptr;
+    }
+    if (maxNumEntries < 0) {
+        PyErr_SetString(PyExc_ValueError, "the cache size must not be negative");
+        return nullptr;
+    }
+    if (!checkNotProjecting(self)) {
+        return nullptr;
+    }
+
+    self->ipp.setProjectionCacheSize(maxNumEntries);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+ippGetProjectionCacheStats(PyIpp* self, PyObject* args) {
+    // Returns the hits, misses and number of entries of the projection cache.
+    Ipp::ProjectionCacheStats const stats(self->ipp.projectionCacheStats());
+    return Py_BuildValue("{s:K,s:K,s:n}",
+                         "hits", (unsigned long long)stats.hits,
+                         "misses", (unsigned long long)stats.misses,
+                         "num_entries", (Py_ssize_t)stats.numEntries);
+}
+
+static PyObject*
+ippSetStatsEnabled(PyIpp* self, PyObject* args) {
+    // Enables (or disables) the collection of the stats.
+    int enabled;
+    if (!PyArg_ParseTuple(args, "p", &enabled)) {
+        return nullptr;
+    }
+    if (!checkNotProjecting(self)) {
+        return nullptr;
+    }
+
+    self->ipp.setStatsEnabled(enabled);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+ippSetThreadPinning(PyIpp* self, PyObject* args) {
+    // Enables (or disables) the pinning of the projection threads.
+    int enabled;
+    if (!PyArg_ParseTuple(args, "p", &enabled)) {
+        return nullptr;
+    }
+    if (!checkNotProjecting(self)) {
+        return nullptr;
+    }
+
+    self->ipp.setThreadPinning(enabled);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+ippSetSearchInterleave(PyIpp* self, PyObject* args) {
+    // Sets the number of searches that each projection thread interleaves.
+    unsigned numSearches;
+    if (!PyArg_ParseTuple(args, "I", &numSearches)) {
+        return nullptr;
+    }
+    if (!checkNotProjecting(self)) {
+        return nullptr;
+    }
+
+    self->ipp.setSearchInterleave(numSearches);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+ippResetStats(PyIpp* self, PyObject* args) {
+    if (!checkNotProjecting(self)) {
+        return nullptr;
+    }
+
+    self->ipp.resetStats();
+
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+histogramToPyDict(Ipp::Histogram const& histogram) {
+    // Returns the count, sum, max and quantiles of the histogram and its
+    // non-empty buckets as (upper end, count) tuples.
+    PyObjectPtr buckets(PyList_New(0));
+    if (!buckets) {
+        return nullptr;
+    }
+    for (std::size_t i(0); i < histogram.counts.size(); ++i) {
+        if (!histogram.counts[i]) {
+            continue;
+        }
+        uint64_t const bucketEnd(i < 64 ? (uint64_t(1) << i) - 1
+                                        : std::numeric_limits<uint64_t>::max());
+        PyObjectPtr const bucket(
+            Py_BuildValue("(KK)",
+                          (unsigned long long)bucketEnd,
+                          (unsigned long long)histogram.counts[i]));
+        if (!bucket || PyList_Append(buckets.get(), bucket.get()) != 0) {
+            return nullptr;
+        }
+    }
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:O}",
+                         "count", (unsigned long long)histogram.count(),
+                         "sum", (unsigned long long)histogram.sum,
+                         "max", (unsigned long long)histogram.max,
+                         "p50", (unsigned long long)histogram.quantile(0.5),
+                         "p90", (unsigned long long)histogram.quantile(0.9),
+                         "p99", (unsigned long long)histogram.quantile(0.99),
+                         "buckets", buckets.get());
+}
+
+static PyObject*
+ippGetStats(PyIpp* self, PyObject* args) {
+    // Returns the stats as a dict. The histograms are dicts (see
+    // histogramToPyDict()), the getAnchors() calls are keyed by
+    // (ref species, qry species).
+    Ipp::Stats const stats(self->ipp.stats());
+
+    PyObjectPtr getAnchorsCalls(PyDict_New());
+    if (!getAnchorsCalls) {
+        return nullptr;
+    }
+    for (auto const& [pwaln, calls] : stats.getAnchorsCalls) {
+        PyObjectPtr const key(Py_BuildValue("(ss)",
+                                            pwaln.first.c_str(),
+                                            pwaln.second.c_str()));
+        PyObjectPtr const value(PyLong_FromUnsignedLongLong(calls));
+        if (!key
+            || !value
+            || PyDict_SetItem(getAnchorsCalls.get(), key.get(), value.get())
+               != 0) {
+            return nullptr;
+        }
+    }
+
+    PyObjectPtr dict(PyDict_New());
+    if (!dict) {
+        return nullptr;
+    }
+    auto const setItem = [&](char const* key, PyObject* value) {
+        PyObjectPtr const valuePtr(value);
+        return valuePtr && PyDict_SetItemString(dict.get(), key, value) == 0;
+    };
+    if (!setItem("get_anchors_calls", getAnchorsCalls.release())
+        || !setItem("upstream_walk_lengths",
+                    histogramToPyDict(stats.upstreamWalkLengths))
+        || !setItem("lis_input_sizes", histogramToPyDict(stats.lisInputSizes))
+        || !setItem("orange_pushes",
+                    PyLong_FromUnsignedLongLong(stats.orangePushes))
+        || !setItem("orange_pops",
+                    PyLong_FromUnsignedLongLong(stats.orangePops))
+        || !setItem("search_nodes", histogramToPyDict(stats.searchNodes))
+        || !setItem("project_coord_ns", histogramToPyDict(stats.projectCoordNs))
+        || !setItem("load_block_ns", histogramToPyDict(stats.loadBlockNs))
+        || !setItem("load_pwalns_ns", histogramToPyDict(stats.loadPwalnsNs))) {
+        return nullptr;
+    }
+    return dict.release();
+}
+
 static PyObject*
 ippProjectCoords(PyIpp* self, PyObject* args) {
     char const* refSpecies;
@@ -144,16 +805,24 @@ ippProjectCoords(PyIpp* self, PyObject* args) {
     PyObject* pyRefCoords; // [ (chrom1, loc1), (chrom2, loc2), ... ]
     unsigned nThreads;
     PyObject* callback;
+    int sorted(0);
+    PyObject* pyParams(nullptr);
     int res(PyArg_ParseTuple(args,
-                             "ssO!IO",
+                             "ssO!IO|pO",
                              &refSpecies,
                              &qrySpecies,
                              &PyList_Type, &pyRefCoords,
                              &nThreads,
-                             &callback));
+                             &callback,
+                             &sorted,
+                             &pyParams));
     if (!res) {
         return nullptr;
     }
+    Ipp::ProjectionParams params(self->ipp.defaultProjectionParams());
+    if (!parseProjectionParams(pyParams, &params)) {
+        return nullptr;
+    }
     if (!PyCallable_Check(callback)) {
         PyErr_SetString(PyExc_TypeError, "callback parameter must be callable");
         return nullptr;
@@ -255,14 +924,26 @@ ippProjectCoords(PyIpp* self, PyObject* args) {
 
     // Listen for Ctrl-C signals.
     AbortSignalHandler const abortSignalHandler(&self->ipp);
+    // Keep the callback from loading or configuring the ipp.
+    RunningCall const runningCall(self);
 
     // Do the coord projection.
     try {
-        self->ipp.projectCoords(refSpecies,
-                                qrySpecies,
-                                refCoords,
-                                nThreads,
-                                onJobDone);
+        if (sorted) {
+            self->ipp.projectCoordsSorted(refSpecies,
+                                          qrySpecies,
+                                          refCoords,
+                                          nThreads,
+                                          params,
+                                          onJobDone);
+        } else {
+            self->ipp.projectCoords(refSpecies,
+                                    qrySpecies,
+                                    refCoords,
+                                    nThreads,
+                                    params,
+                                    onJobDone);
+        }
     } catch (std::exception const& e) {
         if (!PyErr_Occurred()) {
             PyErr_SetString(PyExc_RuntimeError, e.what());
@@ -273,6 +954,652 @@ ippProjectCoords(PyIpp* self, PyObject* args) {
     Py_RETURN_NONE;
 }
 
+static PyObject*
+ippProjectCoordsArray(PyIpp* self, PyObject* args, PyObject* kwds) {
+    // Projects the coords given as numpy arrays of chrom ids and locs and
+    // returns the results as a dict of numpy arrays (see ProjectionColumns).
+    // The GIL is released during the projection.
+    static char const* kwlist[] = {
+        "ref_species", "qry_species", "ref_chroms", "ref_locs",
+        "n_threads", "sorted", "include_anchors", "params", nullptr};
+    char const* refSpecies;
+    char const* qrySpecies;
+    PyObject* pyRefChromsArg;
+    PyObject* pyRefLocsArg;
+    unsigned nThreads(1);
+    int sorted(0);
+    int includeAnchors(0);
+    PyObject* pyParams(nullptr);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "ssOO|IppO",
+                                     const_cast<char**>(kwlist),
+                                     &refSpecies,
+                                     &qrySpecies,
+                                     &pyRefChromsArg,
+                                     &pyRefLocsArg,
+                                     &nThreads,
+                                     &sorted,
+                                     &includeAnchors,
+                                     &pyParams)) {
+        return nullptr;
+    }
+    Ipp::ProjectionParams params(self->ipp.defaultProjectionParams());
+    if (!parseProjectionParams(pyParams, &params)) {
+        return nullptr;
+    }
+
+    RefCoordsArrays arrays;
+    if (!arrays.parse(pyRefChromsArg,
+                      pyRefLocsArg,
+                      self->ipp.chromNames().size())) {
+        return nullptr;
+    }
+    std::vector<Ipp::Coords> const& refCoords(arrays.refCoords());
+
+    // Do the coord projection (w/o the GIL; the callback is called from this
+    // thread and does not touch python objects).
+    std::map<Ipp::Coords, Ipp::CoordProjection> results;
+    auto const onJobDone = [&](Ipp::Coords const& refCoord,
+                               Ipp::CoordProjection const& coordProjection) {
+        results.emplace(refCoord, coordProjection);
+    };
+    std::string error;
+    {
+        // Listen for Ctrl-C signals.
+        AbortSignalHandler const abortSignalHandler(&self->ipp);
+        RunningCall const runningCall(self);
+
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            if (sorted) {
+                self->ipp.projectCoordsSorted(refSpecies,
+                                              qrySpecies,
+                                              refCoords,
+                                              nThreads,
+                                              params,
+                                              onJobDone);
+            } else {
+                self->ipp.projectCoords(refSpecies,
+                                        qrySpecies,
+                                        refCoords,
+                                        nThreads,
+                                        params,
+                                        onJobDone);
+            }
+        } catch (std::exception const& e) {
+            error = e.what();
+            if (error.empty()) {
+                error = "projection failed";
+            }
+        }
+        Py_END_ALLOW_THREADS
+    }
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        return nullptr;
+    }
+    if (self->ipp.isCancelled()) {
+        // Interrupted by a signal: The coords that were not projected would
+        // look unmapped.
+        PyErr_SetNone(PyExc_KeyboardInterrupt);
+        return nullptr;
+    }
+
+    // Translate the results to columns in the order of the input.
+    ProjectionColumns columns(arrays.numRows(), includeAnchors);
+    for (std::size_t i(0); i < arrays.numRows(); ++i) {
+        columns.append(arrays.find(results, i));
+    }
+    return columns.createPyDict();
+}
+
+static PyObject*
+ippProjectCoordsMulti(PyIpp* self, PyObject* args, PyObject* kwds) {
+    // Like project_coords_array() but projects the coords to all the species
+    // of the given list with a single search per coord. Returns a dict that
+    // maps each qry species to its dict of numpy arrays.
+    // The GIL is released during the projection.
+    static char const* kwlist[] = {
+        "ref_species", "qry_species", "ref_chroms", "ref_locs",
+        "n_threads", "sorted", "include_anchors", "params", nullptr};
+    char const* refSpecies;
+    PyObject* pyQrySpecies;
+    PyObject* pyRefChromsArg;
+    PyObject* pyRefLocsArg;
+    unsigned nThreads(1);
+    int sorted(0);
+    int includeAnchors(0);
+    PyObject* pyParams(nullptr);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "sOOO|IppO",
+                                     const_cast<char**>(kwlist),
+                                     &refSpecies,
+                                     &pyQrySpecies,
+                                     &pyRefChromsArg,
+                                     &pyRefLocsArg,
+                                     &nThreads,
+                                     &sorted,
+                                     &includeAnchors,
+                                     &pyParams)) {
+        return nullptr;
+    }
+    Ipp::ProjectionParams params(self->ipp.defaultProjectionParams());
+    if (!parseProjectionParams(pyParams, &params)) {
+        return nullptr;
+    }
+
+    if (PyUnicode_Check(pyQrySpecies)) {
+        PyErr_SetString(PyExc_TypeError, "qry_species must be a list of strings");
+        return nullptr;
+    }
+    PyObjectPtr const pyQrySpeciesSeq(
+        PySequence_Fast(pyQrySpecies, "qry_species must be a list of strings"));
+    if (!pyQrySpeciesSeq) {
+        return nullptr;
+    }
+    std::vector<std::string> qrySpecies;
+    for (Py_ssize_t i(0); i < PySequence_Fast_GET_SIZE(pyQrySpeciesSeq.get()); ++i) {
+        char const* const name(PyUnicode_AsUTF8(
+            PySequence_Fast_GET_ITEM(pyQrySpeciesSeq.get(), i)));
+        if (!name) {
+            return nullptr;
+        }
+        qrySpecies.push_back(name);
+    }
+
+    RefCoordsArrays arrays;
+    if (!arrays.parse(pyRefChromsArg,
+                      pyRefLocsArg,
+                      self->ipp.chromNames().size())) {
+        return nullptr;
+    }
+
+    // Do the coord projection (w/o the GIL; the callback is called from this
+    // thread and does not touch python objects).
+    std::map<Ipp::Coords, std::vector<Ipp::CoordProjection>> results;
+    auto const onJobDone = [&](
+            Ipp::Coords const& refCoord,
+            std::vector<Ipp::CoordProjection> const& coordProjections) {
+        results.emplace(refCoord, coordProjections);
+    };
+    std::string error;
+    {
+        // Listen for Ctrl-C signals.
+        AbortSignalHandler const abortSignalHandler(&self->ipp);
+        RunningCall const runningCall(self);
+
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            self->ipp.projectCoordsMulti(refSpecies,
+                                         qrySpecies,
+                                         arrays.refCoords(),
+                                         nThreads,
+                                         sorted,
+                                         params,
+                                         onJobDone);
+        } catch (std::exception const& e) {
+            error = e.what();
+            if (error.empty()) {
+                error = "projection failed";
+            }
+        }
+        Py_END_ALLOW_THREADS
+    }
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        return nullptr;
+    }
+    if (self->ipp.isCancelled()) {
+        // See project_coords_array().
+        PyErr_SetNone(PyExc_KeyboardInterrupt);
+        return nullptr;
+    }
+
+    // Translate the results of each qry species to columns in the order of
+    // the input.
+    PyObjectPtr ret(PyDict_New());
+    if (!ret) {
+        return nullptr;
+    }
+    for (std::size_t q(0); q < qrySpecies.size(); ++q) {
+        ProjectionColumns columns(arrays.numRows(), includeAnchors);
+        for (std::size_t i(0); i < arrays.numRows(); ++i) {
+            std::vector<Ipp::CoordProjection> const* const coordProjections(
+                arrays.find(results, i));
+            columns.append(coordProjections ? &(*coordProjections)[q]
+                                            : nullptr);
+        }
+        PyObjectPtr const pyColumns(columns.createPyDict());
+        if (!pyColumns
+            || PyDict_SetItemString(ret.get(),
+                                    qrySpecies[q].c_str(),
+                                    pyColumns.get()) != 0) {
+            return nullptr;
+        }
+    }
+    return ret.release();
+}
+
+static bool
+parseRefInterval(PyIpp* self,
+                 char const* refChromName,
+                 long long start,
+                 PyObject* pyEnd,
+                 std::optional<Ipp::ChromId>* refChrom,
+                 Ipp::LocInterval* refInterval) {
+    // Translates the half-open interval [start, end) on the given chrom (end
+    // None: to the end of the chromosome) to an inclusive LocInterval.
+    // refChrom is empty if the chromosome is unknown (i.e. has no
+    // alignments). Sets a python exception and returns false on errors.
+    long long end(static_cast<long long>(std::numeric_limits<uint32_t>::max()) + 1);
+    if (pyEnd && pyEnd != Py_None) {
+        end = PyLong_AsLongLong(pyEnd);
+        if (PyErr_Occurred()) {
+            return false;
+        }
+    }
+    if (start < 0
+        || end <= start
+        || end > static_cast<long long>(std::numeric_limits<uint32_t>::max()) + 1) {
+        PyErr_SetString(PyExc_ValueError, "invalid interval");
+        return false;
+    }
+    *refChrom = self->ipp.chromIdFromName(refChromName);
+    *refInterval = Ipp::LocInterval(start, end - 1);
+    return true;
+}
+
+static PyObject*
+ippProjectInterval(PyIpp* self, PyObject* args, PyObject* kwds) {
+    // Projects the interval [start, end) of the given ref chrom and returns the
+    // segments of projectInterval() as a dict of numpy arrays: ref_start,
+    // ref_end (half-open), qry_chrom (chrom id), qry_start, qry_end (the
+    // projections of the first and the last ref location), min_score and
+    // max_score.
+    // The GIL is released during the projection.
+    static char const* kwlist[] = {
+        "ref_species", "qry_species", "ref_chrom", "start", "end", "params",
+        nullptr};
+    char const* refSpecies;
+    char const* qrySpecies;
+    char const* refChromName;
+    long long start(0);
+    PyObject* pyEnd(nullptr);
+    PyObject* pyParams(nullptr);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "sss|LOO",
+                                     const_cast<char**>(kwlist),
+                                     &refSpecies,
+                                     &qrySpecies,
+                                     &refChromName,
+                                     &start,
+                                     &pyEnd,
+                                     &pyParams)) {
+        return nullptr;
+    }
+    Ipp::ProjectionParams params(self->ipp.defaultProjectionParams());
+    std::optional<Ipp::ChromId> refChrom;
+    Ipp::LocInterval refInterval;
+    if (!parseProjectionParams(pyParams, &params)
+        || !parseRefInterval(self, refChromName, start, pyEnd, &refChrom, &refInterval)) {
+        return nullptr;
+    }
+
+    std::vector<Ipp::ProjectedSegment> segments;
+    std::string error;
+    {
+        // Listen for Ctrl-C signals.
+        AbortSignalHandler const abortSignalHandler(&self->ipp);
+        RunningCall const runningCall(self);
+
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            if (refChrom) {
+                segments = self->ipp.projectInterval(refSpecies,
+                                                     qrySpecies,
+                                                     *refChrom,
+                                                     refInterval,
+                                                     params);
+            }
+        } catch (std::exception const& e) {
+            error = e.what();
+            if (error.empty()) {
+                error = "projection failed";
+            }
+        }
+        Py_END_ALLOW_THREADS
+    }
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        return nullptr;
+    }
+    if (refChrom && self->ipp.isCancelled()) {
+        PyErr_SetNone(PyExc_KeyboardInterrupt);
+        return nullptr;
+    }
+
+    std::vector<int64_t> refStart;
+    std::vector<int64_t> refEnd;
+    std::vector<int32_t> qryChrom;
+    std::vector<uint32_t> qryStart;
+    std::vector<uint32_t> qryEnd;
+    std::vector<double> minScore;
+    std::vector<double> maxScore;
+    for (Ipp::ProjectedSegment const& segment : segments) {
+        refStart.push_back(segment.ref.start);
+        refEnd.push_back(static_cast<int64_t>(segment.ref.end) + 1);
+        qryChrom.push_back(segment.qryChrom);
+        qryStart.push_back(segment.qryStart);
+        qryEnd.push_back(segment.qryEnd);
+        minScore.push_back(segment.minScore);
+        maxScore.push_back(segment.maxScore);
+    }
+
+    PyObjectPtr dict(PyDict_New());
+    if (!dict) {
+        return nullptr;
+    }
+    auto const setItem = [&](char const* key, PyObject* value) {
+        PyObjectPtr const valuePtr(value);
+        return valuePtr && PyDict_SetItemString(dict.get(), key, value) == 0;
+    };
+    if (!setItem("ref_start", createPyArray(refStart, NPY_INT64))
+        || !setItem("ref_end", createPyArray(refEnd, NPY_INT64))
+        || !setItem("qry_chrom", createPyArray(qryChrom, NPY_INT32))
+        || !setItem("qry_start", createPyArray(qryStart, NPY_UINT32))
+        || !setItem("qry_end", createPyArray(qryEnd, NPY_UINT32))
+        || !setItem("min_score", createPyArray(minScore, NPY_FLOAT64))
+        || !setItem("max_score", createPyArray(maxScore, NPY_FLOAT64))) {
+        return nullptr;
+    }
+    return dict.release();
+}
+
+static PyObject*
+ippProjectTiles(PyIpp* self, PyObject* args, PyObject* kwds) {
+    // Projects the locations start, start + step, ... of the interval
+    // [start, end) of the given ref chrom and returns the mappable ones as a
+    // dict of numpy arrays: ref_loc, qry_chrom (chrom id), qry_loc and score.
+    // The GIL is released during the projection.
+    static char const* kwlist[] = {
+        "ref_species", "qry_species", "ref_chrom", "step", "start", "end",
+        "params", nullptr};
+    char const* refSpecies;
+    char const* qrySpecies;
+    char const* refChromName;
+    unsigned step;
+    long long start(0);
+    PyObject* pyEnd(nullptr);
+    PyObject* pyParams(nullptr);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "sssI|LOO",
+                                     const_cast<char**>(kwlist),
+                                     &refSpecies,
+                                     &qrySpecies,
+                                     &refChromName,
+                                     &step,
+                                     &start,
+                                     &pyEnd,
+                                     &pyParams)) {
+        return nullptr;
+    }
+    Ipp::ProjectionParams params(self->ipp.defaultProjectionParams());
+    std::optional<Ipp::ChromId> refChrom;
+    Ipp::LocInterval refInterval;
+    if (!parseProjectionParams(pyParams, &params)
+        || !parseRefInterval(self, refChromName, start, pyEnd, &refChrom, &refInterval)) {
+        return nullptr;
+    }
+
+    std::vector<Ipp::TileProjection> tiles;
+    std::string error;
+    {
+        // Listen for Ctrl-C signals.
+        AbortSignalHandler const abortSignalHandler(&self->ipp);
+        RunningCall const runningCall(self);
+
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            if (refChrom) {
+                tiles = self->ipp.projectTiles(refSpecies,
+                                               qrySpecies,
+                                               *refChrom,
+                                               refInterval,
+                                               step,
+                                               params);
+            }
+        } catch (std::exception const& e) {
+            error = e.what();
+            if (error.empty()) {
+                error = "projection failed";
+            }
+        }
+        Py_END_ALLOW_THREADS
+    }
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        return nullptr;
+    }
+    if (refChrom && self->ipp.isCancelled()) {
+        PyErr_SetNone(PyExc_KeyboardInterrupt);
+        return nullptr;
+    }
+
+    std::vector<uint32_t> refLoc;
+    std::vector<int32_t> qryChrom;
+    std::vector<uint32_t> qryLoc;
+    std::vector<double> score;
+    for (auto const& [loc, proj] : tiles) {
+        refLoc.push_back(loc);
+        qryChrom.push_back(proj.nextCoords.chrom);
+        qryLoc.push_back(proj.nextCoords.loc);
+        score.push_back(proj.score);
+    }
+
+    PyObjectPtr dict(PyDict_New());
+    if (!dict) {
+        return nullptr;
+    }
+    auto const setItem = [&](char const* key, PyObject* value) {
+        PyObjectPtr const valuePtr(value);
+        return valuePtr && PyDict_SetItemString(dict.get(), key, value) == 0;
+    };
+    if (!setItem("ref_loc", createPyArray(refLoc, NPY_UINT32))
+        || !setItem("qry_chrom", createPyArray(qryChrom, NPY_INT32))
+        || !setItem("qry_loc", createPyArray(qryLoc, NPY_UINT32))
+        || !setItem("score", createPyArray(score, NPY_FLOAT64))) {
+        return nullptr;
+    }
+    return dict.release();
+}
+
+static PyObject*
+ippProjectBedFile(PyIpp* self, PyObject* args, PyObject* kwds) {
+    // Projects the regions of a BED file and streams the results to the given
+    // files (see projectBedFile()). Returns (num_regions, num_unmapped).
+    // The GIL is released during the projection. Raises a KeyboardInterrupt
+    // if cancelled (the files are incomplete then).
+    static char const* kwlist[] = {
+        "ref_species", "qry_species", "bed_file", "proj_file",
+        "unmapped_file", "n_threads", "chunk_size", "sorted", "score_dc",
+        "score_ic", "params", nullptr};
+    char const* refSpecies;
+    char const* qrySpecies;
+    char const* bedFileName;
+    char const* projFileName;
+    char const* unmappedFileName;
+    BedStreamOptions options;
+    Py_ssize_t chunkSize(options.chunkSize);
+    int sorted(options.sorted);
+    PyObject* pyParams(nullptr);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "sssss|InpddO",
+                                     const_cast<char**>(kwlist),
+                                     &refSpecies,
+                                     &qrySpecies,
+                                     &bedFileName,
+                                     &projFileName,
+                                     &unmappedFileName,
+                                     &options.nThreads,
+                                     &chunkSize,
+                                     &sorted,
+                                     &options.scoreDC,
+                                     &options.scoreIC,
+                                     &pyParams)) {
+        return nullptr;
+    }
+    options.params = self->ipp.defaultProjectionParams();
+    if (!parseProjectionParams(pyParams, &*options.params)) {
+        return nullptr;
+    }
+    if (chunkSize <= 0) {
+        PyErr_SetString(PyExc_ValueError, "chunk_size must be positive");
+        return nullptr;
+    }
+    options.chunkSize = chunkSize;
+    options.sorted = sorted;
+
+    BedStreamStats stats;
+    std::string error;
+    {
+        // Listen for Ctrl-C signals.
+        AbortSignalHandler const abortSignalHandler(&self->ipp);
+        RunningCall const runningCall(self);
+
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            stats = projectBedFile(self->ipp,
+                                   refSpecies,
+                                   qrySpecies,
+                                   bedFileName,
+                                   projFileName,
+                                   unmappedFileName,
+                                   options);
+        } catch (std::exception const& e) {
+            error = e.what();
+            if (error.empty()) {
+                error = "projection failed";
+            }
+        }
+        Py_END_ALLOW_THREADS
+    }
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        return nullptr;
+    }
+    if (self->ipp.isCancelled()) {
+        // The output files are incomplete.
+        PyErr_SetNone(PyExc_KeyboardInterrupt);
+        return nullptr;
+    }
+
+    return Py_BuildValue("nn",
+                         static_cast<Py_ssize_t>(stats.numRecords),
+                         static_cast<Py_ssize_t>(stats.numUnmapped));
+}
+
+static PyObject*
+ippProjectBedFileBinary(PyIpp* self, PyObject* args, PyObject* kwds) {
+    // Projects the regions of a BED file and streams the results to the given
+    // binary results file (see projectBedFileBinary()). Returns
+    // (num_regions, num_unmapped). The GIL is released during the projection.
+    // Raises a KeyboardInterrupt if cancelled (the file has no end then).
+    static char const* kwlist[] = {
+        "ref_species", "qry_species", "bed_file", "results_file",
+        "n_threads", "chunk_size", "sorted", "include_anchors", "score_dc",
+        "score_ic", "params", nullptr};
+    char const* refSpecies;
+    char const* qrySpecies;
+    char const* bedFileName;
+    char const* resultsFileName;
+    BedStreamOptions options;
+    Py_ssize_t chunkSize(options.chunkSize);
+    int sorted(options.sorted);
+    int includeAnchors(options.includeAnchors);
+    PyObject* pyParams(nullptr);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "ssss|InppddO",
+                                     const_cast<char**>(kwlist),
+                                     &refSpecies,
+                                     &qrySpecies,
+                                     &bedFileName,
+                                     &resultsFileName,
+                                     &options.nThreads,
+                                     &chunkSize,
+                                     &sorted,
+                                     &includeAnchors,
+                                     &options.scoreDC,
+                                     &options.scoreIC,
+                                     &pyParams)) {
+        return nullptr;
+    }
+    options.params = self->ipp.defaultProjectionParams();
+    if (!parseProjectionParams(pyParams, &*options.params)) {
+        return nullptr;
+    }
+    if (chunkSize <= 0) {
+        PyErr_SetString(PyExc_ValueError, "chunk_size must be positive");
+        return nullptr;
+    }
+    options.chunkSize = chunkSize;
+    options.sorted = sorted;
+    options.includeAnchors = includeAnchors;
+
+    BedStreamStats stats;
+    std::string error;
+    {
+        // Listen for Ctrl-C signals.
+        AbortSignalHandler const abortSignalHandler(&self->ipp);
+        RunningCall const runningCall(self);
+
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            stats = projectBedFileBinary(self->ipp,
+                                         refSpecies,
+                                         qrySpecies,
+                                         bedFileName,
+                                         resultsFileName,
+                                         options);
+        } catch (std::exception const& e) {
+            error = e.what();
+            if (error.empty()) {
+                error = "projection failed";
+            }
+        }
+        Py_END_ALLOW_THREADS
+    }
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        return nullptr;
+    }
+    if (self->ipp.isCancelled()) {
+        // The output files are incomplete.
+        PyErr_SetNone(PyExc_KeyboardInterrupt);
+        return nullptr;
+    }
+
+    return Py_BuildValue("nn",
+                         static_cast<Py_ssize_t>(stats.numRecords),
+                         static_cast<Py_ssize_t>(stats.numUnmapped));
+}
+
+static PyObject*
+ippGetChromNames(PyIpp* self, PyObject* args) {
+    // Returns the list of chromosome names, indexed by chromosome id.
+    std::vector<std::string> const& chromNames(self->ipp.chromNames());
+    PyObject* const ret(PyList_New(chromNames.size()));
+    for (std::size_t i(0); ret && i < chromNames.size(); ++i) {
+        PyList_SET_ITEM(ret, i, PyUnicode_FromString(chromNames[i].c_str()));
+    }
+    return ret;
+}
+
 static PyObject*
 ippCancel(PyIpp* self, PyObject* args) {
     // Cancel ongoing project_coords() call.
@@ -281,11 +1608,324 @@ ippCancel(PyIpp* self, PyObject* args) {
     Py_RETURN_NONE;
 }
 
+struct ProjectionJobState {
+    // The state of an ipp.ProjectionJob.
+    PyObjectPtr pyIpp;
+    // Keeps the Ipp alive while the job runs.
+    std::unique_ptr<ProjectCoordsJob> job;
+    std::vector<std::size_t> rows;
+    // The row of each coords of the job.
+    std::vector<std::size_t> noResultRows;
+    // The rows with an unknown chrom id, returned by the first results().
+    std::size_t numRows;
+    bool includeAnchors;
+
+    ProjectionJobState()
+        : numRows(0)
+        , includeAnchors(false)
+    {}
+};
+
+struct PyIppProjectionJob {
+    PyObject_HEAD
+
+    ProjectionJobState state;
+};
+
+static PyObject*
+ippProjectionJobNew(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    PyErr_SetString(PyExc_TypeError,
+                    "projection jobs are created by Ipp.start_project_coords()");
+    return nullptr;
+}
+
+static void
+ippProjectionJobDealloc(PyIppProjectionJob* self) {
+    // Cancels the job and waits for its thread (w/o the GIL, the job does
+    // not touch python objects). Meanwhile the job counts as a running call
+    // on the ipp.
+    std::unique_ptr<ProjectCoordsJob> job(std::move(self->state.job));
+    if (job) {
+        auto const pyIpp(reinterpret_cast<PyIpp*>(self->state.pyIpp.get()));
+        RunningCall const runningCall(pyIpp);
+        pyIpp->jobs.erase(std::remove(pyIpp->jobs.begin(),
+                                      pyIpp->jobs.end(),
+                                      job.get()),
+                          pyIpp->jobs.end());
+        Py_BEGIN_ALLOW_THREADS
+        job.reset();
+        Py_END_ALLOW_THREADS
+    }
+    self->state.~ProjectionJobState();
+
+    PyTypeObject* const type(Py_TYPE(self));
+    type->tp_free((PyObject*)self);
+    Py_DECREF(type);
+}
+
+static PyObject*
+ippProjectionJobResults(PyIppProjectionJob* self, PyObject* args, PyObject* kwds) {
+    // Removes and returns up to max_results (0: all) of the available
+    // results as a dict of numpy arrays like project_coords_array() with an
+    // additional index column: the row of each result in ref_chroms and
+    // ref_locs. The results are in the order of completion.
+    static char const* kwlist[] = {"max_results", nullptr};
+    Py_ssize_t maxResults(0);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "|n",
+                                     const_cast<char**>(kwlist),
+                                     &maxResults)) {
+        return nullptr;
+    }
+    if (maxResults < 0) {
+        PyErr_SetString(PyExc_ValueError, "max_results must not be negative");
+        return nullptr;
+    }
+    ProjectionJobState& state(self->state);
+
+    std::vector<int64_t> index;
+    std::size_t const numNoResult(
+        maxResults > 0
+        ? std::min<std::size_t>(maxResults, state.noResultRows.size())
+        : state.noResultRows.size());
+    std::vector<ProjectCoordsJob::Result> results;
+    if (numNoResult < static_cast<std::size_t>(maxResults) || maxResults == 0) {
+        try {
+            results = state.job->takeResults(maxResults > 0
+                                             ? maxResults - numNoResult
+                                             : 0);
+        } catch (std::exception const& e) {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+            return nullptr;
+        }
+    }
+
+    ProjectionColumns columns(numNoResult + results.size(),
+                              state.includeAnchors);
+    for (std::size_t i(0); i < numNoResult; ++i) {
+        index.push_back(state.noResultRows[i]);
+        columns.append(nullptr);
+    }
+    state.noResultRows.erase(state.noResultRows.begin(),
+                             state.noResultRows.begin() + numNoResult);
+    for (ProjectCoordsJob::Result const& result : results) {
+        index.push_back(state.rows[result.index]);
+        columns.append(&result.projection);
+    }
+
+    PyObjectPtr dict(columns.createPyDict());
+    if (!dict) {
+        return nullptr;
+    }
+    PyObjectPtr const pyIndex(createPyArray(index, NPY_INT64));
+    if (!pyIndex
+        || PyDict_SetItemString(dict.get(), "index", pyIndex.get()) < 0) {
+        return nullptr;
+    }
+    return dict.release();
+}
+
+static PyObject*
+ippProjectionJobProgress(PyIppProjectionJob* self, PyObject* args) {
+    // Returns (num_done, num_rows): The number of rows whose results are
+    // available (taken or not) and the number of all rows.
+    ProjectionJobState const& state(self->state);
+    std::size_t const numNoResult(state.numRows - state.rows.size());
+    return Py_BuildValue("nn",
+                         static_cast<Py_ssize_t>(state.job->numDone()
+                                                 + numNoResult),
+                         static_cast<Py_ssize_t>(state.numRows));
+}
+
+static PyObject*
+ippProjectionJobDone(PyIppProjectionJob* self, PyObject* args) {
+    // Returns whether the projection has ended (completed, cancelled or
+    // failed).
+    return PyBool_FromLong(self->state.job->isDone());
+}
+
+static PyObject*
+ippProjectionJobCancel(PyIppProjectionJob* self, PyObject* args) {
+    // Stops the job from starting any further projections.
+    self->state.job->cancel();
+
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+ippProjectionJobCancelled(PyIppProjectionJob* self, PyObject* args) {
+    return PyBool_FromLong(self->state.job->isCancelled());
+}
+
+static PyObject*
+ippProjectionJobWait(PyIppProjectionJob* self, PyObject* args, PyObject* kwds) {
+    // Waits (w/o the GIL) until results are available or the job has ended,
+    // at most timeout seconds (None: no limit). Returns whether that is the
+    // case.
+    static char const* kwlist[] = {"timeout", nullptr};
+    PyObject* pyTimeout(Py_None);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "|O",
+                                     const_cast<char**>(kwlist),
+                                     &pyTimeout)) {
+        return nullptr;
+    }
+    double timeout(-1);
+    if (pyTimeout != Py_None) {
+        timeout = PyFloat_AsDouble(pyTimeout);
+        if (PyErr_Occurred()) {
+            return nullptr;
+        }
+        timeout = std::max(timeout, 0.0);
+    }
+    if (!self->state.noResultRows.empty()) {
+        Py_RETURN_TRUE;
+    }
+
+    bool ready;
+    ProjectCoordsJob& job(*self->state.job);
+    Py_BEGIN_ALLOW_THREADS
+    ready = job.wait(timeout);
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(ready);
+}
+
+static PyMethodDef ippProjectionJobMethods[] = {
+    {"results", (PyCFunction)(void(*)(void))ippProjectionJobResults, METH_VARARGS|METH_KEYWORDS, "Removes and returns up to max_results (0: all) of the available results as a dict of numpy arrays like project_coords_array() with an additional index column (the rows of the results in the input arrays): results(max_results=0)"},
+    {"progress", (PyCFunction)ippProjectionJobProgress, METH_NOARGS, "Returns (num_done, num_rows), the number of rows whose results are available (taken or not) and the number of all rows"},
+    {"done", (PyCFunction)ippProjectionJobDone, METH_NOARGS, "Returns whether the projection has ended (completed, cancelled or failed); its errors are raised by results()"},
+    {"cancel", (PyCFunction)ippProjectionJobCancel, METH_NOARGS, "Stops the job from starting any further projections"},
+    {"cancelled", (PyCFunction)ippProjectionJobCancelled, METH_NOARGS, "Returns whether cancel() was called"},
+    {"wait", (PyCFunction)(void(*)(void))ippProjectionJobWait, METH_VARARGS|METH_KEYWORDS, "Waits until results are available or the job has ended, at most timeout seconds (None: no limit), and returns whether that is the case: wait(timeout=None)"},
+
+    {nullptr, nullptr, 0, nullptr} /* Sentinel */
+};
+static PyType_Slot ippProjectionJobTypeSlots[] = {
+    {Py_tp_new, (void*)ippProjectionJobNew},
+    {Py_tp_dealloc, (void*)ippProjectionJobDealloc},
+    {Py_tp_methods, (void*)ippProjectionJobMethods},
+
+    {0, nullptr}                   /* Sentinel */
+};
+
+static PyType_Spec ippProjectionJobTypeSpec = {
+    "ipp.ProjectionJob",           /* name */
+    sizeof(PyIppProjectionJob),    /* basicsize */
+    0,                             /* itemsize */
+    Py_TPFLAGS_DEFAULT,            /* flags */
+    ippProjectionJobTypeSlots      /* slots */
+};
+
+static PyObject*
+ippStartProjectCoords(PyIpp* self, PyObject* args, PyObject* kwds) {
+    // Starts the projection of the coords given as numpy arrays of chrom ids
+    // and locs on a background thread and returns an ipp.ProjectionJob to
+    // poll its results. Neither the projection nor the job installs signal
+    // handlers; cancel the job instead.
+    static char const* kwlist[] = {
+        "ref_species", "qry_species", "ref_chroms", "ref_locs",
+        "n_threads", "sorted", "include_anchors", "params", nullptr};
+    char const* refSpecies;
+    char const* qrySpecies;
+    PyObject* pyRefChromsArg;
+    PyObject* pyRefLocsArg;
+    unsigned nThreads(1);
+    int sorted(0);
+    int includeAnchors(0);
+    PyObject* pyParams(nullptr);
+    if (!PyArg_ParseTupleAndKeywords(args,
+                                     kwds,
+                                     "ssOO|IppO",
+                                     const_cast<char**>(kwlist),
+                                     &refSpecies,
+                                     &qrySpecies,
+                                     &pyRefChromsArg,
+                                     &pyRefLocsArg,
+                                     &nThreads,
+                                     &sorted,
+                                     &includeAnchors,
+                                     &pyParams)) {
+        return nullptr;
+    }
+    Ipp::ProjectionParams params(self->ipp.defaultProjectionParams());
+    if (!parseProjectionParams(pyParams, &params)) {
+        return nullptr;
+    }
+    for (char const* species : {refSpecies, qrySpecies}) {
+        if (!self->ipp.speciesIdFromName(species)) {
+            PyErr_Format(PyExc_RuntimeError, "unknown species: %s", species);
+            return nullptr;
+        }
+    }
+
+    RefCoordsArrays arrays;
+    if (!arrays.parse(pyRefChromsArg,
+                      pyRefLocsArg,
+                      self->ipp.chromNames().size())) {
+        return nullptr;
+    }
+
+    auto const pyJob(reinterpret_cast<PyIppProjectionJob*>(
+        PyIppProjectionJob_Type->tp_alloc(PyIppProjectionJob_Type, 0)));
+    if (!pyJob) {
+        return nullptr;
+    }
+    new (&pyJob->state) ProjectionJobState();
+    PyObjectPtr ret(reinterpret_cast<PyObject*>(pyJob));
+    ProjectionJobState& state(pyJob->state);
+    Py_INCREF(self);
+    state.pyIpp.reset(reinterpret_cast<PyObject*>(self));
+    state.numRows = arrays.numRows();
+    state.includeAnchors = includeAnchors;
+
+    std::vector<Ipp::Coords> refCoords;
+    for (std::size_t i(0); i < arrays.numRows(); ++i) {
+        if (std::optional<Ipp::Coords> const coords = arrays.rowCoords(i)) {
+            refCoords.push_back(*coords);
+            state.rows.push_back(i);
+        } else {
+            state.noResultRows.push_back(i);
+        }
+    }
+    try {
+        state.job = std::make_unique<ProjectCoordsJob>(self->ipp,
+                                                       refSpecies,
+                                                       qrySpecies,
+                                                       refCoords,
+                                                       nThreads,
+                                                       sorted,
+                                                       params);
+        self->jobs.push_back(state.job.get());
+    } catch (std::exception const& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return nullptr;
+    }
+    return ret.release();
+}
+
 static PyMethodDef ippMethods[] = {
-    {"load_pwalns", (PyCFunction)ippLoadPwalns, METH_VARARGS, "Reads the chromosomes and pwalns from the given file"},
+    {"load_pwalns", (PyCFunction)(void(*)(void))ippLoadPwalns, METH_VARARGS|METH_KEYWORDS, "Reads the chromosomes and pwalns from the given file: load_pwalns(file_name, n_threads=1, lazy=False, compact=False, search_index=False, anchor_tables=False, derive_reverse=False, numa_interleave=False)"},
 	{"get_genome_size", (PyCFunction)ippGetGenomeSize, METH_VARARGS, "Returns the genome size for a given species name"},
     {"set_half_life_distance", (PyCFunction)ippSetHalfLifeDistance, METH_VARARGS, "Sets the half-life distance"},
-    {"project_coords", (PyCFunction)ippProjectCoords, METH_VARARGS, ""},
+    {"set_search_limits", (PyCFunction)(void(*)(void))ippSetSearchLimits, METH_VARARGS|METH_KEYWORDS, "Sets the limits of the multi-species search: set_search_limits(max_path_length=0, min_score=0.0, early_cutoff=False)"},
+    {"set_projection_cache_size", (PyCFunction)ippSetProjectionCacheSize, METH_VARARGS, "Enables the cache of the projections along each pwaln with room for about that many entries (0: disabled)"},
+    {"get_projection_cache_stats", (PyCFunction)ippGetProjectionCacheStats, METH_NOARGS, "Returns a dict with the hits, misses and num_entries of the projection cache"},
+    {"set_stats_enabled", (PyCFunction)ippSetStatsEnabled, METH_VARARGS, "Enables (or disables) the collection of the stats of the projections and the loading (default: disabled)"},
+    {"set_thread_pinning", (PyCFunction)ippSetThreadPinning, METH_VARARGS, "Enables (or disables) the pinning of the projection threads to one CPU each, spread over the NUMA nodes (default: disabled)"},
+    {"set_search_interleave", (PyCFunction)ippSetSearchInterleave, METH_VARARGS, "Sets the number of coords whose searches each projection thread keeps in flight to hide the memory latency of the anchor searches (default: 8; 1: one coord at a time). Does not change the results and does not apply to sorted projections"},
+    {"reset_stats", (PyCFunction)ippResetStats, METH_NOARGS, "Clears the stats"},
+    {"get_stats", (PyCFunction)ippGetStats, METH_NOARGS, "Returns a dict with the stats: get_anchors_calls per (ref, qry) pwaln, orange_pushes and orange_pops of the shortest path searches and the histograms (dicts with count, sum, max, p50, p90, p99 and the (upper end, count) buckets) upstream_walk_lengths, lis_input_sizes, search_nodes, project_coord_ns, load_block_ns and load_pwalns_ns"},
+    {"project_coords", (PyCFunction)ippProjectCoords, METH_VARARGS, "Projects the given coords and calls the callback for each result: project_coords(ref_species, qry_species, ref_coords, n_threads, callback, sorted=False, params=None)"},
+    {"project_coords_array", (PyCFunction)(void(*)(void))ippProjectCoordsArray, METH_VARARGS|METH_KEYWORDS, "Projects the coords given as numpy arrays of chrom ids and locs and returns a dict of numpy arrays: project_coords_array(ref_species, qry_species, ref_chroms, ref_locs, n_threads=1, sorted=False, include_anchors=False, params=None)"},
+    {"start_project_coords", (PyCFunction)(void(*)(void))ippStartProjectCoords, METH_VARARGS|METH_KEYWORDS, "Starts the projection of the coords given as numpy arrays of chrom ids and locs on background threads and returns an ipp.ProjectionJob to poll the results in batches (several jobs can run at the same time; each is cancelled with its own cancel()): start_project_coords(ref_species, qry_species, ref_chroms, ref_locs, n_threads=1, sorted=False, include_anchors=False, params=None)"},
+    {"project_coords_multi", (PyCFunction)(void(*)(void))ippProjectCoordsMulti, METH_VARARGS|METH_KEYWORDS, "Projects the coords given as numpy arrays to all the given qry species with a single search per coord and returns a dict of the project_coords_array() results per qry species: project_coords_multi(ref_species, qry_species_list, ref_chroms, ref_locs, n_threads=1, sorted=False, include_anchors=False, params=None)"},
+    {"project_interval", (PyCFunction)(void(*)(void))ippProjectInterval, METH_VARARGS|METH_KEYWORDS, "Projects the interval [start, end) (end=None: to the end of the chromosome) with the direct pwaln and returns the segments with the same anchors as a dict of numpy arrays: project_interval(ref_species, qry_species, ref_chrom, start=0, end=None, params=None)"},
+    {"project_tiles", (PyCFunction)(void(*)(void))ippProjectTiles, METH_VARARGS|METH_KEYWORDS, "Projects every step-th location of the interval [start, end) with the direct pwaln and returns the mappable ones as a dict of numpy arrays: project_tiles(ref_species, qry_species, ref_chrom, step, start=0, end=None, params=None)"},
+    {"project_bed_file", (PyCFunction)(void(*)(void))ippProjectBedFile, METH_VARARGS|METH_KEYWORDS, "Projects the regions of a BED file and streams the results to a .proj (with the DC/IC/NC classification) and an .unmapped file: project_bed_file(ref_species, qry_species, bed_file, proj_file, unmapped_file, n_threads=1, chunk_size=100000, sorted=False, score_dc=0.98, score_ic=0.84, params=None) -> (num_regions, num_unmapped)"},
+    {"project_bed_file_binary", (PyCFunction)(void(*)(void))ippProjectBedFileBinary, METH_VARARGS|METH_KEYWORDS, "Projects the regions of a BED file and streams the results of all the regions (with their DC/IC/NC classification) to a binary, columnar results file that ipp_results.read_results() loads: project_bed_file_binary(ref_species, qry_species, bed_file, results_file, n_threads=1, chunk_size=100000, sorted=False, include_anchors=False, score_dc=0.98, score_ic=0.84, params=None) -> (num_regions, num_unmapped)"},
+    {"get_chrom_names", (PyCFunction)ippGetChromNames, METH_NOARGS, "Returns the list of chromosome names, indexed by chromosome id"},
     {"cancel", (PyCFunction)ippCancel, METH_VARARGS, "Cancel ongoing project_coords() call"},
 
     {nullptr, nullptr, 0, nullptr} /* Sentinel */
@@ -387,6 +2027,11 @@ PyInit_ipp(void) {
     };
     RefAnchor refAnchor;
 
+    // Load the numpy C API.
+    if (_import_array() < 0) {
+        return nullptr;
+    }
+
     // Create the module.
     PyObject* const m(PyModule_Create(&ippModule));
     refAnchor.add(m);
@@ -404,6 +2049,16 @@ PyInit_ipp(void) {
         return nullptr;
     }
 
+    // Create the ipp.ProjectionJob type and add it to the module.
+    PyIppProjectionJob_Type = reinterpret_cast<PyTypeObject*>(
+        PyType_FromSpec(&ippProjectionJobTypeSpec));
+    if (!PyIppProjectionJob_Type) {
+        return nullptr;
+    }
+    if (PyModule_AddType(m, PyIppProjectionJob_Type) < 0) {
+        return nullptr;
+    }
+
     // Create the "ipp.Anchor" named tuple and add it to the module.
     PyIppAnchor_Type = PyStructSequence_NewType(&ippAnchorTypeDesc);
     if (!PyIppAnchor_Type) {
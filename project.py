@@ -38,6 +38,30 @@ def debug(*args, **kwargs):
     if is_debug():
         do_print(*args, **kwargs)
 
+def debug_cache_stats(myIpp):
+    # Prints the hits and misses of the projection cache (if it is enabled).
+    stats = myIpp.get_projection_cache_stats()
+    if stats['hits'] + stats['misses'] > 0:
+        debug('Projection cache: %i hits, %i misses, %i entries'
+              %(stats['hits'], stats['misses'], stats['num_entries']))
+
+def log_stats(myIpp):
+    # Prints the stats of the projections (see --stats).
+    stats = myIpp.get_stats()
+    headers = ['', 'count', 'mean', 'p50', 'p90', 'p99', 'max']
+    data = []
+    for name in ['load_pwalns_ns', 'load_block_ns', 'project_coord_ns',
+                 'search_nodes', 'upstream_walk_lengths', 'lis_input_sizes']:
+        h = stats[name]
+        data.append([name, h['count'], h['sum'] / h['count'] if h['count'] else 0,
+                     h['p50'], h['p90'], h['p99'], h['max']])
+    log(tabulate.tabulate(data, headers=headers, floatfmt='.1f'))
+    log('Shortest path searches: %i queue pushes, %i queue pops'
+        %(stats['orange_pushes'], stats['orange_pops']))
+    calls = sorted(stats['get_anchors_calls'].items(), key=lambda x: -x[1])
+    log(tabulate.tabulate([[ref, qry, n] for (ref, qry), n in calls],
+                          headers=['ref', 'qry', 'anchor searches']))
+
 def debug_shortest_path(shortest_path, simple):
     # Prints the given shortest path.
     # The "out anchors" are the ref coordinates of the anchors of the next
@@ -94,6 +118,175 @@ def debug_shortest_path(shortest_path, simple):
     debug()
 
 
+def projection_params(args):
+    # Returns the params of the projection as passed to the ipp module.
+    return {'topn': args.topn,
+            'minn': args.minn,
+            'half_life_distance': args.half_life_distance,
+            'genome_size_basis': args.genome_size_basis,
+            'max_path_length': args.max_path_length,
+            'min_score': args.min_score,
+            'early_cutoff': args.early_cutoff}
+
+def project_regions_array(my_ipp, args, region_chroms, region_locs, region_names,
+                          anchor_cols):
+    # Projects the given regions with project_coords_array() and returns the
+    # results table, the list of names of the unmapped regions and whether
+    # each region was mapped.
+    chrom_names = np.array(my_ipp.get_chrom_names(), dtype=object)
+    chrom_ids = {name: i for i, name in enumerate(chrom_names)}
+    ref_chroms = np.array([chrom_ids.get(c, -1) for c in region_chroms],
+                          dtype=np.int64)
+    ref_locs = np.array(region_locs, dtype=np.int64)
+    region_names = np.array(region_names, dtype=object)
+
+    res = my_ipp.project_coords_array(args.ref,
+                                      args.qry,
+                                      ref_chroms,
+                                      ref_locs,
+                                      n_threads=args.n_cores,
+                                      sorted=args.sorted,
+                                      include_anchors=True,
+                                      params=projection_params(args))
+
+    mapped = res['multi_chrom'] >= 0
+    unmapped_regions = list(region_names[~mapped])
+
+    # The first intermediate and the qry species entries on the shortest paths.
+    path_offsets = res['path_offsets']
+    first_idx = path_offsets[:-1][mapped] + 1
+    last_idx = path_offsets[1:][mapped] - 1
+    species = np.array(res['species'], dtype=object)
+    path_species = res['path_species']
+    bridging_species = [','.join(species[path_species[b:e]])
+                        for b, e in zip(first_idx, last_idx)]
+
+    def to_coords(chroms, locs):
+        return [ipp.Coords((chrom_names[c], int(l))) if c >= 0 else None
+                for c, l in zip(chroms, locs)]
+
+    direct_chrom = res['direct_chrom'][mapped]
+    has_direct = direct_chrom >= 0
+    def direct_anchor_cols(up, down, offset):
+        # The given direct anchor coords as strings ("" if no direct
+        # projection).
+        return [np.where(has_direct, a.astype(str), '')
+                for a in (up[:, offset], up[:, offset+1],
+                          down[:, offset], down[:, offset+1])]
+    direct_up = res['direct_up_anchor'][mapped]
+    direct_down = res['direct_down_anchor'][mapped]
+    path_up = res['path_up_anchor']
+    path_down = res['path_down_anchor']
+
+    columns = [
+        region_names[mapped],
+        to_coords(ref_chroms[mapped], ref_locs[mapped]),
+        to_coords(direct_chrom, res['direct_loc'][mapped]),
+        to_coords(res['multi_chrom'][mapped], res['multi_loc'][mapped]),
+        res['direct_score'][mapped],
+        res['multi_score'][mapped],
+        bridging_species,
+        *direct_anchor_cols(direct_up, direct_down, 0),
+        path_up[first_idx, 0], path_up[first_idx, 1],
+        path_down[first_idx, 0], path_down[first_idx, 1],
+        *direct_anchor_cols(direct_up, direct_down, 2),
+        path_up[last_idx, 2], path_up[last_idx, 3],
+        path_down[last_idx, 2], path_down[last_idx, 3]]
+    names = ['id', 'coords_ref', 'coords_direct', 'coords_multi',
+             'score_direct', 'score_multi', 'bridging_species', *anchor_cols]
+    results_df = pd.DataFrame(dict(zip(names, columns))).set_index('id')
+    return results_df, unmapped_regions, mapped
+
+
+def read_region_chroms(regions_file):
+    # Returns the ref chrom of each region of the given BED file.
+    with open(regions_file) as f:
+        return [line.strip().split('\t')[0] for line in f]
+
+def shards_of_chroms(region_chroms, num_shards):
+    # Assigns the ref chroms to the shards such that the shards get about the
+    # same number of regions (largest chroms first, each to the shard with
+    # the fewest regions so far). Returns {chrom: shard}.
+    counts = {}
+    for chrom in region_chroms:
+        counts[chrom] = counts.get(chrom, 0) + 1
+    shard_sizes = [0] * num_shards
+    shards = {}
+    for chrom, count in sorted(counts.items(), key=lambda x: (-x[1], x[0])):
+        shard = shard_sizes.index(min(shard_sizes))
+        shards[chrom] = shard
+        shard_sizes[shard] += count
+    return shards
+
+def shard_dir(out_dir, shard, num_shards):
+    # The output directory of the given shard.
+    return os.path.join(out_dir, 'shard%iof%i' %(shard, num_shards))
+
+def merge_shards(args):
+    # Merges the output files of the shards (see --shard) into the output
+    # files of the whole regions file, with the regions in input order. The
+    # .mapped file of each shard tells whether the next region of the shard
+    # is in its .proj and bed files or in its .unmapped file.
+    regions_file_basename = os.path.splitext(os.path.basename(args.regions_file))[0]
+    prefix = '{}.{}-{}'.format(regions_file_basename, args.ref, args.qry)
+    region_chroms = read_region_chroms(args.regions_file)
+    shards = shards_of_chroms(region_chroms, args.num_shards)
+
+    def read_lines(path, skip_header=False):
+        # Returns an iterator over the non-empty lines of the given file (no
+        # file: no lines).
+        if not os.path.exists(path):
+            return iter([])
+        with open(path) as f:
+            lines = [line for line in f.read().split('\n') if line]
+        return iter(lines[1:] if skip_header else lines)
+
+    header = None
+    inputs = []
+    for shard in range(args.num_shards):
+        d = shard_dir(args.out_dir, shard, args.num_shards)
+        if not os.path.exists(os.path.join(d, prefix + '.mapped')):
+            sys.exit('Error: shard %i of %i is missing (%s)' %(shard, args.num_shards, d))
+        proj_file = os.path.join(d, prefix + '.proj')
+        if header is None and os.path.exists(proj_file):
+            with open(proj_file) as f:
+                header = f.readline().rstrip('\n')
+        inputs.append({
+            'mapped': read_lines(os.path.join(d, prefix + '.mapped')),
+            'proj': read_lines(proj_file, skip_header=True),
+            'unmapped': read_lines(os.path.join(d, prefix + '.unmapped')),
+            'bed_ref': read_lines('{}.{}.bed'.format(os.path.join(d, regions_file_basename), args.ref)),
+            'bed_qry': read_lines('{}.{}.bed'.format(os.path.join(d, regions_file_basename), args.qry))})
+
+    outputs = {'proj': [], 'unmapped': [], 'bed_ref': [], 'bed_qry': []}
+    for chrom in region_chroms:
+        shard = inputs[shards[chrom]]
+        if next(shard['mapped']) == '1':
+            for key in ['proj', 'bed_ref', 'bed_qry']:
+                outputs[key].append(next(shard[key]))
+        else:
+            outputs['unmapped'].append(next(shard['unmapped']))
+
+    outfile_unmapped = os.path.join(args.out_dir, prefix + '.unmapped')
+    log('Writing unmapped regions to:\n\t%s' %outfile_unmapped)
+    with open(outfile_unmapped, 'w') as f:
+        f.write('\n'.join(outputs['unmapped']) + '\n')
+    if not outputs['proj']:
+        log('No regions from the input bed files could be projected\nDone')
+        return
+    outfile_table = os.path.join(args.out_dir, prefix + '.proj')
+    outfile_bed_ref = '{}.{}.bed'.format(os.path.join(args.out_dir, regions_file_basename), args.ref)
+    outfile_bed_qry = '{}.{}.bed'.format(os.path.join(args.out_dir, regions_file_basename), args.qry)
+    log('Writing the merged results to:\n\t%s\n\t%s\n\t%s'
+        %(outfile_table, outfile_bed_ref, outfile_bed_qry))
+    with open(outfile_table, 'w') as f:
+        f.write('\n'.join([header] + outputs['proj']) + '\n')
+    for path, key in [(outfile_bed_ref, 'bed_ref'), (outfile_bed_qry, 'bed_qry')]:
+        with open(path, 'w') as f:
+            f.write('\n'.join(outputs[key]) + '\n')
+    log('Done')
+
+
 def main():
     parser = argparse.ArgumentParser(description='Independent Point Projections (IPP).\nA method for projecting genomic point coordinates between genomes with large evolutionary distances.', formatter_class=argparse.ArgumentDefaultsHelpFormatter)#RawTextHelpFormatter)
     parser.add_argument('regions_file', help='Bed file containing genomic coordinates. regions with width > 1 will be centered.')
@@ -108,11 +301,33 @@ def main():
     parser.add_argument('-dfc', '--distance_FC', type=float, default=500, help='Distance threshold for functional conservation detection.\nRegions up to this distance to the closest region in the target_bedfile will be considered as functionally conserved.')
     parser.add_argument('-n', '--n_cores', type=int, default=1, help='Number of CPUs')
     parser.add_argument('-t', '--target_bedfile', default=None, help='Functional regions in target species to check for overlap with projections for classification')
-    # parser.add_argument('-dhl', '--half_life_distance', type=int, default=10000, help='distance to closest anchor point at which projection score is 0.5')
+    parser.add_argument('-dhl', '--half_life_distance', type=int, default=10000, help='Distance to the closest anchor point at which the projection score is 0.5')
+    parser.add_argument('--genome_size_basis', type=int, default=2728222451, help='Genome size that the distances of all species are scaled to (default: mouse mm39)')
+    parser.add_argument('--topn', type=int, default=20, help='Number of closest up- and downstream alignments that are considered as anchors')
+    parser.add_argument('--minn', type=int, default=5, help='Minimum number of collinear anchors')
     parser.add_argument('-q', '--quiet', action="store_true", help='Do not produce any log output')
     parser.add_argument('-v', '--verbose', action="store_true", help='Produce additional debugging output')
     parser.add_argument('-c', '--simple_coords', action="store_true", help='Make coord numbers in debug output as small as possible')
     parser.add_argument('-a', '--include_anchors', action='store_true', help='Include anchors in results table')
+    parser.add_argument('-l', '--lazy', action='store_true', help='Only read the alignments from the pwaln file once they are needed (faster startup for small region files)')
+    parser.add_argument('--compact', action='store_true', help='Keep the alignments in a compact representation in memory (less memory, slightly slower)')
+    parser.add_argument('--search_index', action='store_true', help='Build a search index for the alignments (more memory, faster projection of many regions)')
+    parser.add_argument('--anchor_tables', action='store_true', help='Use the precomputed anchors of each alignment gap from the <path_pwaln>.anchors file (built and saved on the first use; faster projection)')
+    parser.add_argument('--derive_reverse', action='store_true', help='Only keep one direction of each species pair of the pwaln file in memory and derive the other one from it (less memory; directions that are missing in the file are always derived)')
+    parser.add_argument('--numa', action='store_true', help='Interleave the alignments over the memory of all NUMA nodes and pin the worker threads to CPUs spread over the nodes (multi-socket machines)')
+    parser.add_argument('--sorted', action='store_true', help='Project the regions in sorted order and reuse the anchor search between neighbouring regions (faster for dense region files)')
+    parser.add_argument('--max_path_length', type=int, default=0, help='Maximum number of hops of the multi-species projection paths (0: no limit)')
+    parser.add_argument('--min_score', type=float, default=0, help='Drop multi-species projection paths with a lower score (regions without a better path are reported as unmapped)')
+    parser.add_argument('--early_cutoff', action='store_true', help='Stop extending projection paths that cannot beat the best path found so far (same results, faster)')
+    parser.add_argument('--cache_size', type=int, default=0, help='Cache up to this many projections of intermediate coordinates and reuse them for other regions (0: no cache)')
+    parser.add_argument('--stream', action='store_true', help='Stream the regions through the native pipeline and write the .proj and .unmapped files while projecting (constant memory for very large region files; no functional classification and no bed files)')
+    parser.add_argument('--binary', action='store_true', help='With --stream: Write the results of all regions (mapped or not, with their DC/IC/NC classification and, with --include_anchors, the anchors) to one binary, columnar .projb file instead of the .proj and .unmapped files (load it with ipp_results.read_results())')
+    parser.add_argument('--server', default=None, help='Project with the alignments of a running projection server (ipp_server.py) listening on this Unix socket instead of loading path_pwaln (the load options and --cache_size are those of the server)')
+    parser.add_argument('--num_shards', type=int, default=1, help='Number of shards for --shard and --merge_shards')
+    parser.add_argument('--shard', type=int, default=None, help='Only project the regions on the ref chromosomes of this shard (0 to num_shards-1; the chromosomes are assigned such that the shards have about the same number of regions) and write the results to <out_dir>/shard<i>of<num_shards>/. Only the alignments that these projections reach are loaded. Run each shard on its own node and merge the results with --merge_shards')
+    parser.add_argument('--merge_shards', action='store_true', help='Merge the results of the --num_shards shards in out_dir into the results of the whole regions file (in input order; path_pwaln is not read)')
+    parser.add_argument('--stats', action='store_true', help='Print the stats of the projections (anchor searches per species pair, search sizes and timings) to tune the load options and the number of cores')
+    parser.add_argument('--segments', action='store_true', help='Project the whole regions instead of their centers with the direct alignments only and write the projected segments (runs of locations that are projected with the same anchors) to a .segments file (liftOver-style; no classification and no bed files)')
     args = parser.parse_args()
     
     # check if files exist
@@ -128,20 +343,55 @@ def main():
     elif args.verbose:
         log_level = LOG_LEVEL_DEBUG
 
+    if args.binary and not args.stream:
+        sys.exit('Error: --binary requires --stream')
+    if args.stream and args.target_bedfile is not None:
+        sys.exit('Error: --stream does not support --target_bedfile')
+    if args.shard is not None or args.merge_shards:
+        if args.num_shards < 1 or (args.shard is not None
+                                   and not 0 <= args.shard < args.num_shards):
+            sys.exit('Error: --shard must be in [0, --num_shards)')
+        if args.stream or args.segments or args.verbose:
+            sys.exit('Error: --shard and --merge_shards do not support --stream, --segments and --verbose')
+    if args.merge_shards:
+        merge_shards(args)
+        return
+    if args.shard is not None:
+        # Only the blocks that the projections of the shard reach are loaded.
+        args.out_dir = shard_dir(args.out_dir, args.shard, args.num_shards)
+        args.lazy = True
+
     # define variables and create output directory
     if not os.path.exists(args.out_dir):
-        os.mkdir(args.out_dir)
+        os.makedirs(args.out_dir)
 
     #input("about to init ipp")
-    log("Loading pairwise alignments")
-    half_life_distance = 10000
-    myIpp = ipp.Ipp()
-    myIpp.load_pwalns(args.path_pwaln)
-    myIpp.set_half_life_distance(half_life_distance)
+    if args.server:
+        # The server has the alignments of path_pwaln loaded already.
+        if args.stream or args.segments or args.verbose:
+            sys.exit('Error: --server does not support --stream, --segments and --verbose')
+        import ipp_server
+        log("Connecting to the projection server at %s" %args.server)
+        myIpp = ipp_server.RemoteIpp(args.server)
+    else:
+        log("Loading pairwise alignments")
+        myIpp = ipp.Ipp()
+        myIpp.set_stats_enabled(args.stats)
+        myIpp.set_thread_pinning(args.numa)
+        myIpp.load_pwalns(args.path_pwaln,
+                          n_threads=args.n_cores,
+                          lazy=args.lazy,
+                          compact=args.compact,
+                          search_index=args.search_index,
+                          anchor_tables=args.anchor_tables,
+                          derive_reverse=args.derive_reverse,
+                          numa_interleave=args.numa)
+        myIpp.set_projection_cache_size(args.cache_size)
 
     # compute score thresholds if distance thresholds were passed
-    # score = 0.5^{minDist * genomeSizeBasis / (genomeSize * halfLifeDistance_)}
-    genome_size_basis = 2728222451 # mouse mm39 genome size
+    # score = 0.5^{minDist * genomeSizeBasis / (genomeSize * halfLifeDistance)}
+    genome_size_basis = args.genome_size_basis
+    half_life_distance = args.half_life_distance
     genome_size_ref = myIpp.get_genome_size(args.ref)
     score_DC = args.score_DC
     score_IC = args.score_IC
@@ -154,12 +404,101 @@ def main():
     if score_DC < score_IC:
         sys.exit('Error: score_DC must not be lower than score_IC')
     
+    if args.stream and args.binary:
+        regions_file_basename = os.path.splitext(os.path.basename(args.regions_file))[0]
+        outfile_results = os.path.join(args.out_dir, '{}.{}-{}.projb'.format(regions_file_basename, args.ref, args.qry))
+        log('Projecting regions from %s to %s and writing the results to:\n\t%s'
+            %(args.ref, args.qry, outfile_results))
+        num_regions, num_unmapped = myIpp.project_bed_file_binary(args.ref,
+                                                                  args.qry,
+                                                                  args.regions_file,
+                                                                  outfile_results,
+                                                                  n_threads=args.n_cores,
+                                                                  sorted=args.sorted,
+                                                                  include_anchors=args.include_anchors,
+                                                                  score_dc=score_DC,
+                                                                  score_ic=score_IC,
+                                                                  params=projection_params(args))
+        log('Projected %i of %i regions' %(num_regions - num_unmapped, num_regions))
+        debug_cache_stats(myIpp)
+        if args.stats:
+            log_stats(myIpp)
+        log('Done')
+        return
+
+    if args.stream:
+        regions_file_basename = os.path.splitext(os.path.basename(args.regions_file))[0]
+        outfile_table = os.path.join(args.out_dir, '{}.{}-{}.proj'.format(regions_file_basename, args.ref, args.qry))
+        outfile_unmapped = os.path.join(args.out_dir, '{}.{}-{}.unmapped'.format(regions_file_basename, args.ref, args.qry))
+        log('Projecting regions from %s to %s and writing the results to:\n\t%s\n\t%s'
+            %(args.ref, args.qry, outfile_table, outfile_unmapped))
+        num_regions, num_unmapped = myIpp.project_bed_file(args.ref,
+                                                           args.qry,
+                                                           args.regions_file,
+                                                           outfile_table,
+                                                           outfile_unmapped,
+                                                           n_threads=args.n_cores,
+                                                           sorted=args.sorted,
+                                                           score_dc=score_DC,
+                                                           score_ic=score_IC,
+                                                           params=projection_params(args))
+        log('Projected %i of %i regions' %(num_regions - num_unmapped, num_regions))
+        debug_cache_stats(myIpp)
+        if args.stats:
+            log_stats(myIpp)
+        log('Done')
+        return
+
+    if args.segments:
+        regions_file_basename = os.path.splitext(os.path.basename(args.regions_file))[0]
+        outfile_segments = os.path.join(args.out_dir, '{}.{}-{}.segments'.format(regions_file_basename, args.ref, args.qry))
+        log('Projecting regions from %s to %s and writing the segments to:\n\t%s'
+            %(args.ref, args.qry, outfile_segments))
+        chrom_names = myIpp.get_chrom_names()
+        params = projection_params(args)
+        num_regions = 0
+        num_segments = 0
+        with open(args.regions_file) as regions_file, open(outfile_segments, 'w') as f:
+            # The segments are half-open in the ref species. qry_start and
+            # qry_end are the projections of the first and the last location
+            # of the segment (qry_start > qry_end on the reverse strand).
+            f.write('\t'.join(['id', 'ref_chrom', 'ref_start', 'ref_end',
+                               'qry_chrom', 'qry_start', 'qry_end',
+                               'min_score', 'max_score']) + '\n')
+            for line in regions_file:
+                cols = line.strip().split('\t')
+                if len(cols) < 4:
+                    continue
+                num_regions += 1
+                res = myIpp.project_interval(args.ref, args.qry, cols[0],
+                                             int(cols[1]), int(cols[2]),
+                                             params=params)
+                # Trim the scores like those of the .proj file.
+                min_scores = np.floor(res['min_score']*1000)/1000
+                max_scores = np.floor(res['max_score']*1000)/1000
+                for i in range(len(res['ref_start'])):
+                    f.write('%s\t%s\t%i\t%i\t%s\t%i\t%i\t%.3f\t%.3f\n'
+                            %(cols[3], cols[0],
+                              res['ref_start'][i], res['ref_end'][i],
+                              chrom_names[res['qry_chrom'][i]],
+                              res['qry_start'][i], res['qry_end'][i],
+                              min_scores[i], max_scores[i]))
+                num_segments += len(res['ref_start'])
+        log('Projected %i regions to %i segments' %(num_regions, num_segments))
+        if args.stats:
+            log_stats(myIpp)
+        log('Done')
+        return
+
     #input('Press enter to start')
     log('Reading regions from %s' %(args.regions_file))
 
     # Read the regions file and enqueue one projection job per line.
     ref_coords = []
     coord_names = {}
+    region_chroms = []
+    region_locs = []
+    region_names = []
     with open(args.regions_file) as regions_file:
         for i,line in enumerate(regions_file.readlines()):
             cols = line.strip().split('\t')
@@ -171,99 +510,125 @@ def main():
             ref_coords.append(coords)
             # add the name of the region to a dict with refChrom:refLoc as the key for later translation
             coord_names[coords] = (i, name)
+            region_chroms.append(refChrom)
+            region_locs.append(refLoc)
+            region_names.append(name)
+
+    if args.shard is not None:
+        # Only keep the regions on the ref chroms of this shard.
+        shards = shards_of_chroms(region_chroms, args.num_shards)
+        in_shard = [shards[c] == args.shard for c in region_chroms]
+        ref_coords = [c for c, keep in zip(ref_coords, in_shard) if keep]
+        coord_names = {c: v for c, v in coord_names.items() if shards[c.chrom] == args.shard}
+        region_chroms = [c for c, keep in zip(region_chroms, in_shard) if keep]
+        region_locs = [l for l, keep in zip(region_locs, in_shard) if keep]
+        region_names = [n for n, keep in zip(region_names, in_shard) if keep]
+        log('Shard %i of %i: %i of %i regions' %(args.shard, args.num_shards, len(region_names), len(in_shard)))
+
+    # Names of the anchor columns.
+    anchor_cols = ['ref_anchor_direct_left_start', 'ref_anchor_direct_left_end', 'ref_anchor_direct_right_start', 'ref_anchor_direct_right_end',
+                   'ref_anchor_multi_left_start', 'ref_anchor_multi_left_end', 'ref_anchor_multi_right_start', 'ref_anchor_multi_right_end',
+                   'qry_anchor_direct_left_start', 'qry_anchor_direct_left_end', 'qry_anchor_direct_right_start', 'qry_anchor_direct_right_end',
+                   'qry_anchor_multi_left_start', 'qry_anchor_multi_left_end', 'qry_anchor_multi_right_start', 'qry_anchor_multi_right_end']
 
-    global pbar
-    pbar = tqdm.tqdm(total=len(ref_coords), leave=False)
-
-    results = []
-    unmapped_regions = []
+    if not is_debug():
+        # Project all the regions in one call and build the results table from
+        # the returned columns.
+        log('Projecting regions from %s to %s' %(args.ref, args.qry))
+        results_df, unmapped_regions, mapped = project_regions_array(
+            myIpp, args, region_chroms, region_locs, region_names, anchor_cols)
+    else:
+        # Project the regions one by one to print the debug output for each.
+        global pbar
+        pbar = tqdm.tqdm(total=len(ref_coords), leave=False)
+
+        results = []
+        unmapped_regions = []
     
-    def on_job_done_callback(ref_coord,
-                             direct_score,
-                             direct_coords,
-                             direct_up_anchor,
-                             direct_down_anchor,
-                             multi_shortest_path):
-        # ref_coord:           ipp.Coords              (ref_chrom, ref_loc)
-        # direct_score:        float                   [0-1]
-        # direct_coords:       ipp.Coords              (qry_chrom, qry_loc)
-        # direct_up_anchor:    ipp.Anchor              (up.ref_start, up.ref_end, up.qry_start, up.qry_end)
-        # direct_down_anchor:  ipp.Anchor              (down.ref_start, down.ref_end, down.qry_start, down.qry_end)
-        # multi_shortest_path: [ipp.ShortestPathEntry] [ref, intermediate1, intermediate2, ..., qry]
-        #     species      string           "spX"
-        #     score        float            [0-1]
-        #     coords       ipp.Coords       (chrom, loc)
-        #     up_anchor    ipp.Anchor       (up.ref_start, up.ref_end, up.qry_start, up.qry_end)
-        #     down_anchor  ipp.Anchor       (down.ref_start, down.ref_end, down.qry_start, down.qry_end)
-        nonlocal coord_names, results, unmapped_regions
-        pbar.update()
-
-        coord_idx, coord_name = coord_names[ref_coord]
-
-        # handle unmapped region
-        debug()
-        if not len(multi_shortest_path):
-            debug("no mapping found for {} ({}:{})".format(
-                  coord_name, ref_coord.chrom, ref_coord.loc))
+        def on_job_done_callback(ref_coord,
+                                 direct_score,
+                                 direct_coords,
+                                 direct_up_anchor,
+                                 direct_down_anchor,
+                                 multi_shortest_path):
+            # ref_coord:           ipp.Coords              (ref_chrom, ref_loc)
+            # direct_score:        float                   [0-1]
+            # direct_coords:       ipp.Coords              (qry_chrom, qry_loc)
+            # direct_up_anchor:    ipp.Anchor              (up.ref_start, up.ref_end, up.qry_start, up.qry_end)
+            # direct_down_anchor:  ipp.Anchor              (down.ref_start, down.ref_end, down.qry_start, down.qry_end)
+            # multi_shortest_path: [ipp.ShortestPathEntry] [ref, intermediate1, intermediate2, ..., qry]
+            #     species      string           "spX"
+            #     score        float            [0-1]
+            #     coords       ipp.Coords       (chrom, loc)
+            #     up_anchor    ipp.Anchor       (up.ref_start, up.ref_end, up.qry_start, up.qry_end)
+            #     down_anchor  ipp.Anchor       (down.ref_start, down.ref_end, down.qry_start, down.qry_end)
+            nonlocal coord_names, results, unmapped_regions
+            pbar.update()
+
+            coord_idx, coord_name = coord_names[ref_coord]
+
+            # handle unmapped region
             debug()
-            unmapped_regions.append(coord_name)
-            return
-
-        debug("({})".format(coord_name))
-        debug_shortest_path(multi_shortest_path, args.simple_coords)
+            if not len(multi_shortest_path):
+                debug("no mapping found for {} ({}:{})".format(
+                      coord_name, ref_coord.chrom, ref_coord.loc))
+                debug()
+                unmapped_regions.append(coord_name)
+                return
+
+            debug("({})".format(coord_name))
+            debug_shortest_path(multi_shortest_path, args.simple_coords)
   
-        direct_refs = tuple(map(str, (direct_up_anchor.ref_start, direct_up_anchor.ref_end,
-                                      direct_down_anchor.ref_start, direct_down_anchor.ref_end))) \
-            if direct_up_anchor else ("", "", "", "")
-        direct_qrys = tuple(map(str, (direct_up_anchor.qry_start, direct_up_anchor.qry_end,
-                                      direct_down_anchor.qry_start, direct_down_anchor.qry_end))) \
-            if direct_up_anchor else ("", "", "", "")
-
-        # The first intermediate species on the path.
-        multi_first_entry = multi_shortest_path[1]
-
-        # The qry species on the shortest path.
-        multi_last_entry = multi_shortest_path[-1]
-        assert multi_last_entry.species == args.qry
-        multi_score = multi_last_entry.score
-        multi_coords = multi_last_entry.coords
+            direct_refs = tuple(map(str, (direct_up_anchor.ref_start, direct_up_anchor.ref_end,
+                                          direct_down_anchor.ref_start, direct_down_anchor.ref_end))) \
+                if direct_up_anchor else ("", "", "", "")
+            direct_qrys = tuple(map(str, (direct_up_anchor.qry_start, direct_up_anchor.qry_end,
+                                          direct_down_anchor.qry_start, direct_down_anchor.qry_end))) \
+                if direct_up_anchor else ("", "", "", "")
+
+            # The first intermediate species on the path.
+            multi_first_entry = multi_shortest_path[1]
+
+            # The qry species on the shortest path.
+            multi_last_entry = multi_shortest_path[-1]
+            assert multi_last_entry.species == args.qry
+            multi_score = multi_last_entry.score
+            multi_coords = multi_last_entry.coords
   
-        multi_bridging_species = \
-            ','.join([spe.species for spe in multi_shortest_path[1:-1]])
-        results.append([
-            coord_idx,
-            coord_name, ref_coord, direct_coords, multi_coords,
-            direct_score, multi_score,
-            multi_bridging_species,
-            *direct_refs,
-            multi_first_entry.up_anchor.ref_start, multi_first_entry.up_anchor.ref_end,
-            multi_first_entry.down_anchor.ref_start, multi_first_entry.down_anchor.ref_end,
-            *direct_qrys,
-            multi_last_entry.up_anchor.qry_start, multi_last_entry.up_anchor.qry_end,
-            multi_last_entry.down_anchor.qry_start, multi_last_entry.down_anchor.qry_end])
+            multi_bridging_species = \
+                ','.join([spe.species for spe in multi_shortest_path[1:-1]])
+            results.append([
+                coord_idx,
+                coord_name, ref_coord, direct_coords, multi_coords,
+                direct_score, multi_score,
+                multi_bridging_species,
+                *direct_refs,
+                multi_first_entry.up_anchor.ref_start, multi_first_entry.up_anchor.ref_end,
+                multi_first_entry.down_anchor.ref_start, multi_first_entry.down_anchor.ref_end,
+                *direct_qrys,
+                multi_last_entry.up_anchor.qry_start, multi_last_entry.up_anchor.qry_end,
+                multi_last_entry.down_anchor.qry_start, multi_last_entry.down_anchor.qry_end])
   
-    # Start the projection
-    log('Projecting regions from %s to %s' %(args.ref, args.qry))
-    myIpp.project_coords(args.ref,
-                         args.qry,
-                         ref_coords,
-                         args.n_cores,
-                         on_job_done_callback)
-    pbar.close()
-
-    # create data frame from results dict
-    anchor_cols = ['ref_anchor_direct_left_start', 'ref_anchor_direct_left_end', 'ref_anchor_direct_right_start', 'ref_anchor_direct_right_end',
-                   'ref_anchor_multi_left_start', 'ref_anchor_multi_left_end', 'ref_anchor_multi_right_start', 'ref_anchor_multi_right_end',
-                   'qry_anchor_direct_left_start', 'qry_anchor_direct_left_end', 'qry_anchor_direct_right_start', 'qry_anchor_direct_right_end',
-                   'qry_anchor_multi_left_start', 'qry_anchor_multi_left_end', 'qry_anchor_multi_right_start', 'qry_anchor_multi_right_end']
-    results_df = pd.DataFrame(results, columns=[
-        'sort_idx',
-        'id', 'coords_ref', 'coords_direct', 'coords_multi',
-        'score_direct', 'score_multi', 'bridging_species',
-        *anchor_cols]) \
-            .sort_values(by=['sort_idx']) \
-            .drop(columns=['sort_idx']) \
-            .set_index('id')
+        # Start the projection
+        log('Projecting regions from %s to %s' %(args.ref, args.qry))
+        myIpp.project_coords(args.ref,
+                             args.qry,
+                             ref_coords,
+                             args.n_cores,
+                             on_job_done_callback,
+                             args.sorted,
+                             projection_params(args))
+        pbar.close()
+
+        # create data frame from results dict
+        results_df = pd.DataFrame(results, columns=[
+            'sort_idx',
+            'id', 'coords_ref', 'coords_direct', 'coords_multi',
+            'score_direct', 'score_multi', 'bridging_species',
+            *anchor_cols]) \
+                .sort_values(by=['sort_idx']) \
+                .drop(columns=['sort_idx']) \
+                .set_index('id')
 
     # exclude anchor columns if flag to keep them was not set
     if not args.include_anchors:
@@ -277,6 +642,9 @@ def main():
         
     if is_debug():
         debug(results_df.to_string())
+    debug_cache_stats(myIpp)
+    if args.stats:
+        log_stats(myIpp)
 
     # write list of coord names of unmapped regions to file
     regions_file_basename = os.path.splitext(os.path.basename(args.regions_file))[0]
@@ -284,6 +652,10 @@ def main():
     log('Writing unmapped regions to:\n\t%s' %outfile_unmapped)
     with open(outfile_unmapped, 'w') as f:
         f.write('\n'.join(unmapped_regions) + '\n')
+    if args.shard is not None:
+        # Whether each region of the shard was mapped (for --merge_shards).
+        with open(os.path.join(args.out_dir, '{}.{}-{}.mapped'.format(regions_file_basename, args.ref, args.qry)), 'w') as f:
+            f.write(''.join('%i\n' %m for m in mapped))
 
     def classify_conservation(df_projections, target_regions=pr.PyRanges(), thresh_dc=score_DC, thresh_ic=score_IC, maxgap=args.distance_FC):
         ### function for determining the conservation of sequence (DC/IC/NC) and function (+/-)  
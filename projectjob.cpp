@@ -0,0 +1,143 @@
+/**
+ * Projections of coords on a background thread.
+ */
+#include "projectjob.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+
+ProjectCoordsJob::ProjectCoordsJob(Ipp& ipp,
+                                   std::string const& refSpecies,
+                                   std::string const& qrySpecies,
+                                   std::vector<Ipp::Coords> const& refCoords,
+                                   unsigned nThreads,
+                                   bool sorted,
+                                   Ipp::ProjectionParams const& params)
+    : ipp_(ipp)
+    , numJobs_(refCoords.size())
+    , cancel_(false)
+    , numDone_(0)
+    , done_(false)
+{
+    for (std::size_t i(0); i < refCoords.size(); ++i) {
+        indicesByCoords_[refCoords[i]].push_back(i);
+    }
+    thread_ = std::thread([this, refSpecies, qrySpecies, nThreads, sorted,
+                           params]() {
+        run(refSpecies, qrySpecies, nThreads, sorted, params);
+    });
+}
+
+ProjectCoordsJob::~ProjectCoordsJob() {
+    cancel();
+    thread_.join();
+}
+
+std::size_t
+ProjectCoordsJob::numJobs() const {
+    return numJobs_;
+}
+
+std::size_t
+ProjectCoordsJob::numDone() const {
+    return numDone_;
+}
+
+bool
+ProjectCoordsJob::isDone() const {
+    std::lock_guard const lockGuard(mutex_);
+    return done_;
+}
+
+void
+ProjectCoordsJob::cancel() {
+    cancel_ = true;
+}
+
+bool
+ProjectCoordsJob::isCancelled() const {
+    return cancel_;
+}
+
+bool
+ProjectCoordsJob::wait(double timeoutSeconds) {
+    // Waits for resultsAvailable_, which is notified for each batch of
+    // results and at the end.
+    std::unique_lock lock(mutex_);
+    auto const ready = [this]() {
+        return done_ || !results_.empty();
+    };
+    if (timeoutSeconds < 0) {
+        resultsAvailable_.wait(lock, ready);
+        return true;
+    }
+    return resultsAvailable_.wait_for(
+        lock, std::chrono::duration<double>(timeoutSeconds), ready);
+}
+
+std::vector<ProjectCoordsJob::Result>
+ProjectCoordsJob::takeResults(std::size_t maxResults) {
+    std::lock_guard const lockGuard(mutex_);
+    if (results_.empty() && error_) {
+        std::rethrow_exception(error_);
+    }
+    std::size_t const numResults(maxResults > 0
+                                 ? std::min(maxResults, results_.size())
+                                 : results_.size());
+    std::vector<Result> ret(std::make_move_iterator(results_.begin()),
+                            std::make_move_iterator(results_.begin()
+                                                    + numResults));
+    results_.erase(results_.begin(), results_.begin() + numResults);
+    return ret;
+}
+
+void
+ProjectCoordsJob::run(std::string const& refSpecies,
+                      std::string const& qrySpecies,
+                      unsigned nThreads,
+                      bool sorted,
+                      Ipp::ProjectionParams const& params) {
+    // Projects the distinct coords and queues a result for each of their
+    // indices.
+    std::vector<Ipp::Coords> refCoords;
+    refCoords.reserve(indicesByCoords_.size());
+    for (auto const& [coords, indices] : indicesByCoords_) {
+        refCoords.push_back(coords);
+    }
+
+    auto const onJobDone = [this](Ipp::Coords const& refCoord,
+                                  Ipp::CoordProjection const& coordProjection) {
+        std::vector<std::size_t> const& indices(
+            indicesByCoords_.at(refCoord));
+        {
+            std::lock_guard const lockGuard(mutex_);
+            for (std::size_t const i : indices) {
+                results_.emplace_back(i, coordProjection);
+            }
+            numDone_ += indices.size();
+        }
+        resultsAvailable_.notify_all();
+    };
+
+    std::exception_ptr error;
+    try {
+        ipp_.projectCoords(refSpecies,
+                           qrySpecies,
+                           refCoords,
+                           nThreads,
+                           sorted,
+                           params,
+                           cancel_,
+                           onJobDone);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    {
+        std::lock_guard const lockGuard(mutex_);
+        done_ = true;
+        error_ = error;
+    }
+    resultsAvailable_.notify_all();
+}
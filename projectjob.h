@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipp.h"
+
+class ProjectCoordsJob {
+    // A projection of coords that runs on a background thread (with its own
+    // worker threads) while the caller polls the results in batches. Several
+    // jobs can run at the same time on one Ipp (see the Ipp::projectCoords()
+    // overload with a cancelFlag); each job is cancelled on its own. The Ipp
+    // must outlive the job and must not be loaded or configured while jobs
+    // are running (the python module checks isDone() before doing so).
+public:
+    struct Result {
+        std::size_t index;
+        // The index of the coords in the refCoords of the job.
+        Ipp::CoordProjection projection;
+
+        Result(std::size_t index, Ipp::CoordProjection const& projection)
+            : index(index)
+            , projection(projection)
+        {}
+    };
+
+    ProjectCoordsJob(Ipp& ipp,
+                     std::string const& refSpecies,
+                     std::string const& qrySpecies,
+                     std::vector<Ipp::Coords> const& refCoords,
+                     unsigned nThreads,
+                     bool sorted,
+                     Ipp::ProjectionParams const& params);
+    // Starts the projection of the given refCoords (like
+    // Ipp::projectCoords() or Ipp::projectCoordsSorted() if sorted is set).
+    // Equal coords are projected once.
+
+    ~ProjectCoordsJob();
+    // Cancels the job and waits for its thread.
+
+    ProjectCoordsJob(ProjectCoordsJob const&) = delete;
+    ProjectCoordsJob& operator=(ProjectCoordsJob const&) = delete;
+
+    std::size_t numJobs() const;
+    // The number of refCoords.
+
+    std::size_t numDone() const;
+    // The number of refCoords whose results are available (taken or not).
+    // Lock-free, for progress reports.
+
+    bool isDone() const;
+    // Returns whether the projection has ended (completed, cancelled or
+    // failed). The results may not be taken yet.
+
+    void cancel();
+    // Stops any further coords from being started. Their results are never
+    // available.
+
+    bool isCancelled() const;
+    // Returns whether cancel() was called.
+
+    bool wait(double timeoutSeconds);
+    // Waits until results are available or the projection has ended (at
+    // most timeoutSeconds if >= 0). Returns whether that is the case.
+
+    std::vector<Result> takeResults(std::size_t maxResults);
+    // Removes and returns up to maxResults (0: all) of the available results
+    // in the order in which they were completed. Throws the error of a
+    // failed projection once all its results are taken (from the next call
+    // on).
+
+private:
+    void run(std::string const& refSpecies,
+             std::string const& qrySpecies,
+             unsigned nThreads,
+             bool sorted,
+             Ipp::ProjectionParams const& params);
+    // The body of thread_.
+
+    Ipp& ipp_;
+    std::size_t const numJobs_;
+    std::map<Ipp::Coords, std::vector<std::size_t>> indicesByCoords_;
+    // The indices of the refCoords. Not changed once the thread runs.
+    std::atomic<bool> cancel_;
+    std::atomic<std::size_t> numDone_;
+    mutable std::mutex mutex_;
+    std::condition_variable resultsAvailable_;
+    std::deque<Result> results_;
+    bool done_;
+    std::exception_ptr error_;
+    // Guarded by mutex_.
+    std::thread thread_;
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ipp.h"
+
+// The definitions of the pwaln file format that are shared by the reader
+// (Ipp::loadPwalns()) and the writers (compute_alignments/collect_pwalns.cpp;
+// compute_alignments/collect_pwalns.py has the full description of the
+// format).
+
+uint8_t const pwalnFormatV4(4);
+// The pwaln entries are packed (PackedPwalnEntry) and each block is preceded
+// by its ref chrom and number of entries.
+uint8_t const pwalnFormatV5(5);
+// The pwaln entries have the in-memory layout of Ipp::PwalnEntry, aligned to
+// pwalnV5BlockAlignment, and are followed by an index.
+uint8_t const pwalnFormatV6(6);
+// Like v5, but the entries of each block are compressed independently
+// (PwalnBlockEncoder) and the index has the size of each compressed block.
+
+uint16_t const pwalnEndiannessMagic(0xAFFE);
+// Follows the format version. Written in the byte order of the producer.
+
+std::size_t const pwalnV5HeaderSize(16);
+// version, endiannessMagic, 5 bytes of padding, uint64 index offset (also
+// the header of v6 files).
+std::size_t const pwalnV5BlockAlignment(16);
+// The file offset of the entries of each block is a multiple of this.
+
+#pragma pack(1)
+class PackedPwalnEntry : public Ipp::PwalnEntry {
+    // Packed PwalnEntry that does not have the extra padding bytes at the end
+    // which are used for alignment (the layout in v4 files).
+public:
+    PackedPwalnEntry() {}
+    explicit PackedPwalnEntry(Ipp::PwalnEntry const& entry)
+        : Ipp::PwalnEntry(entry)
+    {}
+};
+static_assert(sizeof(PackedPwalnEntry) == 14);
+#pragma pack()
+
+static_assert(sizeof(Ipp::PwalnEntry) == 16);
+static_assert(alignof(Ipp::PwalnEntry) <= pwalnV5BlockAlignment);
+
+class PwalnBlockCodec {
+    // The state that PwalnBlockEncoder and PwalnBlockDecoder share: Each entry
+    // of a (sorted) block is encoded as four LEB128 varints:
+    //     refStart - the refStart of the previous entry
+    //     the index of the qry chrom in the dictionary of the block; a new
+    //         qry chrom gets the next index and its id follows
+    //     zigzag(qryStart - the qryStart that is predicted from the previous
+    //         entry with the same qry chrom, assuming collinear alignments)
+    //     lengthAndStrand
+    // That takes ~6 bytes per entry instead of 14 (v4) or 16 (v5).
+protected:
+    struct QryChromState {
+        uint32_t lastRefStart;
+        uint32_t lastQryStart;
+
+        explicit QryChromState(uint32_t refStart)
+            : lastRefStart(refStart)
+            , lastQryStart(0)
+        {}
+    };
+
+    PwalnBlockCodec()
+        : lastRefStart_(0)
+    {}
+
+    static int64_t predictQryStart(QryChromState const& state,
+                                   uint32_t refStart,
+                                   uint16_t lengthAndStrand) {
+        // The qryStart moves by the refStart delta (backwards on the reverse
+        // strand). The first entry of a qry chrom is predicted as 0.
+        int64_t const refDelta(int64_t(refStart) - state.lastRefStart);
+        return int64_t(state.lastQryStart)
+            + (lengthAndStrand & (1<<15) ? -refDelta : refDelta);
+    }
+
+    uint32_t lastRefStart_;
+    std::vector<Ipp::ChromId> qryChroms_;
+    std::vector<QryChromState> qryChromStates_;
+    // Indexed by the dictionary index of the qry chrom.
+};
+
+class PwalnBlockEncoder : private PwalnBlockCodec {
+    // Compresses the entries of one block (in order).
+public:
+    void add(Ipp::PwalnEntry const& entry, std::string* out) {
+        // Appends the encoding of the given entry to out.
+        writeVarint(entry.refStart() - lastRefStart_, out);
+        lastRefStart_ = entry.refStart();
+
+        auto const [it, isNew] = qryChromIdxs_.emplace(entry.qryChrom(),
+                                                       qryChroms_.size());
+        writeVarint(it->second, out);
+        if (isNew) {
+            writeVarint(entry.qryChrom(), out);
+            qryChroms_.push_back(entry.qryChrom());
+            qryChromStates_.emplace_back(entry.refStart());
+        }
+        QryChromState& state(qryChromStates_[it->second]);
+        int64_t const delta(
+            int64_t(entry.qryStart())
+            - predictQryStart(state, entry.refStart(), entry.lengthAndStrand()));
+        writeVarint((uint64_t(delta) << 1) ^ uint64_t(delta >> 63), out);
+        state.lastRefStart = entry.refStart();
+        state.lastQryStart = entry.qryStart();
+
+        writeVarint(entry.lengthAndStrand(), out);
+    }
+
+private:
+    static void writeVarint(uint64_t value, std::string* out) {
+        while (value >= 0x80) {
+            out->push_back(char(value | 0x80));
+            value >>= 7;
+        }
+        out->push_back(char(value));
+    }
+
+    std::unordered_map<Ipp::ChromId, uint32_t> qryChromIdxs_;
+};
+
+class PwalnBlockDecoder : private PwalnBlockCodec {
+    // Decompresses the entries of one block written by PwalnBlockEncoder.
+public:
+    PwalnBlockDecoder(char const* begin, char const* end)
+        : pos_(reinterpret_cast<uint8_t const*>(begin))
+        , end_(reinterpret_cast<uint8_t const*>(end))
+    {}
+
+    Ipp::PwalnEntry next() {
+        // Returns the next entry. Throws if the data is invalid.
+        uint64_t const refStart(lastRefStart_ + readVarint());
+        uint64_t const qryChromIdx(readVarint());
+        if (qryChromIdx == qryChroms_.size()) {
+            qryChroms_.push_back(checkRange(readVarint(), UINT32_MAX));
+            qryChromStates_.emplace_back(checkRange(refStart, UINT32_MAX));
+        } else if (qryChromIdx > qryChroms_.size()) {
+            throw std::runtime_error("invalid compressed pwaln entries");
+        }
+        uint64_t const zigzag(readVarint());
+        int64_t const delta(int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1));
+        uint64_t const lengthAndStrand(checkRange(readVarint(), UINT16_MAX));
+
+        QryChromState& state(qryChromStates_[qryChromIdx]);
+        Ipp::PwalnEntry const entry(
+            checkRange(refStart, UINT32_MAX),
+            checkRange(predictQryStart(state, refStart, lengthAndStrand) + delta,
+                       UINT32_MAX),
+            qryChroms_[qryChromIdx],
+            lengthAndStrand);
+        lastRefStart_ = entry.refStart();
+        state.lastRefStart = entry.refStart();
+        state.lastQryStart = entry.qryStart();
+        return entry;
+    }
+
+    bool atEnd() const {
+        return pos_ == end_;
+    }
+
+private:
+    uint64_t readVarint() {
+        uint64_t value(0);
+        for (unsigned shift(0); shift < 64; shift += 7) {
+            if (pos_ == end_) {
+                throw std::runtime_error("invalid compressed pwaln entries");
+            }
+            uint8_t const byte(*pos_++);
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("invalid compressed pwaln entries");
+    }
+
+    template<typename T>
+    static T checkRange(T value, uint64_t max) {
+        if (value < 0 || uint64_t(value) > max) {
+            throw std::runtime_error("invalid compressed pwaln entries");
+        }
+        return value;
+    }
+
+    uint8_t const* pos_;
+    uint8_t const* end_;
+};
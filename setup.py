@@ -1,5 +1,7 @@
-from distutils.core import setup
+from distutils.ccompiler import new_compiler
+from distutils.core import Command, setup
 from distutils.extension import Extension
+from distutils.sysconfig import customize_compiler
 import numpy as np
 import os
 
@@ -8,10 +10,54 @@ if os.environ.get("IPP_DEBUG"):
     extra_compile_args.append('-O0')
 
 ipp_extension = Extension('ipp',
-                          ['ippmodule.cpp', 'ipp.cpp'],
+                          ['ippmodule.cpp', 'ipp.cpp', 'bedstream.cpp', 'projectjob.cpp'],
                           include_dirs=[np.get_include()],
                           extra_compile_args=extra_compile_args)
+
+class BuildExecutable(Command):
+    """Builds the executable build/<executable> from the given sources."""
+
+    user_options = []
+    executable = None
+    sources = []
+
+    def initialize_options(self):
+        pass
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        compiler = new_compiler()
+        customize_compiler(compiler)
+        objects = compiler.compile(self.sources,
+                                   output_dir='build/temp.' + self.executable,
+                                   include_dirs=['.'],
+                                   extra_postargs=['-std=c++17'])
+        compiler.link_executable(objects, self.executable,
+                                 output_dir='build',
+                                 libraries=['pthread'],
+                                 target_lang='c++')
+
+class BuildBench(BuildExecutable):
+    """Builds the benchmark executable build/ipp_bench."""
+
+    description = 'build the ipp_bench microbenchmarks'
+    executable = 'ipp_bench'
+    sources = ['bench/ipp_bench.cpp', 'ipp.cpp']
+
+class BuildCollectPwalns(BuildExecutable):
+    """Builds build/collect_pwalns, the native version of
+    compute_alignments/collect_pwalns.py."""
+
+    description = 'build the native collect_pwalns'
+    executable = 'collect_pwalns'
+    sources = ['compute_alignments/collect_pwalns.cpp']
+
+
 setup(name='ipp',
       version='1.0',
       description='This is the IPP package',
-      ext_modules=[ipp_extension])
+      ext_modules=[ipp_extension],
+      cmdclass={'build_bench': BuildBench,
+                'build_collect_pwalns': BuildCollectPwalns})